@@ -1,22 +1,5 @@
-// Initialize Vanta.js background
-VANTA.NET({
-    el: "#vanta-bg",
-    mouseControls: true,
-    touchControls: true,
-    gyroControls: false,
-    minHeight: 200.00,
-    minWidth: 200.00,
-    scale: 1.00,
-    scaleMobile: 1.00,
-    color: 0x4f46e5,
-    backgroundColor: 0xf9fafb,
-    points: 12.00,
-    maxDistance: 22.00,
-    spacing: 18.00
-});
-
-// Initialize Feather Icons
-feather.replace();
+// Icons are <i data-feather="name"> in the sources; tools/build_ui.py turns
+// them into references to an inline sprite, so nothing renders them here.
 
 // Device Management Logic
 document.addEventListener('DOMContentLoaded', function() {
@@ -28,8 +11,177 @@ document.addEventListener('DOMContentLoaded', function() {
     const devicesList = document.getElementById('devicesList');
     const deviceCount = document.getElementById('deviceCount');
     const accessLogs = document.getElementById('accessLogs');
+    const moreLogs = document.getElementById('moreLogs');
     
-    let deviceCounter = 3; // Starting with 3 sample devices
+    const WHITELIST_API = '/api/v1/devices/whitelist';
+    const LOGS_API = '/api/v1/logs';
+    const EVENTS_API = '/api/v1/events';
+    const UI_STATS_API = '/api/v1/stats/ui';
+    const ACCESS_BADGES = {
+        full: ['Full Access', 'bg-green-100 text-green-800'],
+        limited: ['Limited', 'bg-blue-100 text-blue-800'],
+        temporary: ['Temporary', 'bg-yellow-100 text-yellow-800']
+    };
+
+    function escapeHtml(text) {
+        const div = document.createElement('div');
+        div.textContent = text;
+        return div.innerHTML;
+    }
+
+    // Create a device card for a whitelist entry
+    function createDeviceCard(device) {
+        const [badgeText, badgeClass] = ACCESS_BADGES[device.access] || ACCESS_BADGES.full;
+        const expires = device.expires ? `Expires ${new Date(device.expires * 1000).toLocaleDateString()}` : 'Never expires';
+        const card = document.createElement('div');
+        card.className = 'device-card bg-white rounded-lg border border-gray-200 p-4 transition-all duration-300';
+        card.innerHTML = `
+            <div class="flex items-start">
+                <div class="p-3 rounded-full bg-indigo-100 mr-4">
+                    <i data-feather="smartphone" class="text-indigo-600 w-5 h-5"></i>
+                </div>
+                <div class="flex-1">
+                    <h3 class="font-medium text-gray-800">${escapeHtml(device.name || 'Unnamed device')}</h3>
+                    <p class="text-sm text-gray-500 mt-1">MAC: ${device.mac}</p>
+                    <div class="flex items-center mt-3">
+                        <span class="inline-flex items-center px-2.5 py-0.5 rounded-full text-xs font-medium ${badgeClass}">
+                            ${badgeText}
+                        </span>
+                        <span class="ml-2 text-xs text-gray-500">${expires}</span>
+                    </div>
+                </div>
+                <button class="remove-device text-gray-400 hover:text-red-600" title="Remove device">
+                    <i data-feather="trash-2" class="w-5 h-5"></i>
+                </button>
+            </div>
+        `;
+        card.querySelector('.remove-device').addEventListener('click', function() {
+            removeDevice(device.mac);
+        });
+        return card;
+    }
+
+    // Device names by MAC, for the access log
+    let deviceNames = {};
+    // Cursor of the next (older) page of access logs, null at the oldest entry
+    let logCursor = null;
+
+    const LOG_SOURCES = { http: 'web', discord: 'Discord', wifi: 'Wi-Fi' };
+    const LOG_ACTIONS = {
+        'open': ['Gate opened for car passage', 'unlock'],
+        'open-half': ['Gate opened for pedestrian passage', 'unlock'],
+        'close': ['Gate closed', 'lock'],
+        'whitelist-add': ['Device added', 'user-plus'],
+        'whitelist-remove': ['Device removed', 'user-minus'],
+        'whitelist-import': ['Whitelist imported', 'upload'],
+        'station-join': ['Access granted', 'check'],
+        'settings-change': ['Settings changed', 'settings']
+    };
+
+    // Full class names, so the build finds them in the sources
+    const LOG_COLORS = {
+        blue: ['bg-blue-100', 'text-blue-600'],
+        green: ['bg-green-100', 'text-green-600'],
+        red: ['bg-red-100', 'text-red-600']
+    };
+
+    // Wall-clock values before this mean the device clock was not set yet
+    const CLOCK_VALID_AFTER = 1700000000;
+
+    function formatAge(time) {
+        if (time < CLOCK_VALID_AFTER) {
+            return 'before clock sync';
+        }
+        const seconds = Math.max(0, Math.floor(Date.now() / 1000) - time);
+        if (seconds < 60) return 'just now';
+        if (seconds < 3600) return `${Math.floor(seconds / 60)} minutes ago`;
+        if (seconds < 86400) return `${Math.floor(seconds / 3600)} hours ago`;
+        return new Date(time * 1000).toLocaleString();
+    }
+
+    // Create an access log row for an entry of /api/v1/logs
+    function createLogEntry(entry) {
+        let [text, icon] = LOG_ACTIONS[entry.action] || [entry.action, 'activity'];
+        let color = 'blue';
+        const name = entry.mac && deviceNames[entry.mac];
+        if (entry.action === 'station-join') {
+            text = entry.result === 'ok' ? `Access granted to ${name || entry.mac}` : 'Access denied to unknown device';
+            color = entry.result === 'ok' ? 'green' : 'red';
+            icon = entry.result === 'ok' ? 'check' : 'x';
+        } else {
+            if (name) {
+                text += `: ${name}`;
+            }
+            text += ` via ${LOG_SOURCES[entry.source] || entry.source}`;
+            if (entry.result !== 'ok') {
+                text += ' failed';
+                color = 'red';
+                icon = 'x';
+            }
+        }
+        const details = [entry.mac ? `MAC: ${entry.mac}` : null, entry.actor ? `By: ${entry.actor}` : null,
+                         formatAge(entry.time)].filter(Boolean).join(' • ');
+
+        const [bgClass, textClass] = LOG_COLORS[color];
+        const row = document.createElement('div');
+        row.className = 'px-6 py-4 flex items-center';
+        row.innerHTML = `
+            <div class="p-2 rounded-full ${bgClass} mr-4">
+                <i data-feather="${icon}" class="${textClass} w-4 h-4"></i>
+            </div>
+            <div class="flex-1">
+                <p class="text-sm font-medium text-gray-800">${escapeHtml(text)}</p>
+                <p class="text-xs text-gray-500 mt-1">${escapeHtml(details)}</p>
+            </div>
+        `;
+        return row;
+    }
+
+    function showLastAccess(entry) {
+        document.getElementById('lastAccess').textContent = formatAge(entry.time);
+    }
+
+    // Load the newest page of access logs, or the next older one
+    function loadLogs(older) {
+        const query = older && logCursor !== null ? `?before=${logCursor}` : '';
+        return fetch(LOGS_API + query)
+            .then(response => response.ok ? response.json() : Promise.reject(response.status))
+            .then(page => {
+                if (!older) {
+                    accessLogs.innerHTML = '';
+                }
+                page.entries.forEach(entry => accessLogs.appendChild(createLogEntry(entry)));
+                if (!older && page.entries.length) {
+                    showLastAccess(page.entries[0]);
+                }
+                logCursor = page.next;
+                moreLogs.classList.toggle('hidden', logCursor === null);
+            })
+            .catch(err => console.error('Failed to load access logs', err));
+    }
+
+    // Render the whitelist returned by the device
+    function renderDevices(devices) {
+        deviceNames = {};
+        devices.forEach(device => { deviceNames[device.mac] = device.name; });
+        devicesList.innerHTML = '';
+        devices.forEach(device => devicesList.appendChild(createDeviceCard(device)));
+        deviceCount.textContent = `${devices.length} Active`;
+    }
+
+    function loadDevices() {
+        return fetch(WHITELIST_API)
+            .then(response => response.ok ? response.json() : Promise.reject(response.status))
+            .then(renderDevices)
+            .catch(err => console.error('Failed to load whitelist', err));
+    }
+
+    function removeDevice(mac) {
+        fetch(`${WHITELIST_API}?mac=${mac.replace(/:/g, '-')}`, { method: 'DELETE' })
+            .then(response => response.ok ? loadDevices() : Promise.reject(response.status))
+            .then(() => loadLogs(false))
+            .catch(err => console.error('Failed to remove device', err));
+    }
 
     // Show modal
     addDeviceBtn.addEventListener('click', function() {
@@ -54,61 +206,21 @@ document.addEventListener('DOMContentLoaded', function() {
         e.preventDefault();
         
         const deviceName = document.getElementById('deviceName').value;
-        const macAddress = document.getElementById('macAddress').value;
+        const macAddress = document.getElementById('macAddress').value.trim();
         const accessLevel = document.querySelector('input[name="accessLevel"]:checked').value;
-        
-        // Create new device card
-        const newDevice = document.createElement('div');
-        newDevice.className = 'device-card bg-white rounded-lg border border-gray-200 p-4 transition-all duration-300';
-        newDevice.innerHTML = `
-            <div class="flex items-start">
-                <div class="p-3 rounded-full bg-indigo-100 mr-4">
-                    <i data-feather="smartphone" class="text-indigo-600 w-5 h-5"></i>
-                </div>
-                <div class="flex-1">
-                    <h3 class="font-medium text-gray-800">${deviceName}</h3>
-                    <p class="text-sm text-gray-500 mt-1">MAC: ${macAddress}</p>
-                    <div class="flex items-center mt-3">
-                        <span class="inline-flex items-center px-2.5 py-0.5 rounded-full text-xs font-medium bg-yellow-100 text-yellow-800">
-                            Pending
-                        </span>
-                        <span class="ml-2 text-xs text-gray-500">Added just now</span>
-                    </div>
-                </div>
-                <button class="text-gray-400 hover:text-gray-600">
-                    <i data-feather="more-vertical" class="w-5 h-5"></i>
-                </button>
-            </div>
-        `;
-        
-        // Add to the beginning of the devices list
-        devicesList.insertBefore(newDevice, devicesList.firstChild);
-        
-        // Create access log entry
-        const newLog = document.createElement('div');
-        newLog.className = 'px-6 py-4 flex items-center';
-        newLog.innerHTML = `
-            <div class="p-2 rounded-full bg-blue-100 mr-4">
-                <i data-feather="user-plus" class="text-blue-600 w-4 h-4"></i>
-            </div>
-            <div class="flex-1">
-                <p class="text-sm font-medium text-gray-800">New device added: ${deviceName}</p>
-                <p class="text-xs text-gray-500 mt-1">MAC: ${macAddress} • just now</p>
-            </div>
-        `;
-        
-        // Add to the beginning of the access logs
-        accessLogs.insertBefore(newLog, accessLogs.firstChild);
-        
-        // Update device count
-        deviceCounter++;
-        deviceCount.textContent = `${deviceCounter} Active`;
-        
-        // Hide modal and reset form
-        hideModal();
-        
-        // Refresh icons
-        feather.replace();
+
+        fetch(WHITELIST_API, {
+            method: 'POST',
+            headers: { 'Content-Type': 'application/json' },
+            body: JSON.stringify({ mac: macAddress, name: deviceName, access: accessLevel })
+        })
+            .then(response => response.ok ? response.json() : Promise.reject(response.status))
+            .then(() => {
+                // Hide modal and reload the list and the log from the device
+                hideModal();
+                return loadDevices().then(() => loadLogs(false));
+            })
+            .catch(err => alert(`Failed to add device (${err})`));
     });
 
     // Close modal when clicking outside
@@ -117,4 +229,69 @@ document.addEventListener('DOMContentLoaded', function() {
             hideModal();
         }
     });
+
+    moreLogs.addEventListener('click', function(e) {
+        e.preventDefault();
+        loadLogs(true);
+    });
+
+    // Live updates pushed by the device; reconnect after a drop and reload
+    // what may have been missed in the meantime
+    const RECONNECT_DELAY_MS = 5000;
+    const systemStatus = document.getElementById('systemStatus');
+    const GATE_STATES = {
+        closed: 'Operational',
+        opening: 'Gate opening',
+        open: 'Gate open',
+        half: 'Gate open for pedestrians',
+        closing: 'Gate closing',
+        fault: 'Gate fault',
+    };
+
+    function handleEvent(event) {
+        if (event.type === 'log') {
+            accessLogs.insertBefore(createLogEntry(event.entry), accessLogs.firstChild);
+            showLastAccess(event.entry);
+        } else if (event.type === 'gate_state') {
+            systemStatus.textContent = GATE_STATES[event.state] || 'Operational';
+        } else if (event.type === 'station') {
+            loadDevices();
+        }
+    }
+
+    function subscribeEvents() {
+        const scheme = location.protocol === 'https:' ? 'wss:' : 'ws:';
+        const socket = new WebSocket(`${scheme}//${location.host}${EVENTS_API}`);
+        socket.onmessage = msg => {
+            try {
+                handleEvent(JSON.parse(msg.data));
+            } catch (err) {
+                console.error('Bad event from device', err);
+            }
+        };
+        socket.onclose = () => {
+            setTimeout(() => {
+                loadLogs(false);
+                subscribeEvents();
+            }, RECONNECT_DELAY_MS);
+        };
+    }
+
+    // Time to interactive and bytes over the wire of this page load, kept
+    // by the device next to its asset counters
+    function reportLoad() {
+        const entries = performance.getEntriesByType('navigation').concat(performance.getEntriesByType('resource'));
+        const transferBytes = entries.reduce((sum, entry) => sum + (entry.transferSize || 0), 0);
+        fetch(UI_STATS_API, {
+            method: 'POST',
+            headers: { 'Content-Type': 'application/json' },
+            body: JSON.stringify({ tti_ms: Math.round(performance.now()), transfer_bytes: transferBytes })
+        }).catch(err => console.error('Failed to report page load', err));
+    }
+
+    // Names are needed to describe the log entries
+    loadDevices().then(() => loadLogs(false)).then(() => {
+        reportLoad();
+        subscribeEvents();
+    });
 });
\ No newline at end of file
@@ -0,0 +1,89 @@
+#ifndef ACCESS_LOG
+#define ACCESS_LOG
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+/* ACCESS_LOG_EVENT_RECORD is posted to the default event loop with the
+ * access_log_record_t once a record has its sequence number */
+ESP_EVENT_DECLARE_BASE(ACCESS_LOG_EVENT);
+
+typedef enum {
+    ACCESS_LOG_EVENT_RECORD,
+} access_log_event_id_t;
+
+/* Who triggered an event; decides what the actor field holds */
+typedef enum {
+    ACCESS_SOURCE_HTTP = 0,     /* actor: client IPv4 address, host byte order */
+    ACCESS_SOURCE_DISCORD,      /* actor: Discord user ID */
+    ACCESS_SOURCE_WIFI,         /* actor: unused, the station is in mac */
+    ACCESS_SOURCE_MAX,
+} access_source_t;
+
+typedef enum {
+    /* The gate actions in gate_action_t order */
+    ACCESS_ACTION_GATE_OPEN = 0,
+    ACCESS_ACTION_GATE_OPEN_HALF,
+    ACCESS_ACTION_GATE_CLOSE,
+    ACCESS_ACTION_WHITELIST_ADD,
+    ACCESS_ACTION_WHITELIST_REMOVE,
+    ACCESS_ACTION_WHITELIST_IMPORT,
+    ACCESS_ACTION_STATION_JOIN,
+    ACCESS_ACTION_SETTINGS_CHANGE,
+    ACCESS_ACTION_MAX,
+} access_action_t;
+
+typedef enum {
+    ACCESS_RESULT_OK = 0,
+    ACCESS_RESULT_DENIED,       /* e.g. a station that is not whitelisted */
+    ACCESS_RESULT_FAILED,
+    ACCESS_RESULT_MAX,
+} access_result_t;
+
+/* One event, stored as is in flash: 8 records per 256-byte flash page */
+typedef struct {
+    uint32_t seq;               /* position in the log, also the read cursor */
+    uint32_t time;              /* Unix time, seconds since boot before SNTP */
+    uint64_t actor;
+    uint8_t mac[6];             /* device concerned, zero if none */
+    uint8_t source;
+    uint8_t action;
+    uint8_t result;
+    uint8_t reserved[3];
+    uint32_t crc;
+} access_log_record_t;
+
+typedef struct {
+    uint32_t appended;          /* records accepted by access_log_append() */
+    uint32_t dropped;           /* records lost because the ring was full */
+    uint32_t stored;            /* records written to flash */
+    uint32_t page_writes;       /* flash program operations */
+    uint32_t sector_erases;
+    uint32_t next_seq;
+    uint32_t capacity;          /* records the partition holds */
+} access_log_stats_t;
+
+/* Find the "alog" partition, recover the write position and start the
+ * flush task. Records appended earlier are kept and flushed. */
+esp_err_t access_log_start(void);
+
+/* Record an event. Never blocks and takes no lock, so it can be called from
+ * any task, including event loop handlers and completion callbacks. mac
+ * may be NULL. Drops the record when the ring is full. */
+void access_log_append(access_source_t source, access_action_t action, access_result_t result,
+                       uint64_t actor, const uint8_t *mac);
+
+/* Copy up to max records older than before, newest first; before = 0 starts
+ * at the newest record. Continue with before set to the seq of the last
+ * record returned. Reads flash: call from a task that may block. */
+size_t access_log_read(uint32_t before, access_log_record_t *out, size_t max);
+
+void access_log_get_stats(access_log_stats_t *stats);
+
+const char *access_source_to_str(access_source_t source);
+const char *access_action_to_str(access_action_t action);
+const char *access_result_to_str(access_result_t result);
+
+#endif /* ACCESS_LOG */
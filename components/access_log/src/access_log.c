@@ -0,0 +1,400 @@
+#include "access_log.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "access-log";
+
+ESP_EVENT_DEFINE_BASE(ACCESS_LOG_EVENT);
+
+#define ALOG_PARTITION_LABEL    "alog"
+#define ALOG_RECORD_SIZE        sizeof(access_log_record_t)
+/* Records are flushed a flash page at a time */
+#define ALOG_PAGE_SIZE          256
+#define ALOG_PAGE_RECORDS       (ALOG_PAGE_SIZE / ALOG_RECORD_SIZE)
+#define ALOG_RING_SIZE          CONFIG_ACCESS_LOG_RING_SIZE
+#define ALOG_RING_MASK          (ALOG_RING_SIZE - 1)
+#define ALOG_FLUSH_INTERVAL     pdMS_TO_TICKS(CONFIG_ACCESS_LOG_FLUSH_INTERVAL_S * 1000)
+#define ALOG_CRC_LEN            offsetof(access_log_record_t, crc)
+#define ALOG_ERASED             0xFFFFFFFFu
+
+_Static_assert(ALOG_RECORD_SIZE == 32, "records must tile flash pages");
+_Static_assert((ALOG_RING_SIZE & ALOG_RING_MASK) == 0, "ACCESS_LOG_RING_SIZE must be a power of two");
+
+/* Bounded multi-producer ring. A slot is free for the producer at position
+ * pos when turn + index == pos, and full for the consumer when
+ * turn + index == pos + 1. Storing turn relative to the slot index makes
+ * the zero-initialised ring valid, so producers may append before
+ * access_log_start(). */
+typedef struct {
+    atomic_uint_least32_t turn;
+    access_log_record_t rec;
+} alog_slot_t;
+
+static alog_slot_t s_ring[ALOG_RING_SIZE];
+static atomic_uint_least32_t s_ring_head;
+static uint32_t s_ring_tail;                /* flush task only */
+static atomic_uint_least32_t s_appended;
+static atomic_uint_least32_t s_dropped;
+static TaskHandle_t s_task = NULL;
+
+/* Flash side, guarded by s_store_lock. The partition is a circular array
+ * of record slots; a sector is erased right before its first slot is
+ * written, so every sector is erased once per lap and wear is even. The
+ * page being filled is kept in RAM so readers see records before they are
+ * flushed. */
+static SemaphoreHandle_t s_store_lock = NULL;
+static const esp_partition_t *s_part = NULL;
+static uint32_t s_capacity;
+static uint32_t s_sector_records;
+static access_log_record_t s_page[ALOG_PAGE_RECORDS];
+static uint32_t s_page_slot;                /* slot of s_page[0], page aligned */
+static uint32_t s_page_count;               /* records in s_page */
+static uint32_t s_page_written;             /* of those, already in flash */
+static TickType_t s_page_dirty_since;
+static uint32_t s_next_seq = 1;
+static uint32_t s_stored;
+static uint32_t s_page_writes;
+static uint32_t s_sector_erases;
+
+static const char *const s_source_names[ACCESS_SOURCE_MAX] = {
+    [ACCESS_SOURCE_HTTP] = "http",
+    [ACCESS_SOURCE_DISCORD] = "discord",
+    [ACCESS_SOURCE_WIFI] = "wifi",
+};
+
+static const char *const s_action_names[ACCESS_ACTION_MAX] = {
+    [ACCESS_ACTION_GATE_OPEN] = "open",
+    [ACCESS_ACTION_GATE_OPEN_HALF] = "open-half",
+    [ACCESS_ACTION_GATE_CLOSE] = "close",
+    [ACCESS_ACTION_WHITELIST_ADD] = "whitelist-add",
+    [ACCESS_ACTION_WHITELIST_REMOVE] = "whitelist-remove",
+    [ACCESS_ACTION_WHITELIST_IMPORT] = "whitelist-import",
+    [ACCESS_ACTION_STATION_JOIN] = "station-join",
+    [ACCESS_ACTION_SETTINGS_CHANGE] = "settings-change",
+};
+
+static const char *const s_result_names[ACCESS_RESULT_MAX] = {
+    [ACCESS_RESULT_OK] = "ok",
+    [ACCESS_RESULT_DENIED] = "denied",
+    [ACCESS_RESULT_FAILED] = "failed",
+};
+
+void access_log_append(access_source_t source, access_action_t action, access_result_t result,
+                       uint64_t actor, const uint8_t *mac)
+{
+    uint32_t pos = atomic_load_explicit(&s_ring_head, memory_order_relaxed);
+    alog_slot_t *slot;
+
+    for (;;) {
+        slot = &s_ring[pos & ALOG_RING_MASK];
+        uint32_t turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+        int32_t diff = (int32_t)(turn + (pos & ALOG_RING_MASK) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&s_ring_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The flush task is a whole ring behind */
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&s_ring_head, memory_order_relaxed);
+        }
+    }
+
+    access_log_record_t *rec = &slot->rec;
+    memset(rec, 0, sizeof(*rec));
+    rec->time = time(NULL);
+    rec->actor = actor;
+    if (mac) {
+        memcpy(rec->mac, mac, sizeof(rec->mac));
+    }
+    rec->source = source;
+    rec->action = action;
+    rec->result = result;
+    atomic_store_explicit(&slot->turn, pos + 1 - (pos & ALOG_RING_MASK), memory_order_release);
+    atomic_fetch_add_explicit(&s_appended, 1, memory_order_relaxed);
+
+    TaskHandle_t task = s_task;
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+static bool ring_pop(access_log_record_t *out)
+{
+    alog_slot_t *slot = &s_ring[s_ring_tail & ALOG_RING_MASK];
+    uint32_t turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+    if (turn + (s_ring_tail & ALOG_RING_MASK) != s_ring_tail + 1) {
+        return false;
+    }
+    *out = slot->rec;
+    atomic_store_explicit(&slot->turn, s_ring_tail + ALOG_RING_SIZE - (s_ring_tail & ALOG_RING_MASK),
+                          memory_order_release);
+    s_ring_tail++;
+    return true;
+}
+
+static inline uint32_t record_crc(const access_log_record_t *rec)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)rec, ALOG_CRC_LEN);
+}
+
+static inline bool record_valid(const access_log_record_t *rec)
+{
+    return rec->seq != ALOG_ERASED && rec->crc == record_crc(rec);
+}
+
+static inline bool record_erased(const access_log_record_t *rec)
+{
+    return rec->seq == ALOG_ERASED && rec->crc == ALOG_ERASED;
+}
+
+static esp_err_t slot_read(uint32_t slot, access_log_record_t *rec)
+{
+    return esp_partition_read(s_part, slot * ALOG_RECORD_SIZE, rec, sizeof(*rec));
+}
+
+/* Write the unwritten part of the RAM page; lock held */
+static void page_flush(void)
+{
+    uint32_t count = s_page_count - s_page_written;
+    uint32_t slot = s_page_slot + s_page_written;
+
+    if (count == 0) {
+        return;
+    }
+    esp_err_t err = ESP_OK;
+    if (slot % s_sector_records == 0) {
+        err = esp_partition_erase_range(s_part, slot * ALOG_RECORD_SIZE, s_part->erase_size);
+        s_sector_erases++;
+    }
+    if (err == ESP_OK) {
+        err = esp_partition_write(s_part, slot * ALOG_RECORD_SIZE, &s_page[s_page_written], count * ALOG_RECORD_SIZE);
+        s_page_writes++;
+    }
+    if (err == ESP_OK) {
+        s_stored += count;
+    } else {
+        /* Nothing sensible to retry with: the records stay readable from RAM
+         * until the page moves on */
+        ESP_LOGE(TAG, "Failed to write %lu records at slot %lu (%s)",
+                 (unsigned long)count, (unsigned long)slot, esp_err_to_name(err));
+    }
+    s_page_written = s_page_count;
+
+    if (s_page_count == ALOG_PAGE_RECORDS) {
+        s_page_slot = (s_page_slot + ALOG_PAGE_RECORDS) % s_capacity;
+        s_page_count = 0;
+        s_page_written = 0;
+    }
+}
+
+static void access_log_task(void *arg)
+{
+    access_log_record_t rec;
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        if (s_page_written < s_page_count) {
+            TickType_t dirty_for = xTaskGetTickCount() - s_page_dirty_since;
+            wait = dirty_for >= ALOG_FLUSH_INTERVAL ? 0 : ALOG_FLUSH_INTERVAL - dirty_for;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        xSemaphoreTake(s_store_lock, portMAX_DELAY);
+        while (ring_pop(&rec)) {
+            if (s_page_written == s_page_count) {
+                s_page_dirty_since = xTaskGetTickCount();
+            }
+            rec.seq = s_next_seq++;
+            rec.crc = record_crc(&rec);
+            s_page[s_page_count++] = rec;
+            if (s_page_count == ALOG_PAGE_RECORDS) {
+                page_flush();
+            }
+            esp_event_post(ACCESS_LOG_EVENT, ACCESS_LOG_EVENT_RECORD, &rec, sizeof(rec), 0);
+        }
+        /* A partial page is written once it has waited long enough, the
+         * rest of it is appended to the same flash page later */
+        if (s_page_written < s_page_count && xTaskGetTickCount() - s_page_dirty_since >= ALOG_FLUSH_INTERVAL) {
+            page_flush();
+        }
+        xSemaphoreGive(s_store_lock);
+    }
+}
+
+/* Find the newest record and continue right after it */
+static void access_log_recover(void)
+{
+    access_log_record_t rec;
+    uint32_t sectors = s_part->size / s_part->erase_size;
+    int32_t newest_sector = -1;
+    uint32_t newest_seq = 0;
+
+    /* The sector whose first record is the newest is being filled */
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        for (uint32_t i = 0; i < s_sector_records; i++) {
+            if (slot_read(sector * s_sector_records + i, &rec) != ESP_OK || record_erased(&rec)) {
+                break;
+            }
+            if (record_valid(&rec)) {
+                if (newest_sector < 0 || rec.seq > newest_seq) {
+                    newest_sector = sector;
+                    newest_seq = rec.seq;
+                }
+                break;
+            }
+        }
+    }
+    if (newest_sector < 0) {
+        ESP_LOGI(TAG, "Log is empty");
+        return;
+    }
+
+    /* Its end is the first erased slot; torn records are skipped over */
+    uint32_t base = newest_sector * s_sector_records;
+    uint32_t end = 0;
+    for (uint32_t i = 0; i < s_sector_records; i++) {
+        if (slot_read(base + i, &rec) != ESP_OK || record_erased(&rec)) {
+            break;
+        }
+        end = i + 1;
+        if (record_valid(&rec) && rec.seq >= newest_seq) {
+            newest_seq = rec.seq;
+        }
+    }
+    s_next_seq = newest_seq + 1;
+
+    uint32_t write_slot = (base + end) % s_capacity;
+    s_page_slot = write_slot - write_slot % ALOG_PAGE_RECORDS;
+    s_page_count = write_slot - s_page_slot;
+    s_page_written = s_page_count;
+    if (s_page_count) {
+        esp_partition_read(s_part, s_page_slot * ALOG_RECORD_SIZE, s_page, s_page_count * ALOG_RECORD_SIZE);
+    }
+    ESP_LOGI(TAG, "Resuming at slot %lu, seq %lu", (unsigned long)write_slot, (unsigned long)s_next_seq);
+}
+
+esp_err_t access_log_start(void)
+{
+    if (s_task) {
+        return ESP_OK;
+    }
+
+    s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ALOG_PARTITION_LABEL);
+    if (!s_part) {
+        ESP_LOGE(TAG, "No \"%s\" partition", ALOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_sector_records = s_part->erase_size / ALOG_RECORD_SIZE;
+    s_capacity = (s_part->size / s_part->erase_size) * s_sector_records;
+
+    s_store_lock = xSemaphoreCreateMutex();
+    if (!s_store_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    access_log_recover();
+
+    /* Below the request handlers: flushing happens when the device is idle */
+    if (xTaskCreate(access_log_task, "access_log", 3072, NULL, tskIDLE_PRIORITY + 1, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Pick up whatever was appended before the task existed */
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+}
+
+size_t access_log_read(uint32_t before, access_log_record_t *out, size_t max)
+{
+    access_log_record_t rec;
+    size_t n = 0;
+
+    if (!s_store_lock) {
+        return 0;
+    }
+    xSemaphoreTake(s_store_lock, portMAX_DELAY);
+
+    for (uint32_t i = s_page_count; i-- > 0 && n < max;) {
+        if (record_valid(&s_page[i]) && (before == 0 || s_page[i].seq < before)) {
+            out[n++] = s_page[i];
+        }
+    }
+
+    /* Sequence numbers are contiguous in flash, so the cursor usually maps
+     * straight to its slot; fall back to walking back from the newest */
+    uint32_t start = s_page_slot;
+    uint32_t newest = (s_page_count ? s_page[0].seq : s_next_seq) - 1;
+    if (n < max && before != 0 && before - 1 < newest && newest - (before - 1) < s_capacity) {
+        uint32_t guess = (s_page_slot + s_capacity - (newest - (before - 1))) % s_capacity;
+        if (slot_read((guess + s_capacity - 1) % s_capacity, &rec) == ESP_OK && record_valid(&rec) &&
+                rec.seq == before - 1) {
+            start = guess;
+        }
+    }
+
+    uint32_t slot = start;
+    uint32_t last_seq = UINT32_MAX;
+    for (uint32_t k = 0; k < s_capacity && n < max; k++) {
+        slot = (slot + s_capacity - 1) % s_capacity;
+        if (slot == s_page_slot || slot_read(slot, &rec) != ESP_OK || record_erased(&rec)) {
+            break;
+        }
+        if (!record_valid(&rec)) {
+            continue;
+        }
+        /* Older than the oldest record: left over from the previous lap */
+        if (rec.seq >= last_seq) {
+            break;
+        }
+        last_seq = rec.seq;
+        if (before == 0 || rec.seq < before) {
+            out[n++] = rec;
+        }
+    }
+
+    xSemaphoreGive(s_store_lock);
+    return n;
+}
+
+void access_log_get_stats(access_log_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->appended = atomic_load(&s_appended);
+    stats->dropped = atomic_load(&s_dropped);
+    if (!s_store_lock) {
+        return;
+    }
+    xSemaphoreTake(s_store_lock, portMAX_DELAY);
+    stats->stored = s_stored;
+    stats->page_writes = s_page_writes;
+    stats->sector_erases = s_sector_erases;
+    stats->next_seq = s_next_seq;
+    stats->capacity = s_capacity;
+    xSemaphoreGive(s_store_lock);
+}
+
+const char *access_source_to_str(access_source_t source)
+{
+    return source < ACCESS_SOURCE_MAX ? s_source_names[source] : "unknown";
+}
+
+const char *access_action_to_str(access_action_t action)
+{
+    return action < ACCESS_ACTION_MAX ? s_action_names[action] : "unknown";
+}
+
+const char *access_result_to_str(access_result_t result)
+{
+    return result < ACCESS_RESULT_MAX ? s_result_names[result] : "unknown";
+}
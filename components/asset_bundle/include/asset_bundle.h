@@ -0,0 +1,76 @@
+#ifndef ASSET_BUNDLE
+#define ASSET_BUNDLE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Read-only bundle of web assets written by tools/compress_assets.py and
+ * flashed to its own partition. It is mapped into the address space as a
+ * whole: lookups binary search the index in place and the bodies are
+ * served straight from the flash cache, with no file system, no file
+ * descriptor and no copy.
+ *
+ * Layout, little-endian, every offset from the start of the bundle:
+ *   header                  asset_bundle_header_t
+ *   index[count]            asset_bundle_index_t, sorted by URI (bytewise)
+ *   strings                 URIs, MIME types and ETags, NUL-terminated
+ *   bodies                  each ASSET_BUNDLE_ALIGN aligned */
+
+#define ASSET_BUNDLE_MAGIC      0x31424741  /* "AGB1" */
+#define ASSET_BUNDLE_VERSION    1
+#define ASSET_BUNDLE_ALIGN      16
+
+#define ASSET_FLAG_GZIP         (1 << 0)    /* body is gzip, send Content-Encoding */
+#define ASSET_FLAG_REVALIDATE   (1 << 1)    /* no-cache, the others are immutable */
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t size;              /* whole bundle, header included */
+    uint32_t raw_total;         /* bodies before compression */
+} asset_bundle_header_t;
+
+typedef struct {
+    uint32_t uri;
+    uint32_t mime;
+    uint32_t etag;              /* quoted, as sent */
+    uint32_t data;
+    uint32_t raw_len;
+    uint32_t stored_len;
+    uint16_t uri_len;
+    uint16_t flags;
+    uint32_t reserved;
+} asset_bundle_index_t;
+
+typedef struct {
+    const uint8_t *base;
+    const asset_bundle_index_t *index;
+    uint16_t count;
+    uint32_t size;
+    uint32_t raw_total;
+} asset_bundle_t;
+
+/* Map the bundle and check it. name is the partition label on the board,
+ * a file path on the host. The mapping is never released. */
+esp_err_t asset_bundle_map(const char *name, asset_bundle_t *out);
+/* Check a bundle already in memory: every offset and length in bounds,
+ * every string terminated, the index sorted */
+esp_err_t asset_bundle_open(const void *base, size_t size, asset_bundle_t *out);
+
+/* uri need not be NUL-terminated. The entry lives as long as the mapping. */
+const asset_bundle_index_t *asset_bundle_find(const asset_bundle_t *bundle, const char *uri, size_t uri_len);
+
+static inline const char *asset_bundle_str(const asset_bundle_t *bundle, uint32_t offset)
+{
+    return (const char *)bundle->base + offset;
+}
+
+static inline const uint8_t *asset_bundle_data(const asset_bundle_t *bundle, const asset_bundle_index_t *entry)
+{
+    return bundle->base + entry->data;
+}
+
+#endif /* ASSET_BUNDLE */
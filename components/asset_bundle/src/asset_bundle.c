@@ -0,0 +1,141 @@
+#include "asset_bundle.h"
+
+#include <string.h>
+#include "esp_log.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include "esp_partition.h"
+#endif
+
+static const char *TAG = "asset-bundle";
+
+/* A NUL-terminated string starting at offset, within the bundle */
+static bool str_valid(const uint8_t *base, size_t size, uint32_t offset)
+{
+    return offset < size && memchr(base + offset, '\0', size - offset) != NULL;
+}
+
+static int uri_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (cmp == 0) {
+        cmp = (a_len > b_len) - (a_len < b_len);
+    }
+    return cmp;
+}
+
+esp_err_t asset_bundle_open(const void *base, size_t size, asset_bundle_t *out)
+{
+    const asset_bundle_header_t *header = base;
+
+    if (size < sizeof(*header) || header->magic != ASSET_BUNDLE_MAGIC) {
+        ESP_LOGE(TAG, "No asset bundle");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header->version != ASSET_BUNDLE_VERSION) {
+        ESP_LOGE(TAG, "Bundle version %u, expected %u", header->version, ASSET_BUNDLE_VERSION);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (header->size > size || sizeof(*header) + (size_t)header->count * sizeof(asset_bundle_index_t) > header->size) {
+        ESP_LOGE(TAG, "Bundle truncated (%lu bytes, %u mapped)", (unsigned long)header->size, (unsigned)size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const uint8_t *bytes = base;
+    const asset_bundle_index_t *index = (const asset_bundle_index_t *)(header + 1);
+    size = header->size;
+    for (uint16_t i = 0; i < header->count; i++) {
+        const asset_bundle_index_t *entry = &index[i];
+        bool valid = str_valid(bytes, size, entry->uri) && str_valid(bytes, size, entry->mime) &&
+                     str_valid(bytes, size, entry->etag) && strlen((const char *)bytes + entry->uri) == entry->uri_len &&
+                     entry->data <= size && entry->stored_len <= size - entry->data;
+        if (valid && i > 0) {
+            const asset_bundle_index_t *prev = &index[i - 1];
+            valid = uri_cmp((const char *)bytes + prev->uri, prev->uri_len,
+                            (const char *)bytes + entry->uri, entry->uri_len) < 0;
+        }
+        if (!valid) {
+            ESP_LOGE(TAG, "Bundle entry %u corrupt", i);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    out->base = bytes;
+    out->index = index;
+    out->count = header->count;
+    out->size = header->size;
+    out->raw_total = header->raw_total;
+    return ESP_OK;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+esp_err_t asset_bundle_map(const char *name, asset_bundle_t *out)
+{
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        ESP_LOGE(TAG, "Cannot open %s", name);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return ESP_ERR_NO_MEM;
+    }
+    return asset_bundle_open(base, st.st_size, out);
+}
+#else
+esp_err_t asset_bundle_map(const char *name, asset_bundle_t *out)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+    if (!part) {
+        ESP_LOGE(TAG, "No \"%s\" partition", name);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Map only what the bundle uses, MMU pages are scarce */
+    asset_bundle_header_t header;
+    esp_err_t err = esp_partition_read(part, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (header.magic != ASSET_BUNDLE_MAGIC || header.size > part->size) {
+        ESP_LOGE(TAG, "No asset bundle in \"%s\"", name);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *base;
+    esp_partition_mmap_handle_t handle;
+    err = esp_partition_mmap(part, 0, header.size, ESP_PARTITION_MMAP_DATA, &base, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot map \"%s\" (%s)", name, esp_err_to_name(err));
+        return err;
+    }
+    return asset_bundle_open(base, header.size, out);
+}
+#endif
+
+const asset_bundle_index_t *asset_bundle_find(const asset_bundle_t *bundle, const char *uri, size_t uri_len)
+{
+    size_t lo = 0, hi = bundle->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const asset_bundle_index_t *entry = &bundle->index[mid];
+        int cmp = uri_cmp(asset_bundle_str(bundle, entry->uri), entry->uri_len, uri, uri_len);
+        if (cmp == 0) {
+            return entry;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
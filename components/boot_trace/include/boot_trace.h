@@ -0,0 +1,22 @@
+#ifndef BOOT_TRACE
+#define BOOT_TRACE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_TRACE_MAX_PHASES 16
+
+typedef struct {
+    const char *phase;
+    int64_t time_us;        /* esp_timer time when the phase was reached */
+} boot_trace_entry_t;
+
+/* Record that a start-up phase was reached. phase must be a string literal;
+ * only the first occurrence of each phase is kept, so marks on reconnects
+ * are ignored. Safe to call from any task. */
+void boot_trace_mark(const char *phase);
+
+/* Copy up to max recorded phases in the order they were reached */
+size_t boot_trace_get(boot_trace_entry_t *out, size_t max);
+
+#endif /* BOOT_TRACE */
@@ -0,0 +1,45 @@
+#include "boot_trace.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "boot";
+
+static boot_trace_entry_t s_phases[BOOT_TRACE_MAX_PHASES];
+static size_t s_count = 0;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_trace_mark(const char *phase)
+{
+    int64_t now = esp_timer_get_time();
+    bool added = false;
+
+    portENTER_CRITICAL(&s_lock);
+    size_t i = 0;
+    while (i < s_count && strcmp(s_phases[i].phase, phase) != 0) {
+        i++;
+    }
+    if (i == s_count && s_count < BOOT_TRACE_MAX_PHASES) {
+        s_phases[s_count].phase = phase;
+        s_phases[s_count].time_us = now;
+        s_count++;
+        added = true;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (added) {
+        ESP_LOGI(TAG, "%s at %lld ms", phase, (long long)(now / 1000));
+    }
+}
+
+size_t boot_trace_get(boot_trace_entry_t *out, size_t max)
+{
+    portENTER_CRITICAL(&s_lock);
+    size_t n = s_count < max ? s_count : max;
+    memcpy(out, s_phases, n * sizeof(*out));
+    portEXIT_CRITICAL(&s_lock);
+    return n;
+}
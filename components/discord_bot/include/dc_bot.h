@@ -1,6 +1,8 @@
 #ifndef DC_BOT
 #define DC_BOT
 
+/* Create the bot; it logs in whenever the uplink is up and logs out when it
+ * goes down (see link_supervisor.h). Does not block on the network. */
 void dc_bot_start(void);
 
 #endif /* DC_BOT */
@@ -1,117 +1,542 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "discord.h"
 #include "discord/session.h"
 #include "discord/message.h"
-#include "estr.h"
 
+#include "access_log.h"
 #include "basic_http_server.h"
+#include "boot_trace.h"
+#include "dc_filter.h"
+#include "dlog.h"
+#include "link_supervisor.h"
+#include "gate_actuator.h"
+#include "metrics.h"
+#include "presence.h"
+#include "settings.h"
+#include "whitelist.h"
+#include "dc_outbox.h"
 
 static const char *TAG = "discord-bot";
 
-/* forward declarations for handlers (matching typedef) */
-static esp_err_t cmd_config(discord_message_t *msg, char *args, discord_message_t **out_result);
-static esp_err_t cmd_gate_action(discord_message_t *msg, char *args, discord_message_t **out_result);
-
-/* handler typedef now returns an optional out-result pointer */
-typedef esp_err_t (*cmd_handler_t)(discord_message_t *msg, char *args, discord_message_t **out_result);
+#define DC_MAX_ARGS         4
+#define DC_CMD_UNKNOWN      (-1)
+#define DC_CMD_UNKNOWN_SUB  (-2)
+/* Replies are built to fit an outbox slot whole */
+#define DC_REPLY_MAX        DC_OUTBOX_MSG_MAX
+#define DC_GATE_PENDING_MAX 8
+/* Matches the usage strings generated from commands.def */
+#define DC_COMMAND_PREFIX   '!'
+
+/* Arguments point into the message content, nothing is copied */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} dc_arg_t;
+
+typedef struct {
+    dc_arg_t argv[DC_MAX_ARGS];
+    int argc;
+} dc_args_t;
+
+typedef esp_err_t (*cmd_handler_t)(discord_message_t *msg, const dc_args_t *args);
+
+typedef struct {
+    cmd_handler_t handler;
+    uint8_t min_args;
+    uint8_t max_args;
+    bool rest;              /* last argument takes the rest of the line */
+    const char *usage;
+    const char *help;
+} dc_command_t;
+
+/* Gate command waiting for the actuator to report completion */
+typedef struct {
+    atomic_bool in_use;
+    char channel_id[DC_SNOWFLAKE_MAX];
+    uint64_t author_id;
+} dc_gate_pending_t;
 
 /* Bot handle*/
 static discord_handle_t bot;
+static atomic_bool s_logged_in = false;
 
-/* dispatch table */
-static const struct {
-    const char *name;
-    cmd_handler_t handler;
-} commands[] = {
-    { "config", cmd_config },
-    { "gate", cmd_gate_action },
-    { NULL, NULL }
+_Static_assert(SETTINGS_IDS_MAX <= DC_FILTER_MAX_IDS, "allow-lists do not fit the filter");
+
+static dc_filter_t s_filter;
+/* Settings generation the filter was built from */
+static uint32_t s_filter_generation;
+/* Received messages by filter verdict, only written by the bot event task */
+static uint32_t s_filter_counts[DC_FILTER_RESULT_MAX];
+
+static dc_gate_pending_t s_gate_pending[DC_GATE_PENDING_MAX];
+/* Arrival time of the message being processed, for latency accounting */
+static int64_t s_msg_time_us = 0;
+
+static const char *const s_gate_replies[GATE_ACTION_MAX] = {
+    [GATE_ACTION_OPEN] = "Gate opens fully for car passage!",
+    [GATE_ACTION_OPEN_HALF] = "Gate opens partially for pedestrian passage!",
+    [GATE_ACTION_CLOSE] = "Gate closes!",
 };
 
-static esp_err_t cmd_config(discord_message_t *cmd, char *args, discord_message_t **out_result)
+/* Handler declarations, command table, help text and dc_command_find(),
+ * generated from commands.def at build time */
+#include "dc_commands.inc"
+
+static metrics_hist_t s_parse_hist = METRICS_HIST_INIT("discord_parse_seconds",
+                                                       "Command message received -> handler dispatched");
+/* One per command, labelled with the command name */
+static metrics_hist_t s_command_hist[DC_COMMAND_COUNT];
+
+/* Replies go through the outbox so handlers never wait on the Discord API */
+static esp_err_t dc_bot_reply(discord_message_t *msg, const char *content)
+{
+    return dc_outbox_post(msg->channel_id, content);
+}
+
+static inline uint64_t dc_author_id(const discord_message_t *msg)
+{
+    return msg->author && msg->author->id ? strtoull(msg->author->id, NULL, 10) : 0;
+}
+
+static void dc_log(const discord_message_t *msg, access_action_t action, esp_err_t err, const uint8_t *mac)
+{
+    access_log_append(ACCESS_SOURCE_DISCORD, action, err == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED,
+                      dc_author_id(msg), mac);
+}
+
+/* Runs on the actuator task: only queue the confirmation */
+static void dc_gate_done(gate_action_t action, esp_err_t result, void *ctx)
 {
-    if (!args) return ESP_FAIL;
+    dc_gate_pending_t *pending = ctx;
+    char channel_id[DC_SNOWFLAKE_MAX];
+
+    access_log_append(ACCESS_SOURCE_DISCORD, ACCESS_ACTION_GATE_OPEN + action,
+                      result == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED, pending->author_id, NULL);
+    strlcpy(channel_id, pending->channel_id, sizeof(channel_id));
+    atomic_store(&pending->in_use, false);
+    dc_outbox_post(channel_id, result == ESP_OK ? s_gate_replies[action] :
+                   result == ESP_ERR_INVALID_STATE ? "Gate command replaced by a newer one" : "Gate command failed");
+}
 
-    if (strcmp(args, "start") == 0) {
-        start_rest_server();
-        discord_message_t reply = { .content = "Web server started", .channel_id = cmd->channel_id };
-        return discord_message_send(bot, &reply, out_result);
-    } else if (strcmp(args, "stop") == 0) {
-        stop_rest_server();
-        discord_message_t reply = { .content = "Web server stopped", .channel_id = cmd->channel_id };
-        return discord_message_send(bot, &reply, out_result);
+static esp_err_t dc_bot_gate_submit(discord_message_t *msg, gate_action_t action)
+{
+    dc_gate_pending_t *pending = NULL;
+    for (int i = 0; i < DC_GATE_PENDING_MAX && !pending; i++) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&s_gate_pending[i].in_use, &expected, true)) {
+            pending = &s_gate_pending[i];
+        }
+    }
+    if (!pending) {
+        dc_log(msg, ACCESS_ACTION_GATE_OPEN + action, ESP_ERR_TIMEOUT, NULL);
+        return dc_bot_reply(msg, "Gate is busy, try again");
+    }
+    strlcpy(pending->channel_id, msg->channel_id, sizeof(pending->channel_id));
+    pending->author_id = dc_author_id(msg);
+
+    gate_request_t request = {
+        .action = action,
+        .source = GATE_SOURCE_DISCORD,
+        .event_time_us = s_msg_time_us,
+        .done_cb = dc_gate_done,
+        .ctx = pending,
+    };
+    if (gate_actuator_submit(&request) != ESP_OK) {
+        dc_log(msg, ACCESS_ACTION_GATE_OPEN + action, ESP_ERR_TIMEOUT, NULL);
+        atomic_store(&pending->in_use, false);
+        return dc_bot_reply(msg, "Gate is busy, try again");
     }
+    return ESP_OK;
+}
 
-    discord_message_t reply = { .content = "Unknown config subcommand", .channel_id = cmd->channel_id };
-    return discord_message_send(bot, &reply, out_result);
+/* Copy an argument into a NUL-terminated buffer, failing if it does not fit */
+static bool dc_arg_copy(const dc_arg_t *arg, char *out, size_t out_len)
+{
+    if (arg->len >= out_len) {
+        return false;
+    }
+    memcpy(out, arg->ptr, arg->len);
+    out[arg->len] = '\0';
+    return true;
 }
 
-static esp_err_t cmd_gate_action(discord_message_t *cmd, char *args, discord_message_t **out_result)
+static esp_err_t cmd_config_start(discord_message_t *msg, const dc_args_t *args)
 {
-    if (!args) return ESP_FAIL;
+    char text[64];
+    rest_lifecycle_stats_t stats;
 
-    if (strcmp(args, "open") == 0) {
-        // open_gate();
-        discord_message_t reply = { .content = "Gate opens fully for car passage!", .channel_id = cmd->channel_id };
-        return discord_message_send(bot, &reply, out_result);
-    } else if (strcmp(args, "open-half") == 0) {
-        // open_gate_halfway();
-        discord_message_t reply = { .content = "Gate opens partially for pedestrian passage!", .channel_id = cmd->channel_id };
-        return discord_message_send(bot, &reply, out_result);
-    } else if (strcmp(args, "close") == 0) {
-        // close_gate();
-        discord_message_t reply = { .content = "Gate closes!", .channel_id = cmd->channel_id };
-        return discord_message_send(bot, &reply, out_result);
+    if (start_rest_server() != ESP_OK) {
+        return dc_bot_reply(msg, "Web server failed to start");
     }
+    rest_get_lifecycle_stats(&stats);
+    snprintf(text, sizeof(text), "Web server started, accepting after %luus", (unsigned long)stats.last_start_us);
+    return dc_bot_reply(msg, text);
+}
 
-    discord_message_t reply = { .content = "Unknown config subcommand", .channel_id = cmd->channel_id };
-    return discord_message_send(bot, &reply, out_result);
+static esp_err_t cmd_config_stop(discord_message_t *msg, const dc_args_t *args)
+{
+    esp_err_t err = stop_rest_server();
+    if (err == ESP_ERR_TIMEOUT) {
+        return dc_bot_reply(msg, "Web server still busy with requests, left running; try again");
+    }
+    if (err != ESP_OK) {
+        return dc_bot_reply(msg, "Web server failed to stop");
+    }
+    return dc_bot_reply(msg, "Web server stopped");
 }
 
-static esp_err_t dc_bot_parse_command(discord_message_t *msg)
+/* Every setting but the secrets, or one of them */
+static esp_err_t cmd_config_get(discord_message_t *msg, const dc_args_t *args)
+{
+    static char text[DC_REPLY_MAX];
+    char key[24] = "";
+    char value[SETTINGS_VALUE_MAX + 1];
+    size_t len = 0;
+
+    if (args->argc > 0 && (!dc_arg_copy(&args->argv[0], key, sizeof(key)) || !settings_find(key))) {
+        return dc_bot_reply(msg, "Unknown setting");
+    }
+    const settings_t *settings = settings_acquire();
+    for (size_t i = 0; i < settings_field_count() && len < sizeof(text); i++) {
+        const settings_field_t *field = settings_field(i);
+        if (key[0] && strcmp(key, field->name) != 0) {
+            continue;
+        }
+        if (field->flags & SETTINGS_FLAG_SECRET) {
+            strlcpy(value, "(hidden)", sizeof(value));
+        } else {
+            settings_format(settings, field, value, sizeof(value));
+        }
+        len += snprintf(text + len, sizeof(text) - len, "`%s` = %s%s\n", field->name, value,
+                        field->flags & SETTINGS_FLAG_RESTART ? " (on restart)" : "");
+        if (key[0] && len < sizeof(text)) {
+            len += snprintf(text + len, sizeof(text) - len, "%s\n", field->help);
+        }
+    }
+    settings_release(settings);
+    return dc_bot_reply(msg, text);
+}
+
+static esp_err_t cmd_config_set(discord_message_t *msg, const dc_args_t *args)
+{
+    char key[24];
+    char value[SETTINGS_VALUE_MAX + 1] = "";
+
+    const settings_field_t *field = dc_arg_copy(&args->argv[0], key, sizeof(key)) ? settings_find(key) : NULL;
+    if (!field) {
+        return dc_bot_reply(msg, "Unknown setting");
+    }
+    /* The channel history would keep them */
+    if (field->flags & SETTINGS_FLAG_SECRET) {
+        return dc_bot_reply(msg, "Secrets can only be changed from the web UI");
+    }
+    if (args->argc > 1 && !dc_arg_copy(&args->argv[1], value, sizeof(value))) {
+        return dc_bot_reply(msg, "Value too long");
+    }
+
+    bool restart = false;
+    esp_err_t err = settings_set(key, value, &restart);
+    if (err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE) {
+        return dc_bot_reply(msg, err == ESP_ERR_INVALID_ARG ? "Invalid value" : "Value out of range");
+    }
+    dc_log(msg, ACCESS_ACTION_SETTINGS_CHANGE, err, NULL);
+    if (err != ESP_OK && err != ESP_FAIL) {
+        return dc_bot_reply(msg, "Failed to apply the setting");
+    }
+    return dc_bot_reply(msg, err == ESP_FAIL ? "Setting applied but not saved, it is lost on restart" :
+                        restart ? "Setting saved, it takes effect after a restart" : "Setting applied");
+}
+
+static esp_err_t cmd_gate_open(discord_message_t *msg, const dc_args_t *args)
+{
+    return dc_bot_gate_submit(msg, GATE_ACTION_OPEN);
+}
+
+static esp_err_t cmd_gate_open_half(discord_message_t *msg, const dc_args_t *args)
+{
+    return dc_bot_gate_submit(msg, GATE_ACTION_OPEN_HALF);
+}
+
+static esp_err_t cmd_gate_close(discord_message_t *msg, const dc_args_t *args)
+{
+    return dc_bot_gate_submit(msg, GATE_ACTION_CLOSE);
+}
+
+/* Text histogram of the command-to-relay latency of every source */
+static esp_err_t cmd_gate_stats(discord_message_t *msg, const dc_args_t *args)
+{
+    static char text[DC_REPLY_MAX];
+    gate_status_t status;
+
+    gate_actuator_get_status(&status);
+    size_t len = snprintf(text, sizeof(text),
+                          "**gate** %s (%u%%) pulses=%lu redundant=%lu replaced=%lu faults=%lu queue max=%lu\n",
+                          gate_state_to_str(status.state), status.position_pct, (unsigned long)status.pulses,
+                          (unsigned long)status.redundant, (unsigned long)status.superseded,
+                          (unsigned long)status.faults, (unsigned long)status.queue_max);
+    for (int source = 0; source < GATE_SOURCE_MAX && len < sizeof(text); source++) {
+        gate_latency_hist_t hist;
+        gate_actuator_get_latency(source, &hist);
+        len += snprintf(text + len, sizeof(text) - len, "**%s** n=%lu avg=%lluus max=%luus\n",
+                        gate_source_to_str(source), (unsigned long)hist.count,
+                        hist.count ? (unsigned long long)(hist.total_us / hist.count) : 0ULL, (unsigned long)hist.max_us);
+
+        uint32_t peak = 1;
+        for (int i = 0; i < GATE_LATENCY_BUCKETS; i++) {
+            peak = hist.buckets[i] > peak ? hist.buckets[i] : peak;
+        }
+        for (int i = 0; i < GATE_LATENCY_BUCKETS && len < sizeof(text); i++) {
+            if (!hist.buckets[i]) {
+                continue;
+            }
+            char bar[21];
+            int width = (hist.buckets[i] * 20 + peak - 1) / peak;
+            memset(bar, '#', width);
+            bar[width] = '\0';
+            if (i == GATE_LATENCY_BUCKETS - 1) {
+                len += snprintf(text + len, sizeof(text) - len, "`   >%7luus` %s %lu\n",
+                                (unsigned long)gate_latency_bucket_us[i - 1], bar, (unsigned long)hist.buckets[i]);
+            } else {
+                len += snprintf(text + len, sizeof(text) - len, "`  <=%7luus` %s %lu\n",
+                                (unsigned long)gate_latency_bucket_us[i], bar, (unsigned long)hist.buckets[i]);
+            }
+        }
+    }
+    return dc_bot_reply(msg, text);
+}
+
+typedef struct {
+    char *buf;
+    size_t len;
+} dc_list_ctx_t;
+
+static void dc_whitelist_append(const whitelist_entry_t *entry, void *arg)
+{
+    dc_list_ctx_t *ctx = arg;
+    char mac[18];
+    whitelist_mac_to_str(entry->mac, mac);
+    if (ctx->len < DC_REPLY_MAX) {
+        int n = snprintf(ctx->buf + ctx->len, DC_REPLY_MAX - ctx->len, "`%s` %s (%s)\n",
+                         mac, entry->name, whitelist_access_to_str(entry->access));
+        ctx->len += n > 0 ? n : 0;
+    }
+}
+
+static esp_err_t cmd_whitelist_list(discord_message_t *msg, const dc_args_t *args)
 {
-    /* copy because strtok_r modifies the buffer */
-    char buf[128];
-    strlcpy(buf, msg->content + 1, sizeof(buf)); /* skip leading '!' */
+    /* Only the bot event task runs command handlers */
+    static char list[DC_REPLY_MAX];
+    dc_list_ctx_t ctx = { .buf = list, .len = 0 };
 
-    char *saveptr = NULL;
-    char *cmd = strtok_r(buf, " \t", &saveptr);
-    char *args = strtok_r(NULL, "", &saveptr); /* rest of line as args (may be NULL) */
+    list[0] = '\0';
+    whitelist_foreach(dc_whitelist_append, &ctx);
+    return dc_bot_reply(msg, ctx.len ? list : "The whitelist is empty");
+}
 
-    if (!cmd) return ESP_FAIL;
+static esp_err_t cmd_whitelist_add(discord_message_t *msg, const dc_args_t *args)
+{
+    char mac_str[18];
+    whitelist_entry_t entry = { .access = WHITELIST_ACCESS_FULL };
 
-    discord_message_t *sent = NULL;
-    bool matched = false;
-    esp_err_t err = ESP_FAIL;
+    if (!dc_arg_copy(&args->argv[0], mac_str, sizeof(mac_str)) || whitelist_mac_from_str(mac_str, entry.mac) != ESP_OK) {
+        return dc_bot_reply(msg, "Invalid MAC address");
+    }
+    if (args->argc > 1) {
+        size_t len = args->argv[1].len < sizeof(entry.name) - 1 ? args->argv[1].len : sizeof(entry.name) - 1;
+        memcpy(entry.name, args->argv[1].ptr, len);
+    }
+
+    esp_err_t err = whitelist_add(&entry);
+    dc_log(msg, ACCESS_ACTION_WHITELIST_ADD, err, entry.mac);
+    return dc_bot_reply(msg, err == ESP_OK ? "Device whitelisted" :
+                        err == ESP_ERR_NO_MEM ? "Whitelist is full" : "Failed to store device");
+}
 
-    for (int i = 0; commands[i].name != NULL; ++i) {
-        if (strcmp(cmd, commands[i].name) == 0) {
-            matched = true;
-            err = commands[i].handler(msg, args, &sent);
+static esp_err_t cmd_whitelist_remove(discord_message_t *msg, const dc_args_t *args)
+{
+    char mac_str[18];
+    uint8_t mac[6];
+
+    if (!dc_arg_copy(&args->argv[0], mac_str, sizeof(mac_str)) || whitelist_mac_from_str(mac_str, mac) != ESP_OK) {
+        return dc_bot_reply(msg, "Invalid MAC address");
+    }
+
+    esp_err_t err = whitelist_remove(mac);
+    dc_log(msg, ACCESS_ACTION_WHITELIST_REMOVE, err, mac);
+    return dc_bot_reply(msg, err == ESP_OK ? "Device removed" :
+                        err == ESP_ERR_NOT_FOUND ? "Device is not whitelisted" : "Failed to remove device");
+}
+
+static esp_err_t cmd_status(discord_message_t *msg, const dc_args_t *args)
+{
+    static char text[DC_REPLY_MAX];
+    dc_outbox_stats_t stats;
+    link_state_t link_state;
+    link_fsm_stats_t link;
+    presence_stats_t presence;
+    char recent[LINK_RECOVERY_HISTORY * 8];
+    size_t len = 0;
+
+    dc_outbox_get_stats(&stats);
+    link_supervisor_get_stats(&link_state, &link);
+    presence_get_stats(&presence);
+
+    /* Most recent recovery first */
+    recent[0] = '\0';
+    for (int i = 1; i <= LINK_RECOVERY_HISTORY && len < sizeof(recent); i++) {
+        uint32_t ms = link.recent_recovery_ms[(link.recent_head + LINK_RECOVERY_HISTORY - i) % LINK_RECOVERY_HISTORY];
+        if (ms == 0) {
             break;
         }
+        len += snprintf(recent + len, sizeof(recent) - len, "%s%lu", len ? "," : "", (unsigned long)ms);
+    }
+
+    len = snprintf(text, sizeof(text),
+             "**outbox** depth=%lu (max %lu) sent=%lu merged=%lu retries=%lu (429: %lu) dropped=%lu\n"
+             "**latency** avg=%llums max=%lums, API avg=%llums max=%lums\n"
+             "**link** %s outages=%lu attempts=%lu recovery last=%lums max=%lums recent=[%s]\n"
+             "**messages** commands=%lu dropped prefix=%lu bot=%lu guild=%lu channel=%lu author=%lu\n"
+             "**presence** opens=%lu (probe %lu, failed %lu) flaps=%lu cooldown=%lu startup=%lu unknown=%lu\n",
+             (unsigned long)stats.depth, (unsigned long)stats.max_depth, (unsigned long)stats.sent,
+             (unsigned long)stats.merged, (unsigned long)stats.retries, (unsigned long)stats.rate_limited,
+             (unsigned long)stats.dropped,
+             stats.sent ? (unsigned long long)(stats.total_latency_us / stats.sent / 1000) : 0ULL,
+             (unsigned long)(stats.max_latency_us / 1000),
+             stats.sent ? (unsigned long long)(stats.total_api_us / stats.sent / 1000) : 0ULL,
+             (unsigned long)(stats.max_api_us / 1000),
+             link_state_to_str(link_state), (unsigned long)link.outages, (unsigned long)link.attempts,
+             (unsigned long)link.last_recovery_ms, (unsigned long)link.max_recovery_ms, recent,
+             (unsigned long)s_filter_counts[DC_FILTER_PASS], (unsigned long)s_filter_counts[DC_FILTER_DROP_PREFIX],
+             (unsigned long)s_filter_counts[DC_FILTER_DROP_BOT], (unsigned long)s_filter_counts[DC_FILTER_DROP_GUILD],
+             (unsigned long)s_filter_counts[DC_FILTER_DROP_CHANNEL], (unsigned long)s_filter_counts[DC_FILTER_DROP_AUTHOR],
+             (unsigned long)presence.counts[PRESENCE_VERDICT_OPEN], (unsigned long)presence.prewarm_opens,
+             (unsigned long)presence.open_failures, (unsigned long)presence.counts[PRESENCE_VERDICT_FLAP],
+             (unsigned long)presence.counts[PRESENCE_VERDICT_COOLDOWN],
+             (unsigned long)presence.counts[PRESENCE_VERDICT_STARTUP],
+             (unsigned long)presence.counts[PRESENCE_VERDICT_UNKNOWN]);
+    if (len < sizeof(text)) {
+        metrics_format_summary(text + len, sizeof(text) - len);
+    }
+    return dc_bot_reply(msg, text);
+}
+
+static esp_err_t cmd_help(discord_message_t *msg, const dc_args_t *args)
+{
+    return dc_bot_reply(msg, s_dc_help_text);
+}
+
+static inline bool dc_is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Find the next whitespace separated token, returns the position after it */
+static const char *dc_next_token(const char *p, const char **tok, size_t *len)
+{
+    while (dc_is_space(*p)) {
+        p++;
+    }
+    *tok = p;
+    while (*p && !dc_is_space(*p)) {
+        p++;
+    }
+    *len = p - *tok;
+    return p;
+}
+
+static esp_err_t dc_bot_reply_usage(discord_message_t *msg, const char *usage)
+{
+    char reply[256];
+    snprintf(reply, sizeof(reply), "Usage: %s", usage);
+    return dc_bot_reply(msg, reply);
+}
+
+static esp_err_t dc_bot_parse_command(discord_message_t *msg)
+{
+    const char *cmd, *sub;
+    size_t cmd_len, sub_len;
+    bool consumed_sub;
+
+    /* skip the prefix */
+    const char *p = dc_next_token(msg->content + 1, &cmd, &cmd_len);
+    const char *after_sub = dc_next_token(p, &sub, &sub_len);
+    if (cmd_len == 0) {
+        return ESP_FAIL;
     }
 
-    if (!matched) {
-        discord_message_t reply = { .content = "Unknown command", .channel_id = msg->channel_id };
-        err = discord_message_send(bot, &reply, &sent);
+    int index = dc_command_find(cmd, cmd_len, sub, sub_len, &consumed_sub);
+    if (index == DC_CMD_UNKNOWN) {
+        return dc_bot_reply(msg, "Unknown command, try `!help`");
+    } else if (index == DC_CMD_UNKNOWN_SUB) {
+        return dc_bot_reply_usage(msg, dc_command_usage(cmd, cmd_len));
     }
 
-    if (err == ESP_OK) {
-        ESP_LOGI(TAG, "Message successfully sent");
+    const dc_command_t *command = &s_dc_commands[index];
+    metrics_hist_t *hist = &s_command_hist[index];
+    dc_args_t args = { .argc = 0 };
+    if (consumed_sub) {
+        p = after_sub;
+    }
+    for (;;) {
+        const char *tok;
+        size_t len;
+
+        if (command->rest && args.argc == command->max_args - 1) {
+            /* Last argument: the rest of the line without surrounding blanks */
+            while (dc_is_space(*p)) {
+                p++;
+            }
+            len = strlen(p);
+            while (len > 0 && dc_is_space(p[len - 1])) {
+                len--;
+            }
+            if (len > 0) {
+                args.argv[args.argc++] = (dc_arg_t) { p, len };
+            }
+            break;
+        }
 
-        if (sent) {
-            ESP_LOGI(TAG, "Message got ID #%s", sent->id);
-            discord_message_free(sent);
+        p = dc_next_token(p, &tok, &len);
+        if (len == 0) {
+            break;
+        }
+        if (args.argc == command->max_args) {
+            return dc_bot_reply_usage(msg, command->usage);
         }
-    } else {
-        ESP_LOGE(TAG, "Fail to send message");
+        args.argv[args.argc++] = (dc_arg_t) { tok, len };
+    }
+    if (args.argc < command->min_args) {
+        return dc_bot_reply_usage(msg, command->usage);
     }
 
+    int64_t start_us = esp_timer_get_time();
+    metrics_observe_us(&s_parse_hist, start_us - s_msg_time_us);
+    esp_err_t err = command->handler(msg, &args);
+    metrics_observe_since(hist, start_us);
     return err;
 }
 
+/* Rebuild the filter from the allow-lists in settings */
+static void dc_filter_load(const settings_t *settings)
+{
+    s_filter = (dc_filter_t) {
+        .prefix = DC_COMMAND_PREFIX,
+        .guild_count = settings->dc_guilds.count,
+        .channel_count = settings->dc_channels.count,
+        .user_count = settings->dc_users.count,
+    };
+    memcpy(s_filter.guilds, settings->dc_guilds.id, settings->dc_guilds.count * sizeof(uint64_t));
+    memcpy(s_filter.channels, settings->dc_channels.id, settings->dc_channels.count * sizeof(uint64_t));
+    memcpy(s_filter.users, settings->dc_users.id, settings->dc_users.count * sizeof(uint64_t));
+    s_filter_generation = settings->generation;
+}
+
 static void bot_event_handler(void *handler_arg, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     discord_event_data_t *data = (discord_event_data_t *)event_data;
@@ -121,43 +546,31 @@ static void bot_event_handler(void *handler_arg, esp_event_base_t base, int32_t
             discord_session_t *session = (discord_session_t *)data->ptr;
 
             ESP_LOGI(TAG, "Bot %s#%s connected", session->user->username, session->user->discriminator);
+            boot_trace_mark("discord");
         } break;
 
         case DISCORD_EVENT_MESSAGE_RECEIVED: {
             discord_message_t *msg = (discord_message_t *)data->ptr;
 
-            ESP_LOGI(TAG,
-                "New message (dm=%s, autor=%s#%s, bot=%s, channel=%s, guild=%s, content=%s)",
-                !msg->guild_id ? "true" : "false",
-                msg->author->username,
-                msg->author->discriminator,
-                msg->author->bot ? "true" : "false",
-                msg->channel_id,
-                msg->guild_id ? msg->guild_id : "NULL",
-                msg->content);
-            
-            if(msg->content && msg->content[0] == '!') {
-                ESP_LOGI(TAG, "Processing command");
-                dc_bot_parse_command(msg);
+            const settings_t *settings = settings_acquire();
+            if (settings->generation != s_filter_generation) {
+                dc_filter_load(settings);
             }
-            else {
-                ESP_LOGI(TAG, "Not a command, ignoring");
+            settings_release(settings);
+
+            /* Everything but authorised commands stops here, before any
+             * logging or string handling; what passes has an author */
+            dc_filter_result_t verdict = dc_filter_check(&s_filter, msg->content, msg->author && msg->author->bot,
+                                                         msg->guild_id, msg->channel_id,
+                                                         msg->author ? msg->author->id : NULL);
+            s_filter_counts[verdict]++;
+            if (verdict != DC_FILTER_PASS) {
                 break;
             }
-        } break;
-
-        case DISCORD_EVENT_MESSAGE_UPDATED: {
-            discord_message_t *msg = (discord_message_t *)data->ptr;
-            ESP_LOGI(TAG,
-                "%s has updated his message (#%s). New content: %s",
-                msg->author->username,
-                msg->id,
-                msg->content);
-        } break;
 
-        case DISCORD_EVENT_MESSAGE_DELETED: {
-            discord_message_t *msg = (discord_message_t *)data->ptr;
-            ESP_LOGI(TAG, "Message #%s deleted", msg->id);
+            DLOG(DC_COMMAND, msg->author->username, msg->channel_id, msg->content);
+            s_msg_time_us = esp_timer_get_time();
+            dc_bot_parse_command(msg);
         } break;
 
         case DISCORD_EVENT_DISCONNECTED:
@@ -166,13 +579,60 @@ static void bot_event_handler(void *handler_arg, esp_event_base_t base, int32_t
     }
 }
 
+static void dc_bot_login(void)
+{
+    if (atomic_exchange(&s_logged_in, true)) {
+        return;
+    }
+    esp_err_t err = discord_login(bot);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Login failed (%s)", esp_err_to_name(err));
+        atomic_store(&s_logged_in, false);
+    }
+}
+
+/* Follow the uplink: a gateway session cannot outlive the Wi-Fi link, and
+ * letting the client retry on its own while the link is down only burns
+ * heap and reconnect attempts. */
+static void link_event_handler(void *arg, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    if (event_id == LINK_EVENT_SERVICES_READY) {
+        dc_bot_login();
+    } else if (event_id == LINK_EVENT_DOWN && atomic_exchange(&s_logged_in, false)) {
+        ESP_LOGI(TAG, "Uplink lost, closing the gateway session");
+        discord_logout(bot);
+    }
+}
+
 void dc_bot_start(void)
 {
+    /* Guild messages with their content are all the bot reads: no DMs,
+     * reactions or member events are subscribed to */
     discord_config_t cfg = { .intents = DISCORD_INTENT_GUILD_MESSAGES | DISCORD_INTENT_MESSAGE_CONTENT};
 
+    /* Allow-lists that fail to parse come out of settings as the ID 0,
+     * which nobody has: the filter fails closed */
+    const settings_t *settings = settings_acquire();
+    dc_filter_load(settings);
+    settings_release(settings);
+
+    metrics_register_hist(&s_parse_hist);
+    for (int i = 0; i < DC_COMMAND_COUNT; i++) {
+        s_command_hist[i] = (metrics_hist_t) METRICS_HIST_INIT("discord_command_seconds", "Command handler run time");
+        s_command_hist[i].label = "command";
+        s_command_hist[i].label_value = s_dc_command_names[i];
+        metrics_register_hist(&s_command_hist[i]);
+    }
+
     bot = discord_create(&cfg);
-    ESP_ERROR_CHECK(discord_register_events(bot, DISCORD_EVENT_ANY, bot_event_handler, NULL));
-    ESP_ERROR_CHECK(discord_login(bot));
+    ESP_ERROR_CHECK(dc_outbox_start(bot));
+    /* Edits and deletions are not registered: they carry no commands */
+    ESP_ERROR_CHECK(discord_register_events(bot, DISCORD_EVENT_CONNECTED, bot_event_handler, NULL));
+    ESP_ERROR_CHECK(discord_register_events(bot, DISCORD_EVENT_MESSAGE_RECEIVED, bot_event_handler, NULL));
+    ESP_ERROR_CHECK(discord_register_events(bot, DISCORD_EVENT_DISCONNECTED, bot_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(LINK_EVENT, ESP_EVENT_ANY_ID, link_event_handler, NULL, NULL));
+    // The link may have come up before the handler was registered
+    if (link_supervisor_is_up()) {
+        dc_bot_login();
+    }
 }
-
-
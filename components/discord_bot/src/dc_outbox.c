@@ -0,0 +1,329 @@
+#include "dc_outbox.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dlog.h"
+#include "metrics.h"
+
+static const char *TAG = "discord-outbox";
+
+#define OUTBOX_SLOTS        CONFIG_DC_OUTBOX_SLOTS
+#define OUTBOX_MSG_MAX      DC_OUTBOX_MSG_MAX
+#define ROUTE_BURST         CONFIG_DC_RATE_LIMIT_BURST
+#define ROUTE_REFILL_US     ((int64_t)CONFIG_DC_RATE_LIMIT_REFILL_MS * 1000)
+#define RETRY_BASE_US       (1000 * 1000)
+
+typedef struct {
+    bool used;
+    uint8_t attempts;
+    uint32_t seq;               /* FIFO order among slots */
+    int64_t enqueued_us;
+    int64_t not_before_us;      /* retry backoff */
+    dc_outbox_sent_cb_t cb;
+    void *ctx;
+    char channel_id[DC_SNOWFLAKE_MAX];
+    size_t len;
+    char content[OUTBOX_MSG_MAX];
+} dc_outbox_slot_t;
+
+/* Token bucket of the per-channel "create message" route */
+typedef struct {
+    char channel_id[DC_SNOWFLAKE_MAX];
+    int tokens;
+    int64_t refilled_us;
+    int64_t last_used_us;
+} dc_route_bucket_t;
+
+static discord_handle_t s_bot;
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_lock = NULL;
+static dc_outbox_slot_t s_slots[OUTBOX_SLOTS];
+static dc_route_bucket_t s_routes[OUTBOX_SLOTS];
+static uint32_t s_next_seq = 0;
+static dc_outbox_stats_t s_stats;
+/* Message being sent, owned by the outbox task */
+static dc_outbox_slot_t s_sending;
+
+static metrics_hist_t s_send_hist = METRICS_HIST_INIT("discord_send_seconds", "discord_message_send() round trip");
+static metrics_counter_t s_send_failures = METRICS_COUNTER_INIT("discord_send_failures_total",
+                                                                "Failed sends, retried or dropped");
+
+/* The API refused the send with a 429. The host library in tools/dc_host
+ * says so; esp-discord folds a 429 into ESP_ERR_INVALID_RESPONSE with every
+ * other refusal, so there those count as rate limiting too. Timeouts and
+ * transport errors never do. */
+static inline bool send_rate_limited(esp_err_t err)
+{
+#ifdef DISCORD_ERR_RATE_LIMITED
+    return err == DISCORD_ERR_RATE_LIMITED;
+#else
+    return err == ESP_ERR_INVALID_RESPONSE;
+#endif
+}
+
+/* Another message to the same channel is ahead in line */
+static bool outbox_has_older(const dc_outbox_slot_t *slot)
+{
+    for (int i = 0; i < OUTBOX_SLOTS; i++) {
+        const dc_outbox_slot_t *other = &s_slots[i];
+        if (other->used && other->seq < slot->seq && strcmp(other->channel_id, slot->channel_id) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static dc_route_bucket_t *route_get(const char *channel_id, int64_t now)
+{
+    dc_route_bucket_t *lru = &s_routes[0];
+    for (int i = 0; i < OUTBOX_SLOTS; i++) {
+        if (strcmp(s_routes[i].channel_id, channel_id) == 0) {
+            return &s_routes[i];
+        }
+        if (s_routes[i].last_used_us < lru->last_used_us) {
+            lru = &s_routes[i];
+        }
+    }
+
+    strlcpy(lru->channel_id, channel_id, sizeof(lru->channel_id));
+    lru->tokens = ROUTE_BURST;
+    lru->refilled_us = now;
+    lru->last_used_us = now;
+    return lru;
+}
+
+/* Refill the bucket, returns when the next token is due (now if one is available) */
+static int64_t route_ready_at(dc_route_bucket_t *route, int64_t now)
+{
+    int64_t elapsed = now - route->refilled_us;
+    if (elapsed >= ROUTE_REFILL_US) {
+        int64_t add = elapsed / ROUTE_REFILL_US;
+        route->tokens = route->tokens + add >= ROUTE_BURST ? ROUTE_BURST : route->tokens + add;
+        route->refilled_us = route->tokens == ROUTE_BURST ? now : route->refilled_us + add * ROUTE_REFILL_US;
+    }
+    return route->tokens > 0 ? now : route->refilled_us + ROUTE_REFILL_US;
+}
+
+/* Pick the oldest message whose route has a token; returns false and the
+ * time of the next possible send when nothing can go out yet. Only the
+ * oldest message of a channel is a candidate, so a reply backing off after
+ * a failed send is not overtaken by the ones behind it. */
+static bool outbox_take_ready(int64_t now, int64_t *wake_at)
+{
+    dc_outbox_slot_t *best = NULL;
+    dc_route_bucket_t *best_route = NULL;
+    *wake_at = INT64_MAX;
+
+    for (int i = 0; i < OUTBOX_SLOTS; i++) {
+        dc_outbox_slot_t *slot = &s_slots[i];
+        if (!slot->used || outbox_has_older(slot)) {
+            continue;
+        }
+        dc_route_bucket_t *route = route_get(slot->channel_id, now);
+        int64_t ready_at = route_ready_at(route, now);
+        if (slot->not_before_us > ready_at) {
+            ready_at = slot->not_before_us;
+        }
+        if (ready_at > now) {
+            *wake_at = ready_at < *wake_at ? ready_at : *wake_at;
+        } else if (!best || slot->seq < best->seq) {
+            best = slot;
+            best_route = route;
+        }
+    }
+    if (!best) {
+        return false;
+    }
+
+    best_route->tokens--;
+    best_route->last_used_us = now;
+    s_sending = *best;
+    best->used = false;
+    s_stats.depth--;
+    return true;
+}
+
+/* Put a failed message back with exponential backoff, keeping its place in line */
+static bool outbox_requeue(const dc_outbox_slot_t *msg, int64_t now)
+{
+    for (int i = 0; i < OUTBOX_SLOTS; i++) {
+        if (!s_slots[i].used) {
+            s_slots[i] = *msg;
+            s_slots[i].not_before_us = now + (RETRY_BASE_US << (msg->attempts - 1));
+            s_stats.depth++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void dc_outbox_task(void *arg)
+{
+    for (;;) {
+        int64_t now = esp_timer_get_time();
+        int64_t wake_at;
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool ready = outbox_take_ready(now, &wake_at);
+        xSemaphoreGive(s_lock);
+
+        if (!ready) {
+            TickType_t wait = wake_at == INT64_MAX ? portMAX_DELAY : pdMS_TO_TICKS((wake_at - now) / 1000) + 1;
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+
+        /* Only ask the API for the created message if somebody needs it */
+        discord_message_t msg = { .content = s_sending.content, .channel_id = s_sending.channel_id };
+        discord_message_t *sent = NULL;
+        int64_t start = esp_timer_get_time();
+        esp_err_t err = discord_message_send(s_bot, &msg, s_sending.cb ? &sent : NULL);
+        int64_t end = esp_timer_get_time();
+        metrics_observe_us(&s_send_hist, end - start);
+        if (err != ESP_OK) {
+            metrics_inc(&s_send_failures);
+        }
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        uint32_t api_us = end - start;
+        s_stats.total_api_us += api_us;
+        s_stats.max_api_us = api_us > s_stats.max_api_us ? api_us : s_stats.max_api_us;
+        if (err == ESP_OK) {
+            uint32_t latency_us = end - s_sending.enqueued_us;
+            s_stats.sent++;
+            s_stats.total_latency_us += latency_us;
+            s_stats.max_latency_us = latency_us > s_stats.max_latency_us ? latency_us : s_stats.max_latency_us;
+        } else {
+            /* Back off this message; a 429 also empties the route bucket */
+            if (send_rate_limited(err)) {
+                dc_route_bucket_t *route = route_get(s_sending.channel_id, end);
+                route->tokens = 0;
+                route->refilled_us = end;
+                s_stats.rate_limited++;
+            }
+            s_sending.attempts++;
+            if (s_sending.attempts <= CONFIG_DC_SEND_MAX_RETRIES && outbox_requeue(&s_sending, end)) {
+                s_stats.retries++;
+                xSemaphoreGive(s_lock);
+                DLOG(DC_SEND_RETRY, esp_err_to_name(err), s_sending.attempts);
+                continue;
+            }
+            s_stats.dropped++;
+        }
+        xSemaphoreGive(s_lock);
+
+        if (err != ESP_OK) {
+            DLOG(DC_SEND_FAILED, esp_err_to_name(err));
+        }
+        if (s_sending.cb) {
+            s_sending.cb(err, sent, s_sending.ctx);
+        }
+        if (sent) {
+            discord_message_free(sent);
+        }
+    }
+}
+
+esp_err_t dc_outbox_start(discord_handle_t bot)
+{
+    if (s_task) {
+        return ESP_OK;
+    }
+
+    s_bot = bot;
+    metrics_register_hist(&s_send_hist);
+    metrics_register_counter(&s_send_failures);
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(dc_outbox_task, "dc_outbox", 4096, NULL, 3, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create outbox task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t dc_outbox_post_ex(const char *channel_id, const char *content, dc_outbox_sent_cb_t cb, void *ctx)
+{
+    if (!s_task) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    size_t len = strnlen(content, OUTBOX_MSG_MAX - 1);
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    /* Merge into the last reply waiting for the same channel; an earlier
+     * one would carry this reply ahead of the ones in between */
+    dc_outbox_slot_t *last = NULL;
+    for (int i = 0; i < OUTBOX_SLOTS && !cb; i++) {
+        dc_outbox_slot_t *slot = &s_slots[i];
+        if (slot->used && strcmp(slot->channel_id, channel_id) == 0 && (!last || slot->seq > last->seq)) {
+            last = slot;
+        }
+    }
+    if (last && !last->cb && last->len + 1 + len < OUTBOX_MSG_MAX) {
+        last->content[last->len++] = '\n';
+        memcpy(last->content + last->len, content, len);
+        last->len += len;
+        last->content[last->len] = '\0';
+        s_stats.merged++;
+        xSemaphoreGive(s_lock);
+        return ESP_OK;
+    }
+
+    dc_outbox_slot_t *slot = NULL;
+    for (int i = 0; i < OUTBOX_SLOTS && !slot; i++) {
+        if (!s_slots[i].used) {
+            slot = &s_slots[i];
+        }
+    }
+    if (slot) {
+        slot->used = true;
+        slot->attempts = 0;
+        slot->seq = s_next_seq++;
+        slot->enqueued_us = esp_timer_get_time();
+        slot->not_before_us = 0;
+        slot->cb = cb;
+        slot->ctx = ctx;
+        strlcpy(slot->channel_id, channel_id, sizeof(slot->channel_id));
+        memcpy(slot->content, content, len);
+        slot->content[len] = '\0';
+        slot->len = len;
+        s_stats.depth++;
+        s_stats.max_depth = s_stats.depth > s_stats.max_depth ? s_stats.depth : s_stats.max_depth;
+    } else {
+        s_stats.dropped++;
+        err = ESP_ERR_NO_MEM;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (err == ESP_OK) {
+        xTaskNotifyGive(s_task);
+    } else {
+        DLOG(DC_OUTBOX_FULL);
+    }
+    return err;
+}
+
+esp_err_t dc_outbox_post(const char *channel_id, const char *content)
+{
+    return dc_outbox_post_ex(channel_id, content, NULL, NULL);
+}
+
+void dc_outbox_get_stats(dc_outbox_stats_t *out)
+{
+    if (!s_lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    *out = s_stats;
+    xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,45 @@
+#ifndef DC_OUTBOX
+#define DC_OUTBOX
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "discord.h"
+#include "discord/message.h"
+
+/* Snowflake IDs are at most 20 decimal digits */
+#define DC_SNOWFLAKE_MAX 24
+/* Size of every outbox slot: Discord rejects messages longer than 2000
+ * characters, so no reply needs more */
+#define DC_OUTBOX_MSG_MAX 2000
+
+/* Called on the outbox task once a message has been sent (or dropped).
+ * sent is only valid during the call and is NULL on failure. */
+typedef void (*dc_outbox_sent_cb_t)(esp_err_t result, const discord_message_t *sent, void *ctx);
+
+typedef struct {
+    uint32_t depth;             /* messages currently waiting */
+    uint32_t max_depth;
+    uint32_t sent;
+    uint32_t merged;            /* replies coalesced into a waiting message */
+    uint32_t retries;
+    uint32_t rate_limited;      /* sends refused with a 429 */
+    uint32_t dropped;           /* outbox full or out of retries */
+    uint64_t total_latency_us;  /* enqueue to sent, including rate-limit waits */
+    uint32_t max_latency_us;
+    uint64_t total_api_us;      /* discord_message_send round trips */
+    uint32_t max_api_us;
+} dc_outbox_stats_t;
+
+esp_err_t dc_outbox_start(discord_handle_t bot);
+
+/* Copy content into the outbox without waiting on the Discord API.
+ * Safe to call from any task. */
+esp_err_t dc_outbox_post(const char *channel_id, const char *content);
+
+/* Like dc_outbox_post(), for callers that need the created message.
+ * Such messages are never merged with others. */
+esp_err_t dc_outbox_post_ex(const char *channel_id, const char *content, dc_outbox_sent_cb_t cb, void *ctx);
+
+void dc_outbox_get_stats(dc_outbox_stats_t *out);
+
+#endif /* DC_OUTBOX */
@@ -0,0 +1,48 @@
+#ifndef DC_FILTER
+#define DC_FILTER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Entries per allow-list */
+#define DC_FILTER_MAX_IDS 8
+
+/* Why a message was let through or dropped, in the order of the checks */
+typedef enum {
+    DC_FILTER_PASS = 0,
+    DC_FILTER_DROP_PREFIX,      /* not a command */
+    DC_FILTER_DROP_BOT,         /* sent by a bot, including ourselves */
+    DC_FILTER_DROP_GUILD,
+    DC_FILTER_DROP_CHANNEL,
+    DC_FILTER_DROP_AUTHOR,      /* not allowed, or no author at all */
+    DC_FILTER_RESULT_MAX,
+} dc_filter_result_t;
+
+/* Allow-lists of snowflake IDs; an empty list allows everything */
+typedef struct {
+    char prefix;
+    uint8_t guild_count;
+    uint8_t channel_count;
+    uint8_t user_count;
+    uint64_t guilds[DC_FILTER_MAX_IDS];
+    uint64_t channels[DC_FILTER_MAX_IDS];
+    uint64_t users[DC_FILTER_MAX_IDS];
+} dc_filter_t;
+
+/* Parse the allow-lists, IDs separated by commas or blanks. Returns
+ * ESP_ERR_INVALID_ARG for anything that is not an ID and
+ * ESP_ERR_INVALID_SIZE for more than DC_FILTER_MAX_IDS in a list. */
+esp_err_t dc_filter_init(dc_filter_t *filter, char prefix, const char *guilds, const char *channels,
+                         const char *users);
+
+/* Decide on a received message before anything else looks at it. Touches
+ * the first byte of the content and, only past the cheap checks, the IDs;
+ * nothing is copied, allocated or logged. guild_id is NULL for DMs;
+ * author_id NULL, for webhook and system messages, is always dropped. */
+dc_filter_result_t dc_filter_check(const dc_filter_t *filter, const char *content, bool from_bot,
+                                   const char *guild_id, const char *channel_id, const char *author_id);
+
+const char *dc_filter_result_to_str(dc_filter_result_t result);
+
+#endif /* DC_FILTER */
@@ -0,0 +1,113 @@
+#include "dc_filter.h"
+
+#include <string.h>
+
+static const char *const s_result_names[DC_FILTER_RESULT_MAX] = {
+    [DC_FILTER_PASS] = "pass",
+    [DC_FILTER_DROP_PREFIX] = "prefix",
+    [DC_FILTER_DROP_BOT] = "bot",
+    [DC_FILTER_DROP_GUILD] = "guild",
+    [DC_FILTER_DROP_CHANNEL] = "channel",
+    [DC_FILTER_DROP_AUTHOR] = "author",
+};
+
+/* Snowflake to integer, 0 for NULL or anything that is not all digits */
+static uint64_t snowflake(const char *id)
+{
+    uint64_t value = 0;
+    if (!id || !*id) {
+        return 0;
+    }
+    for (; *id; id++) {
+        if (*id < '0' || *id > '9') {
+            return 0;
+        }
+        value = value * 10 + (uint64_t)(*id - '0');
+    }
+    return value;
+}
+
+static esp_err_t parse_list(const char *text, uint64_t *ids, uint8_t *count)
+{
+    *count = 0;
+    if (!text) {
+        return ESP_OK;
+    }
+    while (*text) {
+        size_t len = strcspn(text, ", \t");
+        if (len > 0) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < len; i++) {
+                if (text[i] < '0' || text[i] > '9' || i >= 20) {
+                    return ESP_ERR_INVALID_ARG;
+                }
+                value = value * 10 + (uint64_t)(text[i] - '0');
+            }
+            if (*count == DC_FILTER_MAX_IDS) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            ids[(*count)++] = value;
+        }
+        text += len;
+        text += *text ? 1 : 0;
+    }
+    return ESP_OK;
+}
+
+static bool allowed(const uint64_t *ids, uint8_t count, const char *id)
+{
+    if (count == 0) {
+        return true;
+    }
+    uint64_t value = snowflake(id);
+    for (uint8_t i = 0; i < count; i++) {
+        if (ids[i] == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t dc_filter_init(dc_filter_t *filter, char prefix, const char *guilds, const char *channels,
+                         const char *users)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->prefix = prefix;
+
+    esp_err_t err = parse_list(guilds, filter->guilds, &filter->guild_count);
+    if (err == ESP_OK) {
+        err = parse_list(channels, filter->channels, &filter->channel_count);
+    }
+    if (err == ESP_OK) {
+        err = parse_list(users, filter->users, &filter->user_count);
+    }
+    return err;
+}
+
+dc_filter_result_t dc_filter_check(const dc_filter_t *filter, const char *content, bool from_bot,
+                                   const char *guild_id, const char *channel_id, const char *author_id)
+{
+    /* Nearly all traffic is chatter: the prefix byte settles it */
+    if (!content || content[0] != filter->prefix) {
+        return DC_FILTER_DROP_PREFIX;
+    }
+    if (from_bot) {
+        return DC_FILTER_DROP_BOT;
+    }
+    if (!allowed(filter->guilds, filter->guild_count, guild_id)) {
+        return DC_FILTER_DROP_GUILD;
+    }
+    if (!allowed(filter->channels, filter->channel_count, channel_id)) {
+        return DC_FILTER_DROP_CHANNEL;
+    }
+    /* Webhook and system messages have no author to answer to */
+    if (!author_id || !allowed(filter->users, filter->user_count, author_id)) {
+        return DC_FILTER_DROP_AUTHOR;
+    }
+    return DC_FILTER_PASS;
+}
+
+const char *dc_filter_result_to_str(dc_filter_result_t result)
+{
+    return result < DC_FILTER_RESULT_MAX ? s_result_names[result] : "unknown";
+}
@@ -0,0 +1,83 @@
+#ifndef DEFERRED_LOG
+#define DEFERRED_LOG
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "dlog_messages.h"
+
+/* Logging for latency-critical paths. A message is declared once in
+ * components/dlog/messages.def and logged with DLOG(name, args...).
+ *
+ * With CONFIG_DLOG_DEFERRED the call stores the message ID, a timestamp and
+ * the raw arguments in a lock-free ring of the calling core and returns; a
+ * low-priority task renders the records on the console later. With
+ * CONFIG_DLOG_STRIP_FORMATS the format strings are left out of the image and
+ * the task prints the records as "#DL <base64>" lines for
+ * tools/dlog_decode.py. Without CONFIG_DLOG_DEFERRED, DLOG() is a plain
+ * ESP_LOG call. Formats are checked against the arguments in every mode. */
+
+#define DLOG_MAX_ARGS   4
+/* Room for the string arguments of one record */
+#define DLOG_TEXT_MAX   68
+
+typedef struct {
+    uint32_t written;           /* records stored by DLOG() */
+    uint32_t dropped;           /* records lost because the ring was full */
+    uint32_t rendered;          /* records handed to the console */
+} dlog_stats_t;
+
+/* Start the render task. Records written earlier are kept and rendered. */
+esp_err_t dlog_start(void);
+
+/* Render every pending record from the calling task, e.g. before a restart */
+void dlog_flush(void);
+
+void dlog_get_stats(dlog_stats_t *stats);
+
+#if CONFIG_DLOG_DEFERRED
+
+typedef struct {
+    uint32_t value;
+    const char *str;            /* set for string arguments */
+} dlog_arg_t;
+
+void dlog_write(dlog_id_t id, const dlog_arg_t *args, size_t nargs);
+
+static inline __attribute__((format(printf, 1, 2))) void dlog_check_format(const char *format, ...)
+{
+}
+
+#define DLOG_ARG(x) _Generic((x),                                           \
+    char *: (dlog_arg_t){ .str = (const char *)(uintptr_t)(x) },            \
+    const char *: (dlog_arg_t){ .str = (const char *)(uintptr_t)(x) },      \
+    default: (dlog_arg_t){ .value = (uint32_t)(uintptr_t)(x) })
+
+#define DLOG_ARGS_0() NULL, 0
+#define DLOG_ARGS_1(a) (const dlog_arg_t[]){ DLOG_ARG(a) }, 1
+#define DLOG_ARGS_2(a, b) (const dlog_arg_t[]){ DLOG_ARG(a), DLOG_ARG(b) }, 2
+#define DLOG_ARGS_3(a, b, c) (const dlog_arg_t[]){ DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c) }, 3
+#define DLOG_ARGS_4(a, b, c, d) (const dlog_arg_t[]){ DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c), DLOG_ARG(d) }, 4
+#define DLOG_ARGS_PICK(_0, _1, _2, _3, _4, pick, ...) pick
+#define DLOG_ARGS(...) \
+    DLOG_ARGS_PICK(_0, ##__VA_ARGS__, DLOG_ARGS_4, DLOG_ARGS_3, DLOG_ARGS_2, DLOG_ARGS_1, DLOG_ARGS_0)(__VA_ARGS__)
+
+/* The format only feeds the compile-time check and is never emitted */
+#define DLOG(name, ...) do {                                                \
+        if (LOG_LOCAL_LEVEL >= DLOG_LEVEL_##name) {                         \
+            if (0) {                                                        \
+                dlog_check_format(DLOG_FMT_##name, ##__VA_ARGS__);          \
+            }                                                               \
+            dlog_write(DLOG_ID_##name, DLOG_ARGS(__VA_ARGS__));             \
+        }                                                                   \
+    } while (0)
+
+#else
+
+#define DLOG(name, ...) \
+    ESP_LOG_LEVEL_LOCAL(DLOG_LEVEL_##name, DLOG_TAG_##name, DLOG_FMT_##name, ##__VA_ARGS__)
+
+#endif /* CONFIG_DLOG_DEFERRED */
+
+#endif /* DEFERRED_LOG */
@@ -0,0 +1,347 @@
+#include "dlog.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "dlog";
+
+#if CONFIG_DLOG_DEFERRED
+
+#define DLOG_RING_SIZE          CONFIG_DLOG_RING_SIZE
+#define DLOG_RING_MASK          (DLOG_RING_SIZE - 1)
+#define DLOG_FLUSH_INTERVAL     pdMS_TO_TICKS(CONFIG_DLOG_FLUSH_INTERVAL_MS)
+/* Longest rendered message, longer ones are cut */
+#define DLOG_LINE_MAX           192
+
+#if CONFIG_IDF_TARGET_LINUX
+#define DLOG_CORES              1
+#define DLOG_CORE_ID()          0
+#else
+#define DLOG_CORES              portNUM_PROCESSORS
+#define DLOG_CORE_ID()          xPortGetCoreID()
+#endif
+
+_Static_assert((DLOG_RING_SIZE & DLOG_RING_MASK) == 0, "DLOG_RING_SIZE must be a power of two");
+_Static_assert(DLOG_MESSAGE_COUNT <= UINT16_MAX, "message IDs are stored in 16 bits");
+_Static_assert(DLOG_TEXT_MAX < 256, "string lengths are stored in 8 bits");
+
+/* The record is also the wire format of the stripped mode: the 8-byte
+ * header, the nargs arguments and the text_len text bytes, little-endian. */
+typedef struct {
+    uint32_t timestamp;         /* esp_log_timestamp() */
+    uint16_t id;
+    uint8_t nargs;
+    uint8_t text_len;
+    uint32_t args[DLOG_MAX_ARGS];   /* strings: offset << 8 | length in text */
+    char text[DLOG_TEXT_MAX];
+} dlog_record_t;
+
+#define DLOG_HEADER_SIZE        offsetof(dlog_record_t, args)
+
+_Static_assert(DLOG_HEADER_SIZE == 8, "the decoder expects an 8-byte header");
+
+typedef struct {
+    esp_log_level_t level;
+    const char *tag;
+    const char *format;         /* NULL when stripped */
+} dlog_message_t;
+
+#if CONFIG_DLOG_STRIP_FORMATS
+#define DLOG_MESSAGE(name) [DLOG_ID_##name] = { DLOG_LEVEL_##name, DLOG_TAG_##name, NULL },
+#else
+#define DLOG_MESSAGE(name) [DLOG_ID_##name] = { DLOG_LEVEL_##name, DLOG_TAG_##name, DLOG_FMT_##name },
+#endif
+
+static const dlog_message_t s_messages[DLOG_MESSAGE_COUNT] = {
+    DLOG_FOR_EACH_MESSAGE(DLOG_MESSAGE)
+};
+
+/* One bounded multi-producer ring per core, the same scheme as the access
+ * log: a slot is free for the producer at position pos when turn + index
+ * == pos and full for the consumer when turn + index == pos + 1, which
+ * makes the zero-initialised ring valid before dlog_start(). A task that
+ * moves to the other core halfway through a write is still safe; the rings
+ * are per core only so that the cores do not contend for one head. */
+typedef struct {
+    atomic_uint_least32_t turn;
+    dlog_record_t rec;
+} dlog_slot_t;
+
+typedef struct {
+    dlog_slot_t slots[DLOG_RING_SIZE];
+    atomic_uint_least32_t head;
+    atomic_uint_least32_t tail;     /* written by the consumer only */
+} dlog_ring_t;
+
+static dlog_ring_t s_rings[DLOG_CORES];
+static atomic_uint_least32_t s_written;
+static atomic_uint_least32_t s_dropped;
+static atomic_uint_least32_t s_rendered;
+static TaskHandle_t s_task = NULL;
+/* Serialises the consumers: the render task and dlog_flush() */
+static SemaphoreHandle_t s_drain_lock = NULL;
+static StaticSemaphore_t s_drain_lock_buf;
+
+void dlog_write(dlog_id_t id, const dlog_arg_t *args, size_t nargs)
+{
+    dlog_ring_t *ring = &s_rings[DLOG_CORE_ID()];
+    uint32_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    dlog_slot_t *slot;
+
+    for (;;) {
+        slot = &ring->slots[pos & DLOG_RING_MASK];
+        uint32_t turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+        int32_t diff = (int32_t)(turn + (pos & DLOG_RING_MASK) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit(&s_dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    dlog_record_t *rec = &slot->rec;
+    size_t used = 0;
+    rec->timestamp = esp_log_timestamp();
+    rec->id = id;
+    rec->nargs = nargs;
+    for (size_t i = 0; i < nargs; i++) {
+        if (!args[i].str) {
+            rec->args[i] = args[i].value;
+            continue;
+        }
+        size_t len = strnlen(args[i].str, DLOG_TEXT_MAX - used);
+        memcpy(rec->text + used, args[i].str, len);
+        rec->args[i] = (uint32_t)used << 8 | len;
+        used += len;
+    }
+    rec->text_len = used;
+    atomic_store_explicit(&slot->turn, pos + 1 - (pos & DLOG_RING_MASK), memory_order_release);
+    atomic_fetch_add_explicit(&s_written, 1, memory_order_relaxed);
+
+    /* The task renders on a timer; wake it early only when the ring fills
+     * up, so most writes cost no scheduler call */
+    TaskHandle_t task = s_task;
+    if (task && pos - atomic_load_explicit(&ring->tail, memory_order_relaxed) == DLOG_RING_SIZE / 2) {
+        xTaskNotifyGive(task);
+    }
+}
+
+static bool ring_pop(dlog_ring_t *ring, dlog_record_t *out)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    dlog_slot_t *slot = &ring->slots[tail & DLOG_RING_MASK];
+    uint32_t turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+    if (turn + (tail & DLOG_RING_MASK) != tail + 1) {
+        return false;
+    }
+    *out = slot->rec;
+    atomic_store_explicit(&slot->turn, tail + DLOG_RING_SIZE - (tail & DLOG_RING_MASK), memory_order_release);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_relaxed);
+    return true;
+}
+
+#if CONFIG_DLOG_STRIP_FORMATS
+
+static void base64_encode(const uint8_t *in, size_t len, char *out)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        v |= i + 1 < len ? (uint32_t)in[i + 1] << 8 : 0;
+        v |= i + 2 < len ? in[i + 2] : 0;
+        *out++ = alphabet[v >> 18];
+        *out++ = alphabet[(v >> 12) & 0x3F];
+        *out++ = i + 1 < len ? alphabet[(v >> 6) & 0x3F] : '=';
+        *out++ = i + 2 < len ? alphabet[v & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+/* The format is not in the image: hand the record to the host decoder */
+static void render(const dlog_message_t *msg, const dlog_record_t *rec)
+{
+    uint8_t frame[sizeof(dlog_record_t)];
+    char line[4 * ((sizeof(frame) + 2) / 3) + 1];
+    size_t len = DLOG_HEADER_SIZE;
+
+    memcpy(frame, rec, DLOG_HEADER_SIZE);
+    memcpy(frame + len, rec->args, rec->nargs * sizeof(uint32_t));
+    len += rec->nargs * sizeof(uint32_t);
+    memcpy(frame + len, rec->text, rec->text_len);
+    len += rec->text_len;
+    base64_encode(frame, len, line);
+    esp_log_write(msg->level, msg->tag, "#DL %s\n", line);
+}
+
+#else
+
+/* printf for the stored arguments: copies each conversion without its
+ * length modifier and formats the 32-bit value or string it refers to */
+static void format_record(const char *format, const dlog_record_t *rec, char *out, size_t len)
+{
+    size_t n = 0;
+    size_t arg = 0;
+
+    while (*format && n + 1 < len) {
+        if (*format != '%') {
+            out[n++] = *format++;
+            continue;
+        }
+        if (format[1] == '%') {
+            out[n++] = '%';
+            format += 2;
+            continue;
+        }
+
+        char spec[16];
+        size_t s = 0;
+        spec[s++] = *format++;
+        while (*format && strchr("-+ #0123456789.", *format) && s < sizeof(spec) - 2) {
+            spec[s++] = *format++;
+        }
+        while (*format == 'h' || *format == 'l') {
+            format++;
+        }
+        if (!*format) {
+            break;
+        }
+        char conv = *format++;
+        spec[s++] = conv;
+        spec[s] = '\0';
+
+        uint32_t value = arg < rec->nargs ? rec->args[arg] : 0;
+        arg++;
+        int written;
+        if (conv == 's') {
+            char text[DLOG_TEXT_MAX + 1];
+            size_t offset = value >> 8;
+            size_t text_len = value & 0xFF;
+            if (offset + text_len > rec->text_len) {
+                text_len = 0;
+            }
+            memcpy(text, rec->text + offset, text_len);
+            text[text_len] = '\0';
+            written = snprintf(out + n, len - n, spec, text);
+        } else if (conv == 'd' || conv == 'i') {
+            written = snprintf(out + n, len - n, spec, (int)(int32_t)value);
+        } else {
+            written = snprintf(out + n, len - n, spec, (unsigned)value);
+        }
+        if (written > 0) {
+            n += (size_t)written < len - n ? (size_t)written : len - n - 1;
+        }
+    }
+    out[n] = '\0';
+}
+
+/* Same line as ESP_LOGx, with the time the record was written */
+static void render(const dlog_message_t *msg, const dlog_record_t *rec)
+{
+    static const char letters[] = "NEWIDV";
+    static const char *const colors[] = { "", LOG_COLOR_E, LOG_COLOR_W, LOG_COLOR_I, LOG_COLOR_D, LOG_COLOR_V };
+    char line[DLOG_LINE_MAX];
+
+    format_record(msg->format, rec, line, sizeof(line));
+    esp_log_write(msg->level, msg->tag, "%s%c (%" PRIu32 ") %s: %s" LOG_RESET_COLOR "\n",
+                  colors[msg->level], letters[msg->level], rec->timestamp, msg->tag, line);
+}
+
+#endif /* CONFIG_DLOG_STRIP_FORMATS */
+
+static void drain(void)
+{
+    dlog_record_t rec;
+
+    for (int core = 0; core < DLOG_CORES; core++) {
+        while (ring_pop(&s_rings[core], &rec)) {
+            if (rec.id < DLOG_MESSAGE_COUNT) {
+                render(&s_messages[rec.id], &rec);
+            }
+            atomic_fetch_add_explicit(&s_rendered, 1, memory_order_relaxed);
+        }
+    }
+}
+
+static void dlog_task(void *arg)
+{
+    uint32_t reported_drops = 0;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, DLOG_FLUSH_INTERVAL);
+
+        xSemaphoreTake(s_drain_lock, portMAX_DELAY);
+        drain();
+        xSemaphoreGive(s_drain_lock);
+
+        uint32_t dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+        if (dropped != reported_drops) {
+            ESP_LOGW(TAG, "%" PRIu32 " records dropped, ring full", dropped - reported_drops);
+            reported_drops = dropped;
+        }
+    }
+}
+
+esp_err_t dlog_start(void)
+{
+    if (s_task) {
+        return ESP_OK;
+    }
+
+    s_drain_lock = xSemaphoreCreateMutexStatic(&s_drain_lock_buf);
+#if CONFIG_DLOG_STRIP_FORMATS
+    ESP_LOGI(TAG, "#DL catalogue %08" PRIx32, (uint32_t)DLOG_CATALOGUE_ID);
+#endif
+    if (xTaskCreate(dlog_task, "dlog", 3072, NULL, tskIDLE_PRIORITY + 1, &s_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void dlog_flush(void)
+{
+    if (!s_drain_lock) {
+        return;
+    }
+    xSemaphoreTake(s_drain_lock, portMAX_DELAY);
+    drain();
+    xSemaphoreGive(s_drain_lock);
+}
+
+void dlog_get_stats(dlog_stats_t *stats)
+{
+    stats->written = atomic_load_explicit(&s_written, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&s_dropped, memory_order_relaxed);
+    stats->rendered = atomic_load_explicit(&s_rendered, memory_order_relaxed);
+}
+
+#else
+
+/* DLOG() logs directly, there is nothing to render */
+esp_err_t dlog_start(void)
+{
+    ESP_LOGD(TAG, "Deferred logging disabled");
+    return ESP_OK;
+}
+
+void dlog_flush(void)
+{
+}
+
+void dlog_get_stats(dlog_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif /* CONFIG_DLOG_DEFERRED */
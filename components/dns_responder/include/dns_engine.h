@@ -0,0 +1,96 @@
+#ifndef DNS_ENGINE
+#define DNS_ENGINE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+/* Plain UDP DNS: longer answers are truncated by the upstream anyway */
+#define DNS_MSG_MAX         512
+/* Names longer than this are forwarded but not cached */
+#define DNS_NAME_MAX        96
+/* Answers larger than this are relayed but not cached */
+#define DNS_CACHE_MSG_MAX   256
+/* Header and question of the longest valid query */
+#define DNS_QUERY_HEAD_MAX  (12 + 255 + 4)
+#define DNS_CACHE_ENTRIES   CONFIG_DNS_CACHE_ENTRIES
+
+#define DNS_TYPE_A          1
+#define DNS_TYPE_AAAA       28
+#define DNS_TYPE_ANY        255
+#define DNS_RCODE_SERVFAIL  2
+
+typedef struct {
+    uint16_t id;
+    uint16_t flags;
+    uint16_t qtype;
+    uint16_t qclass;
+    size_t end;                 /* offset just past the question */
+    char name[DNS_NAME_MAX];    /* lower case, no trailing dot */
+    bool name_fits;
+} dns_question_t;
+
+/* What the engine made of a query, in the order of the checks */
+typedef enum {
+    DNS_VERDICT_LOCAL = 0,      /* own hostname or captive-portal probe, answered from the table */
+    DNS_VERDICT_CACHED,         /* answered from the cache */
+    DNS_VERDICT_FORWARD,        /* to be sent upstream */
+    DNS_VERDICT_INVALID,        /* not a single-question query, dropped */
+    DNS_VERDICT_MAX,
+} dns_verdict_t;
+
+typedef struct {
+    bool used;
+    uint16_t qtype;
+    uint16_t len;
+    int64_t stored_us;
+    int64_t expires_us;
+    int64_t used_us;
+    char name[DNS_NAME_MAX];
+    uint8_t msg[DNS_CACHE_MSG_MAX];
+} dns_cache_entry_t;
+
+typedef struct {
+    uint32_t ip;                /* IPv4 address local names resolve to, network order */
+    const char *hostname;       /* answered as is and with .local */
+    bool captive;               /* answer captive-portal probe domains with ip */
+    uint32_t local_ttl_s;
+    uint32_t cache_ttl_max_s;   /* upstream TTLs are cut down to this */
+    uint32_t stale_s;           /* how long past expiry an answer may stand in for a dead upstream */
+} dns_engine_config_t;
+
+/* Static table and answer cache. Not thread-safe and never blocks: use it
+ * from one task, with the time passed in, so the same code runs on the
+ * device and in the host benchmark. */
+typedef struct {
+    dns_engine_config_t config;
+    dns_cache_entry_t cache[DNS_CACHE_ENTRIES];
+    uint32_t counts[DNS_VERDICT_MAX];
+} dns_engine_t;
+
+void dns_engine_init(dns_engine_t *engine, const dns_engine_config_t *config);
+
+/* Parse the header and single question of a message, query or answer */
+bool dns_parse_question(const uint8_t *msg, size_t len, dns_question_t *q);
+
+/* Answer a query from the table or the cache into out (DNS_MSG_MAX bytes).
+ * *out_len is set for LOCAL and CACHED; q is filled in for everything but
+ * INVALID. */
+dns_verdict_t dns_engine_query(dns_engine_t *engine, const uint8_t *msg, size_t len, int64_t now_us,
+                               dns_question_t *q, uint8_t *out, size_t *out_len);
+
+/* Cache an upstream answer to q. Answers with an error, without records or
+ * too large are not kept. */
+void dns_engine_store(dns_engine_t *engine, const dns_question_t *q, const uint8_t *msg, size_t len,
+                      int64_t now_us);
+
+/* For when the upstream is down or silent: the expired answer to q if it
+ * is within stale_s, else SERVFAIL, so the client fails at once instead of
+ * retrying. Returns whether the answer is a stale one. */
+bool dns_engine_fallback(dns_engine_t *engine, const dns_question_t *q, const uint8_t *query, int64_t now_us,
+                         uint8_t *out, size_t *out_len);
+
+const char *dns_verdict_to_str(dns_verdict_t verdict);
+
+#endif /* DNS_ENGINE */
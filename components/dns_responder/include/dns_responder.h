@@ -0,0 +1,36 @@
+#ifndef DNS_RESPONDER
+#define DNS_RESPONDER
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "dns_engine.h"
+
+typedef struct {
+    uint32_t ip;                /* address to listen on and to answer local names with, network order */
+    const char *hostname;       /* kept, not copied */
+    uint16_t upstream_port;     /* 0 for 53 */
+} dns_responder_config_t;
+
+typedef struct {
+    uint32_t counts[DNS_VERDICT_MAX];   /* queries per engine verdict */
+    uint32_t answered_upstream; /* forwarded queries relayed back */
+    uint32_t stale;             /* answered from an expired cache entry */
+    uint32_t servfail;          /* failed at once: no upstream and nothing cached */
+    uint32_t upstream_timeouts; /* forwarded queries the upstream never answered */
+    uint32_t pending_max;       /* most forwarded queries in flight at once */
+} dns_responder_stats_t;
+
+/* Serve DNS to the SoftAP clients: the hostname and captive-portal probes
+ * from the static table, everything else through the answer cache or the
+ * upstream server. Without an upstream, queries are answered from the
+ * expired cache or with SERVFAIL right away rather than left to time out.
+ * Call after the SoftAP netif is up. */
+esp_err_t dns_responder_start(const dns_responder_config_t *config);
+
+/* Upstream server, network order; 0 while the uplink is down. Safe to call
+ * from event handlers, before or after dns_responder_start(). */
+void dns_responder_set_upstream(uint32_t ip);
+
+void dns_responder_get_stats(dns_responder_stats_t *out);
+
+#endif /* DNS_RESPONDER */
@@ -0,0 +1,330 @@
+#include "dns_engine.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#define US_PER_S        1000000LL
+#define HEADER_LEN      12
+/* Encoded names are at most 255 bytes (RFC 1035 2.3.4) */
+#define NAME_WIRE_MAX   255
+
+#define FLAG_QR         0x8000
+#define FLAG_OPCODE     0x7800
+#define FLAG_AA         0x0400
+#define FLAG_TC         0x0200
+#define FLAG_RD         0x0100
+#define FLAG_RA         0x0080
+#define FLAG_RCODE      0x000F
+
+#define CLASS_IN        1
+#define TYPE_OPT        41
+/* TTL of a stale answer, as RFC 8767 suggests */
+#define STALE_TTL_S     30
+
+static const char *const s_verdict_names[DNS_VERDICT_MAX] = {
+    [DNS_VERDICT_LOCAL] = "local",
+    [DNS_VERDICT_CACHED] = "cached",
+    [DNS_VERDICT_FORWARD] = "forward",
+    [DNS_VERDICT_INVALID] = "invalid",
+};
+
+/* Looked up by phones and laptops right after joining a network. Answered
+ * with our own address, the probe gets the web server instead of the
+ * expected reply and the OS offers the dashboard as the sign-in page. */
+static const char *const s_captive_names[] = {
+    "connectivitycheck.gstatic.com",
+    "connectivitycheck.android.com",
+    "clients3.google.com",
+    "captive.apple.com",
+    "www.msftconnecttest.com",
+    "www.msftncsi.com",
+    "detectportal.firefox.com",
+    "nmcheck.gnome.org",
+};
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put32(uint8_t *p, uint32_t value)
+{
+    put16(p, value >> 16);
+    put16(p + 2, value & 0xFFFF);
+}
+
+void dns_engine_init(dns_engine_t *engine, const dns_engine_config_t *config)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->config = *config;
+}
+
+bool dns_parse_question(const uint8_t *msg, size_t len, dns_question_t *q)
+{
+    if (len < HEADER_LEN || get16(msg + 4) != 1) {
+        return false;
+    }
+    q->id = get16(msg);
+    q->flags = get16(msg + 2);
+    q->name_fits = true;
+
+    size_t pos = HEADER_LEN;
+    size_t out = 0;
+    for (;;) {
+        if (pos >= len || pos - HEADER_LEN >= NAME_WIRE_MAX) {
+            return false;
+        }
+        uint8_t label = msg[pos++];
+        if (label == 0) {
+            break;
+        }
+        /* Compression has nothing to point at in a lone question */
+        if ((label & 0xC0) || pos + label > len) {
+            return false;
+        }
+        if (out + (out ? 1 : 0) + label >= DNS_NAME_MAX) {
+            q->name_fits = false;
+        }
+        if (q->name_fits) {
+            if (out) {
+                q->name[out++] = '.';
+            }
+            for (int i = 0; i < label; i++) {
+                q->name[out++] = tolower(msg[pos + i]);
+            }
+        }
+        pos += label;
+    }
+    q->name[q->name_fits ? out : 0] = '\0';
+
+    if (pos + 4 > len) {
+        return false;
+    }
+    q->qtype = get16(msg + pos);
+    q->qclass = get16(msg + pos + 2);
+    q->end = pos + 4;
+    return true;
+}
+
+static bool local_match(const dns_engine_t *engine, const char *name)
+{
+    const char *host = engine->config.hostname;
+    size_t host_len = host ? strlen(host) : 0;
+    if (host_len && strncasecmp(name, host, host_len) == 0 &&
+            (name[host_len] == '\0' || strcmp(name + host_len, ".local") == 0)) {
+        return true;
+    }
+    for (size_t i = 0; engine->config.captive && i < sizeof(s_captive_names) / sizeof(s_captive_names[0]); i++) {
+        if (strcmp(name, s_captive_names[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Header and question of the query, then our address for A and ANY.
+ * Other types get an empty answer so the client does not wait for one. */
+static size_t local_answer(const dns_engine_t *engine, const dns_question_t *q, const uint8_t *query, uint8_t *out)
+{
+    memcpy(out, query, q->end);
+    put16(out + 2, FLAG_QR | FLAG_AA | FLAG_RA | (q->flags & FLAG_RD));
+    memset(out + 6, 0, 6);
+    size_t pos = q->end;
+    if (q->qtype == DNS_TYPE_A || q->qtype == DNS_TYPE_ANY) {
+        put16(out + 6, 1);
+        put16(out + pos, 0xC000 | HEADER_LEN);
+        put16(out + pos + 2, DNS_TYPE_A);
+        put16(out + pos + 4, CLASS_IN);
+        put32(out + pos + 6, engine->config.local_ttl_s);
+        put16(out + pos + 10, 4);
+        memcpy(out + pos + 12, &engine->config.ip, 4);
+        pos += 16;
+    }
+    return pos;
+}
+
+/* Offset past the name at pos, 0 if it runs off the message */
+static size_t skip_name(const uint8_t *msg, size_t len, size_t pos)
+{
+    while (pos < len) {
+        uint8_t label = msg[pos];
+        if (label == 0) {
+            return pos + 1;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            return pos + 2 <= len ? pos + 2 : 0;
+        }
+        pos += 1 + label;
+    }
+    return 0;
+}
+
+/* Visit the TTL of every record but EDNS: collect the smallest into
+ * *min_ttl, and set them all to ttl unless it is negative */
+static bool records_ttl(uint8_t *msg, size_t len, uint32_t *min_ttl, int64_t ttl)
+{
+    size_t pos = HEADER_LEN;
+    for (int i = get16(msg + 4); i > 0; i--) {
+        pos = skip_name(msg, len, pos);
+        if (!pos || pos + 4 > len) {
+            return false;
+        }
+        pos += 4;
+    }
+    int records = get16(msg + 6) + get16(msg + 8) + get16(msg + 10);
+    for (int i = 0; i < records; i++) {
+        pos = skip_name(msg, len, pos);
+        if (!pos || pos + 10 > len) {
+            return false;
+        }
+        if (get16(msg + pos) != TYPE_OPT) {
+            uint32_t record_ttl = get32(msg + pos + 4);
+            if (min_ttl && record_ttl < *min_ttl) {
+                *min_ttl = record_ttl;
+            }
+            if (ttl >= 0) {
+                put32(msg + pos + 4, (uint32_t)ttl);
+            }
+        }
+        pos += 10 + get16(msg + pos + 8);
+        if (pos > len) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static dns_cache_entry_t *cache_find(dns_engine_t *engine, const dns_question_t *q)
+{
+    if (!q->name_fits) {
+        return NULL;
+    }
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        dns_cache_entry_t *entry = &engine->cache[i];
+        if (entry->used && entry->qtype == q->qtype && strcmp(entry->name, q->name) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* The cached answer under the client's ID and spelling of the name, with
+ * the TTLs counting down from when it was stored */
+static size_t cache_answer(dns_cache_entry_t *entry, const dns_question_t *q, const uint8_t *query,
+                           int64_t now_us, bool stale, uint8_t *out)
+{
+    memcpy(out, entry->msg, entry->len);
+    put16(out, q->id);
+    memcpy(out + HEADER_LEN, query + HEADER_LEN, q->end - HEADER_LEN);
+    int64_t ttl = stale ? STALE_TTL_S : (entry->expires_us - now_us + US_PER_S - 1) / US_PER_S;
+    records_ttl(out, entry->len, NULL, ttl);
+    entry->used_us = now_us;
+    return entry->len;
+}
+
+dns_verdict_t dns_engine_query(dns_engine_t *engine, const uint8_t *msg, size_t len, int64_t now_us,
+                               dns_question_t *q, uint8_t *out, size_t *out_len)
+{
+    if (!dns_parse_question(msg, len, q) || (q->flags & (FLAG_QR | FLAG_OPCODE))) {
+        engine->counts[DNS_VERDICT_INVALID]++;
+        return DNS_VERDICT_INVALID;
+    }
+    if (q->qclass == CLASS_IN && q->name_fits && local_match(engine, q->name)) {
+        *out_len = local_answer(engine, q, msg, out);
+        engine->counts[DNS_VERDICT_LOCAL]++;
+        return DNS_VERDICT_LOCAL;
+    }
+    dns_cache_entry_t *entry = cache_find(engine, q);
+    if (entry && entry->expires_us > now_us) {
+        *out_len = cache_answer(entry, q, msg, now_us, false, out);
+        engine->counts[DNS_VERDICT_CACHED]++;
+        return DNS_VERDICT_CACHED;
+    }
+    engine->counts[DNS_VERDICT_FORWARD]++;
+    return DNS_VERDICT_FORWARD;
+}
+
+/* A free entry, else one too old even to stand in for a dead upstream,
+ * else the least recently used */
+static dns_cache_entry_t *cache_victim(dns_engine_t *engine, int64_t now_us)
+{
+    int64_t stale_us = (int64_t)engine->config.stale_s * US_PER_S;
+    dns_cache_entry_t *victim = NULL;
+    for (int i = 0; i < DNS_CACHE_ENTRIES; i++) {
+        dns_cache_entry_t *entry = &engine->cache[i];
+        if (!entry->used || entry->expires_us + stale_us <= now_us) {
+            return entry;
+        }
+        if (!victim || entry->used_us < victim->used_us) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+void dns_engine_store(dns_engine_t *engine, const dns_question_t *q, const uint8_t *msg, size_t len,
+                      int64_t now_us)
+{
+    if (!q->name_fits || len < HEADER_LEN || len > DNS_CACHE_MSG_MAX) {
+        return;
+    }
+    uint16_t flags = get16(msg + 2);
+    if ((flags & (FLAG_RCODE | FLAG_TC)) || get16(msg + 6) == 0) {
+        return;
+    }
+    uint8_t copy[DNS_CACHE_MSG_MAX];
+    memcpy(copy, msg, len);
+    uint32_t ttl = UINT32_MAX;
+    if (!records_ttl(copy, len, &ttl, -1)) {
+        return;
+    }
+    ttl = ttl < engine->config.cache_ttl_max_s ? ttl : engine->config.cache_ttl_max_s;
+    if (ttl == 0) {
+        return;
+    }
+
+    dns_cache_entry_t *entry = cache_find(engine, q);
+    if (!entry) {
+        entry = cache_victim(engine, now_us);
+    }
+    entry->used = true;
+    entry->qtype = q->qtype;
+    entry->len = len;
+    entry->stored_us = now_us;
+    entry->expires_us = now_us + ttl * US_PER_S;
+    entry->used_us = now_us;
+    strcpy(entry->name, q->name);
+    memcpy(entry->msg, copy, len);
+}
+
+bool dns_engine_fallback(dns_engine_t *engine, const dns_question_t *q, const uint8_t *query, int64_t now_us,
+                         uint8_t *out, size_t *out_len)
+{
+    dns_cache_entry_t *entry = cache_find(engine, q);
+    if (entry && now_us < entry->expires_us + (int64_t)engine->config.stale_s * US_PER_S) {
+        *out_len = cache_answer(entry, q, query, now_us, entry->expires_us <= now_us, out);
+        return true;
+    }
+    memcpy(out, query, q->end);
+    put16(out + 2, FLAG_QR | FLAG_RA | (q->flags & FLAG_RD) | DNS_RCODE_SERVFAIL);
+    memset(out + 6, 0, 6);
+    *out_len = q->end;
+    return false;
+}
+
+const char *dns_verdict_to_str(dns_verdict_t verdict)
+{
+    return verdict < DNS_VERDICT_MAX ? s_verdict_names[verdict] : "?";
+}
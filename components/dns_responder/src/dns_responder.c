@@ -0,0 +1,363 @@
+#include "dns_responder.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "metrics.h"
+
+static const char *TAG = "dns";
+
+#define DNS_UPSTREAM_PORT   53
+/* Forwarded queries in flight; beyond that, new ones fail over at once */
+#define DNS_PENDING_MAX     8
+/* The AP address only changes with the firmware */
+#define DNS_LOCAL_TTL_S     300
+
+typedef enum {
+    DNS_ANSWER_LOCAL = 0,
+    DNS_ANSWER_CACHED,
+    DNS_ANSWER_UPSTREAM,
+    DNS_ANSWER_STALE,
+    DNS_ANSWER_SERVFAIL,
+    DNS_ANSWER_MAX,
+} dns_answer_t;
+
+static const char *const s_answer_names[DNS_ANSWER_MAX] = {
+    [DNS_ANSWER_LOCAL] = "local",
+    [DNS_ANSWER_CACHED] = "cached",
+    [DNS_ANSWER_UPSTREAM] = "upstream",
+    [DNS_ANSWER_STALE] = "stale",
+    [DNS_ANSWER_SERVFAIL] = "servfail",
+};
+
+typedef struct {
+    bool used;
+    uint16_t upstream_id;       /* ours, random, the client's is in q */
+    struct sockaddr_in client;
+    dns_question_t q;
+    int64_t start_us;
+    int64_t deadline_us;
+    uint8_t head[DNS_QUERY_HEAD_MAX];   /* the client's header and question */
+} dns_pending_t;
+
+/* Owned by the responder task */
+static dns_engine_t s_engine;
+static dns_pending_t s_pending[DNS_PENDING_MAX];
+static uint8_t s_rx[DNS_MSG_MAX];
+static uint8_t s_tx[DNS_MSG_MAX];
+static dns_responder_stats_t s_stats;
+
+static int s_server = -1;
+static int s_upstream = -1;
+static uint16_t s_upstream_port;
+static _Atomic uint32_t s_upstream_ip;
+
+/* One per answer source, labelled with it; from the query arriving to the
+ * answer leaving */
+static metrics_hist_t s_answer_hist[DNS_ANSWER_MAX];
+static metrics_counter_t s_timeout_counter = METRICS_COUNTER_INIT("dns_upstream_timeouts_total",
+                                                                  "Forwarded queries the upstream never answered");
+static metrics_counter_t s_invalid_counter = METRICS_COUNTER_INIT("dns_invalid_total",
+                                                                  "Malformed queries dropped");
+
+static void dns_reply(const struct sockaddr_in *client, const uint8_t *msg, size_t len, dns_answer_t answer,
+                      int64_t start_us)
+{
+    if (sendto(s_server, msg, len, 0, (const struct sockaddr *)client, sizeof(*client)) < 0) {
+        ESP_LOGD(TAG, "Reply failed: errno %d", errno);
+    }
+    metrics_observe_since(&s_answer_hist[answer], start_us);
+}
+
+/* No upstream to ask: an expired answer if there is one, else SERVFAIL */
+static void dns_fail_over(const struct sockaddr_in *client, const dns_question_t *q, const uint8_t *query,
+                          int64_t start_us)
+{
+    size_t len;
+    bool stale = dns_engine_fallback(&s_engine, q, query, esp_timer_get_time(), s_tx, &len);
+    if (stale) {
+        s_stats.stale++;
+    } else {
+        s_stats.servfail++;
+    }
+    dns_reply(client, s_tx, len, stale ? DNS_ANSWER_STALE : DNS_ANSWER_SERVFAIL, start_us);
+}
+
+static dns_pending_t *pending_alloc(const struct sockaddr_in *client, const dns_question_t *q, bool *duplicate)
+{
+    dns_pending_t *free_slot = NULL;
+    uint32_t in_flight = 1;
+    *duplicate = false;
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        dns_pending_t *p = &s_pending[i];
+        if (!p->used) {
+            free_slot = free_slot ? free_slot : p;
+            continue;
+        }
+        in_flight++;
+        /* A retransmission: the first copy is still on its way */
+        if (p->q.id == q->id && p->client.sin_port == client->sin_port &&
+                p->client.sin_addr.s_addr == client->sin_addr.s_addr) {
+            *duplicate = true;
+            return NULL;
+        }
+    }
+    if (free_slot && in_flight > s_stats.pending_max) {
+        s_stats.pending_max = in_flight;
+    }
+    return free_slot;
+}
+
+static uint16_t pending_new_id(void)
+{
+    for (;;) {
+        uint16_t id = esp_random() & 0xFFFF;
+        bool taken = false;
+        for (int i = 0; i < DNS_PENDING_MAX && !taken; i++) {
+            taken = s_pending[i].used && s_pending[i].upstream_id == id;
+        }
+        if (!taken) {
+            return id;
+        }
+    }
+}
+
+static void dns_forward(const struct sockaddr_in *client, const dns_question_t *q, size_t len, int64_t start_us)
+{
+    uint32_t upstream_ip = atomic_load(&s_upstream_ip);
+    bool duplicate = false;
+    dns_pending_t *p = upstream_ip && q->end <= DNS_QUERY_HEAD_MAX ? pending_alloc(client, q, &duplicate) : NULL;
+    if (duplicate) {
+        return;
+    }
+    if (!p) {
+        dns_fail_over(client, q, s_rx, start_us);
+        return;
+    }
+
+    p->upstream_id = pending_new_id();
+    p->client = *client;
+    p->q = *q;
+    p->start_us = start_us;
+    p->deadline_us = start_us + CONFIG_DNS_UPSTREAM_TIMEOUT_MS * 1000LL;
+    memcpy(p->head, s_rx, q->end);
+
+    /* The client's query as is, under our ID */
+    s_rx[0] = p->upstream_id >> 8;
+    s_rx[1] = p->upstream_id & 0xFF;
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(s_upstream_port),
+        .sin_addr.s_addr = upstream_ip,
+    };
+    if (sendto(s_upstream, s_rx, len, 0, (struct sockaddr *)&to, sizeof(to)) < 0) {
+        ESP_LOGD(TAG, "Forward failed: errno %d", errno);
+        dns_fail_over(client, q, p->head, start_us);
+        return;
+    }
+    p->used = true;
+}
+
+static void dns_handle_query(void)
+{
+    struct sockaddr_in client;
+    socklen_t client_len = sizeof(client);
+    int len = recvfrom(s_server, s_rx, sizeof(s_rx), 0, (struct sockaddr *)&client, &client_len);
+    if (len <= 0) {
+        return;
+    }
+    int64_t start_us = esp_timer_get_time();
+    dns_question_t q;
+    size_t out_len;
+    dns_verdict_t verdict = dns_engine_query(&s_engine, s_rx, len, start_us, &q, s_tx, &out_len);
+    switch (verdict) {
+    case DNS_VERDICT_LOCAL:
+        dns_reply(&client, s_tx, out_len, DNS_ANSWER_LOCAL, start_us);
+        break;
+    case DNS_VERDICT_CACHED:
+        dns_reply(&client, s_tx, out_len, DNS_ANSWER_CACHED, start_us);
+        break;
+    case DNS_VERDICT_FORWARD:
+        dns_forward(&client, &q, len, start_us);
+        break;
+    default:
+        metrics_inc(&s_invalid_counter);
+        break;
+    }
+}
+
+static void dns_handle_answer(void)
+{
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int len = recvfrom(s_upstream, s_rx, sizeof(s_rx), 0, (struct sockaddr *)&from, &from_len);
+    dns_question_t q;
+    if (len <= 0 || from.sin_addr.s_addr != atomic_load(&s_upstream_ip) ||
+            from.sin_port != htons(s_upstream_port) || !dns_parse_question(s_rx, len, &q)) {
+        return;
+    }
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        dns_pending_t *p = &s_pending[i];
+        /* The ID alone is 16 bits to guess, the question has to match too */
+        if (!p->used || p->upstream_id != q.id || p->q.qtype != q.qtype || p->q.qclass != q.qclass ||
+                p->q.name_fits != q.name_fits || strcmp(p->q.name, q.name) != 0) {
+            continue;
+        }
+        p->used = false;
+        dns_engine_store(&s_engine, &p->q, s_rx, len, esp_timer_get_time());
+        s_rx[0] = p->q.id >> 8;
+        s_rx[1] = p->q.id & 0xFF;
+        s_stats.answered_upstream++;
+        dns_reply(&p->client, s_rx, len, DNS_ANSWER_UPSTREAM, p->start_us);
+        return;
+    }
+}
+
+/* Fail over what the upstream left unanswered; returns the next deadline */
+static int64_t dns_expire(int64_t now_us)
+{
+    int64_t next = 0;
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        dns_pending_t *p = &s_pending[i];
+        if (!p->used) {
+            continue;
+        }
+        if (p->deadline_us <= now_us) {
+            p->used = false;
+            s_stats.upstream_timeouts++;
+            metrics_inc(&s_timeout_counter);
+            dns_fail_over(&p->client, &p->q, p->head, p->start_us);
+        } else if (!next || p->deadline_us < next) {
+            next = p->deadline_us;
+        }
+    }
+    return next;
+}
+
+static void dns_task(void *arg)
+{
+    int max_fd = s_server > s_upstream ? s_server : s_upstream;
+    for (;;) {
+        int64_t now = esp_timer_get_time();
+        int64_t next = dns_expire(now);
+        struct timeval timeout = { .tv_sec = 1 };
+        if (next) {
+            int64_t wait_us = next - now;
+            timeout.tv_sec = wait_us / 1000000;
+            timeout.tv_usec = wait_us % 1000000;
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(s_server, &readable);
+        FD_SET(s_upstream, &readable);
+        int ready = select(max_fd + 1, &readable, NULL, NULL, &timeout);
+        if (ready < 0) {
+            if (errno != EINTR) {
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
+                vTaskDelay(pdMS_TO_TICKS(100));
+            }
+            continue;
+        }
+        if (ready > 0 && FD_ISSET(s_server, &readable)) {
+            dns_handle_query();
+        }
+        if (ready > 0 && FD_ISSET(s_upstream, &readable)) {
+            dns_handle_answer();
+        }
+    }
+}
+
+static int dns_socket(uint32_t ip, uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = ip,
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        ESP_LOGE(TAG, "bind to port %u failed: errno %d", port, errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+esp_err_t dns_responder_start(const dns_responder_config_t *config)
+{
+    if (s_server >= 0) {
+        return ESP_OK;
+    }
+
+    dns_engine_config_t engine_config = {
+        .ip = config->ip,
+        .hostname = config->hostname,
+#if CONFIG_DNS_CAPTIVE_PORTAL
+        .captive = true,
+#endif
+        .local_ttl_s = DNS_LOCAL_TTL_S,
+        .cache_ttl_max_s = CONFIG_DNS_CACHE_TTL_MAX_S,
+        .stale_s = CONFIG_DNS_CACHE_STALE_S,
+    };
+    dns_engine_init(&s_engine, &engine_config);
+    s_upstream_port = config->upstream_port ? config->upstream_port : DNS_UPSTREAM_PORT;
+
+    /* On the AP address only: the station side is not ours to serve */
+    s_server = dns_socket(config->ip, CONFIG_DNS_RESPONDER_PORT);
+    s_upstream = dns_socket(htonl(INADDR_ANY), 0);
+    if (s_server < 0 || s_upstream < 0) {
+        goto fail;
+    }
+
+    for (int i = 0; i < DNS_ANSWER_MAX; i++) {
+        s_answer_hist[i] = (metrics_hist_t) METRICS_HIST_INIT("dns_answer_seconds", "Query to answer time");
+        s_answer_hist[i].label = "answer";
+        s_answer_hist[i].label_value = s_answer_names[i];
+        metrics_register_hist(&s_answer_hist[i]);
+    }
+    metrics_register_counter(&s_timeout_counter);
+    metrics_register_counter(&s_invalid_counter);
+
+    if (xTaskCreate(dns_task, "dns", 3072, NULL, CONFIG_DNS_RESPONDER_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create DNS task");
+        goto fail;
+    }
+    ESP_LOGI(TAG, "Serving %s on port %d", config->hostname, CONFIG_DNS_RESPONDER_PORT);
+    return ESP_OK;
+
+fail:
+    if (s_server >= 0) {
+        close(s_server);
+        s_server = -1;
+    }
+    if (s_upstream >= 0) {
+        close(s_upstream);
+        s_upstream = -1;
+    }
+    return ESP_FAIL;
+}
+
+void dns_responder_set_upstream(uint32_t ip)
+{
+    atomic_store(&s_upstream_ip, ip);
+}
+
+void dns_responder_get_stats(dns_responder_stats_t *out)
+{
+    *out = s_stats;
+    memcpy(out->counts, s_engine.counts, sizeof(out->counts));
+}
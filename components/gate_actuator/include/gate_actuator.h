@@ -0,0 +1,110 @@
+#ifndef GATE_ACTUATOR
+#define GATE_ACTUATOR
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+/* Posted to the default event loop when a relay pulse starts and ends and
+ * when the gate state changes, with a gate_event_t. Dropped when the loop's
+ * queue is full. */
+ESP_EVENT_DECLARE_BASE(GATE_EVENT);
+
+typedef enum {
+    GATE_ACTION_OPEN = 0,       /* full opening for car passage */
+    GATE_ACTION_OPEN_HALF,      /* pedestrian opening */
+    GATE_ACTION_CLOSE,
+    GATE_ACTION_MAX,
+} gate_action_t;
+
+typedef enum {
+    GATE_SOURCE_DISCORD = 0,
+    GATE_SOURCE_HTTP,
+    GATE_SOURCE_PRESENCE,
+    GATE_SOURCE_MAX,
+} gate_source_t;
+
+/* Called on the actuator task once the command has been carried out (ESP_OK,
+ * also when the gate was already heading there), replaced by a later command
+ * before its pulse (ESP_ERR_INVALID_STATE) or failed. Must not block: hand
+ * the result over to another task. */
+typedef void (*gate_done_cb_t)(gate_action_t action, esp_err_t result, void *ctx);
+
+/* Where the gate is, as tracked by the arbiter from the pulses it sent and
+ * the configured travel times; the LCU-30H gives no position feedback */
+typedef enum {
+    GATE_STATE_CLOSED = 0,
+    GATE_STATE_OPENING,
+    GATE_STATE_OPEN,
+    GATE_STATE_HALF,            /* stopped at the pedestrian opening */
+    GATE_STATE_CLOSING,
+    GATE_STATE_FAULT,           /* a relay could not be driven, position unsure */
+    GATE_STATE_MAX,
+} gate_state_t;
+
+typedef enum {
+    GATE_EVENT_ACTIVE,          /* relay energised */
+    GATE_EVENT_IDLE,            /* pulse finished */
+    GATE_EVENT_STATE,           /* gate state changed, action and source of the last pulse */
+} gate_event_id_t;
+
+typedef struct {
+    gate_action_t action;
+    gate_source_t source;
+    gate_state_t state;
+} gate_event_t;
+
+typedef struct {
+    gate_action_t action;
+    gate_source_t source;
+    int64_t event_time_us;      /* when the triggering event arrived, 0 = now */
+    gate_done_cb_t done_cb;     /* optional */
+    void *ctx;
+} gate_request_t;
+
+#define GATE_LATENCY_BUCKETS 12
+
+/* Upper bound of every latency bucket in microseconds, the last one is open */
+extern const uint32_t gate_latency_bucket_us[GATE_LATENCY_BUCKETS];
+
+/* Event-to-relay latency of one command source */
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[GATE_LATENCY_BUCKETS];
+} gate_latency_hist_t;
+
+typedef struct {
+    gate_state_t state;
+    uint8_t position_pct;       /* estimated opening, 0 = closed */
+    uint32_t pulses;            /* relay pulses sent */
+    uint32_t redundant;         /* commands the gate was already carrying out */
+    uint32_t superseded;        /* commands replaced while waiting for the relay */
+    uint32_t faults;
+    uint32_t queue_max;         /* deepest the submit queue has been */
+} gate_status_t;
+
+struct gate_hal;
+
+/* Configure the relay GPIOs and start the actuator task. The host build
+ * drives a simulated LCU-30H instead. */
+esp_err_t gate_actuator_start(void);
+
+/* Start the actuator task on another hardware interface, e.g. a gate_sim_t */
+esp_err_t gate_actuator_start_hal(const struct gate_hal *hal);
+
+/* Queue a command without blocking. Returns ESP_ERR_TIMEOUT when the queue
+ * is full and ESP_ERR_INVALID_STATE before gate_actuator_start(). */
+esp_err_t gate_actuator_submit(const gate_request_t *request);
+
+void gate_actuator_get_latency(gate_source_t source, gate_latency_hist_t *out);
+
+void gate_actuator_get_status(gate_status_t *out);
+
+const char *gate_action_to_str(gate_action_t action);
+esp_err_t gate_action_from_str(const char *str, gate_action_t *out);
+const char *gate_source_to_str(gate_source_t source);
+const char *gate_state_to_str(gate_state_t state);
+
+#endif /* GATE_ACTUATOR */
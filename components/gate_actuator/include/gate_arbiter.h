@@ -0,0 +1,99 @@
+#ifndef GATE_ARBITER
+#define GATE_ARBITER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gate_actuator.h"
+#include "gate_hal.h"
+
+/* The single owner of the gate. Every command from every source goes
+ * through gate_arbiter_submit():
+ *  - a command the gate is already carrying out, or will once the waiting
+ *    command has gone out, is completed at once without a pulse;
+ *  - otherwise it is pulsed on the relay, or, while a pulse or the idle gap
+ *    after it is running, waits in a single slot where a later command
+ *    replaces it: only the latest intent is worth a pulse.
+ * So at most one pulse and one waiting command exist at any time. The state
+ * is tracked from the pulses and the travel times, the controller acting
+ * when a pulse ends.
+ *
+ * Not thread-safe and never blocks: drive it from one task with the time
+ * of each call, so the same code runs on the device and under a simulated
+ * clock. */
+
+typedef struct {
+    uint32_t full_travel_ms;    /* closed to fully open */
+    uint32_t half_travel_ms;    /* closed to the pedestrian opening */
+    uint32_t pulse_ms;          /* relay hold time */
+    uint32_t gap_ms;            /* relay idle time between two pulses */
+} gate_timing_t;
+
+typedef enum {
+    GATE_NOTE_RELAY_ON,         /* request: the command being pulsed */
+    GATE_NOTE_RELAY_OFF,        /* request: the same, about to be completed */
+    GATE_NOTE_STATE,            /* request: the last command pulsed, if any */
+} gate_note_t;
+
+typedef void (*gate_arbiter_notify_fn_t)(void *ctx, gate_note_t note, const gate_request_t *request,
+                                         gate_state_t state, int64_t now_us);
+
+typedef struct {
+    gate_timing_t timing;
+    gate_hal_t hal;
+    gate_arbiter_notify_fn_t notify;    /* optional */
+    void *notify_ctx;
+} gate_arbiter_config_t;
+
+typedef enum {
+    GATE_VERDICT_STARTED = 0,   /* relay energised */
+    GATE_VERDICT_WAITING,       /* for the relay, may still be replaced */
+    GATE_VERDICT_REDUNDANT,     /* completed without a pulse */
+    GATE_VERDICT_FAILED,        /* the relay could not be driven */
+} gate_verdict_t;
+
+typedef struct {
+    uint32_t pulses;
+    uint32_t redundant;
+    uint32_t superseded;
+    uint32_t faults;
+} gate_arbiter_stats_t;
+
+typedef struct {
+    gate_arbiter_config_t config;
+    bool fault;
+    int64_t position;           /* microseconds of travel from closed */
+    int64_t target;
+    int64_t position_us;        /* when position was last updated */
+    bool relay_on;
+    gate_request_t active;      /* being pulsed, or pulsed last */
+    bool pulsed;                /* active is valid */
+    int64_t relay_off_us;       /* end of the current or last pulse */
+    bool waiting;
+    gate_request_t next;
+    gate_state_t state;         /* as last notified */
+    gate_arbiter_stats_t stats;
+} gate_arbiter_t;
+
+/* The gate is assumed closed at start: the controller closes it after a
+ * power cut and there is no position feedback */
+void gate_arbiter_init(gate_arbiter_t *arb, const gate_arbiter_config_t *config, int64_t now_us);
+
+/* New timing from now on. A pulse in progress keeps its length; the leaf
+ * keeps its place along the travel, scaled to the new travel times. */
+void gate_arbiter_set_timing(gate_arbiter_t *arb, const gate_timing_t *timing, int64_t now_us);
+
+/* A command the gate is already carrying out while a pulse is pending or
+ * the leaf is still travelling completes without a pulse; once the leaf
+ * has settled every command is pulsed. Done callbacks run from here or
+ * from gate_arbiter_poll(). */
+gate_verdict_t gate_arbiter_submit(gate_arbiter_t *arb, const gate_request_t *request, int64_t now_us);
+
+/* Carry out everything due by now_us. Returns when to call again, 0 when
+ * nothing is due until the next command. */
+int64_t gate_arbiter_poll(gate_arbiter_t *arb, int64_t now_us);
+
+gate_state_t gate_arbiter_state(const gate_arbiter_t *arb);
+/* Microseconds of travel from closed at now_us */
+int64_t gate_arbiter_position(const gate_arbiter_t *arb, int64_t now_us);
+
+#endif /* GATE_ARBITER */
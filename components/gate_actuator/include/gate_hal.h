@@ -0,0 +1,20 @@
+#ifndef GATE_HAL
+#define GATE_HAL
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "gate_actuator.h"
+
+/* The controller inputs as seen by the arbiter: one relay per action,
+ * energised for the length of a pulse. Called from the actuator task only. */
+typedef struct gate_hal {
+    esp_err_t (*set_input)(void *ctx, gate_action_t input, bool on);
+    void *ctx;
+} gate_hal_t;
+
+#if !CONFIG_IDF_TARGET_LINUX
+/* Configure the relay GPIOs from Kconfig, released, and fill in *hal */
+esp_err_t gate_hal_gpio_init(gate_hal_t *hal);
+#endif
+
+#endif /* GATE_HAL */
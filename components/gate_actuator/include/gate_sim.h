@@ -0,0 +1,61 @@
+#ifndef GATE_SIM
+#define GATE_SIM
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gate_actuator.h"
+#include "gate_hal.h"
+
+/* A simulated LCU-30H behind a gate_hal_t, for the host build and the
+ * benchmarks. Like the real controller it acts on an input once the input
+ * is released after a long enough pulse, ignores inputs that follow the
+ * previous one too closely, and moves the leaf at a constant speed:
+ * open drives it fully open, open-half to the pedestrian opening unless it
+ * is opening fully or already open, close drives it shut. */
+
+typedef int64_t (*gate_sim_clock_fn_t)(void *ctx);
+
+typedef struct {
+    uint32_t full_travel_ms;    /* closed to fully open */
+    uint32_t half_travel_ms;    /* closed to the pedestrian opening */
+    uint32_t min_pulse_ms;      /* shorter pulses are ignored */
+    uint32_t min_gap_ms;        /* pulses after less idle time are ignored */
+    gate_sim_clock_fn_t clock;  /* esp_timer_get_time() when NULL */
+    void *clock_ctx;
+} gate_sim_config_t;
+
+/* Inputs the controller did not act on mean the arbiter got the timing wrong */
+typedef struct {
+    uint32_t accepted;
+    uint32_t short_pulses;
+    uint32_t early_pulses;
+    uint32_t overlaps;          /* two inputs energised at once */
+    uint32_t failures;          /* injected set_input() errors */
+} gate_sim_stats_t;
+
+typedef struct {
+    gate_sim_config_t config;
+    bool input[GATE_ACTION_MAX];
+    int64_t pressed_us[GATE_ACTION_MAX];
+    int64_t idle_us[GATE_ACTION_MAX];   /* idle time before each press */
+    int64_t released_us;
+    int64_t position;           /* microseconds of travel from closed */
+    int64_t target;
+    int64_t position_us;        /* when position was last updated */
+    uint32_t fail_next;
+    gate_sim_stats_t stats;
+} gate_sim_t;
+
+void gate_sim_init(gate_sim_t *sim, const gate_sim_config_t *config);
+
+/* A HAL driving the simulated controller; sim must outlive it */
+void gate_sim_hal(gate_sim_t *sim, gate_hal_t *hal);
+
+/* Make the next count relay presses fail, as a broken relay driver would */
+void gate_sim_fail_next(gate_sim_t *sim, uint32_t count);
+
+gate_state_t gate_sim_state(gate_sim_t *sim);
+/* Microseconds of travel from closed */
+int64_t gate_sim_position(gate_sim_t *sim);
+
+#endif /* GATE_SIM */
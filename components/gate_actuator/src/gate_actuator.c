@@ -0,0 +1,280 @@
+#include "gate_actuator.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "dlog.h"
+#include "gate_arbiter.h"
+#include "gate_sim.h"
+#include "settings.h"
+
+static const char *TAG = "gate-actuator";
+
+ESP_EVENT_DEFINE_BASE(GATE_EVENT);
+
+const uint32_t gate_latency_bucket_us[GATE_LATENCY_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, UINT32_MAX
+};
+
+static const char *const s_action_names[GATE_ACTION_MAX] = {
+    [GATE_ACTION_OPEN] = "open",
+    [GATE_ACTION_OPEN_HALF] = "open-half",
+    [GATE_ACTION_CLOSE] = "close",
+};
+
+static const char *const s_source_names[GATE_SOURCE_MAX] = {
+    [GATE_SOURCE_DISCORD] = "discord",
+    [GATE_SOURCE_HTTP] = "http",
+    [GATE_SOURCE_PRESENCE] = "presence",
+};
+
+static const char *const s_state_names[GATE_STATE_MAX] = {
+    [GATE_STATE_CLOSED] = "closed",
+    [GATE_STATE_OPENING] = "opening",
+    [GATE_STATE_OPEN] = "open",
+    [GATE_STATE_HALF] = "half",
+    [GATE_STATE_CLOSING] = "closing",
+    [GATE_STATE_FAULT] = "fault",
+};
+
+static QueueHandle_t s_queue = NULL;
+/* Owned by the actuator task, s_arbiter_lock lets the status be read */
+static gate_arbiter_t s_arbiter;
+static SemaphoreHandle_t s_arbiter_lock = NULL;
+static uint32_t s_queue_max;
+/* Settings generation the arbiter timing was taken from */
+static uint32_t s_settings_generation;
+#if CONFIG_IDF_TARGET_LINUX
+/* Host build has no relays: drive a simulated controller instead */
+static gate_sim_t s_sim;
+#endif
+static gate_latency_hist_t s_latency[GATE_SOURCE_MAX];
+static portMUX_TYPE s_latency_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void record_latency(gate_source_t source, int64_t latency_us)
+{
+    uint32_t us = latency_us < 0 ? 0 : latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us;
+    int bucket = 0;
+    while (us > gate_latency_bucket_us[bucket]) {
+        bucket++;
+    }
+
+    gate_latency_hist_t *hist = &s_latency[source];
+    portENTER_CRITICAL(&s_latency_lock);
+    hist->count++;
+    hist->total_us += us;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+    hist->buckets[bucket]++;
+    portEXIT_CRITICAL(&s_latency_lock);
+}
+
+/* Runs on the actuator task with s_arbiter_lock held */
+static void gate_notify(void *ctx, gate_note_t note, const gate_request_t *request, gate_state_t state, int64_t now_us)
+{
+    gate_event_t event = { .state = state };
+    if (request) {
+        event.action = request->action;
+        event.source = request->source;
+    }
+
+    switch (note) {
+    case GATE_NOTE_RELAY_ON:
+        record_latency(request->source, now_us - request->event_time_us);
+        esp_event_post(GATE_EVENT, GATE_EVENT_ACTIVE, &event, sizeof(event), 0);
+        break;
+    case GATE_NOTE_RELAY_OFF:
+        esp_event_post(GATE_EVENT, GATE_EVENT_IDLE, &event, sizeof(event), 0);
+        DLOG(GATE_DONE, s_action_names[request->action], s_source_names[request->source]);
+        break;
+    case GATE_NOTE_STATE:
+        esp_event_post(GATE_EVENT, GATE_EVENT_STATE, &event, sizeof(event), 0);
+        break;
+    }
+}
+
+/* The timing as currently set. Returns the settings generation it is from. */
+static uint32_t timing_from_settings(gate_timing_t *timing)
+{
+    const settings_t *settings = settings_acquire();
+    timing->full_travel_ms = settings->gate_travel_full_ms;
+    /* The pedestrian opening lies within the full one */
+    timing->half_travel_ms = settings->gate_travel_half_ms < settings->gate_travel_full_ms ?
+                             settings->gate_travel_half_ms : settings->gate_travel_full_ms;
+    timing->pulse_ms = settings->gate_pulse_ms;
+    timing->gap_ms = settings->gate_gap_ms;
+    uint32_t generation = settings->generation;
+    settings_release(settings);
+    return generation;
+}
+
+/* Pick up changed settings before acting on anything. Called with
+ * s_arbiter_lock held. */
+static void apply_settings(int64_t now_us)
+{
+    const settings_t *settings = settings_acquire();
+    bool changed = settings->generation != s_settings_generation;
+    settings_release(settings);
+    if (changed) {
+        gate_timing_t timing;
+        s_settings_generation = timing_from_settings(&timing);
+        gate_arbiter_set_timing(&s_arbiter, &timing, now_us);
+    }
+}
+
+static void gate_actuator_task(void *arg)
+{
+    gate_request_t request;
+    int64_t due = 0;
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        if (due) {
+            int64_t wait_ms = (due - esp_timer_get_time() + 999) / 1000;
+            wait = wait_ms > 0 ? pdMS_TO_TICKS(wait_ms) + 1 : 0;
+        }
+        bool received = xQueueReceive(s_queue, &request, wait) == pdTRUE;
+
+        xSemaphoreTake(s_arbiter_lock, portMAX_DELAY);
+        apply_settings(esp_timer_get_time());
+        if (received) {
+            gate_arbiter_submit(&s_arbiter, &request, esp_timer_get_time());
+        }
+        due = gate_arbiter_poll(&s_arbiter, esp_timer_get_time());
+        xSemaphoreGive(s_arbiter_lock);
+    }
+}
+
+esp_err_t gate_actuator_start(void)
+{
+    gate_hal_t hal;
+#if CONFIG_IDF_TARGET_LINUX
+    gate_timing_t timing;
+    timing_from_settings(&timing);
+    gate_sim_config_t sim_config = {
+        .full_travel_ms = timing.full_travel_ms,
+        .half_travel_ms = timing.half_travel_ms,
+        .min_pulse_ms = timing.pulse_ms,
+        .min_gap_ms = timing.gap_ms,
+    };
+    gate_sim_init(&s_sim, &sim_config);
+    gate_sim_hal(&s_sim, &hal);
+#else
+    esp_err_t err = gate_hal_gpio_init(&hal);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure relay GPIOs (%s)", esp_err_to_name(err));
+        return err;
+    }
+#endif
+    return gate_actuator_start_hal(&hal);
+}
+
+esp_err_t gate_actuator_start_hal(const gate_hal_t *hal)
+{
+    if (s_queue) {
+        return ESP_OK;
+    }
+
+    gate_arbiter_config_t config = {
+        .hal = *hal,
+        .notify = gate_notify,
+    };
+    s_settings_generation = timing_from_settings(&config.timing);
+    gate_arbiter_init(&s_arbiter, &config, esp_timer_get_time());
+
+    s_arbiter_lock = xSemaphoreCreateMutex();
+    s_queue = xQueueCreate(CONFIG_GATE_ACTUATOR_QUEUE_LEN, sizeof(gate_request_t));
+    if (!s_queue || !s_arbiter_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(gate_actuator_task, "gate_actuator", 3072, NULL,
+                                CONFIG_GATE_ACTUATOR_TASK_PRIORITY, NULL, CONFIG_GATE_ACTUATOR_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create actuator task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t gate_actuator_submit(const gate_request_t *request)
+{
+    if (!s_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (request->action >= GATE_ACTION_MAX || request->source >= GATE_SOURCE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    gate_request_t queued = *request;
+    if (queued.event_time_us == 0) {
+        queued.event_time_us = esp_timer_get_time();
+    }
+    if (xQueueSend(s_queue, &queued, 0) != pdTRUE) {
+        DLOG(GATE_QUEUE_FULL, s_action_names[request->action], s_source_names[request->source]);
+        return ESP_ERR_TIMEOUT;
+    }
+    uint32_t depth = uxQueueMessagesWaiting(s_queue);
+    if (depth > s_queue_max) {
+        s_queue_max = depth;
+    }
+    return ESP_OK;
+}
+
+void gate_actuator_get_latency(gate_source_t source, gate_latency_hist_t *out)
+{
+    if (source >= GATE_SOURCE_MAX) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    portENTER_CRITICAL(&s_latency_lock);
+    *out = s_latency[source];
+    portEXIT_CRITICAL(&s_latency_lock);
+}
+
+void gate_actuator_get_status(gate_status_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (!s_arbiter_lock) {
+        return;
+    }
+    xSemaphoreTake(s_arbiter_lock, portMAX_DELAY);
+    int64_t position = gate_arbiter_position(&s_arbiter, esp_timer_get_time());
+    out->state = gate_arbiter_state(&s_arbiter);
+    out->position_pct = position * 100 / (s_arbiter.config.timing.full_travel_ms * 1000LL);
+    out->pulses = s_arbiter.stats.pulses;
+    out->redundant = s_arbiter.stats.redundant;
+    out->superseded = s_arbiter.stats.superseded;
+    out->faults = s_arbiter.stats.faults;
+    xSemaphoreGive(s_arbiter_lock);
+    out->queue_max = s_queue_max;
+}
+
+const char *gate_action_to_str(gate_action_t action)
+{
+    return action < GATE_ACTION_MAX ? s_action_names[action] : "unknown";
+}
+
+esp_err_t gate_action_from_str(const char *str, gate_action_t *out)
+{
+    for (int i = 0; i < GATE_ACTION_MAX; i++) {
+        if (strcmp(str, s_action_names[i]) == 0) {
+            *out = i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+const char *gate_source_to_str(gate_source_t source)
+{
+    return source < GATE_SOURCE_MAX ? s_source_names[source] : "unknown";
+}
+
+const char *gate_state_to_str(gate_state_t state)
+{
+    return state < GATE_STATE_MAX ? s_state_names[state] : "unknown";
+}
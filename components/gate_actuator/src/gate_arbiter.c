@@ -0,0 +1,248 @@
+#include "gate_arbiter.h"
+
+#include <string.h>
+
+#define US_PER_MS 1000LL
+
+static int64_t travel_towards(int64_t position, int64_t target, int64_t elapsed)
+{
+    if (elapsed <= 0) {
+        return position;
+    }
+    if (target > position) {
+        return target - position > elapsed ? position + elapsed : target;
+    }
+    return position - target > elapsed ? position - elapsed : target;
+}
+
+static void arb_move(gate_arbiter_t *arb, int64_t now)
+{
+    arb->position = travel_towards(arb->position, arb->target, now - arb->position_us);
+    arb->position_us = now;
+}
+
+static void arb_notify(gate_arbiter_t *arb, gate_note_t note, const gate_request_t *request, int64_t now)
+{
+    if (arb->config.notify) {
+        arb->config.notify(arb->config.notify_ctx, note, request, arb->state, now);
+    }
+}
+
+static void arb_update_state(gate_arbiter_t *arb, int64_t now)
+{
+    gate_state_t state;
+    if (arb->fault) {
+        state = GATE_STATE_FAULT;
+    } else if (arb->position < arb->target) {
+        state = GATE_STATE_OPENING;
+    } else if (arb->position > arb->target) {
+        state = GATE_STATE_CLOSING;
+    } else if (arb->position == 0) {
+        state = GATE_STATE_CLOSED;
+    } else if (arb->position == arb->config.timing.full_travel_ms * US_PER_MS) {
+        state = GATE_STATE_OPEN;
+    } else {
+        state = GATE_STATE_HALF;
+    }
+    if (state != arb->state) {
+        arb->state = state;
+        arb_notify(arb, GATE_NOTE_STATE, arb->pulsed ? &arb->active : NULL, now);
+    }
+}
+
+/* Where the controller heads after acting on action, as the LCU-30H does */
+static int64_t target_after(const gate_arbiter_t *arb, gate_action_t action, int64_t target)
+{
+    int64_t full = arb->config.timing.full_travel_ms * US_PER_MS;
+    switch (action) {
+    case GATE_ACTION_OPEN:
+        return full;
+    case GATE_ACTION_OPEN_HALF:
+        return target == full ? full : arb->config.timing.half_travel_ms * US_PER_MS;
+    default:
+        return 0;
+    }
+}
+
+/* Whether the gate already ends up where action would take it, counting
+ * the pulse in progress and the waiting command. Only within a motion
+ * cycle: once travel has settled the model is open loop, with no sensor to
+ * tell it about the handheld remote, the auto-close or a power blip, so a
+ * command then always gets its pulse. After a fault nothing is taken for
+ * granted either. */
+static bool is_redundant(const gate_arbiter_t *arb, gate_action_t action, int64_t now)
+{
+    if (arb->fault) {
+        return false;
+    }
+    if (!arb->relay_on && !arb->waiting && gate_arbiter_position(arb, now) == arb->target) {
+        return false;
+    }
+    int64_t planned = arb->target;
+    if (arb->relay_on) {
+        planned = target_after(arb, arb->active.action, planned);
+    }
+    if (arb->waiting) {
+        planned = target_after(arb, arb->next.action, planned);
+    }
+    return target_after(arb, action, planned) == planned;
+}
+
+static void complete(const gate_request_t *request, esp_err_t result)
+{
+    if (request->done_cb) {
+        request->done_cb(request->action, result, request->ctx);
+    }
+}
+
+static void fault(gate_arbiter_t *arb, int64_t now)
+{
+    arb->fault = true;
+    arb->stats.faults++;
+    arb_update_state(arb, now);
+}
+
+static gate_verdict_t pulse_start(gate_arbiter_t *arb, const gate_request_t *request, int64_t now)
+{
+    arb_move(arb, now);
+    esp_err_t err = arb->config.hal.set_input(arb->config.hal.ctx, request->action, true);
+    if (err != ESP_OK) {
+        fault(arb, now);
+        complete(request, err);
+        return GATE_VERDICT_FAILED;
+    }
+    arb->relay_on = true;
+    arb->active = *request;
+    arb->pulsed = true;
+    arb->relay_off_us = now + arb->config.timing.pulse_ms * US_PER_MS;
+    arb->stats.pulses++;
+    arb_notify(arb, GATE_NOTE_RELAY_ON, &arb->active, now);
+    return GATE_VERDICT_STARTED;
+}
+
+/* The controller acts on the input as it is released */
+static void pulse_end(gate_arbiter_t *arb, int64_t now)
+{
+    arb_move(arb, now);
+    esp_err_t err = arb->config.hal.set_input(arb->config.hal.ctx, arb->active.action, false);
+    arb->relay_on = false;
+    arb->relay_off_us = now;
+    if (err == ESP_OK) {
+        arb->fault = false;
+        arb->target = target_after(arb, arb->active.action, arb->target);
+    }
+    arb_notify(arb, GATE_NOTE_RELAY_OFF, &arb->active, now);
+    if (err == ESP_OK) {
+        arb_update_state(arb, now);
+    } else {
+        fault(arb, now);
+    }
+    complete(&arb->active, err);
+}
+
+static void fire_waiting(gate_arbiter_t *arb, int64_t now)
+{
+    gate_request_t request = arb->next;
+    arb->waiting = false;
+    if (is_redundant(arb, request.action, now)) {
+        arb->stats.redundant++;
+        complete(&request, ESP_OK);
+        return;
+    }
+    pulse_start(arb, &request, now);
+}
+
+void gate_arbiter_init(gate_arbiter_t *arb, const gate_arbiter_config_t *config, int64_t now_us)
+{
+    memset(arb, 0, sizeof(*arb));
+    arb->config = *config;
+    arb->position_us = now_us;
+    arb->relay_off_us = now_us - config->timing.gap_ms * US_PER_MS;
+    arb->state = GATE_STATE_CLOSED;
+}
+
+/* A travel point under the old timing, on the new one. The end points of
+ * the travels map onto each other, anything in between proportionally. */
+static int64_t rescale(int64_t point, const gate_timing_t *from, const gate_timing_t *to)
+{
+    if (point == from->half_travel_ms * US_PER_MS) {
+        return to->half_travel_ms * US_PER_MS;
+    }
+    return point * to->full_travel_ms / from->full_travel_ms;
+}
+
+void gate_arbiter_set_timing(gate_arbiter_t *arb, const gate_timing_t *timing, int64_t now_us)
+{
+    arb_move(arb, now_us);
+    if (timing->full_travel_ms != arb->config.timing.full_travel_ms ||
+            timing->half_travel_ms != arb->config.timing.half_travel_ms) {
+        arb->position = rescale(arb->position, &arb->config.timing, timing);
+        arb->target = rescale(arb->target, &arb->config.timing, timing);
+    }
+    arb->config.timing = *timing;
+    arb_update_state(arb, now_us);
+}
+
+gate_verdict_t gate_arbiter_submit(gate_arbiter_t *arb, const gate_request_t *request, int64_t now_us)
+{
+    gate_arbiter_poll(arb, now_us);
+
+    if (is_redundant(arb, request->action, now_us)) {
+        arb->stats.redundant++;
+        complete(request, ESP_OK);
+        return GATE_VERDICT_REDUNDANT;
+    }
+    if (arb->relay_on || arb->waiting || now_us < arb->relay_off_us + arb->config.timing.gap_ms * US_PER_MS) {
+        if (arb->waiting) {
+            arb->stats.superseded++;
+            complete(&arb->next, ESP_ERR_INVALID_STATE);
+        }
+        arb->next = *request;
+        arb->waiting = true;
+        return GATE_VERDICT_WAITING;
+    }
+    return pulse_start(arb, request, now_us);
+}
+
+int64_t gate_arbiter_poll(gate_arbiter_t *arb, int64_t now_us)
+{
+    for (;;) {
+        int64_t pulse_due = 0;
+        if (arb->relay_on) {
+            pulse_due = arb->relay_off_us;
+        } else if (arb->waiting) {
+            pulse_due = arb->relay_off_us + arb->config.timing.gap_ms * US_PER_MS;
+        }
+        int64_t motion_due = 0;
+        if (arb->position != arb->target) {
+            int64_t distance = arb->target - arb->position;
+            motion_due = arb->position_us + (distance > 0 ? distance : -distance);
+        }
+
+        if (pulse_due && pulse_due <= now_us && (!motion_due || pulse_due <= motion_due)) {
+            /* The relay moves now, however late this call is */
+            if (arb->relay_on) {
+                pulse_end(arb, now_us);
+            } else {
+                fire_waiting(arb, now_us);
+            }
+        } else if (motion_due && motion_due <= now_us) {
+            arb_move(arb, motion_due);
+            arb_update_state(arb, motion_due);
+        } else if (pulse_due && motion_due) {
+            return pulse_due < motion_due ? pulse_due : motion_due;
+        } else {
+            return pulse_due ? pulse_due : motion_due;
+        }
+    }
+}
+
+gate_state_t gate_arbiter_state(const gate_arbiter_t *arb)
+{
+    return arb->state;
+}
+
+int64_t gate_arbiter_position(const gate_arbiter_t *arb, int64_t now_us)
+{
+    return travel_towards(arb->position, arb->target, now_us - arb->position_us);
+}
@@ -0,0 +1,42 @@
+#include "gate_hal.h"
+
+#include "driver/gpio.h"
+
+#if CONFIG_GATE_RELAY_ACTIVE_HIGH
+#define RELAY_ON    1
+#else
+#define RELAY_ON    0
+#endif
+#define RELAY_OFF   (!RELAY_ON)
+
+static const gpio_num_t s_relay_gpio[GATE_ACTION_MAX] = {
+    [GATE_ACTION_OPEN] = CONFIG_GATE_RELAY_OPEN_GPIO,
+    [GATE_ACTION_OPEN_HALF] = CONFIG_GATE_RELAY_HALF_GPIO,
+    [GATE_ACTION_CLOSE] = CONFIG_GATE_RELAY_CLOSE_GPIO,
+};
+
+static esp_err_t gpio_set_input(void *ctx, gate_action_t input, bool on)
+{
+    return gpio_set_level(s_relay_gpio[input], on ? RELAY_ON : RELAY_OFF);
+}
+
+esp_err_t gate_hal_gpio_init(gate_hal_t *hal)
+{
+    gpio_config_t io_conf = {
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    for (int i = 0; i < GATE_ACTION_MAX; i++) {
+        io_conf.pin_bit_mask |= 1ULL << s_relay_gpio[i];
+        gpio_set_level(s_relay_gpio[i], RELAY_OFF);
+    }
+    esp_err_t err = gpio_config(&io_conf);
+    if (err != ESP_OK) {
+        return err;
+    }
+    hal->set_input = gpio_set_input;
+    hal->ctx = NULL;
+    return ESP_OK;
+}
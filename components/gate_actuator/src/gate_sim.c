@@ -0,0 +1,125 @@
+#include "gate_sim.h"
+
+#include <string.h>
+#include "esp_timer.h"
+
+#define US_PER_MS 1000LL
+
+static int64_t sim_now(gate_sim_t *sim)
+{
+    return sim->config.clock ? sim->config.clock(sim->config.clock_ctx) : esp_timer_get_time();
+}
+
+/* Move the leaf towards its target up to now */
+static void sim_advance(gate_sim_t *sim, int64_t now)
+{
+    int64_t elapsed = now - sim->position_us;
+    if (elapsed > 0 && sim->position != sim->target) {
+        int64_t distance = sim->target - sim->position;
+        if (distance > elapsed) {
+            distance = elapsed;
+        } else if (distance < -elapsed) {
+            distance = -elapsed;
+        }
+        sim->position += distance;
+    }
+    sim->position_us = now;
+}
+
+static void sim_act(gate_sim_t *sim, gate_action_t input)
+{
+    int64_t full = sim->config.full_travel_ms * US_PER_MS;
+    switch (input) {
+    case GATE_ACTION_OPEN:
+        sim->target = full;
+        break;
+    case GATE_ACTION_OPEN_HALF:
+        if (sim->target != full) {
+            sim->target = sim->config.half_travel_ms * US_PER_MS;
+        }
+        break;
+    default:
+        sim->target = 0;
+        break;
+    }
+}
+
+static esp_err_t sim_set_input(void *ctx, gate_action_t input, bool on)
+{
+    gate_sim_t *sim = ctx;
+    int64_t now = sim_now(sim);
+
+    if (on && sim->fail_next) {
+        sim->fail_next--;
+        sim->stats.failures++;
+        return ESP_FAIL;
+    }
+    if (input >= GATE_ACTION_MAX || sim->input[input] == on) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sim_advance(sim, now);
+    sim->input[input] = on;
+
+    if (on) {
+        for (int i = 0; i < GATE_ACTION_MAX; i++) {
+            if (i != (int)input && sim->input[i]) {
+                sim->stats.overlaps++;
+            }
+        }
+        sim->pressed_us[input] = now;
+        sim->idle_us[input] = now - sim->released_us;
+        return ESP_OK;
+    }
+
+    sim->released_us = now;
+    if (now - sim->pressed_us[input] < sim->config.min_pulse_ms * US_PER_MS) {
+        sim->stats.short_pulses++;
+    } else if (sim->idle_us[input] < sim->config.min_gap_ms * US_PER_MS) {
+        sim->stats.early_pulses++;
+    } else {
+        sim->stats.accepted++;
+        sim_act(sim, input);
+    }
+    return ESP_OK;
+}
+
+void gate_sim_init(gate_sim_t *sim, const gate_sim_config_t *config)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->config = *config;
+    sim->position_us = sim_now(sim);
+    /* Long idle before the first pulse */
+    sim->released_us = sim->position_us - (config->min_gap_ms + 1) * US_PER_MS;
+}
+
+void gate_sim_hal(gate_sim_t *sim, gate_hal_t *hal)
+{
+    hal->set_input = sim_set_input;
+    hal->ctx = sim;
+}
+
+void gate_sim_fail_next(gate_sim_t *sim, uint32_t count)
+{
+    sim->fail_next = count;
+}
+
+gate_state_t gate_sim_state(gate_sim_t *sim)
+{
+    sim_advance(sim, sim_now(sim));
+    if (sim->position < sim->target) {
+        return GATE_STATE_OPENING;
+    }
+    if (sim->position > sim->target) {
+        return GATE_STATE_CLOSING;
+    }
+    if (sim->position == 0) {
+        return GATE_STATE_CLOSED;
+    }
+    return sim->position == sim->config.full_travel_ms * US_PER_MS ? GATE_STATE_OPEN : GATE_STATE_HALF;
+}
+
+int64_t gate_sim_position(gate_sim_t *sim)
+{
+    sim_advance(sim, sim_now(sim));
+    return sim->position;
+}
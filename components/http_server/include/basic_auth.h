@@ -1,10 +1,13 @@
 #ifndef BASIC_AUTH
 #define BASIC_AUTH
 
-typedef struct {
-    char    *username;
-    char    *password;
-} basic_auth_info_t;
+#include "esp_err.h"
+#include <esp_http_server.h>
+
+/* Precompute the expected Authorization header from the credentials in
+ * settings. Call before serving requests; later changes to the settings
+ * are picked up by the next request. */
+esp_err_t basic_auth_init(void);
 
 esp_err_t basic_auth_handler(httpd_req_t *req);
 
@@ -1,11 +1,54 @@
 #ifndef BASIC_HTTP_SERVER
 #define BASIC_HTTP_SERVER
 
+#include <stdint.h>
 #include "esp_err.h"
 
+/* Counters for the precompressed static assets */
+typedef struct {
+    uint32_t requests;      /* asset GETs that passed authentication */
+    uint32_t not_modified;  /* requests answered with 304 from the client's cache */
+    uint64_t bytes_sent;    /* body bytes actually sent */
+    uint64_t bytes_saved;   /* bytes not sent thanks to gzip and 304s */
+    uint32_t not_acceptable;            /* gzip-only asset, client does not take gzip: 406 */
+    uint32_t ui_loads;                  /* page loads reported by the web UI */
+    uint32_t ui_last_tti_ms;            /* navigation until the UI was usable */
+    uint32_t ui_last_transfer_bytes;    /* bytes the browser fetched for it */
+} rest_asset_stats_t;
+
+/* Counters for the WebSocket push channel */
+typedef struct {
+    uint32_t subscribers;   /* WebSocket clients at the last broadcast */
+    uint32_t frames;        /* events broadcast */
+    uint32_t dropped;       /* events lost: out of memory, too large or server queue full */
+    uint32_t sends;         /* frames handed to a subscriber socket */
+    uint32_t send_errors;   /* failed sends, the subscriber is disconnected */
+    uint32_t last_fanout_us;    /* event serialised -> sent to every subscriber */
+    uint32_t max_fanout_us;
+    uint64_t total_fanout_us;
+} rest_push_stats_t;
+
+/* Web server start/stop cycles */
+typedef struct {
+    uint32_t starts;
+    uint32_t stops;
+    uint32_t refused;               /* connections closed while stopped */
+    uint32_t last_start_us;         /* start_rest_server() until accepting */
+    uint32_t max_start_us;
+    uint32_t last_stop_us;
+    uint32_t stop_timeouts;         /* stops given up, workers still busy */
+} rest_lifecycle_stats_t;
+
 esp_err_t start_rest_server(void);
+/* Refuses new connections, waits up to CONFIG_HTTP_STOP_TIMEOUT_MS for the
+ * requests in flight, then closes every connection. ESP_ERR_TIMEOUT if the
+ * requests did not finish: the server is then left running. */
 esp_err_t stop_rest_server(void);
-esp_err_t init_fs(void);
+/* Map the web UI asset bundle, before the first start */
+esp_err_t init_assets(void);
+void rest_get_asset_stats(rest_asset_stats_t *out);
+void rest_get_push_stats(rest_push_stats_t *out);
+void rest_get_lifecycle_stats(rest_lifecycle_stats_t *out);
 
 
 #endif /* BASIC_HTTP_SERVER */
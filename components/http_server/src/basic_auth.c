@@ -1,69 +1,218 @@
+#include <string.h>
 #include "esp_tls_crypto.h"
 #include <esp_http_server.h>
 #include "basic_auth.h"
+#include "dlog.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "metrics.h"
+#include "settings.h"
 
 static const char *TAG = "HTTP_AUTH";
 
 #define HTTPD_401      "401 UNAUTHORIZED"           /*!< HTTP Response 401 */
 
-static char *http_auth_basic(const char *username, const char *password)
+#define AUTH_USERNAME_MAX    (sizeof(((settings_t *)0)->http_username) - 1)
+#define AUTH_PASSWORD_MAX    (sizeof(((settings_t *)0)->http_password) - 1)
+/* "Basic " + base64("user:pass") + NUL */
+#define AUTH_DIGEST_MAX      (6 + 4 * ((AUTH_USERNAME_MAX + 1 + AUTH_PASSWORD_MAX + 2) / 3) + 1)
+
+#define SESSION_COOKIE       "sid"
+#define SESSION_TOKEN_LEN    32
+#define SESSION_TTL_US       ((int64_t)CONFIG_HTTP_AUTH_SESSION_TTL_S * 1000000)
+/* Cookie header bytes looked at: room for a few cookies besides ours */
+#define SESSION_COOKIES_MAX  160
+
+typedef struct {
+    char token[SESSION_TOKEN_LEN + 1];
+    int64_t expires_us;
+    /* Kept with the slot because httpd only stores the header pointer */
+    char set_cookie[SESSION_TOKEN_LEN + 80];
+} auth_session_t;
+
+/* Expected Authorization header value, recomputed when the credentials
+ * change; only touched from the httpd task */
+static char s_expected_digest[AUTH_DIGEST_MAX];
+static size_t s_expected_len = 0;
+static uint32_t s_settings_generation;
+
+static auth_session_t s_sessions[CONFIG_HTTP_AUTH_SESSION_SLOTS];
+/* The slot handed out last, see session_issue() */
+static auth_session_t *s_newest_session;
+
+static metrics_hist_t s_auth_hist = METRICS_HIST_INIT("http_auth_seconds", "Authentication check of a request");
+static metrics_counter_t s_auth_failures = METRICS_COUNTER_INIT("http_auth_failures_total", "Requests answered with 401");
+
+/* Compare without an early exit so the timing does not leak the match length */
+static bool ct_equal(const char *a, const char *b, size_t len)
 {
-    int out;
-    char *user_info = NULL;
-    char *digest = NULL;
-    size_t n = 0;
-    asprintf(&user_info, "%s:%s", username, password);
-    esp_crypto_base64_encode(NULL, 0, &n, (const unsigned char *)user_info, strlen(user_info));
-    digest = calloc(1, 6 + n + 1);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= (uint8_t)a[i] ^ (uint8_t)b[i];
+    }
+    return diff == 0;
+}
+
+/* Precompute the expected Authorization header from the current credentials.
+ * Called on every settings change, but only a change of the credentials
+ * themselves invalidates the verified sessions. */
+static esp_err_t load_credentials(const settings_t *settings)
+{
+    char user_info[AUTH_USERNAME_MAX + 1 + AUTH_PASSWORD_MAX + 1];
+    char digest[AUTH_DIGEST_MAX];
+    int info_len = snprintf(user_info, sizeof(user_info), "%s:%s", settings->http_username, settings->http_password);
+    s_settings_generation = settings->generation;
+
+    size_t out = 0;
     strcpy(digest, "Basic ");
-    esp_crypto_base64_encode((unsigned char *)digest + 6, n, (size_t *)&out, (const unsigned char *)user_info, strlen(user_info));
-    free(user_info);
-    return digest;
+    int ret = esp_crypto_base64_encode((unsigned char *)digest + 6, sizeof(digest) - 6, &out,
+                                       (const unsigned char *)user_info, info_len);
+    memset(user_info, 0, sizeof(user_info));
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to encode credentials");
+        s_expected_len = 0;
+        memset(s_sessions, 0, sizeof(s_sessions));
+        return ESP_FAIL;
+    }
+
+    size_t len = 6 + out;
+    digest[len] = '\0';
+    if (len != s_expected_len || !ct_equal(digest, s_expected_digest, len)) {
+        memcpy(s_expected_digest, digest, len + 1);
+        s_expected_len = len;
+        memset(s_sessions, 0, sizeof(s_sessions));
+    }
+    memset(digest, 0, sizeof(digest));
+    return ESP_OK;
 }
 
-/* An HTTP GET handler for HTTP basic authentication*/
-esp_err_t basic_auth_handler(httpd_req_t *req)
+esp_err_t basic_auth_init(void)
+{
+    const settings_t *settings = settings_acquire();
+    esp_err_t err = load_credentials(settings);
+    settings_release(settings);
+
+    metrics_register_hist(&s_auth_hist);
+    metrics_register_counter(&s_auth_failures);
+    return err;
+}
+
+/* Find the session token in the Cookie header. httpd_req_get_cookie_val()
+ * would malloc a copy of the header on every request, so it is read into
+ * a stack buffer instead; a token cut off by truncation is not a match. */
+static const char *session_token(httpd_req_t *req, char *cookies, size_t size)
+{
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Cookie", cookies, size);
+    if (err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return NULL;
+    }
+    char *save;
+    for (char *pair = strtok_r(cookies, ";", &save); pair; pair = strtok_r(NULL, ";", &save)) {
+        pair += strspn(pair, " ");
+        if (strncmp(pair, SESSION_COOKIE "=", strlen(SESSION_COOKIE "=")) == 0) {
+            const char *token = pair + strlen(SESSION_COOKIE "=");
+            return strlen(token) == SESSION_TOKEN_LEN ? token : NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Look the request's session cookie up in the verified-session cache */
+static bool session_valid(httpd_req_t *req, int64_t now)
 {
-    char *buf = NULL;
-    size_t buf_len = 0;
-    basic_auth_info_t *basic_auth_info = calloc(1, sizeof(basic_auth_info_t));
-    basic_auth_info->username = "esp";
-    basic_auth_info->password = "12346";
-
-    buf_len = httpd_req_get_hdr_value_len(req, "Authorization") + 1;
-    if (buf_len > 1) {
-        buf = calloc(1, buf_len);
-        if (httpd_req_get_hdr_value_str(req, "Authorization", buf, buf_len) == ESP_OK) {
-            ESP_LOGI(TAG, "Found header => Authorization: %s", buf);
-        } else {
-            ESP_LOGE(TAG, "No auth value received");
+    char cookies[SESSION_COOKIES_MAX];
+    const char *token = session_token(req, cookies, sizeof(cookies));
+    if (!token) {
+        return false;
+    }
+
+    bool found = false;
+    for (int i = 0; i < CONFIG_HTTP_AUTH_SESSION_SLOTS; i++) {
+        bool live = s_sessions[i].expires_us > now;
+        found |= live && ct_equal(s_sessions[i].token, token, SESSION_TOKEN_LEN);
+    }
+    return found;
+}
+
+/* Give a freshly verified client a session cookie. There is one set of
+ * credentials, so the newest session is handed out again while it has more
+ * than half its life left: clients that never send the cookie back (curl -u,
+ * the load generator) then take one slot per half TTL instead of one per
+ * request, and cannot evict the sessions of the browsers. */
+static void session_issue(httpd_req_t *req, int64_t now)
+{
+    auth_session_t *slot = s_newest_session;
+    if (!slot || slot->expires_us - now <= SESSION_TTL_US / 2) {
+        /* Evict the slot closest to expiry */
+        slot = &s_sessions[0];
+        for (int i = 1; i < CONFIG_HTTP_AUTH_SESSION_SLOTS; i++) {
+            if (s_sessions[i].expires_us < slot->expires_us) {
+                slot = &s_sessions[i];
+            }
         }
 
-        char *auth_credentials = http_auth_basic(basic_auth_info->username, basic_auth_info->password);
-        if (strncmp(auth_credentials, buf, buf_len)) {
-            ESP_LOGE(TAG, "Not authenticated");
-            httpd_resp_set_status(req, HTTPD_401);
-            httpd_resp_set_type(req, "application/json");
-            httpd_resp_set_hdr(req, "Connection", "keep-alive");
-            httpd_resp_set_hdr(req, "WWW-Authenticate", "Basic realm=\"Hello\"");
-            httpd_resp_send(req, NULL, 0);
-            free(auth_credentials);
-            free(buf);
-            return ESP_FAIL;
-        } else {
-            ESP_LOGI(TAG, "Authenticated!");
-            free(auth_credentials);
-            free(buf);
-            return ESP_OK;
+        uint8_t raw[SESSION_TOKEN_LEN / 2];
+        esp_fill_random(raw, sizeof(raw));
+        for (size_t i = 0; i < sizeof(raw); i++) {
+            snprintf(&slot->token[i * 2], 3, "%02x", raw[i]);
         }
-    } else {
-        ESP_LOGE(TAG, "No auth header received");
-        httpd_resp_set_status(req, HTTPD_401);
-        httpd_resp_set_type(req, "application/json");
-        httpd_resp_set_hdr(req, "Connection", "keep-alive");
-        httpd_resp_set_hdr(req, "WWW-Authenticate", "Basic realm=\"Hello\"");
-        httpd_resp_send(req, NULL, 0);
-        return ESP_FAIL; // <-- Return ESP_FAIL if no header
+        slot->expires_us = now + SESSION_TTL_US;
+        snprintf(slot->set_cookie, sizeof(slot->set_cookie),
+                 SESSION_COOKIE "=%s; Path=/; Max-Age=%d; HttpOnly; SameSite=Strict",
+                 slot->token, CONFIG_HTTP_AUTH_SESSION_TTL_S);
+        s_newest_session = slot;
+    }
+    httpd_resp_set_hdr(req, "Set-Cookie", slot->set_cookie);
+}
+
+static esp_err_t send_unauthorized(httpd_req_t *req)
+{
+    httpd_resp_set_status(req, HTTPD_401);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Connection", "keep-alive");
+    httpd_resp_set_hdr(req, "WWW-Authenticate", "Basic realm=\"Hello\"");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_FAIL;
+}
+
+static esp_err_t basic_auth_check(httpd_req_t *req, int64_t now)
+{
+    const settings_t *settings = settings_acquire();
+    if (settings->generation != s_settings_generation) {
+        load_credentials(settings);
     }
-}
\ No newline at end of file
+    settings_release(settings);
+
+    if (session_valid(req, now)) {
+        return ESP_OK;
+    }
+
+    /* One spare byte so a longer header than expected is detected as truncated */
+    char buf[AUTH_DIGEST_MAX + 1];
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Authorization", buf, sizeof(buf));
+    if (err == ESP_ERR_NOT_FOUND) {
+        DLOG(HTTP_AUTH_NO_HEADER);
+        return send_unauthorized(req);
+    }
+    if (err != ESP_OK || s_expected_len == 0 || strlen(buf) != s_expected_len ||
+            !ct_equal(buf, s_expected_digest, s_expected_len)) {
+        DLOG(HTTP_AUTH_DENIED);
+        return send_unauthorized(req);
+    }
+
+    session_issue(req, now);
+    return ESP_OK;
+}
+
+/* An HTTP GET handler for HTTP basic authentication*/
+esp_err_t basic_auth_handler(httpd_req_t *req)
+{
+    int64_t now = esp_timer_get_time();
+    esp_err_t err = basic_auth_check(req, now);
+    metrics_observe_since(&s_auth_hist, now);
+    if (err != ESP_OK) {
+        metrics_inc(&s_auth_failures);
+    }
+    return err;
+}
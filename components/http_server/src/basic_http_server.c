@@ -1,15 +1,34 @@
 #include "basic_http_server.h"
 
+#include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_event.h"
 #include "esp_http_server.h"
-#include "esp_chip_info.h"
-#include "esp_random.h"
 #include "esp_log.h"
-#include "esp_vfs.h"s
-#include "cJSON.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "basic_auth.h"
-#include "esp_spiffs.h"
+#include "json_stream.h"
+#include "json_writer.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_wifi.h"
+#endif
+#include "access_log.h"
+#include "asset_bundle.h"
+#include "boot_trace.h"
+#include "dlog.h"
+#include "gate_actuator.h"
+#include "metrics.h"
+#include "settings.h"
+#include "whitelist.h"
 
 
 static const char *REST_TAG = "rest-server";
@@ -34,227 +53,1654 @@ static const char *REST_TAG = "rest-server";
         }                                                                              \
     } while (0)
 
-#define WEB_MOUNT_POINT "/assets/pages"
+#if CONFIG_IDF_TARGET_LINUX
+/* Host build: the bundle is mapped straight from the build directory */
+#define ASSET_BUNDLE_SOURCE HTTP_HOST_ASSET_BUNDLE
+#else
+#define ASSET_BUNDLE_SOURCE "assets"
+#endif
 
-#define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
 #define SCRATCH_BUFSIZE (10240)
+/* Output buffer of JSON responses written on the server task; anything
+ * longer goes out in chunks of this size */
+#define JSON_CHUNK_BUFSIZE 512
+#define REST_WORKERS CONFIG_HTTP_ASYNC_WORKERS
+#define REST_WORK_QUEUE_LEN (REST_WORKERS * 2)
+/* Set by the worker that finishes the last request in flight */
+#define REST_WORK_IDLE (1 << 0)
+/* Gate commands are tiny and handled inline on the server task */
+#define GATE_RECV_WINDOW 64
+#define GATE_BODY_MAX 256
+
+/* Page load report of the web UI, a couple of numbers */
+#define UI_STATS_RECV_WINDOW 64
+#define UI_STATS_BODY_MAX 128
+
+#define SETTINGS_RECV_WINDOW 128
+#define SETTINGS_BODY_MAX 4096
+/* Rejected element indices reported back by the bulk import */
+#define IMPORT_REJECTED_MAX 8
+/* The whitelist listing splits the worker's scratch buffer: JSON output in
+ * front, a batch of entries copied out of the whitelist behind it */
+#define WHITELIST_JSON_BUFSIZE 2048
+#define WHITELIST_COPY_BATCH ((SCRATCH_BUFSIZE - WHITELIST_JSON_BUFSIZE) / sizeof(whitelist_entry_t))
+/* Access log entries per page; the records are staged on the worker stack */
+#define LOG_PAGE_DEFAULT 20
+#define LOG_PAGE_MAX 25
 
 typedef struct rest_server_context {
-    char base_path[ESP_VFS_PATH_MAX + 1];
-    char scratch[SCRATCH_BUFSIZE];
+    const asset_bundle_t *assets;
 } rest_server_context_t;
 
-#define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
+/* Second half of a handler, run on a worker with the worker's own buffer */
+typedef esp_err_t (*rest_work_fn_t)(httpd_req_t *req, const void *arg, char *scratch);
+
+typedef struct {
+    httpd_req_t *req;           /* async copy, completed by the worker */
+    rest_work_fn_t fn;
+    const void *arg;
+    metrics_hist_t *hist;       /* optional, observes start_us -> completion */
+    int64_t start_us;
+} rest_work_t;
+
+typedef struct {
+    TaskHandle_t task;
+    char scratch[SCRATCH_BUFSIZE];
+} rest_worker_t;
+
+#define ASSET_IMMUTABLE_CACHE "public, max-age=31536000, immutable"
+#define ASSET_REVALIDATE_CACHE "no-cache"
+
+/* Mapped once by init_assets(), never copied */
+static asset_bundle_t s_assets;
+static rest_asset_stats_t s_asset_stats;
+static metrics_hist_t s_static_hist = METRICS_HIST_INIT("http_static_seconds",
+                                                        "Static file requests, from handler entry to the last byte");
+static metrics_hist_t s_ui_tti_hist = METRICS_HIST_INIT("http_ui_tti_seconds",
+                                                        "Web UI page loads, navigation until usable, as the browser saw it");
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
 
-/* add persistent server/context handles so stop_rest_server can free context */
+/* Workers and their buffers are static, started once and kept across
+ * server restarts */
+static rest_worker_t s_workers[REST_WORKERS];
+static StaticQueue_t s_work_queue_buf;
+static uint8_t s_work_queue_storage[REST_WORK_QUEUE_LEN * sizeof(rest_work_t)];
+static QueueHandle_t s_work_queue = NULL;
+static StaticEventGroup_t s_work_events_buf;
+static EventGroupHandle_t s_work_events = NULL;
+static volatile uint32_t s_work_inflight = 0;
+
+/* With CONFIG_HTTP_RESIDENT_SERVER the httpd instance is created by the
+ * first start and kept: stop and start only close and reopen the door */
 static httpd_handle_t s_server_handle = NULL;
-static rest_server_context_t *s_rest_context = NULL;
+static rest_server_context_t s_rest_context = { .assets = &s_assets };
+static volatile bool s_listening = false;
+static rest_lifecycle_stats_t s_lifecycle_stats;
 
-esp_err_t init_fs(void)
+esp_err_t init_assets(void)
 {
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = WEB_MOUNT_POINT,
-        .partition_label = NULL,
-        .max_files = 5,
-        .format_if_mount_failed = false
-    };
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    esp_err_t err = asset_bundle_map(ASSET_BUNDLE_SOURCE, &s_assets);
+    if (err != ESP_OK) {
+        ESP_LOGE(REST_TAG, "Failed to map the asset bundle (%s)", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(REST_TAG, "Serving %u precompressed assets, %lu bytes mapped", s_assets.count,
+             (unsigned long)s_assets.size);
+    return ESP_OK;
+}
 
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(REST_TAG, "Failed to mount or format filesystem");
-        } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(REST_TAG, "Failed to find SPIFFS partition");
-        } else {
-            ESP_LOGE(REST_TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
+/* Feed the request body through the JSON tokenizer as it arrives. buf is
+ * only the receive window, the body itself can be of any size. */
+static esp_err_t rest_recv_json(httpd_req_t *req, char *buf, size_t buf_size, json_stream_t *js)
+{
+    size_t remaining = req->content_len;
+    while (remaining > 0) {
+        int received = httpd_req_recv(req, buf, remaining < buf_size ? remaining : buf_size);
+        if (received <= 0) {
+            /* Respond with 500 Internal Server Error */
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post input!");
+            return ESP_FAIL;
+        }
+        remaining -= received;
+
+        esp_err_t err = json_stream_feed(js, buf, received);
+        if (err != ESP_OK) {
+            DLOG(HTTP_JSON_INVALID, (unsigned)js->offset, esp_err_to_name(err));
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+            return ESP_FAIL;
         }
+    }
+    if (json_stream_finish(js) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Incomplete JSON");
         return ESP_FAIL;
     }
+    return ESP_OK;
+}
 
-    size_t total = 0, used = 0;
-    ret = esp_spiffs_info(NULL, &total, &used);
-    if (ret != ESP_OK) {
-        ESP_LOGE(REST_TAG, "Failed to get SPIFFS partition information (%s)", esp_err_to_name(ret));
-    } else {
-        ESP_LOGI(REST_TAG, "Partition size: total: %d, used: %d", total, used);
+static esp_err_t rest_json_flush(void *ctx, const char *data, size_t len)
+{
+    return httpd_resp_send_chunk(ctx, data, len);
+}
+
+/* Start a JSON response written through buf: the writer streams it out in
+ * chunks whenever buf fills up, no tree and no copy of the whole text */
+static void rest_json_begin(httpd_req_t *req, json_writer_t *w, char *buf, size_t size)
+{
+    httpd_resp_set_type(req, "application/json");
+    json_writer_init(w, buf, size, rest_json_flush, req);
+}
+
+/* A response that fit in the buffer goes out in one piece with its length,
+ * the others end their chunked encoding */
+static esp_err_t rest_json_end(httpd_req_t *req, json_writer_t *w)
+{
+    esp_err_t err = json_writer_finish(w);
+    if (err == ESP_OK && w->flushed == 0) {
+        return httpd_resp_send(req, w->buf, w->len);
+    }
+    if (err == ESP_OK) {
+        err = json_writer_flush(w);
+    }
+    if (err != ESP_OK) {
+        DLOG(HTTP_JSON_WRITE_FAILED, (unsigned)(w->flushed + w->len), esp_err_to_name(err));
+        /* Once chunks are out the status line is gone: drop the connection */
+        return w->flushed == 0 ? httpd_resp_send_500(req) : ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* A request taken by rest_async_submit_timed() is over */
+static void rest_work_done(void)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    bool idle = --s_work_inflight == 0;
+    portEXIT_CRITICAL(&s_stats_lock);
+    if (idle) {
+        xEventGroupSetBits(s_work_events, REST_WORK_IDLE);
+    }
+}
+
+static void rest_worker_task(void *arg)
+{
+    rest_worker_t *worker = arg;
+    rest_work_t work;
+
+    for (;;) {
+        if (xQueueReceive(s_work_queue, &work, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        work.fn(work.req, work.arg, worker->scratch);
+        httpd_req_async_handler_complete(work.req);
+        if (work.hist) {
+            metrics_observe_since(work.hist, work.start_us);
+        }
+
+        rest_work_done();
+    }
+}
+
+static esp_err_t rest_workers_start(unsigned priority)
+{
+    if (s_work_queue) {
+        return ESP_OK;
+    }
+
+    s_work_queue = xQueueCreateStatic(REST_WORK_QUEUE_LEN, sizeof(rest_work_t), s_work_queue_storage,
+                                      &s_work_queue_buf);
+    s_work_events = xEventGroupCreateStatic(&s_work_events_buf);
+    for (int i = 0; i < REST_WORKERS; i++) {
+        if (xTaskCreate(rest_worker_task, "httpd_worker", 4096, &s_workers[i], priority, &s_workers[i].task) != pdPASS) {
+            ESP_LOGE(REST_TAG, "Failed to create worker %d", i);
+            return ESP_ERR_NO_MEM;
+        }
     }
     return ESP_OK;
 }
 
-/* Helper function to process POST requests into a string*/
-static esp_err_t process_post_helper(httpd_req_t *req, char* buf)
+/* Hand the rest of a request over to the worker pool; the server task goes
+ * back to its other sockets while a worker talks to this client. When hist
+ * is set the worker records the time since start_us once it is done. */
+static esp_err_t rest_async_submit_timed(httpd_req_t *req, rest_work_fn_t fn, const void *arg,
+                                         metrics_hist_t *hist, int64_t start_us)
 {
-    int total_len = req->content_len;
-    int cur_len = 0;
-    buf = ((rest_server_context_t *)(req->user_ctx))->scratch;
-    int received = 0;
-    if (total_len >= SCRATCH_BUFSIZE) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Content too long!");
-        buf = NULL;
-        return ESP_FAIL;
+    /* Only the server task queues work, so a free slot stays free. The
+     * slot is taken under the lock stop_rest_server() closes the door
+     * with: once it has, nothing new reaches the workers it drains. */
+    bool space = uxQueueSpacesAvailable(s_work_queue) > 0;
+    portENTER_CRITICAL(&s_stats_lock);
+    bool accept = s_listening && space;
+    if (accept) {
+        s_work_inflight++;
     }
-    while (cur_len < total_len) {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
-        if (received <= 0) {
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post input!");
-            memset(buf,0,SCRATCH_BUFSIZE);
-            buf = NULL;
-            return ESP_FAIL;
+    portEXIT_CRITICAL(&s_stats_lock);
+    if (!accept) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        if (!s_listening) {
+            httpd_resp_set_hdr(req, "Connection", "close");
         }
-        cur_len += received;
+        return httpd_resp_sendstr(req, s_listening ? "Server busy" : "Server stopping");
+    }
+
+    rest_work_t work = { .fn = fn, .arg = arg, .hist = hist, .start_us = start_us };
+    if (httpd_req_async_handler_begin(req, &work.req) != ESP_OK) {
+        rest_work_done();
+        return httpd_resp_send_500(req);
     }
-    buf[total_len] = '\0';
+    xQueueSend(s_work_queue, &work, 0);
     return ESP_OK;
 }
 
-/* Set HTTP response content type according to file extension */
-static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepath)
+/* Wait for the workers to finish every request in flight. Nothing is
+ * submitted once the server stops listening, but a wake-up can be left
+ * over from an earlier stop: the idle bit is cleared before each look. */
+static esp_err_t rest_workers_drain(uint32_t timeout_ms)
 {
-    const char *type = "text/plain";
-    if (CHECK_FILE_EXTENSION(filepath, ".html")) {
-        type = "text/html";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".js")) {
-        type = "application/javascript";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".css")) {
-        type = "text/css";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".png")) {
-        type = "image/png";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".ico")) {
-        type = "image/x-icon";
-    } else if (CHECK_FILE_EXTENSION(filepath, ".svg")) {
-        type = "text/xml";
+    int64_t deadline_us = esp_timer_get_time() + timeout_ms * 1000LL;
+
+    for (;;) {
+        xEventGroupClearBits(s_work_events, REST_WORK_IDLE);
+        if (s_work_inflight == 0) {
+            return ESP_OK;
+        }
+        int64_t left_us = deadline_us - esp_timer_get_time();
+        if (left_us <= 0) {
+            return ESP_ERR_TIMEOUT;
+        }
+        xEventGroupWaitBits(s_work_events, REST_WORK_IDLE, pdTRUE, pdTRUE, pdMS_TO_TICKS(left_us / 1000) + 1);
     }
-    return httpd_resp_set_type(req, type);
+}
+
+static esp_err_t rest_async_submit(httpd_req_t *req, rest_work_fn_t fn, const void *arg)
+{
+    return rest_async_submit_timed(req, fn, arg, NULL, 0);
+}
+
+/* IPv4 address of the client in host byte order, 0 if unknown. The server
+ * listens on an IPv6 socket, so IPv4 peers show up as mapped addresses. */
+static uint32_t rest_client_ipv4(httpd_req_t *req)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    uint32_t ip = 0;
+
+    if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &len) != 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        ip = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    } else if (addr.ss_family == AF_INET6) {
+        memcpy(&ip, &((struct sockaddr_in6 *)&addr)->sin6_addr.s6_addr[12], sizeof(ip));
+    }
+    return ntohl(ip);
+}
+
+/* Check whether the client already holds the current version of the asset */
+static bool asset_not_modified(httpd_req_t *req, const asset_bundle_index_t *asset)
+{
+    char if_none_match[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) != ESP_OK) {
+        return false;
+    }
+    return strstr(if_none_match, asset_bundle_str(&s_assets, asset->etag)) != NULL;
+}
+
+/* Check whether the client takes gzip: listed, or covered by "*", and not
+ * with q=0. No Accept-Encoding header is a no, so that curl and scripts
+ * that do not ask for it get no compressed body. */
+static bool asset_gzip_accepted(httpd_req_t *req)
+{
+    char accept[96];
+    bool any = false;
+
+    /* A truncated header still holds the codings the browsers list first */
+    esp_err_t err = httpd_req_get_hdr_value_str(req, "Accept-Encoding", accept, sizeof(accept));
+    if (err != ESP_OK && err != ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return false;
+    }
+    char *save;
+    for (char *coding = strtok_r(accept, ",", &save); coding; coding = strtok_r(NULL, ",", &save)) {
+        coding += strspn(coding, " \t");
+        size_t len = strcspn(coding, " \t;");
+        const char *q = strstr(coding + len, "q=");
+        bool allowed = !q || strtod(q + 2, NULL) > 0;
+        if (len == 4 && strncasecmp(coding, "gzip", len) == 0) {
+            return allowed;
+        }
+        if (len == 1 && coding[0] == '*') {
+            any = allowed;
+        }
+    }
+    return any;
+}
+
+void rest_get_asset_stats(rest_asset_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_asset_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+static void asset_set_headers(httpd_req_t *req, const asset_bundle_index_t *asset)
+{
+    httpd_resp_set_hdr(req, "ETag", asset_bundle_str(&s_assets, asset->etag));
+    /* The body depends on Accept-Encoding: caches must not hand the gzip
+     * one to a client that did not ask for it */
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    httpd_resp_set_hdr(req, "Cache-Control",
+                       asset->flags & ASSET_FLAG_REVALIDATE ? ASSET_REVALIDATE_CACHE : ASSET_IMMUTABLE_CACHE);
+}
+
+/* Worker half of rest_common_get_handler: the body goes out straight from
+ * the mapped bundle, the scratch buffer is not needed */
+static esp_err_t rest_send_asset(httpd_req_t *req, const void *arg, char *scratch)
+{
+    const asset_bundle_index_t *asset = arg;
+
+    asset_set_headers(req, asset);
+    httpd_resp_set_type(req, asset_bundle_str(&s_assets, asset->mime));
+    /* Only sent to clients that accept it, see rest_common_get_handler */
+    if (asset->flags & ASSET_FLAG_GZIP) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+
+    esp_err_t ret = httpd_resp_send(req, (const char *)asset_bundle_data(&s_assets, asset), asset->stored_len);
+    if (ret != ESP_OK) {
+        DLOG(HTTP_ASSET_SEND);
+        return ret;
+    }
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_asset_stats.bytes_sent += asset->stored_len;
+    s_asset_stats.bytes_saved += asset->raw_len - asset->stored_len;
+    portEXIT_CRITICAL(&s_stats_lock);
+    DLOG(HTTP_ASSET_SENT);
+    return ESP_OK;
 }
 
 /* Send HTTP response with the contents of the requested file */
 static esp_err_t rest_common_get_handler(httpd_req_t *req)
 {
+    int64_t start_us = esp_timer_get_time();
     if (basic_auth_handler(req) != ESP_OK) {
         // Authentication failed, response already sent by basic_auth_handler
+        metrics_observe_since(&s_static_hist, start_us);
+        return ESP_FAIL;
+    }
+
+    /* The query string only carries the cache-busting version */
+    const char *uri = req->uri;
+    size_t uri_len = strcspn(uri, "?#");
+    const asset_bundle_index_t *asset;
+    if (uri_len == 0 || uri[uri_len - 1] == '/') {
+        asset = asset_bundle_find(&s_assets, "/index.html", strlen("/index.html"));
+    } else {
+        asset = asset_bundle_find(&s_assets, uri, uri_len);
+    }
+    if (!asset) {
+        DLOG(HTTP_ASSET_MISSING, uri);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        metrics_observe_since(&s_static_hist, start_us);
+        return ESP_FAIL;
+    }
+
+    /* The bundle holds the gzip body only: there is nothing else to offer */
+    bool not_acceptable = (asset->flags & ASSET_FLAG_GZIP) && !asset_gzip_accepted(req);
+    bool not_modified = !not_acceptable && asset_not_modified(req, asset);
+    portENTER_CRITICAL(&s_stats_lock);
+    s_asset_stats.requests++;
+    if (not_acceptable) {
+        s_asset_stats.not_acceptable++;
+    }
+    if (not_modified) {
+        s_asset_stats.not_modified++;
+        s_asset_stats.bytes_saved += asset->raw_len;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    if (not_acceptable) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        httpd_resp_set_status(req, "406 Not Acceptable");
+        esp_err_t ret = httpd_resp_sendstr(req, "Only available gzip-encoded");
+        metrics_observe_since(&s_static_hist, start_us);
+        return ret;
+    }
+    if (not_modified) {
+        asset_set_headers(req, asset);
+        httpd_resp_set_status(req, "304 Not Modified");
+        esp_err_t ret = httpd_resp_send(req, NULL, 0);
+        metrics_observe_since(&s_static_hist, start_us);
+        return ret;
+    }
+    return rest_async_submit_timed(req, rest_send_asset, asset, &s_static_hist, start_us);
+}
+
+/* Send HTTP Response with the static asset counters */
+static esp_err_t asset_stats_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
         return ESP_FAIL;
     }
 
-    char filepath[FILE_PATH_MAX];
+    rest_asset_stats_t stats;
+    rest_get_asset_stats(&stats);
+
+    char buf[JSON_CHUNK_BUFSIZE];
+    json_writer_t w;
+    rest_json_begin(req, &w, buf, sizeof(buf));
+    json_writer_object_begin(&w);
+    json_writer_field_uint(&w, "requests", stats.requests);
+    json_writer_field_uint(&w, "not_modified", stats.not_modified);
+    json_writer_field_uint(&w, "not_acceptable", stats.not_acceptable);
+    json_writer_field_double(&w, "hit_rate", stats.requests ? (double)stats.not_modified / stats.requests : 0);
+    json_writer_field_uint(&w, "bytes_sent", stats.bytes_sent);
+    json_writer_field_uint(&w, "bytes_saved", stats.bytes_saved);
+    json_writer_field_uint(&w, "ui_loads", stats.ui_loads);
+    json_writer_field_uint(&w, "ui_last_tti_ms", stats.ui_last_tti_ms);
+    json_writer_field_uint(&w, "ui_last_transfer_bytes", stats.ui_last_transfer_bytes);
+    json_writer_object_end(&w);
+    return rest_json_end(req, &w);
+}
+
+typedef struct {
+    char key[16];
+    double tti_ms;
+    double transfer_bytes;
+} ui_stats_body_t;
+
+static esp_err_t ui_stats_body_cb(void *ctx, json_stream_event_t event, const char *text, int depth)
+{
+    ui_stats_body_t *body = ctx;
+    if (depth == 0) {
+        return event == JSON_STREAM_OBJECT_BEGIN || event == JSON_STREAM_OBJECT_END ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+    if (depth == 1 && event == JSON_STREAM_KEY) {
+        strlcpy(body->key, text, sizeof(body->key));
+    } else if (depth == 1 && event == JSON_STREAM_NUMBER) {
+        if (strcmp(body->key, "tti_ms") == 0) {
+            body->tti_ms = strtod(text, NULL);
+        } else if (strcmp(body->key, "transfer_bytes") == 0) {
+            body->transfer_bytes = strtod(text, NULL);
+        }
+    }
+    return ESP_OK;
+}
+
+/* Record a page load reported by the web UI: {"tti_ms": n, "transfer_bytes": n} */
+static esp_err_t ui_stats_post_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (req->content_len > UI_STATS_BODY_MAX) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
+    }
+
+    char buf[UI_STATS_RECV_WINDOW];
+    ui_stats_body_t body = { .tti_ms = -1, .transfer_bytes = -1 };
+    json_stream_t js;
+    json_stream_init(&js, ui_stats_body_cb, &body);
+    if (rest_recv_json(req, buf, sizeof(buf), &js) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    /* Anything beyond ten minutes is a tab left in the background */
+    if (body.tti_ms < 0 || body.tti_ms > 600000 || body.transfer_bytes < 0 || body.transfer_bytes > UINT32_MAX) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid page load report");
+    }
+
+    metrics_observe_us(&s_ui_tti_hist, (int64_t)(body.tti_ms * 1000));
+    portENTER_CRITICAL(&s_stats_lock);
+    s_asset_stats.ui_loads++;
+    s_asset_stats.ui_last_tti_ms = (uint32_t)body.tti_ms;
+    s_asset_stats.ui_last_transfer_bytes = (uint32_t)body.transfer_bytes;
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    httpd_resp_set_status(req, "204 No Content");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static void whitelist_entry_write(json_writer_t *w, const whitelist_entry_t *entry)
+{
+    char mac[18];
+    whitelist_mac_to_str(entry->mac, mac);
+
+    json_writer_object_begin(w);
+    json_writer_field_str(w, "mac", mac);
+    json_writer_field_str(w, "name", entry->name);
+    json_writer_field_str(w, "access", whitelist_access_to_str(entry->access));
+    json_writer_field_uint(w, "expires", entry->expires);
+    json_writer_object_end(w);
+}
+
+/* Send HTTP Response with the time every start-up phase was reached */
+static esp_err_t boot_stats_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    boot_trace_entry_t phases[BOOT_TRACE_MAX_PHASES];
+    size_t count = boot_trace_get(phases, BOOT_TRACE_MAX_PHASES);
+
+    char buf[JSON_CHUNK_BUFSIZE];
+    json_writer_t w;
+    rest_json_begin(req, &w, buf, sizeof(buf));
+    json_writer_object_begin(&w);
+    json_writer_key(&w, "phases");
+    json_writer_array_begin(&w);
+    for (size_t i = 0; i < count; i++) {
+        json_writer_object_begin(&w);
+        json_writer_field_str(&w, "phase", phases[i].phase);
+        json_writer_field_double(&w, "ms", phases[i].time_us / 1000.0);
+        json_writer_object_end(&w);
+    }
+    json_writer_array_end(&w);
+    json_writer_object_end(&w);
+    return rest_json_end(req, &w);
+}
+
+/* Worker half of whitelist_get_handler. The entries are copied out in
+ * batches into the back of the scratch buffer and sent from there, so the
+ * whitelist lock is never held while a client is being written to. */
+static esp_err_t whitelist_get_work(httpd_req_t *req, const void *arg, char *scratch)
+{
+    whitelist_entry_t *batch = (whitelist_entry_t *)(scratch + WHITELIST_JSON_BUFSIZE);
+    size_t first = 0;
+    size_t count;
+
+    json_writer_t w;
+    rest_json_begin(req, &w, scratch, WHITELIST_JSON_BUFSIZE);
+    json_writer_array_begin(&w);
+    while ((count = whitelist_copy(first, batch, WHITELIST_COPY_BATCH)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            whitelist_entry_write(&w, &batch[i]);
+        }
+        first += count;
+    }
+    json_writer_array_end(&w);
+    return rest_json_end(req, &w);
+}
+
+/* Send HTTP Response with the device whitelist */
+static esp_err_t whitelist_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return rest_async_submit(req, whitelist_get_work, NULL);
+}
+
+/* Device objects collected from a JSON stream, one element at a time */
+typedef struct {
+    int element_depth;          /* 0 for a single object, 1 for an array of them */
+    whitelist_entry_t entry;
+    bool has_mac;
+    bool valid;
+    char key[12];
+    esp_err_t last_err;
+    uint32_t index;
+    uint32_t imported;
+    uint32_t rejected;
+    uint32_t rejected_at[IMPORT_REJECTED_MAX];
+#if !CONFIG_IDF_TARGET_LINUX
+    uint32_t heap_start;
+    uint32_t heap_min;
+#endif
+} whitelist_import_t;
 
-    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
-    strlcpy(filepath, rest_context->base_path, sizeof(filepath));
-    if (req->uri[strlen(req->uri) - 1] == '/') {
-        strlcat(filepath, "/index.html", sizeof(filepath));
+static void whitelist_import_field(whitelist_import_t *imp, json_stream_event_t event, const char *text)
+{
+    whitelist_access_t level;
+    if (strcmp(imp->key, "mac") == 0) {
+        imp->has_mac = event == JSON_STREAM_STRING && whitelist_mac_from_str(text, imp->entry.mac) == ESP_OK;
+    } else if (strcmp(imp->key, "name") == 0) {
+        if (event == JSON_STREAM_STRING) {
+            strlcpy(imp->entry.name, text, sizeof(imp->entry.name));
+        } else {
+            imp->valid = false;
+        }
+    } else if (strcmp(imp->key, "access") == 0) {
+        if (event == JSON_STREAM_STRING && whitelist_access_from_str(text, &level) == ESP_OK) {
+            imp->entry.access = level;
+        } else {
+            imp->valid = false;
+        }
+    } else if (strcmp(imp->key, "expires") == 0) {
+        char *end;
+        double expires = event == JSON_STREAM_NUMBER ? strtod(text, &end) : -1;
+        if (expires >= 0 && expires <= UINT32_MAX) {
+            imp->entry.expires = (uint32_t)expires;
+        } else {
+            imp->valid = false;
+        }
+    }
+}
+
+static void whitelist_import_done(whitelist_import_t *imp, bool is_object)
+{
+    esp_err_t err = is_object && imp->valid && imp->has_mac ? whitelist_add(&imp->entry) : ESP_ERR_INVALID_ARG;
+    if (err == ESP_OK) {
+        imp->imported++;
     } else {
-        strlcat(filepath, req->uri, sizeof(filepath));
+        if (imp->rejected < IMPORT_REJECTED_MAX) {
+            imp->rejected_at[imp->rejected] = imp->index;
+        }
+        imp->rejected++;
+        imp->last_err = err;
+    }
+    imp->index++;
+#if !CONFIG_IDF_TARGET_LINUX
+    uint32_t heap = esp_get_free_heap_size();
+    imp->heap_min = heap < imp->heap_min ? heap : imp->heap_min;
+#endif
+}
+
+/* Applies every device object as soon as its closing brace arrives */
+static esp_err_t whitelist_import_cb(void *ctx, json_stream_event_t event, const char *text, int depth)
+{
+    whitelist_import_t *imp = ctx;
+    int field_depth = imp->element_depth + 1;
+
+    if (depth < imp->element_depth) {
+        /* Only the outer array of a bulk import lives above the elements */
+        return event == JSON_STREAM_ARRAY_BEGIN || event == JSON_STREAM_ARRAY_END ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+    if (depth > field_depth) {
+        return ESP_OK;
+    }
+
+    switch (event) {
+    case JSON_STREAM_OBJECT_BEGIN:
+    case JSON_STREAM_ARRAY_BEGIN:
+        if (depth == imp->element_depth && event == JSON_STREAM_OBJECT_BEGIN) {
+            memset(&imp->entry, 0, sizeof(imp->entry));
+            imp->entry.access = WHITELIST_ACCESS_FULL;
+            imp->has_mac = false;
+            imp->valid = true;
+        } else {
+            /* Nested values are not part of a device */
+            imp->valid = false;
+        }
+        break;
+    case JSON_STREAM_OBJECT_END:
+        if (depth == imp->element_depth) {
+            whitelist_import_done(imp, true);
+        }
+        break;
+    case JSON_STREAM_ARRAY_END:
+        if (depth == imp->element_depth) {
+            whitelist_import_done(imp, false);
+        }
+        break;
+    case JSON_STREAM_KEY:
+        strlcpy(imp->key, text, sizeof(imp->key));
+        break;
+    default:
+        if (depth == field_depth) {
+            whitelist_import_field(imp, event, text);
+        } else {
+            whitelist_import_done(imp, false);
+        }
+        break;
+    }
+    return ESP_OK;
+}
+
+static void whitelist_import_init(whitelist_import_t *imp, json_stream_t *js, int element_depth)
+{
+    memset(imp, 0, sizeof(*imp));
+    imp->element_depth = element_depth;
+#if !CONFIG_IDF_TARGET_LINUX
+    imp->heap_start = imp->heap_min = esp_get_free_heap_size();
+#endif
+    json_stream_init(js, whitelist_import_cb, imp);
+}
+
+/* Worker half of whitelist_post_handler */
+static esp_err_t whitelist_post_work(httpd_req_t *req, const void *arg, char *scratch)
+{
+    whitelist_import_t imp;
+    json_stream_t js;
+
+    whitelist_import_init(&imp, &js, 0);
+    if (rest_recv_json(req, scratch, SCRATCH_BUFSIZE, &js) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    if (imp.has_mac) {
+        access_log_append(ACCESS_SOURCE_HTTP, ACCESS_ACTION_WHITELIST_ADD,
+                          imp.imported == 1 ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED,
+                          rest_client_ipv4(req), imp.entry.mac);
+    }
+
+    if (imp.last_err == ESP_ERR_NO_MEM) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Whitelist full");
+    } else if (imp.last_err == ESP_ERR_INVALID_ARG || imp.imported != 1) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid device");
+    } else if (imp.last_err != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store device");
+    }
+    json_writer_t w;
+    rest_json_begin(req, &w, scratch, SCRATCH_BUFSIZE);
+    whitelist_entry_write(&w, &imp.entry);
+    return rest_json_end(req, &w);
+}
+
+/* Worker half of whitelist_import_handler */
+static esp_err_t whitelist_import_work(httpd_req_t *req, const void *arg, char *scratch)
+{
+    whitelist_import_t imp;
+    json_stream_t js;
+
+    whitelist_import_init(&imp, &js, 1);
+    /* One NVS write for the whole upload instead of one per device */
+    whitelist_batch_begin();
+    esp_err_t err = rest_recv_json(req, scratch, SCRATCH_BUFSIZE, &js);
+    esp_err_t flush_err = whitelist_batch_end();
+    if (err != ESP_OK) {
+        return ESP_FAIL;
+    }
+    access_log_append(ACCESS_SOURCE_HTTP, ACCESS_ACTION_WHITELIST_IMPORT,
+                      imp.rejected == 0 && flush_err == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED,
+                      rest_client_ipv4(req), NULL);
+    if (flush_err != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store devices");
+    }
+
+    json_writer_t w;
+    rest_json_begin(req, &w, scratch, SCRATCH_BUFSIZE);
+    json_writer_object_begin(&w);
+    json_writer_field_uint(&w, "imported", imp.imported);
+    json_writer_field_uint(&w, "rejected", imp.rejected);
+    json_writer_key(&w, "rejected_at");
+    json_writer_array_begin(&w);
+    for (uint32_t i = 0; i < imp.rejected && i < IMPORT_REJECTED_MAX; i++) {
+        json_writer_uint(&w, imp.rejected_at[i]);
+    }
+    json_writer_array_end(&w);
+    json_writer_field_uint(&w, "bytes", req->content_len);
+#if !CONFIG_IDF_TARGET_LINUX
+    json_writer_field_uint(&w, "heap_peak", imp.heap_start - imp.heap_min);
+#endif
+    json_writer_object_end(&w);
+    return rest_json_end(req, &w);
+}
+
+/* Add or update a whitelist entry from a JSON object:
+ * {"mac": "AA:BB:CC:DD:EE:FF", "name": "...", "access": "full", "expires": 0} */
+static esp_err_t whitelist_post_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return rest_async_submit(req, whitelist_post_work, NULL);
+}
+
+/* Add or update many entries from a JSON array of whitelist objects. The
+ * body is parsed while it arrives, so its size is not limited by RAM. */
+static esp_err_t whitelist_import_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
     }
-    int fd = open(filepath, O_RDONLY, 0);
-    if (fd == -1) {
-        ESP_LOGE(REST_TAG, "Failed to open file : %s", filepath);
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+    return rest_async_submit(req, whitelist_import_work, NULL);
+}
+
+/* Remove a whitelist entry given as ?mac=AA-BB-CC-DD-EE-FF */
+static esp_err_t whitelist_delete_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
         return ESP_FAIL;
     }
 
-    set_content_type_from_file(req, filepath);
-
-    char *chunk = rest_context->scratch;
-    ssize_t read_bytes;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        read_bytes = read(fd, chunk, SCRATCH_BUFSIZE);
-        if (read_bytes == -1) {
-            ESP_LOGE(REST_TAG, "Failed to read file : %s", filepath);
-        } else if (read_bytes > 0) {
-            /* Send the buffer contents as HTTP response chunk */
-            if (httpd_resp_send_chunk(req, chunk, read_bytes) != ESP_OK) {
-                close(fd);
-                ESP_LOGE(REST_TAG, "File sending failed!");
-                /* Abort sending file */
-                httpd_resp_sendstr_chunk(req, NULL);
-                /* Respond with 500 Internal Server Error */
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-                return ESP_FAIL;
+    char query[64];
+    char mac_str[24];
+    uint8_t mac[6];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+            httpd_query_key_value(query, "mac", mac_str, sizeof(mac_str)) != ESP_OK ||
+            whitelist_mac_from_str(mac_str, mac) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid MAC address");
+    }
+
+    esp_err_t err = whitelist_remove(mac);
+    access_log_append(ACCESS_SOURCE_HTTP, ACCESS_ACTION_WHITELIST_REMOVE,
+                      err == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED, rest_client_ipv4(req), mac);
+    if (err == ESP_ERR_NOT_FOUND) {
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Device not whitelisted");
+    } else if (err != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to remove device");
+    }
+    return httpd_resp_send(req, NULL, 0);
+}
+
+typedef struct {
+    bool action_key;
+    bool valid;
+    gate_action_t action;
+} gate_body_t;
+
+static esp_err_t gate_body_cb(void *ctx, json_stream_event_t event, const char *text, int depth)
+{
+    gate_body_t *body = ctx;
+    if (depth == 0) {
+        return event == JSON_STREAM_OBJECT_BEGIN || event == JSON_STREAM_OBJECT_END ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+    if (depth == 1 && event == JSON_STREAM_KEY) {
+        body->action_key = strcmp(text, "action") == 0;
+    } else if (depth == 1 && body->action_key) {
+        body->valid = event == JSON_STREAM_STRING && gate_action_from_str(text, &body->action) == ESP_OK;
+    }
+    return ESP_OK;
+}
+
+/* Runs on the actuator task; ctx carries the client address */
+static void gate_http_done(gate_action_t action, esp_err_t result, void *ctx)
+{
+    access_log_append(ACCESS_SOURCE_HTTP, ACCESS_ACTION_GATE_OPEN + action,
+                      result == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED, (uintptr_t)ctx, NULL);
+}
+
+/* Queue a gate command from a JSON object: {"action": "open" | "open-half" | "close"}.
+ * Answers 202 as soon as the command is queued, the actuator does the rest. */
+static esp_err_t gate_post_handler(httpd_req_t *req)
+{
+    int64_t received_us = esp_timer_get_time();
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (req->content_len > GATE_BODY_MAX) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
+    }
+
+    char buf[GATE_RECV_WINDOW];
+    gate_body_t body = { .valid = false };
+    json_stream_t js;
+    json_stream_init(&js, gate_body_cb, &body);
+    if (rest_recv_json(req, buf, sizeof(buf), &js) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    gate_request_t request = {
+        .action = body.action,
+        .source = GATE_SOURCE_HTTP,
+        .event_time_us = received_us,
+        .done_cb = gate_http_done,
+        .ctx = (void *)(uintptr_t)rest_client_ipv4(req),
+    };
+    if (!body.valid) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid gate action");
+    }
+
+    if (gate_actuator_submit(&request) != ESP_OK) {
+        access_log_append(ACCESS_SOURCE_HTTP, ACCESS_ACTION_GATE_OPEN + request.action, ACCESS_RESULT_FAILED,
+                          (uintptr_t)request.ctx, NULL);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "Gate is busy");
+    }
+    httpd_resp_set_status(req, "202 Accepted");
+    return httpd_resp_send(req, NULL, 0);
+}
+
+static const char *const s_settings_types[] = {
+    [SETTINGS_TYPE_STR] = "string",
+    [SETTINGS_TYPE_U32] = "integer",
+    [SETTINGS_TYPE_BOOL] = "boolean",
+    [SETTINGS_TYPE_IDS] = "ids",
+};
+
+/* Send HTTP Response with every setting, its schema and its value. Secrets
+ * only tell whether they are set. */
+static esp_err_t settings_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    /* Copied so the snapshot is not pinned while the response is built */
+    static settings_t snapshot;
+    const settings_t *current = settings_acquire();
+    snapshot = *current;
+    settings_release(current);
+
+    char buf[JSON_CHUNK_BUFSIZE];
+    json_writer_t w;
+    rest_json_begin(req, &w, buf, sizeof(buf));
+    json_writer_object_begin(&w);
+    json_writer_field_uint(&w, "version", SETTINGS_SCHEMA_VERSION);
+    json_writer_field_uint(&w, "generation", snapshot.generation);
+    json_writer_key(&w, "fields");
+    json_writer_array_begin(&w);
+    char value[SETTINGS_VALUE_MAX + 1];
+    for (size_t i = 0; i < settings_field_count(); i++) {
+        const settings_field_t *field = settings_field(i);
+        json_writer_object_begin(&w);
+        json_writer_field_str(&w, "name", field->name);
+        json_writer_field_str(&w, "type", s_settings_types[field->type]);
+        json_writer_field_uint(&w, "min", field->min);
+        json_writer_field_uint(&w, "max", field->max);
+        json_writer_field_bool(&w, "restart", field->flags & SETTINGS_FLAG_RESTART);
+        json_writer_field_str(&w, "help", field->help);
+
+        settings_format(&snapshot, field, value, sizeof(value));
+        if (field->flags & SETTINGS_FLAG_SECRET) {
+            json_writer_field_bool(&w, "set", value[0] != '\0');
+        } else if (field->type == SETTINGS_TYPE_U32) {
+            json_writer_field_uint(&w, "value", strtoul(value, NULL, 10));
+        } else if (field->type == SETTINGS_TYPE_BOOL) {
+            json_writer_field_bool(&w, "value", value[0] == 't');
+        } else if (field->type == SETTINGS_TYPE_IDS) {
+            /* Snowflakes do not fit a double: strings */
+            json_writer_key(&w, "value");
+            json_writer_array_begin(&w);
+            char *save = NULL;
+            for (char *id = strtok_r(value, ",", &save); id; id = strtok_r(NULL, ",", &save)) {
+                json_writer_string(&w, id);
             }
+            json_writer_array_end(&w);
+        } else {
+            json_writer_field_str(&w, "value", value);
+        }
+        memset(value, 0, sizeof(value));
+        json_writer_object_end(&w);
+    }
+    json_writer_array_end(&w);
+    json_writer_object_end(&w);
+    memset(&snapshot, 0, sizeof(snapshot));
+    return rest_json_end(req, &w);
+}
+
+/* Settings collected from a JSON object into a draft, one member at a time */
+typedef struct {
+    settings_draft_t draft;
+    char key[24];
+    bool in_list;
+    char list[SETTINGS_VALUE_MAX + 1];
+    size_t list_len;
+    esp_err_t err;
+    char bad_key[24];
+} settings_body_t;
+
+static void settings_body_set(settings_body_t *body, const char *value)
+{
+    esp_err_t err = settings_draft_set(&body->draft, body->key, value);
+    if (err != ESP_OK && body->err == ESP_OK) {
+        body->err = err;
+        strlcpy(body->bad_key, body->key, sizeof(body->bad_key));
+    }
+}
+
+static esp_err_t settings_body_cb(void *ctx, json_stream_event_t event, const char *text, int depth)
+{
+    settings_body_t *body = ctx;
+    if (depth == 0) {
+        return event == JSON_STREAM_OBJECT_BEGIN || event == JSON_STREAM_OBJECT_END ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+    if (depth == 1) {
+        switch (event) {
+        case JSON_STREAM_KEY:
+            strlcpy(body->key, text, sizeof(body->key));
+            return ESP_OK;
+        case JSON_STREAM_STRING:
+        case JSON_STREAM_NUMBER:
+            settings_body_set(body, text);
+            return ESP_OK;
+        case JSON_STREAM_TRUE:
+        case JSON_STREAM_FALSE:
+            settings_body_set(body, event == JSON_STREAM_TRUE ? "true" : "false");
+            return ESP_OK;
+        case JSON_STREAM_ARRAY_BEGIN:
+            body->in_list = true;
+            body->list_len = 0;
+            body->list[0] = '\0';
+            return ESP_OK;
+        case JSON_STREAM_ARRAY_END:
+            body->in_list = false;
+            settings_body_set(body, body->list);
+            return ESP_OK;
+        default:
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    /* ID lists: an array of strings or numbers, joined for the parser */
+    if (depth == 2 && body->in_list && (event == JSON_STREAM_STRING || event == JSON_STREAM_NUMBER)) {
+        int len = snprintf(body->list + body->list_len, sizeof(body->list) - body->list_len, "%s%s",
+                           body->list_len ? "," : "", text);
+        if (len < 0 || body->list_len + len >= sizeof(body->list)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        body->list_len += len;
+        return ESP_OK;
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+/* Change settings from a JSON object of the fields to change, e.g.
+ * {"gate_pulse_ms": 400, "dc_users": ["123", "456"]}. All of them are
+ * applied at once, or none if any is invalid. */
+static esp_err_t settings_post_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    if (req->content_len > SETTINGS_BODY_MAX) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Content too long");
+    }
+
+    /* Only ever used from the httpd task */
+    static settings_body_t body;
+    char buf[SETTINGS_RECV_WINDOW];
+    json_stream_t js;
+    memset(&body, 0, sizeof(body));
+    settings_draft_init(&body.draft);
+    json_stream_init(&js, settings_body_cb, &body);
+    esp_err_t err = rest_recv_json(req, buf, sizeof(buf), &js);
+    if (err == ESP_OK && body.err != ESP_OK) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%s %s", body.err == ESP_ERR_NOT_FOUND ? "Unknown setting" : "Invalid value for",
+                 body.bad_key);
+        err = httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, msg);
+    } else if (err == ESP_OK) {
+        bool restart = false;
+        esp_err_t commit_err = settings_commit(&body.draft, &restart);
+        access_log_append(ACCESS_SOURCE_HTTP, ACCESS_ACTION_SETTINGS_CHANGE,
+                          commit_err == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED, rest_client_ipv4(req), NULL);
+        if (commit_err != ESP_OK && commit_err != ESP_FAIL) {
+            err = httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to apply settings");
+        } else {
+            settings_stats_t stats;
+            settings_get_stats(&stats);
+            /* The receive window is free again: the answer fits in it */
+            json_writer_t w;
+            rest_json_begin(req, &w, buf, sizeof(buf));
+            json_writer_object_begin(&w);
+            json_writer_field_uint(&w, "generation", stats.generation);
+            json_writer_field_bool(&w, "saved", commit_err == ESP_OK);
+            json_writer_field_bool(&w, "restart_required", restart);
+            json_writer_object_end(&w);
+            err = rest_json_end(req, &w);
+        }
+    }
+    memset(&body, 0, sizeof(body));
+    return err;
+}
+
+/* Send HTTP Response with the command-to-relay latency histogram per source */
+static esp_err_t gate_latency_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    char buf[JSON_CHUNK_BUFSIZE];
+    json_writer_t w;
+    rest_json_begin(req, &w, buf, sizeof(buf));
+    json_writer_object_begin(&w);
+    json_writer_key(&w, "bucket_le_us");
+    json_writer_array_begin(&w);
+    for (int i = 0; i < GATE_LATENCY_BUCKETS - 1; i++) {
+        json_writer_uint(&w, gate_latency_bucket_us[i]);
+    }
+    json_writer_array_end(&w);
+    for (int source = 0; source < GATE_SOURCE_MAX; source++) {
+        gate_latency_hist_t hist;
+        gate_actuator_get_latency(source, &hist);
+
+        json_writer_key(&w, gate_source_to_str(source));
+        json_writer_object_begin(&w);
+        json_writer_field_uint(&w, "count", hist.count);
+        json_writer_field_uint(&w, "total_us", hist.total_us);
+        json_writer_field_uint(&w, "max_us", hist.max_us);
+        json_writer_key(&w, "buckets");
+        json_writer_array_begin(&w);
+        for (int i = 0; i < GATE_LATENCY_BUCKETS; i++) {
+            json_writer_uint(&w, hist.buckets[i]);
+        }
+        json_writer_array_end(&w);
+        json_writer_object_end(&w);
+    }
+    json_writer_object_end(&w);
+    return rest_json_end(req, &w);
+}
+
+static void access_record_write(json_writer_t *w, const access_log_record_t *rec)
+{
+    static const uint8_t no_mac[6];
+    char text[24];
+
+    json_writer_object_begin(w);
+    json_writer_field_uint(w, "seq", rec->seq);
+    json_writer_field_uint(w, "time", rec->time);
+    json_writer_field_str(w, "source", access_source_to_str(rec->source));
+    json_writer_field_str(w, "action", access_action_to_str(rec->action));
+    json_writer_field_str(w, "result", access_result_to_str(rec->result));
+    if (rec->source == ACCESS_SOURCE_HTTP && rec->actor) {
+        uint32_t ip = rec->actor;
+        snprintf(text, sizeof(text), "%u.%u.%u.%u",
+                 (unsigned)(ip >> 24), (unsigned)(ip >> 16) & 0xFF, (unsigned)(ip >> 8) & 0xFF, (unsigned)ip & 0xFF);
+        json_writer_field_str(w, "actor", text);
+    } else if (rec->source == ACCESS_SOURCE_DISCORD) {
+        /* Snowflakes do not fit in a JSON number */
+        snprintf(text, sizeof(text), "%llu", (unsigned long long)rec->actor);
+        json_writer_field_str(w, "actor", text);
+    }
+    if (memcmp(rec->mac, no_mac, sizeof(no_mac)) != 0) {
+        whitelist_mac_to_str(rec->mac, text);
+        json_writer_field_str(w, "mac", text);
+    }
+    json_writer_object_end(w);
+}
+
+/* Worker half of access_log_get_handler */
+static esp_err_t access_log_get_work(httpd_req_t *req, const void *arg, char *scratch)
+{
+    access_log_record_t records[LOG_PAGE_MAX];
+    char query[64];
+    char value[12];
+    uint32_t before = 0;
+    size_t limit = LOG_PAGE_DEFAULT;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "before", value, sizeof(value)) == ESP_OK) {
+            before = strtoul(value, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK) {
+            limit = strtoul(value, NULL, 10);
+            limit = limit == 0 ? LOG_PAGE_DEFAULT : limit > LOG_PAGE_MAX ? LOG_PAGE_MAX : limit;
+        }
+    }
+
+    size_t count = access_log_read(before, records, limit);
+
+    json_writer_t w;
+    rest_json_begin(req, &w, scratch, SCRATCH_BUFSIZE);
+    json_writer_object_begin(&w);
+    json_writer_key(&w, "entries");
+    json_writer_array_begin(&w);
+    for (size_t i = 0; i < count; i++) {
+        access_record_write(&w, &records[i]);
+    }
+    json_writer_array_end(&w);
+    /* A short page means the oldest record has been reached */
+    if (count == limit) {
+        json_writer_field_uint(&w, "next", records[count - 1].seq);
+    } else {
+        json_writer_field_null(&w, "next");
+    }
+    json_writer_object_end(&w);
+    return rest_json_end(req, &w);
+}
+
+/* Send HTTP Response with access log entries, newest first:
+ * ?before=<cursor>&limit=<n>, where the cursor is "next" of the previous page */
+static esp_err_t access_log_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return rest_async_submit(req, access_log_get_work, NULL);
+}
+
+/* Collects the exposition text in the worker's scratch buffer and sends it
+ * as chunks whenever the buffer fills up */
+typedef struct {
+    httpd_req_t *req;
+    char *buf;
+    size_t len;
+} metrics_chunk_t;
+
+static esp_err_t metrics_chunk_write(void *ctx, const char *text, size_t len)
+{
+    metrics_chunk_t *out = ctx;
+    if (out->len + len > SCRATCH_BUFSIZE) {
+        esp_err_t err = httpd_resp_send_chunk(out->req, out->buf, out->len);
+        out->len = 0;
+        if (err != ESP_OK) {
+            return err;
         }
-    } while (read_bytes > 0);
-    /* Close file after sending complete */
-    close(fd);
-    ESP_LOGI(REST_TAG, "File sending complete");
-    /* Respond with an empty chunk to signal HTTP response completion */
-    httpd_resp_send_chunk(req, NULL, 0);
+    }
+    memcpy(out->buf + out->len, text, len);
+    out->len += len;
     return ESP_OK;
 }
 
-/* Send HTTP Response with the user whitelist (key-value: device-MAC address) */
-// static esp_err_t whitelist_get_handler(httpd_req_t *req) 
-// {
-//     httpd_resp_set_type(req, "application/json");
-//     cJSON *root = cJSON_CreateObject();
+/* Worker half of metrics_get_handler */
+static esp_err_t metrics_get_work(httpd_req_t *req, const void *arg, char *scratch)
+{
+    metrics_chunk_t out = { .req = req, .buf = scratch, .len = 0 };
 
-//     rest_server_context_t
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    esp_err_t err = metrics_write_prometheus(metrics_chunk_write, &out);
+    if (err == ESP_OK && out.len) {
+        err = httpd_resp_send_chunk(req, out.buf, out.len);
+    }
+    if (err != ESP_OK) {
+        DLOG(HTTP_METRICS_FAILED, esp_err_to_name(err));
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-// }
+/* Send HTTP Response with every metric in Prometheus text format */
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return rest_async_submit(req, metrics_get_work, NULL);
+}
 
-esp_err_t start_rest_server(void)
+/* One serialised event. Built once and shared by every subscriber, then
+ * freed by push_broadcast() on the server task. */
+typedef struct {
+    int64_t published_us;
+    size_t len;
+    char data[];
+} push_frame_t;
+
+static rest_push_stats_t s_push_stats;
+
+void rest_get_push_stats(rest_push_stats_t *out)
 {
-    const char *base_path = WEB_MOUNT_POINT;
-    REST_CHECK(base_path, "wrong base path", err);
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_push_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
 
-    if (s_server_handle) {
-        ESP_LOGW(REST_TAG, "HTTP server already running");
+#if CONFIG_HTTP_EVENT_PUSH
+/* Registered event handlers, kept to unregister them when the server goes */
+static struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_instance_t instance;
+} s_push_handlers[4];
+static size_t s_push_handler_count = 0;
+
+/* Runs on the server task, which owns the sockets */
+static void push_broadcast(void *arg)
+{
+    push_frame_t *frame = arg;
+    int fds[CONFIG_HTTP_MAX_OPEN_SOCKETS];
+    size_t count = CONFIG_HTTP_MAX_OPEN_SOCKETS;
+    uint32_t sent = 0;
+    uint32_t failed = 0;
+    httpd_ws_frame_t pkt = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)frame->data,
+        .len = frame->len,
+    };
+
+    if (s_server_handle && httpd_get_client_list(s_server_handle, &count, fds) == ESP_OK) {
+        for (size_t i = 0; i < count; i++) {
+            if (httpd_ws_get_fd_info(s_server_handle, fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET) {
+                continue;
+            }
+            if (httpd_ws_send_frame_async(s_server_handle, fds[i], &pkt) == ESP_OK) {
+                sent++;
+            } else {
+                /* A stuck dashboard must not hold the others back */
+                failed++;
+                httpd_sess_trigger_close(s_server_handle, fds[i]);
+            }
+        }
+    }
+
+    uint32_t fanout_us = esp_timer_get_time() - frame->published_us;
+    portENTER_CRITICAL(&s_stats_lock);
+    s_push_stats.subscribers = sent;
+    s_push_stats.frames++;
+    s_push_stats.sends += sent;
+    s_push_stats.send_errors += failed;
+    s_push_stats.last_fanout_us = fanout_us;
+    s_push_stats.total_fanout_us += fanout_us;
+    if (fanout_us > s_push_stats.max_fanout_us) {
+        s_push_stats.max_fanout_us = fanout_us;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    free(frame);
+}
+
+/* Queue the event, serialised once by its writer into the frame, to the
+ * server task; consumes the frame */
+static void push_publish(push_frame_t *frame, json_writer_t *w)
+{
+    /* A frame that could not be allocated is as lost as one that did not fit */
+    bool queued = false;
+    if (frame && json_writer_finish(w) == ESP_OK) {
+        frame->len = w->len;
+        frame->published_us = esp_timer_get_time();
+        queued = s_server_handle && httpd_queue_work(s_server_handle, push_broadcast, frame) == ESP_OK;
+    }
+
+    if (!queued) {
+        free(frame);
+        portENTER_CRITICAL(&s_stats_lock);
+        s_push_stats.dropped++;
+        portEXIT_CRITICAL(&s_stats_lock);
+    }
+}
+
+/* Turns gate, SoftAP and access log events into push frames */
+static void push_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (!s_listening) {
+        /* Resident server while stopped: nobody to push to */
+        return;
+    }
+    push_frame_t *frame = malloc(sizeof(push_frame_t) + CONFIG_HTTP_PUSH_FRAME_MAX);
+    json_writer_t w;
+    json_writer_init(&w, frame ? frame->data : NULL, frame ? CONFIG_HTTP_PUSH_FRAME_MAX : 0, NULL, NULL);
+    json_writer_object_begin(&w);
+
+    if (event_base == GATE_EVENT) {
+        const gate_event_t *event = event_data;
+        if (event_id == GATE_EVENT_STATE) {
+            json_writer_field_str(&w, "type", "gate_state");
+            json_writer_field_str(&w, "state", gate_state_to_str(event->state));
+        } else {
+            json_writer_field_str(&w, "type", "gate");
+            json_writer_field_str(&w, "state", event_id == GATE_EVENT_ACTIVE ? "active" : "idle");
+        }
+        json_writer_field_str(&w, "action", gate_action_to_str(event->action));
+        json_writer_field_str(&w, "source", gate_source_to_str(event->source));
+    } else if (event_base == ACCESS_LOG_EVENT) {
+        json_writer_field_str(&w, "type", "log");
+        json_writer_key(&w, "entry");
+        access_record_write(&w, event_data);
+#if !CONFIG_IDF_TARGET_LINUX
+    } else if (event_base == WIFI_EVENT) {
+        /* Both SoftAP events start with the station MAC */
+        const uint8_t *mac = event_id == WIFI_EVENT_AP_STACONNECTED ?
+                             ((wifi_event_ap_staconnected_t *)event_data)->mac :
+                             ((wifi_event_ap_stadisconnected_t *)event_data)->mac;
+        char mac_str[18];
+        whitelist_mac_to_str(mac, mac_str);
+        json_writer_field_str(&w, "type", "station");
+        json_writer_field_str(&w, "event", event_id == WIFI_EVENT_AP_STACONNECTED ? "join" : "leave");
+        json_writer_field_str(&w, "mac", mac_str);
+        json_writer_field_bool(&w, "whitelisted", whitelist_is_allowed(mac));
+#endif
+    }
+    json_writer_object_end(&w);
+    push_publish(frame, &w);
+}
+
+static esp_err_t push_handlers_register(void)
+{
+    const struct {
+        esp_event_base_t base;
+        int32_t id;
+    } events[] = {
+        { GATE_EVENT, ESP_EVENT_ANY_ID },
+        { ACCESS_LOG_EVENT, ACCESS_LOG_EVENT_RECORD },
+#if !CONFIG_IDF_TARGET_LINUX
+        { WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED },
+        { WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED },
+#endif
+    };
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]) && err == ESP_OK; i++) {
+        err = esp_event_handler_instance_register(events[i].base, events[i].id, push_event_handler, NULL,
+                                                  &s_push_handlers[i].instance);
+        if (err == ESP_OK) {
+            s_push_handlers[i].base = events[i].base;
+            s_push_handlers[i].id = events[i].id;
+            s_push_handler_count = i + 1;
+        }
+    }
+    return err;
+}
+
+static void push_handlers_unregister(void)
+{
+    for (size_t i = 0; i < s_push_handler_count; i++) {
+        esp_event_handler_instance_unregister(s_push_handlers[i].base, s_push_handlers[i].id,
+                                              s_push_handlers[i].instance);
+    }
+    s_push_handler_count = 0;
+}
+
+/* The upgrade request is authenticated like any other API call */
+static esp_err_t push_handshake_cb(httpd_req_t *req)
+{
+    return basic_auth_handler(req);
+}
+
+/* Subscribers only listen: anything they send is read and discarded */
+static esp_err_t push_ws_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
         return ESP_OK;
     }
 
-    s_rest_context = calloc(1, sizeof(rest_server_context_t));
-    REST_CHECK(s_rest_context, "No memory for rest context", err);
-    strlcpy(s_rest_context->base_path, base_path, sizeof(s_rest_context->base_path));
+    uint8_t buf[64];
+    httpd_ws_frame_t pkt = { 0 };
+    esp_err_t err = httpd_ws_recv_frame(req, &pkt, 0);
+    if (err != ESP_OK || pkt.len == 0) {
+        return err;
+    }
+    if (pkt.len > sizeof(buf)) {
+        return ESP_FAIL;
+    }
+    pkt.payload = buf;
+    return httpd_ws_recv_frame(req, &pkt, pkt.len);
+}
+
+/* Send HTTP Response with the push channel counters */
+static esp_err_t push_stats_get_handler(httpd_req_t *req)
+{
+    if (basic_auth_handler(req) != ESP_OK) {
+        return ESP_FAIL;
+    }
 
+    rest_push_stats_t stats;
+    rest_get_push_stats(&stats);
+
+    char buf[JSON_CHUNK_BUFSIZE];
+    json_writer_t w;
+    rest_json_begin(req, &w, buf, sizeof(buf));
+    json_writer_object_begin(&w);
+    json_writer_field_uint(&w, "subscribers", stats.subscribers);
+    json_writer_field_uint(&w, "frames", stats.frames);
+    json_writer_field_uint(&w, "dropped", stats.dropped);
+    json_writer_field_uint(&w, "sends", stats.sends);
+    json_writer_field_uint(&w, "send_errors", stats.send_errors);
+    json_writer_field_uint(&w, "last_fanout_us", stats.last_fanout_us);
+    json_writer_field_uint(&w, "max_fanout_us", stats.max_fanout_us);
+    json_writer_field_uint(&w, "avg_fanout_us", stats.frames ? stats.total_fanout_us / stats.frames : 0);
+#if !CONFIG_IDF_TARGET_LINUX
+    json_writer_field_uint(&w, "heap_free", esp_get_free_heap_size());
+    json_writer_field_uint(&w, "heap_min_free", esp_get_minimum_free_heap_size());
+#endif
+    json_writer_object_end(&w);
+    return rest_json_end(req, &w);
+}
+#endif /* CONFIG_HTTP_EVENT_PUSH */
+
+/* Every URI, registered once per httpd instance */
+static const httpd_uri_t s_uri_handlers[] = {
+    /* Device whitelist */
+    { .uri = "/api/v1/devices/whitelist", .method = HTTP_GET, .handler = whitelist_get_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/devices/whitelist", .method = HTTP_POST, .handler = whitelist_post_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/devices/whitelist", .method = HTTP_DELETE, .handler = whitelist_delete_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/devices/whitelist/import", .method = HTTP_POST, .handler = whitelist_import_handler,
+      .user_ctx = &s_rest_context },
+    /* Gate commands and their latency */
+    { .uri = "/api/v1/gate", .method = HTTP_POST, .handler = gate_post_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/gate/latency", .method = HTTP_GET, .handler = gate_latency_get_handler,
+      .user_ctx = &s_rest_context },
+    /* Run-time settings */
+    { .uri = "/api/v1/settings", .method = HTTP_GET, .handler = settings_get_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/settings", .method = HTTP_POST, .handler = settings_post_handler,
+      .user_ctx = &s_rest_context },
+    /* Access log */
+    { .uri = "/api/v1/logs", .method = HTTP_GET, .handler = access_log_get_handler,
+      .user_ctx = &s_rest_context },
+    /* Static asset counters, Prometheus scrape and boot-time report */
+    { .uri = "/api/v1/stats/assets", .method = HTTP_GET, .handler = asset_stats_get_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/stats/ui", .method = HTTP_POST, .handler = ui_stats_post_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/metrics", .method = HTTP_GET, .handler = metrics_get_handler,
+      .user_ctx = &s_rest_context },
+    { .uri = "/api/v1/stats/boot", .method = HTTP_GET, .handler = boot_stats_get_handler,
+      .user_ctx = &s_rest_context },
+#if CONFIG_HTTP_EVENT_PUSH
+    /* WebSocket push channel and its counters */
+    { .uri = "/api/v1/events", .method = HTTP_GET, .handler = push_ws_handler,
+      .user_ctx = &s_rest_context, .is_websocket = true, .ws_pre_handshake_cb = push_handshake_cb },
+    { .uri = "/api/v1/stats/push", .method = HTTP_GET, .handler = push_stats_get_handler,
+      .user_ctx = &s_rest_context },
+#endif
+    /* Web server files, last: it matches everything */
+    { .uri = "/*", .method = HTTP_GET, .handler = rest_common_get_handler,
+      .user_ctx = &s_rest_context },
+};
+
+#define URI_HANDLER_COUNT (sizeof(s_uri_handlers) / sizeof(s_uri_handlers[0]))
+
+/* Connections are only taken while the server is started; a resident
+ * server that is stopped closes them as soon as they are accepted */
+static esp_err_t rest_session_open(httpd_handle_t hd, int sockfd)
+{
+    if (!s_listening) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_lifecycle_stats.refused++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* httpd task, sockets, handler table and push subscriptions */
+static esp_err_t rest_server_create(void)
+{
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_HTTP_SERVER_PORT;
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = URI_HANDLER_COUNT;
+    config.max_open_sockets = CONFIG_HTTP_MAX_OPEN_SOCKETS;
+    config.open_fn = rest_session_open;
+#if CONFIG_HTTP_LRU_PURGE
+    config.lru_purge_enable = true;
+#endif
+
+    REST_CHECK(rest_workers_start(config.task_priority) == ESP_OK, "Failed to start request workers", err);
 
     ESP_LOGI(REST_TAG, "Starting HTTP Server");
-    REST_CHECK(httpd_start(&s_server_handle, &config) == ESP_OK, "Start server failed", err_start);
-
-    /* URI handler for fetching device whitelist */
-    // static const httpd_uri_t device_whitelist_uri= {
-    //     .uri       = "/api/v1/devices/whitelist",
-    //     .method    = HTTP_GET,
-    //     .handler   = whitelist_get_handler,
-    //     .user_ctx  = rest_context
-    // };
-    // httpd_register_uri_handler(server, &device_whitelist_uri);
-
-    /* URI handler for getting web server files */
-    httpd_uri_t common_get_uri = {
-        .uri = "/*",
-        .method = HTTP_GET,
-        .handler = rest_common_get_handler,
-        .user_ctx = s_rest_context
-    };
-    httpd_register_uri_handler(s_server_handle, &common_get_uri);
+    REST_CHECK(httpd_start(&s_server_handle, &config) == ESP_OK, "Start server failed", err);
+    for (size_t i = 0; i < URI_HANDLER_COUNT; i++) {
+        httpd_register_uri_handler(s_server_handle, &s_uri_handlers[i]);
+    }
 
+#if CONFIG_HTTP_EVENT_PUSH
+    if (push_handlers_register() != ESP_OK) {
+        ESP_LOGW(REST_TAG, "Push channel not subscribed to every event");
+    }
+#endif
     return ESP_OK;
-err_start:
-    free(s_rest_context);
 err:
     return ESP_FAIL;
 }
 
-esp_err_t stop_rest_server(void)
+#if !CONFIG_HTTP_RESIDENT_SERVER
+static void rest_server_destroy(void)
+{
+#if CONFIG_HTTP_EVENT_PUSH
+    push_handlers_unregister();
+#endif
+    httpd_stop(s_server_handle);
+    s_server_handle = NULL;
+}
+#else
+/* Close every client connection, WebSocket subscribers included */
+static void rest_sessions_close(void)
 {
+    int fds[CONFIG_HTTP_MAX_OPEN_SOCKETS];
+    size_t count = CONFIG_HTTP_MAX_OPEN_SOCKETS;
+
+    if (httpd_get_client_list(s_server_handle, &count, fds) == ESP_OK) {
+        for (size_t i = 0; i < count; i++) {
+            httpd_sess_trigger_close(s_server_handle, fds[i]);
+        }
+    }
+}
+#endif
+
+void rest_get_lifecycle_stats(rest_lifecycle_stats_t *out)
+{
+    portENTER_CRITICAL(&s_stats_lock);
+    *out = s_lifecycle_stats;
+    portEXIT_CRITICAL(&s_stats_lock);
+}
+
+esp_err_t start_rest_server(void)
+{
+    if (s_listening) {
+        ESP_LOGW(REST_TAG, "HTTP server already running");
+        return ESP_OK;
+    }
+
+    int64_t start = esp_timer_get_time();
     if (!s_server_handle) {
+        REST_CHECK(basic_auth_init() == ESP_OK, "Failed to set up authentication", err);
+        metrics_register_hist(&s_static_hist);
+        metrics_register_hist(&s_ui_tti_hist);
+        REST_CHECK(rest_server_create() == ESP_OK, "Failed to create the server", err);
+    }
+    s_listening = true;
+
+    uint32_t elapsed_us = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&s_stats_lock);
+    s_lifecycle_stats.starts++;
+    s_lifecycle_stats.last_start_us = elapsed_us;
+    if (elapsed_us > s_lifecycle_stats.max_start_us) {
+        s_lifecycle_stats.max_start_us = elapsed_us;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+    return ESP_OK;
+err:
+    return ESP_FAIL;
+}
+
+esp_err_t stop_rest_server(void)
+{
+    if (!s_listening) {
         ESP_LOGW(REST_TAG, "HTTP server not running");
         return ESP_OK;
     }
 
     ESP_LOGI(REST_TAG, "Stopping HTTP Server");
-    httpd_stop(s_server_handle);
-    s_server_handle = NULL;
-
-    if (s_rest_context) {
-        free(s_rest_context);
-        s_rest_context = NULL;
+    int64_t start = esp_timer_get_time();
+    portENTER_CRITICAL(&s_stats_lock);
+    s_listening = false;
+    portEXIT_CRITICAL(&s_stats_lock);
+    /* Closing the sockets under a busy worker would cut its client off
+     * mid-response: if the workers do not finish, stay up */
+    if (rest_workers_drain(CONFIG_HTTP_STOP_TIMEOUT_MS) != ESP_OK) {
+        portENTER_CRITICAL(&s_stats_lock);
+        s_listening = true;
+        s_lifecycle_stats.stop_timeouts++;
+        portEXIT_CRITICAL(&s_stats_lock);
+        ESP_LOGW(REST_TAG, "Requests still in flight after %dms, server left running", CONFIG_HTTP_STOP_TIMEOUT_MS);
+        return ESP_ERR_TIMEOUT;
     }
+#if CONFIG_HTTP_RESIDENT_SERVER
+    rest_sessions_close();
+#else
+    rest_server_destroy();
+#endif
 
+    uint32_t elapsed_us = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&s_stats_lock);
+    s_lifecycle_stats.stops++;
+    s_lifecycle_stats.last_stop_us = elapsed_us;
+    portEXIT_CRITICAL(&s_stats_lock);
     return ESP_OK;
 }
-
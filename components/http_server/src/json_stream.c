@@ -0,0 +1,294 @@
+#include "json_stream.h"
+
+#include <string.h>
+
+enum {
+    JS_VALUE,           /* after ':' or ',' in an array, or at the start */
+    JS_VALUE_OR_END,    /* right after '[' */
+    JS_KEY_OR_END,      /* right after '{' */
+    JS_KEY,             /* after ',' in an object */
+    JS_COLON,
+    JS_COMMA_OR_END,
+    JS_STRING,
+    JS_ESCAPE,
+    JS_UNICODE,
+    JS_NUMBER,
+    JS_LITERAL,
+    JS_DONE,
+};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool in_object(const json_stream_t *js)
+{
+    return js->objects & (1u << (js->depth - 1));
+}
+
+static esp_err_t token_append(json_stream_t *js, char c)
+{
+    if (js->len + 1 >= JSON_STREAM_TOKEN_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    js->token[js->len++] = c;
+    return ESP_OK;
+}
+
+/* Append a \uXXXX code unit as UTF-8; lone surrogates become '?' */
+static esp_err_t token_append_unicode(json_stream_t *js, uint16_t cp)
+{
+    esp_err_t err;
+    if (cp < 0x80) {
+        return token_append(js, cp);
+    } else if (cp < 0x800) {
+        err = token_append(js, 0xC0 | (cp >> 6));
+    } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+        return token_append(js, '?');
+    } else {
+        err = token_append(js, 0xE0 | (cp >> 12));
+        if (err == ESP_OK) {
+            err = token_append(js, 0x80 | ((cp >> 6) & 0x3F));
+        }
+    }
+    return err == ESP_OK ? token_append(js, 0x80 | (cp & 0x3F)) : err;
+}
+
+static void value_done(json_stream_t *js)
+{
+    js->state = js->depth == 0 ? JS_DONE : JS_COMMA_OR_END;
+}
+
+static esp_err_t emit(json_stream_t *js, json_stream_event_t event, const char *text)
+{
+    return js->cb(js->ctx, event, text, js->depth);
+}
+
+static esp_err_t open_container(json_stream_t *js, bool object)
+{
+    if (js->depth >= JSON_STREAM_MAX_DEPTH) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = emit(js, object ? JSON_STREAM_OBJECT_BEGIN : JSON_STREAM_ARRAY_BEGIN, NULL);
+    if (object) {
+        js->objects |= 1u << js->depth;
+    } else {
+        js->objects &= ~(1u << js->depth);
+    }
+    js->depth++;
+    js->state = object ? JS_KEY_OR_END : JS_VALUE_OR_END;
+    return err;
+}
+
+static esp_err_t close_container(json_stream_t *js, bool object)
+{
+    if (js->depth == 0 || in_object(js) != object) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    js->depth--;
+    value_done(js);
+    return emit(js, object ? JSON_STREAM_OBJECT_END : JSON_STREAM_ARRAY_END, NULL);
+}
+
+static esp_err_t begin_value(json_stream_t *js, char c)
+{
+    js->len = 0;
+    switch (c) {
+    case '{':
+        return open_container(js, true);
+    case '[':
+        return open_container(js, false);
+    case '"':
+        js->key = false;
+        js->state = JS_STRING;
+        return ESP_OK;
+    case 't':
+        js->literal = "true";
+        break;
+    case 'f':
+        js->literal = "false";
+        break;
+    case 'n':
+        js->literal = "null";
+        break;
+    default:
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            js->state = JS_NUMBER;
+            return token_append(js, c);
+        }
+        return ESP_ERR_INVALID_ARG;
+    }
+    js->literal_pos = 1;
+    js->state = JS_LITERAL;
+    return ESP_OK;
+}
+
+static esp_err_t end_number(json_stream_t *js)
+{
+    js->token[js->len] = '\0';
+    value_done(js);
+    return emit(js, JSON_STREAM_NUMBER, js->token);
+}
+
+static esp_err_t step(json_stream_t *js, char c)
+{
+    switch (js->state) {
+    case JS_VALUE_OR_END:
+        if (c == ']') {
+            return close_container(js, false);
+        }
+        /* fall through */
+    case JS_VALUE:
+        return is_space(c) ? ESP_OK : begin_value(js, c);
+
+    case JS_KEY_OR_END:
+        if (c == '}') {
+            return close_container(js, true);
+        }
+        /* fall through */
+    case JS_KEY:
+        if (is_space(c)) {
+            return ESP_OK;
+        }
+        if (c != '"') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        js->len = 0;
+        js->key = true;
+        js->state = JS_STRING;
+        return ESP_OK;
+
+    case JS_COLON:
+        if (is_space(c)) {
+            return ESP_OK;
+        }
+        if (c != ':') {
+            return ESP_ERR_INVALID_ARG;
+        }
+        js->state = JS_VALUE;
+        return ESP_OK;
+
+    case JS_COMMA_OR_END:
+        if (is_space(c)) {
+            return ESP_OK;
+        }
+        if (c == ',') {
+            js->state = in_object(js) ? JS_KEY : JS_VALUE;
+            return ESP_OK;
+        }
+        if (c == '}' || c == ']') {
+            return close_container(js, c == '}');
+        }
+        return ESP_ERR_INVALID_ARG;
+
+    case JS_STRING:
+        if (c == '"') {
+            js->token[js->len] = '\0';
+            if (js->key) {
+                js->state = JS_COLON;
+                return emit(js, JSON_STREAM_KEY, js->token);
+            }
+            value_done(js);
+            return emit(js, JSON_STREAM_STRING, js->token);
+        }
+        if (c == '\\') {
+            js->state = JS_ESCAPE;
+            return ESP_OK;
+        }
+        if ((unsigned char)c < 0x20) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return token_append(js, c);
+
+    case JS_ESCAPE: {
+        static const char from[] = "\"\\/bfnrt";
+        static const char to[] = "\"\\/\b\f\n\r\t";
+        const char *esc = c ? strchr(from, c) : NULL;
+        if (c == 'u') {
+            js->unicode = 0;
+            js->unicode_len = 0;
+            js->state = JS_UNICODE;
+            return ESP_OK;
+        }
+        if (!esc) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        js->state = JS_STRING;
+        return token_append(js, to[esc - from]);
+    }
+
+    case JS_UNICODE: {
+        int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            digit = (c | 0x20) - 'a' + 10;
+        } else {
+            return ESP_ERR_INVALID_ARG;
+        }
+        js->unicode = (js->unicode << 4) | digit;
+        if (++js->unicode_len < 4) {
+            return ESP_OK;
+        }
+        js->state = JS_STRING;
+        return token_append_unicode(js, js->unicode);
+    }
+
+    case JS_NUMBER: {
+        if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+            return token_append(js, c);
+        }
+        /* The character after the number belongs to the next state */
+        esp_err_t err = end_number(js);
+        return err == ESP_OK ? step(js, c) : err;
+    }
+
+    case JS_LITERAL:
+        if (c != js->literal[js->literal_pos]) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (js->literal[++js->literal_pos] != '\0') {
+            return ESP_OK;
+        }
+        value_done(js);
+        return emit(js, js->literal[0] == 't' ? JSON_STREAM_TRUE :
+                    js->literal[0] == 'f' ? JSON_STREAM_FALSE : JSON_STREAM_NULL, NULL);
+
+    case JS_DONE:
+    default:
+        return is_space(c) ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+}
+
+void json_stream_init(json_stream_t *js, json_stream_cb_t cb, void *ctx)
+{
+    memset(js, 0, sizeof(*js));
+    js->cb = cb;
+    js->ctx = ctx;
+    js->state = JS_VALUE;
+}
+
+esp_err_t json_stream_feed(json_stream_t *js, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        esp_err_t err = step(js, data[i]);
+        if (err != ESP_OK) {
+            return err;
+        }
+        js->offset++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t json_stream_finish(json_stream_t *js)
+{
+    /* A bare top-level number has no terminating character */
+    if (js->state == JS_NUMBER && js->depth == 0) {
+        esp_err_t err = end_number(js);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return js->state == JS_DONE ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
@@ -0,0 +1,61 @@
+#ifndef JSON_STREAM
+#define JSON_STREAM
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Incremental JSON tokenizer: data is fed in arbitrary chunks as it arrives
+ * and every token is reported through a callback, so a body of any size is
+ * parsed with a fixed amount of memory. Strings and numbers longer than
+ * JSON_STREAM_TOKEN_MAX - 1 bytes are rejected. */
+
+#define JSON_STREAM_MAX_DEPTH 16
+#define JSON_STREAM_TOKEN_MAX 64
+
+typedef enum {
+    JSON_STREAM_OBJECT_BEGIN,
+    JSON_STREAM_OBJECT_END,
+    JSON_STREAM_ARRAY_BEGIN,
+    JSON_STREAM_ARRAY_END,
+    JSON_STREAM_KEY,
+    JSON_STREAM_STRING,
+    JSON_STREAM_NUMBER,     /* text is the number as written */
+    JSON_STREAM_TRUE,
+    JSON_STREAM_FALSE,
+    JSON_STREAM_NULL,
+} json_stream_event_t;
+
+/* text is NUL-terminated and only valid during the call (NULL for
+ * containers and literals). depth is the nesting level of the token: the
+ * outermost container is at 0 and its members at 1. Returning anything but
+ * ESP_OK stops the parse with that error. */
+typedef esp_err_t (*json_stream_cb_t)(void *ctx, json_stream_event_t event, const char *text, int depth);
+
+typedef struct {
+    json_stream_cb_t cb;
+    void *ctx;
+    uint8_t state;
+    uint8_t depth;
+    bool key;                   /* the string being read is an object key */
+    uint8_t literal_pos;
+    const char *literal;
+    uint8_t unicode_len;
+    uint16_t unicode;
+    uint32_t objects;           /* bit per level: 1 = object, 0 = array */
+    size_t offset;              /* bytes consumed, for error reports */
+    size_t len;
+    char token[JSON_STREAM_TOKEN_MAX];
+} json_stream_t;
+
+void json_stream_init(json_stream_t *js, json_stream_cb_t cb, void *ctx);
+
+/* Returns ESP_ERR_INVALID_ARG on a syntax error, ESP_ERR_INVALID_SIZE on an
+ * oversized token or nesting, or the callback's error. */
+esp_err_t json_stream_feed(json_stream_t *js, const char *data, size_t len);
+
+/* Call at the end of the input; ESP_ERR_INVALID_STATE if it was truncated */
+esp_err_t json_stream_finish(json_stream_t *js);
+
+#endif /* JSON_STREAM */
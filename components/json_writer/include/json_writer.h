@@ -0,0 +1,102 @@
+#ifndef JSON_WRITER
+#define JSON_WRITER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Streaming JSON serializer, the counterpart of the request tokenizer:
+ * values are escaped and formatted straight into a caller-provided buffer,
+ * which goes to the flush callback whenever it fills up. A document of any
+ * size is written with that buffer alone, no heap and no tree.
+ *
+ * The writer places the commas and colons and checks the nesting. The first
+ * error (a failed flush, a full buffer without flush callback, a key outside
+ * an object, nesting beyond JSON_WRITER_MAX_DEPTH) sticks and turns the
+ * calls after it into no-ops: callers check once, at json_writer_finish(). */
+
+#define JSON_WRITER_MAX_DEPTH 16
+
+/* Takes len bytes of output; anything but ESP_OK stops the writer */
+typedef esp_err_t (*json_writer_flush_t)(void *ctx, const char *data, size_t len);
+
+typedef struct {
+    json_writer_flush_t flush;  /* NULL: the whole document must fit in buf */
+    void *ctx;
+    char *buf;
+    size_t size;
+    size_t len;                 /* bytes waiting in buf */
+    size_t flushed;             /* bytes already handed to flush */
+    esp_err_t err;
+    uint8_t depth;
+    bool after_key;             /* a key was written, its value comes next */
+    uint32_t objects;           /* bit per level: 1 = object, 0 = array */
+    uint32_t members;           /* bit per level: something was written in it */
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size, json_writer_flush_t flush, void *ctx);
+
+void json_writer_object_begin(json_writer_t *w);
+void json_writer_object_end(json_writer_t *w);
+void json_writer_array_begin(json_writer_t *w);
+void json_writer_array_end(json_writer_t *w);
+/* Member name in an object; the next value written is its value */
+void json_writer_key(json_writer_t *w, const char *key);
+
+/* Escaped as needed; NULL is written as null */
+void json_writer_string(json_writer_t *w, const char *str);
+void json_writer_int(json_writer_t *w, int64_t value);
+void json_writer_uint(json_writer_t *w, uint64_t value);
+/* Integral values as integers, others with the fewest digits that read back
+ * the same (15 or 17, like cJSON); NaN and infinities as null */
+void json_writer_double(json_writer_t *w, double value);
+void json_writer_bool(json_writer_t *w, bool value);
+void json_writer_null(json_writer_t *w);
+
+/* Hand what is in the buffer to the flush callback */
+esp_err_t json_writer_flush(json_writer_t *w);
+
+/* Check the document is complete: the sticky error if any, else
+ * ESP_ERR_INVALID_STATE if a container is still open. The last w->len
+ * bytes stay in the buffer, for the caller to send or flush. */
+esp_err_t json_writer_finish(json_writer_t *w);
+
+/* Key and value in one go, for object members */
+static inline void json_writer_field_str(json_writer_t *w, const char *key, const char *value)
+{
+    json_writer_key(w, key);
+    json_writer_string(w, value);
+}
+
+static inline void json_writer_field_int(json_writer_t *w, const char *key, int64_t value)
+{
+    json_writer_key(w, key);
+    json_writer_int(w, value);
+}
+
+static inline void json_writer_field_uint(json_writer_t *w, const char *key, uint64_t value)
+{
+    json_writer_key(w, key);
+    json_writer_uint(w, value);
+}
+
+static inline void json_writer_field_double(json_writer_t *w, const char *key, double value)
+{
+    json_writer_key(w, key);
+    json_writer_double(w, value);
+}
+
+static inline void json_writer_field_bool(json_writer_t *w, const char *key, bool value)
+{
+    json_writer_key(w, key);
+    json_writer_bool(w, value);
+}
+
+static inline void json_writer_field_null(json_writer_t *w, const char *key)
+{
+    json_writer_key(w, key);
+    json_writer_null(w);
+}
+
+#endif /* JSON_WRITER */
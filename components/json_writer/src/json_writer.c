@@ -0,0 +1,275 @@
+#include "json_writer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char HEX[] = "0123456789abcdef";
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size, json_writer_flush_t flush, void *ctx)
+{
+    memset(w, 0, sizeof(*w));
+    w->flush = flush;
+    w->ctx = ctx;
+    w->buf = buf;
+    w->size = size;
+}
+
+esp_err_t json_writer_flush(json_writer_t *w)
+{
+    if (w->err != ESP_OK || w->len == 0) {
+        return w->err;
+    }
+    if (!w->flush) {
+        w->err = ESP_ERR_INVALID_SIZE;
+        return w->err;
+    }
+    w->err = w->flush(w->ctx, w->buf, w->len);
+    if (w->err == ESP_OK) {
+        w->flushed += w->len;
+        w->len = 0;
+    }
+    return w->err;
+}
+
+static void put(json_writer_t *w, const char *data, size_t len)
+{
+    while (len > 0) {
+        if (w->len == w->size && json_writer_flush(w) != ESP_OK) {
+            return;
+        }
+        size_t n = w->size - w->len < len ? w->size - w->len : len;
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static inline void put_char(json_writer_t *w, char c)
+{
+    if (w->len < w->size) {
+        w->buf[w->len++] = c;
+    } else {
+        put(w, &c, 1);
+    }
+}
+
+static void put_escaped(json_writer_t *w, const char *str)
+{
+    put_char(w, '"');
+    const char *run = str;
+    for (const char *p = str; *p; p++) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        /* Copy the plain run in one piece, then the escape */
+        put(w, run, p - run);
+        run = p + 1;
+        char esc[6] = { '\\', 0 };
+        size_t esc_len = 2;
+        switch (c) {
+        case '"': esc[1] = '"'; break;
+        case '\\': esc[1] = '\\'; break;
+        case '\b': esc[1] = 'b'; break;
+        case '\f': esc[1] = 'f'; break;
+        case '\n': esc[1] = 'n'; break;
+        case '\r': esc[1] = 'r'; break;
+        case '\t': esc[1] = 't'; break;
+        default:
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = HEX[c >> 4];
+            esc[5] = HEX[c & 0xF];
+            esc_len = 6;
+            break;
+        }
+        put(w, esc, esc_len);
+    }
+    put(w, run, strlen(run));
+    put_char(w, '"');
+}
+
+static inline bool in_object(const json_writer_t *w)
+{
+    return w->depth > 0 && (w->objects & (1u << (w->depth - 1)));
+}
+
+/* Separator before a value: nothing after a key, a comma between array
+ * elements. False if no value may go here. */
+static bool value_begin(json_writer_t *w)
+{
+    if (w->err != ESP_OK) {
+        return false;
+    }
+    if (w->after_key) {
+        w->after_key = false;
+        return true;
+    }
+    uint32_t level = 1u << w->depth;
+    if (in_object(w) || (w->depth == 0 && (w->members & level))) {
+        /* A bare value in an object, or a second document */
+        w->err = ESP_ERR_INVALID_STATE;
+        return false;
+    }
+    if (w->members & level) {
+        put_char(w, ',');
+    }
+    w->members |= level;
+    return true;
+}
+
+static void container_begin(json_writer_t *w, bool object)
+{
+    if (!value_begin(w)) {
+        return;
+    }
+    if (w->depth >= JSON_WRITER_MAX_DEPTH) {
+        w->err = ESP_ERR_INVALID_SIZE;
+        return;
+    }
+    put_char(w, object ? '{' : '[');
+    w->depth++;
+    if (object) {
+        w->objects |= 1u << (w->depth - 1);
+    } else {
+        w->objects &= ~(1u << (w->depth - 1));
+    }
+    w->members &= ~(1u << w->depth);
+}
+
+static void container_end(json_writer_t *w, bool object)
+{
+    if (w->err != ESP_OK) {
+        return;
+    }
+    if (w->depth == 0 || in_object(w) != object || w->after_key) {
+        w->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    w->depth--;
+    put_char(w, object ? '}' : ']');
+}
+
+void json_writer_object_begin(json_writer_t *w)
+{
+    container_begin(w, true);
+}
+
+void json_writer_object_end(json_writer_t *w)
+{
+    container_end(w, true);
+}
+
+void json_writer_array_begin(json_writer_t *w)
+{
+    container_begin(w, false);
+}
+
+void json_writer_array_end(json_writer_t *w)
+{
+    container_end(w, false);
+}
+
+void json_writer_key(json_writer_t *w, const char *key)
+{
+    if (w->err != ESP_OK) {
+        return;
+    }
+    if (!in_object(w) || w->after_key) {
+        w->err = ESP_ERR_INVALID_STATE;
+        return;
+    }
+    uint32_t level = 1u << w->depth;
+    if (w->members & level) {
+        put_char(w, ',');
+    }
+    w->members |= level;
+    put_escaped(w, key);
+    put_char(w, ':');
+    w->after_key = true;
+}
+
+void json_writer_string(json_writer_t *w, const char *str)
+{
+    if (!str) {
+        json_writer_null(w);
+    } else if (value_begin(w)) {
+        put_escaped(w, str);
+    }
+}
+
+static void put_uint(json_writer_t *w, uint64_t value, bool negative)
+{
+    char digits[21];
+    char *p = digits + sizeof(digits);
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    if (negative) {
+        *--p = '-';
+    }
+    put(w, p, digits + sizeof(digits) - p);
+}
+
+void json_writer_int(json_writer_t *w, int64_t value)
+{
+    if (value_begin(w)) {
+        /* Through unsigned, so INT64_MIN negates cleanly */
+        put_uint(w, value < 0 ? -(uint64_t)value : (uint64_t)value, value < 0);
+    }
+}
+
+void json_writer_uint(json_writer_t *w, uint64_t value)
+{
+    if (value_begin(w)) {
+        put_uint(w, value, false);
+    }
+}
+
+void json_writer_double(json_writer_t *w, double value)
+{
+    if (!isfinite(value)) {
+        json_writer_null(w);
+        return;
+    }
+    /* Below 2^53 integers are exact and need no exponent */
+    if (value == floor(value) && fabs(value) < 9007199254740992.0) {
+        json_writer_int(w, (int64_t)value);
+        return;
+    }
+    if (value_begin(w)) {
+        char text[32];
+        int len = snprintf(text, sizeof(text), "%.15g", value);
+        if (strtod(text, NULL) != value) {
+            len = snprintf(text, sizeof(text), "%.17g", value);
+        }
+        put(w, text, len);
+    }
+}
+
+void json_writer_bool(json_writer_t *w, bool value)
+{
+    if (value_begin(w)) {
+        put(w, value ? "true" : "false", value ? 4 : 5);
+    }
+}
+
+void json_writer_null(json_writer_t *w)
+{
+    if (value_begin(w)) {
+        put(w, "null", 4);
+    }
+}
+
+esp_err_t json_writer_finish(json_writer_t *w)
+{
+    if (w->err == ESP_OK && (w->depth != 0 || w->after_key || !(w->members & 1u))) {
+        w->err = ESP_ERR_INVALID_STATE;
+    }
+    return w->err;
+}
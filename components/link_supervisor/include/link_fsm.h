@@ -0,0 +1,76 @@
+#ifndef LINK_FSM
+#define LINK_FSM
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Pure state machine behind the link supervisor. It has no ESP-IDF
+ * dependencies: feed it inputs with a timestamp and carry out the returned
+ * actions, so it can be driven with synthetic Wi-Fi/IP events on a host. */
+
+#define LINK_RECOVERY_HISTORY 8
+
+typedef enum {
+    LINK_STATE_IDLE = 0,        /* station not started */
+    LINK_STATE_CONNECTING,      /* waiting for association */
+    LINK_STATE_ASSOCIATED,      /* associated, waiting for an IP */
+    LINK_STATE_UP,
+    LINK_STATE_BACKOFF,         /* waiting before the next attempt */
+} link_state_t;
+
+typedef enum {
+    LINK_INPUT_START = 0,
+    LINK_INPUT_CONNECTED,
+    LINK_INPUT_GOT_IP,
+    LINK_INPUT_LOST_IP,
+    LINK_INPUT_DISCONNECTED,
+    LINK_INPUT_TIMER,           /* the timer armed by the last actions expired */
+} link_input_t;
+
+typedef enum {
+    LINK_NOTIFY_NONE = 0,
+    LINK_NOTIFY_UP,
+    LINK_NOTIFY_DOWN,
+} link_notify_t;
+
+typedef struct {
+    uint32_t backoff_base_ms;
+    uint32_t backoff_max_ms;
+    uint32_t attempt_timeout_ms;    /* association or DHCP taking longer is a failure */
+} link_fsm_config_t;
+
+/* What the caller must do after an input. The pending timer is always
+ * cancelled first and re-armed when timer_ms is non-zero. */
+typedef struct {
+    bool connect;
+    bool use_cached_ap;         /* with connect: go straight to the cached BSSID/channel */
+    bool disconnect;            /* abort a stuck attempt, a DISCONNECTED input follows */
+    uint32_t timer_ms;
+    link_notify_t notify;
+} link_actions_t;
+
+typedef struct {
+    uint32_t outages;
+    uint32_t attempts;              /* connection attempts after the first */
+    uint32_t last_recovery_ms;
+    uint32_t max_recovery_ms;
+    uint64_t total_recovery_ms;
+    uint32_t recent_recovery_ms[LINK_RECOVERY_HISTORY];  /* newest at recent_head - 1 */
+    uint8_t recent_head;
+} link_fsm_stats_t;
+
+typedef struct {
+    link_fsm_config_t cfg;
+    link_state_t state;
+    uint32_t attempt;           /* failed attempts in the current outage */
+    bool have_cache;
+    int64_t down_since_ms;
+    uint32_t rng;
+    link_fsm_stats_t stats;
+} link_fsm_t;
+
+void link_fsm_init(link_fsm_t *fsm, const link_fsm_config_t *cfg, bool have_cached_ap, uint32_t seed);
+link_actions_t link_fsm_input(link_fsm_t *fsm, link_input_t input, int64_t now_ms);
+const char *link_state_to_str(link_state_t state);
+
+#endif /* LINK_FSM */
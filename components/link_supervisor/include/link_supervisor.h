@@ -0,0 +1,29 @@
+#ifndef LINK_SUPERVISOR
+#define LINK_SUPERVISOR
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "link_fsm.h"
+
+/* Upstream link notifications, posted on the default event loop. On
+ * recovery LINK_EVENT_UP is posted before LINK_EVENT_SERVICES_READY, so
+ * network plumbing (DNS forwarding on the SoftAP) is in place before cloud
+ * services reconnect. */
+ESP_EVENT_DECLARE_BASE(LINK_EVENT);
+
+typedef enum {
+    LINK_EVENT_DOWN = 0,
+    LINK_EVENT_UP,
+    LINK_EVENT_SERVICES_READY,
+} link_event_id_t;
+
+/* Take over station reconnects. Call after esp_wifi_init() and before
+ * esp_wifi_start(). The host build has no station: the link is up as soon
+ * as this is called. */
+esp_err_t link_supervisor_start(void);
+
+bool link_supervisor_is_up(void);
+void link_supervisor_get_stats(link_state_t *state, link_fsm_stats_t *stats);
+
+#endif /* LINK_SUPERVISOR */
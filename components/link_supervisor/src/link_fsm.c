@@ -0,0 +1,163 @@
+#include "link_fsm.h"
+
+#include <string.h>
+
+static const char *const s_state_names[] = {
+    [LINK_STATE_IDLE] = "idle",
+    [LINK_STATE_CONNECTING] = "connecting",
+    [LINK_STATE_ASSOCIATED] = "associated",
+    [LINK_STATE_UP] = "up",
+    [LINK_STATE_BACKOFF] = "backoff",
+};
+
+static uint32_t next_random(link_fsm_t *fsm)
+{
+    /* xorshift32, plenty for spreading retries of a few devices apart */
+    uint32_t x = fsm->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    fsm->rng = x;
+    return x;
+}
+
+/* Exponential backoff with "equal jitter": half fixed, half random, so
+ * devices that lost the same router do not retry in lockstep. */
+static uint32_t backoff_ms(link_fsm_t *fsm)
+{
+    uint32_t delay = fsm->cfg.backoff_max_ms;
+    if (fsm->attempt < 32 && (fsm->cfg.backoff_base_ms << fsm->attempt) >> fsm->attempt == fsm->cfg.backoff_base_ms) {
+        uint32_t exp = fsm->cfg.backoff_base_ms << fsm->attempt;
+        delay = exp < delay ? exp : delay;
+    }
+    return delay / 2 + next_random(fsm) % (delay / 2 + 1);
+}
+
+static link_actions_t connect_now(link_fsm_t *fsm, bool cached)
+{
+    link_actions_t actions = {
+        .connect = true,
+        .use_cached_ap = cached && fsm->have_cache,
+        .timer_ms = fsm->cfg.attempt_timeout_ms,
+    };
+    fsm->state = LINK_STATE_CONNECTING;
+    return actions;
+}
+
+static void record_recovery(link_fsm_t *fsm, int64_t now_ms)
+{
+    link_fsm_stats_t *stats = &fsm->stats;
+    uint32_t ms = now_ms - fsm->down_since_ms;
+
+    stats->last_recovery_ms = ms;
+    stats->total_recovery_ms += ms;
+    if (ms > stats->max_recovery_ms) {
+        stats->max_recovery_ms = ms;
+    }
+    stats->recent_recovery_ms[stats->recent_head] = ms;
+    stats->recent_head = (stats->recent_head + 1) % LINK_RECOVERY_HISTORY;
+    fsm->down_since_ms = -1;
+}
+
+/* The attempt in progress failed, or the link went down */
+static link_actions_t link_failed(link_fsm_t *fsm, int64_t now_ms)
+{
+    link_actions_t actions = { 0 };
+
+    if (fsm->state == LINK_STATE_UP) {
+        /* First retry right away on the channel we were just on */
+        fsm->stats.outages++;
+        fsm->stats.attempts++;
+        fsm->down_since_ms = now_ms;
+        fsm->attempt = 0;
+        actions = connect_now(fsm, true);
+        actions.notify = LINK_NOTIFY_DOWN;
+        return actions;
+    }
+
+    /* Every further attempt scans all channels: the AP may have moved */
+    actions.timer_ms = backoff_ms(fsm);
+    fsm->attempt++;
+    fsm->state = LINK_STATE_BACKOFF;
+    return actions;
+}
+
+void link_fsm_init(link_fsm_t *fsm, const link_fsm_config_t *cfg, bool have_cached_ap, uint32_t seed)
+{
+    memset(fsm, 0, sizeof(*fsm));
+    fsm->cfg = *cfg;
+    fsm->state = LINK_STATE_IDLE;
+    fsm->have_cache = have_cached_ap;
+    fsm->down_since_ms = -1;
+    fsm->rng = seed ? seed : 0x2545F491;
+}
+
+link_actions_t link_fsm_input(link_fsm_t *fsm, link_input_t input, int64_t now_ms)
+{
+    link_actions_t actions = { 0 };
+
+    switch (input) {
+    case LINK_INPUT_START:
+        if (fsm->state == LINK_STATE_IDLE) {
+            /* Boot counts as an outage until the first IP */
+            fsm->down_since_ms = now_ms;
+            actions = connect_now(fsm, true);
+        }
+        break;
+
+    case LINK_INPUT_CONNECTED:
+        if (fsm->state == LINK_STATE_CONNECTING || fsm->state == LINK_STATE_BACKOFF) {
+            /* The caller stores the new AP, so the next fast retry can use it */
+            fsm->have_cache = true;
+            fsm->state = LINK_STATE_ASSOCIATED;
+            actions.timer_ms = fsm->cfg.attempt_timeout_ms;
+        }
+        break;
+
+    case LINK_INPUT_GOT_IP:
+        if (fsm->state != LINK_STATE_UP && fsm->state != LINK_STATE_IDLE) {
+            fsm->state = LINK_STATE_UP;
+            fsm->attempt = 0;
+            if (fsm->down_since_ms >= 0) {
+                record_recovery(fsm, now_ms);
+            }
+            actions.notify = LINK_NOTIFY_UP;
+        }
+        break;
+
+    case LINK_INPUT_LOST_IP:
+        if (fsm->state == LINK_STATE_UP) {
+            /* Still associated: give DHCP one attempt timeout to come back */
+            fsm->stats.outages++;
+            fsm->down_since_ms = now_ms;
+            fsm->state = LINK_STATE_ASSOCIATED;
+            actions.notify = LINK_NOTIFY_DOWN;
+            actions.timer_ms = fsm->cfg.attempt_timeout_ms;
+        }
+        break;
+
+    case LINK_INPUT_DISCONNECTED:
+        if (fsm->state == LINK_STATE_UP || fsm->state == LINK_STATE_CONNECTING ||
+                fsm->state == LINK_STATE_ASSOCIATED) {
+            actions = link_failed(fsm, now_ms);
+        }
+        break;
+
+    case LINK_INPUT_TIMER:
+        if (fsm->state == LINK_STATE_BACKOFF) {
+            fsm->stats.attempts++;
+            actions = connect_now(fsm, false);
+        } else if (fsm->state == LINK_STATE_CONNECTING || fsm->state == LINK_STATE_ASSOCIATED) {
+            /* Stuck: drop the attempt, the DISCONNECTED input schedules the next */
+            actions.disconnect = true;
+            actions.timer_ms = fsm->cfg.attempt_timeout_ms;
+        }
+        break;
+    }
+    return actions;
+}
+
+const char *link_state_to_str(link_state_t state)
+{
+    return state <= LINK_STATE_BACKOFF ? s_state_names[state] : "unknown";
+}
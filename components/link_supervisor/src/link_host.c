@@ -0,0 +1,39 @@
+#include "link_supervisor.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+static const char *TAG = "link";
+
+ESP_EVENT_DEFINE_BASE(LINK_EVENT);
+
+/* Host build: there is no station, the uplink is the machine's own network.
+ * It comes up once at start and stays up, so the services following
+ * LINK_EVENT see the same notifications as after a first association. */
+static bool s_up = false;
+
+esp_err_t link_supervisor_start(void)
+{
+    if (s_up) {
+        return ESP_OK;
+    }
+    s_up = true;
+    ESP_LOGI(TAG, "Link up (host)");
+    esp_err_t err = esp_event_post(LINK_EVENT, LINK_EVENT_UP, NULL, 0, portMAX_DELAY);
+    if (err == ESP_OK) {
+        err = esp_event_post(LINK_EVENT, LINK_EVENT_SERVICES_READY, NULL, 0, portMAX_DELAY);
+    }
+    return err;
+}
+
+bool link_supervisor_is_up(void)
+{
+    return s_up;
+}
+
+void link_supervisor_get_stats(link_state_t *state, link_fsm_stats_t *stats)
+{
+    *state = s_up ? LINK_STATE_UP : LINK_STATE_IDLE;
+    memset(stats, 0, sizeof(*stats));
+}
@@ -0,0 +1,218 @@
+#include "link_supervisor.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+#include "boot_trace.h"
+#include "metrics.h"
+
+static const char *TAG = "link";
+
+ESP_EVENT_DEFINE_BASE(LINK_EVENT);
+/* Timer expiries are routed through the event loop, so every input of the
+ * state machine is handled on the same task */
+ESP_EVENT_DEFINE_BASE(LINK_TIMER_EVENT);
+
+/* Last upstream AP, so a reconnect can skip the all-channel scan */
+#define AP_CACHE_NVS_NAMESPACE  "wifi_cache"
+#define AP_CACHE_NVS_KEY        "ap"
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} ap_cache_t;
+
+static link_fsm_t s_fsm;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t s_timer = NULL;
+static ap_cache_t s_ap_cache;
+
+static metrics_hist_t s_reconnect_hist = METRICS_HIST_INIT("wifi_reconnect_seconds",
+                                                           "Uplink lost (or boot) -> IP address again");
+static metrics_counter_t s_outage_count = METRICS_COUNTER_INIT("wifi_outages_total", "Uplink losses");
+
+static bool ap_cache_load(ap_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(*cache);
+    if (nvs_open(AP_CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    esp_err_t err = nvs_get_blob(nvs, AP_CACHE_NVS_KEY, cache, &len);
+    nvs_close(nvs);
+    return err == ESP_OK && len == sizeof(*cache) && cache->channel != 0;
+}
+
+/* Only written when the AP changed, so a normal reconnect costs no flash */
+static void ap_cache_store(const uint8_t bssid[6], uint8_t channel)
+{
+    if (memcmp(s_ap_cache.bssid, bssid, sizeof(s_ap_cache.bssid)) == 0 && s_ap_cache.channel == channel) {
+        return;
+    }
+    memcpy(s_ap_cache.bssid, bssid, sizeof(s_ap_cache.bssid));
+    s_ap_cache.channel = channel;
+
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(AP_CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, AP_CACHE_NVS_KEY, &s_ap_cache, sizeof(s_ap_cache));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to cache AP (%s)", esp_err_to_name(err));
+    }
+}
+
+/* Lock the station to the cached AP, or scan every channel */
+static void sta_configure(bool cached)
+{
+    wifi_config_t cfg;
+    if (esp_wifi_get_config(WIFI_IF_STA, &cfg) != ESP_OK) {
+        return;
+    }
+    cfg.sta.bssid_set = cached;
+    if (cached) {
+        memcpy(cfg.sta.bssid, s_ap_cache.bssid, sizeof(cfg.sta.bssid));
+        cfg.sta.channel = s_ap_cache.channel;
+        cfg.sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        cfg.sta.channel = 0;
+        cfg.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &cfg);
+}
+
+static void link_apply(const link_actions_t *actions)
+{
+    esp_timer_stop(s_timer);
+
+    if (actions->disconnect) {
+        esp_wifi_disconnect();
+    }
+    if (actions->connect) {
+        sta_configure(actions->use_cached_ap);
+        if (actions->use_cached_ap) {
+            ESP_LOGI(TAG, "Connecting to cached AP "MACSTR" on channel %d",
+                     MAC2STR(s_ap_cache.bssid), s_ap_cache.channel);
+        }
+        esp_wifi_connect();
+    }
+    if (actions->timer_ms) {
+        esp_timer_start_once(s_timer, (uint64_t)actions->timer_ms * 1000);
+    }
+
+    if (actions->notify == LINK_NOTIFY_UP) {
+        ESP_LOGI(TAG, "Link up, recovered in %lu ms", (unsigned long)s_fsm.stats.last_recovery_ms);
+        metrics_observe_us(&s_reconnect_hist, (int64_t)s_fsm.stats.last_recovery_ms * 1000);
+        esp_event_post(LINK_EVENT, LINK_EVENT_UP, NULL, 0, 0);
+        esp_event_post(LINK_EVENT, LINK_EVENT_SERVICES_READY, NULL, 0, 0);
+    } else if (actions->notify == LINK_NOTIFY_DOWN) {
+        ESP_LOGW(TAG, "Link down");
+        metrics_inc(&s_outage_count);
+        esp_event_post(LINK_EVENT, LINK_EVENT_DOWN, NULL, 0, 0);
+    } else if (actions->timer_ms && s_fsm.state == LINK_STATE_BACKOFF) {
+        ESP_LOGI(TAG, "Reconnect attempt %lu in %lu ms",
+                 (unsigned long)s_fsm.attempt + 1, (unsigned long)actions->timer_ms);
+    }
+}
+
+static void link_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    link_input_t input;
+
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        input = LINK_INPUT_START;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *) event_data;
+        boot_trace_mark("sta_connected");
+        ap_cache_store(event->bssid, event->channel);
+        input = LINK_INPUT_CONNECTED;
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *) event_data;
+        ESP_LOGI(TAG, "Disconnected (reason %d)", event->reason);
+        input = LINK_INPUT_DISCONNECTED;
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        boot_trace_mark("sta_got_ip");
+        input = LINK_INPUT_GOT_IP;
+    } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+        input = LINK_INPUT_LOST_IP;
+    } else if (event_base == LINK_TIMER_EVENT) {
+        input = LINK_INPUT_TIMER;
+    } else {
+        return;
+    }
+
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    portENTER_CRITICAL(&s_lock);
+    link_actions_t actions = link_fsm_input(&s_fsm, input, now_ms);
+    portEXIT_CRITICAL(&s_lock);
+    link_apply(&actions);
+}
+
+static void link_timer_cb(void *arg)
+{
+    esp_event_post(LINK_TIMER_EVENT, 0, NULL, 0, 0);
+}
+
+esp_err_t link_supervisor_start(void)
+{
+    if (s_timer) {
+        return ESP_OK;
+    }
+
+    const link_fsm_config_t cfg = {
+        .backoff_base_ms = CONFIG_LINK_BACKOFF_BASE_MS,
+        .backoff_max_ms = CONFIG_LINK_BACKOFF_MAX_MS,
+        .attempt_timeout_ms = CONFIG_LINK_ATTEMPT_TIMEOUT_MS,
+    };
+    link_fsm_init(&s_fsm, &cfg, ap_cache_load(&s_ap_cache), esp_random());
+    metrics_register_hist(&s_reconnect_hist);
+    metrics_register_counter(&s_outage_count);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = link_timer_cb,
+        .name = "link",
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &s_timer);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    const struct {
+        esp_event_base_t base;
+        int32_t id;
+    } events[] = {
+        { WIFI_EVENT, WIFI_EVENT_STA_START },
+        { WIFI_EVENT, WIFI_EVENT_STA_CONNECTED },
+        { WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED },
+        { IP_EVENT, IP_EVENT_STA_GOT_IP },
+        { IP_EVENT, IP_EVENT_STA_LOST_IP },
+        { LINK_TIMER_EVENT, ESP_EVENT_ANY_ID },
+    };
+    for (size_t i = 0; i < sizeof(events) / sizeof(events[0]) && err == ESP_OK; i++) {
+        err = esp_event_handler_instance_register(events[i].base, events[i].id, link_event_handler, NULL, NULL);
+    }
+    return err;
+}
+
+bool link_supervisor_is_up(void)
+{
+    return s_fsm.state == LINK_STATE_UP;
+}
+
+void link_supervisor_get_stats(link_state_t *state, link_fsm_stats_t *stats)
+{
+    portENTER_CRITICAL(&s_lock);
+    *state = s_fsm.state;
+    *stats = s_fsm.stats;
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -1,6 +1,11 @@
 #ifndef MDNS_SERVICE
 #define MDNS_SERVICE
 
-void initialise_mdns(void);
+#include "esp_err.h"
+
+/* Announce CONFIG_MDNS_HOST_NAME.local and the web UI over multicast DNS.
+ * Call after start_softap_sta(). SoftAP clients asking the device's own
+ * DNS server get the name from the DNS responder instead. */
+esp_err_t initialise_mdns(void);
 
 #endif /* MDNS_SERVICE */
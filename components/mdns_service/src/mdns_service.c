@@ -1,8 +1,20 @@
+#include "mdns_service.h"
+
+#include "esp_log.h"
 #include "mdns.h"
 
-void initialise_mdns(void)
+static const char *TAG = "mdns";
+
+esp_err_t initialise_mdns(void)
 {
-    mdns_init();
+    /* Records are set once here; the component announces them by itself
+     * on every interface that comes up: the SoftAP at boot and the station
+     * after each reconnect. */
+    esp_err_t err = mdns_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mdns_init failed: %s", esp_err_to_name(err));
+        return err;
+    }
     mdns_hostname_set(CONFIG_MDNS_HOST_NAME);
     mdns_instance_name_set(CONFIG_MDNS_INSTANCE);
 
@@ -11,6 +23,10 @@ void initialise_mdns(void)
         {"path", "/"}
     };
 
-    ESP_ERROR_CHECK(mdns_service_add("ESP32-WebServer", "_http", "_tcp", 80, serviceTxtData,
-                                     sizeof(serviceTxtData) / sizeof(serviceTxtData[0])));
-}
\ No newline at end of file
+    err = mdns_service_add("ESP32-WebServer", "_http", "_tcp", CONFIG_HTTP_SERVER_PORT, serviceTxtData,
+                           sizeof(serviceTxtData) / sizeof(serviceTxtData[0]));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mdns_service_add failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
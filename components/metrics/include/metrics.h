@@ -0,0 +1,78 @@
+#ifndef METRICS
+#define METRICS
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define METRICS_BUCKETS 20
+
+/* Upper bound of every histogram bucket in microseconds, from 100 us to
+ * 2 minutes; the last one is open (+Inf) */
+extern const uint32_t metrics_bucket_us[METRICS_BUCKETS];
+
+/* Fixed-bucket latency histogram. Define it statically with
+ * METRICS_HIST_INIT and register it once; recording is three relaxed
+ * atomic adds and takes no lock. Histograms sharing a name form one
+ * Prometheus family and are told apart by their label. */
+typedef struct metrics_hist {
+    const char *name;           /* Prometheus name, e.g. "http_auth_seconds" */
+    const char *help;
+    const char *label;          /* optional label name */
+    const char *label_value;
+    _Atomic uint32_t buckets[METRICS_BUCKETS];  /* not cumulative */
+    _Atomic uint32_t count;
+    _Atomic uint64_t sum_us;
+    struct metrics_hist *next;
+    bool registered;
+} metrics_hist_t;
+
+typedef struct metrics_counter {
+    const char *name;           /* Prometheus name, ends in "_total" */
+    const char *help;
+    _Atomic uint32_t value;
+    struct metrics_counter *next;
+    bool registered;
+} metrics_counter_t;
+
+#define METRICS_HIST_INIT(name_, help_) { .name = (name_), .help = (help_) }
+#define METRICS_COUNTER_INIT(name_, help_) { .name = (name_), .help = (help_) }
+
+/* Heap figures of the default capabilities */
+typedef struct {
+    uint32_t free;
+    uint32_t min_free;          /* low-water mark since boot */
+    uint32_t largest_block;     /* largest allocation that can succeed */
+} metrics_memory_t;
+
+/* Make a metric visible to the exporters. Idempotent, so owners can call
+ * it from start functions that may run more than once. */
+void metrics_register_hist(metrics_hist_t *hist);
+void metrics_register_counter(metrics_counter_t *counter);
+
+void metrics_observe_us(metrics_hist_t *hist, int64_t us);
+void metrics_observe_since(metrics_hist_t *hist, int64_t start_us);
+
+static inline void metrics_inc(metrics_counter_t *counter)
+{
+    atomic_fetch_add_explicit(&counter->value, 1, memory_order_relaxed);
+}
+
+/* Bucket bound below which a fraction q of the observations fall */
+uint32_t metrics_hist_quantile_us(const metrics_hist_t *hist, float q);
+
+void metrics_get_memory(metrics_memory_t *out);
+
+/* Receives the exported text piece by piece; an error stops the export */
+typedef esp_err_t (*metrics_write_fn_t)(void *ctx, const char *text, size_t len);
+
+/* Every metric in Prometheus text exposition format (version 0.0.4) */
+esp_err_t metrics_write_prometheus(metrics_write_fn_t write, void *ctx);
+
+/* Short human-readable summary: memory, the tightest task stacks and the
+ * median and p99 of every histogram with data. Returns the length. */
+size_t metrics_format_summary(char *buf, size_t len);
+
+#endif /* METRICS */
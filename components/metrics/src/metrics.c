@@ -0,0 +1,299 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+#define LINE_MAX_LEN        192
+/* Tasks listed in the summary, the ones closest to overflowing */
+#define SUMMARY_STACKS      3
+
+const uint32_t metrics_bucket_us[METRICS_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000, 120000000, UINT32_MAX
+};
+
+/* The same bounds as Prometheus "le" values, in seconds */
+static const char *const s_bucket_le[METRICS_BUCKETS] = {
+    "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1",
+    "0.25", "0.5", "1", "2.5", "5", "10", "30", "60", "120", "+Inf"
+};
+
+/* Registration appends, so export follows registration order */
+static metrics_hist_t *s_hists = NULL;
+static metrics_hist_t **s_hists_tail = &s_hists;
+static metrics_counter_t *s_counters = NULL;
+static metrics_counter_t **s_counters_tail = &s_counters;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void metrics_register_hist(metrics_hist_t *hist)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (!hist->registered) {
+        hist->registered = true;
+        hist->next = NULL;
+        *s_hists_tail = hist;
+        s_hists_tail = &hist->next;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_register_counter(metrics_counter_t *counter)
+{
+    portENTER_CRITICAL(&s_lock);
+    if (!counter->registered) {
+        counter->registered = true;
+        counter->next = NULL;
+        *s_counters_tail = counter;
+        s_counters_tail = &counter->next;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void metrics_observe_us(metrics_hist_t *hist, int64_t us)
+{
+    uint32_t value = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    int bucket = 0;
+    while (value > metrics_bucket_us[bucket]) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&hist->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_us, value, memory_order_relaxed);
+}
+
+void metrics_observe_since(metrics_hist_t *hist, int64_t start_us)
+{
+    metrics_observe_us(hist, esp_timer_get_time() - start_us);
+}
+
+uint32_t metrics_hist_quantile_us(const metrics_hist_t *hist, float q)
+{
+    uint32_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    uint32_t rank = (uint32_t)(q * count + 0.5f);
+    uint32_t seen = 0;
+    rank = rank == 0 ? 1 : rank;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            return metrics_bucket_us[i];
+        }
+    }
+    return UINT32_MAX;
+}
+
+void metrics_get_memory(metrics_memory_t *out)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    memset(out, 0, sizeof(*out));
+#else
+    out->free = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    out->min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    out->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+#endif
+}
+
+#if CONFIG_METRICS_TASK_STACKS && !CONFIG_IDF_TARGET_LINUX
+/* Snapshot of every task; the caller frees the array */
+static TaskStatus_t *task_snapshot(UBaseType_t *count)
+{
+    /* A little headroom for tasks created meanwhile */
+    UBaseType_t max = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *tasks = malloc(max * sizeof(TaskStatus_t));
+    *count = tasks ? uxTaskGetSystemState(tasks, max, NULL) : 0;
+    return tasks;
+}
+
+static int stack_cmp(const void *a, const void *b)
+{
+    const TaskStatus_t *ta = a;
+    const TaskStatus_t *tb = b;
+    return (int)ta->usStackHighWaterMark - (int)tb->usStackHighWaterMark;
+}
+#endif
+
+/* Exposition helpers: every line is formatted into buf and written at once */
+typedef struct {
+    metrics_write_fn_t write;
+    void *ctx;
+    esp_err_t err;
+    char buf[LINE_MAX_LEN];
+} prom_writer_t;
+
+static void prom_line(prom_writer_t *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void prom_line(prom_writer_t *w, const char *fmt, ...)
+{
+    if (w->err != ESP_OK) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(w->buf, sizeof(w->buf), fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        w->err = w->write(w->ctx, w->buf, (size_t)len < sizeof(w->buf) ? (size_t)len : sizeof(w->buf) - 1);
+    }
+}
+
+static void prom_header(prom_writer_t *w, const char *name, const char *type, const char *help)
+{
+    prom_line(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void prom_hist(prom_writer_t *w, const metrics_hist_t *hist)
+{
+    /* Label set with and without a trailing comma for the "le" label */
+    char labels[48] = "";
+    char le_prefix[48] = "";
+    if (hist->label) {
+        snprintf(labels, sizeof(labels), "{%s=\"%s\"}", hist->label, hist->label_value);
+        snprintf(le_prefix, sizeof(le_prefix), "%s=\"%s\",", hist->label, hist->label_value);
+    }
+
+    uint32_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        prom_line(w, "%s_bucket{%sle=\"%s\"} %lu\n", hist->name, le_prefix, s_bucket_le[i], (unsigned long)cumulative);
+    }
+    uint64_t sum_us = atomic_load_explicit(&hist->sum_us, memory_order_relaxed);
+    prom_line(w, "%s_sum%s %llu.%06llu\n", hist->name, labels,
+              (unsigned long long)(sum_us / 1000000), (unsigned long long)(sum_us % 1000000));
+    /* The +Inf bucket is the count, read together with the buckets */
+    prom_line(w, "%s_count%s %lu\n", hist->name, labels, (unsigned long)cumulative);
+}
+
+esp_err_t metrics_write_prometheus(metrics_write_fn_t write, void *ctx)
+{
+    prom_writer_t *w = malloc(sizeof(prom_writer_t));
+    if (!w) {
+        return ESP_ERR_NO_MEM;
+    }
+    w->write = write;
+    w->ctx = ctx;
+    w->err = ESP_OK;
+
+    /* Metrics are never unregistered, so the lists can be walked unlocked */
+    for (metrics_hist_t *hist = s_hists; hist; hist = hist->next) {
+        /* A family is written where its first member was registered */
+        bool seen = false;
+        for (metrics_hist_t *prev = s_hists; prev != hist && !seen; prev = prev->next) {
+            seen = strcmp(prev->name, hist->name) == 0;
+        }
+        if (seen) {
+            continue;
+        }
+        prom_header(w, hist->name, "histogram", hist->help);
+        for (metrics_hist_t *member = hist; member; member = member->next) {
+            if (strcmp(member->name, hist->name) == 0) {
+                prom_hist(w, member);
+            }
+        }
+    }
+
+    for (metrics_counter_t *counter = s_counters; counter; counter = counter->next) {
+        prom_header(w, counter->name, "counter", counter->help);
+        prom_line(w, "%s %lu\n", counter->name,
+                  (unsigned long)atomic_load_explicit(&counter->value, memory_order_relaxed));
+    }
+
+    prom_header(w, "uptime_seconds", "gauge", "Time since boot");
+    prom_line(w, "uptime_seconds %lld\n", (long long)(esp_timer_get_time() / 1000000));
+
+#if !CONFIG_IDF_TARGET_LINUX
+    metrics_memory_t mem;
+    metrics_get_memory(&mem);
+    prom_header(w, "heap_free_bytes", "gauge", "Free heap");
+    prom_line(w, "heap_free_bytes %lu\n", (unsigned long)mem.free);
+    prom_header(w, "heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    prom_line(w, "heap_min_free_bytes %lu\n", (unsigned long)mem.min_free);
+    prom_header(w, "heap_largest_free_block_bytes", "gauge", "Largest allocation that can succeed");
+    prom_line(w, "heap_largest_free_block_bytes %lu\n", (unsigned long)mem.largest_block);
+#endif
+
+#if CONFIG_METRICS_TASK_STACKS && !CONFIG_IDF_TARGET_LINUX
+    UBaseType_t count;
+    TaskStatus_t *tasks = task_snapshot(&count);
+    prom_header(w, "task_stack_free_min_bytes", "gauge", "Least free stack a task has had");
+    for (UBaseType_t i = 0; i < count; i++) {
+        prom_line(w, "task_stack_free_min_bytes{task=\"%s\"} %lu\n",
+                  tasks[i].pcTaskName, (unsigned long)tasks[i].usStackHighWaterMark);
+    }
+    free(tasks);
+#endif
+
+    esp_err_t err = w->err;
+    free(w);
+    return err;
+}
+
+/* Microseconds as a short human-readable duration */
+static const char *format_us(uint32_t us, char out[12])
+{
+    if (us == UINT32_MAX) {
+        strcpy(out, "inf");
+    } else if (us < 1000) {
+        snprintf(out, 12, "%luus", (unsigned long)us);
+    } else if (us < 1000000) {
+        snprintf(out, 12, "%lums", (unsigned long)(us / 1000));
+    } else {
+        snprintf(out, 12, "%lus", (unsigned long)(us / 1000000));
+    }
+    return out;
+}
+
+size_t metrics_format_summary(char *buf, size_t len)
+{
+    size_t used = 0;
+    buf[0] = '\0';
+
+#define SUMMARY_APPEND(...) do { \
+        if (used < len) { \
+            int written_ = snprintf(buf + used, len - used, __VA_ARGS__); \
+            used += written_ > 0 ? (size_t)written_ : 0; \
+        } \
+    } while (0)
+
+#if !CONFIG_IDF_TARGET_LINUX
+    metrics_memory_t mem;
+    metrics_get_memory(&mem);
+    SUMMARY_APPEND("**heap** free=%lu min=%lu largest=%lu\n",
+                   (unsigned long)mem.free, (unsigned long)mem.min_free, (unsigned long)mem.largest_block);
+#endif
+
+#if CONFIG_METRICS_TASK_STACKS && !CONFIG_IDF_TARGET_LINUX
+    UBaseType_t count;
+    TaskStatus_t *tasks = task_snapshot(&count);
+    if (count) {
+        qsort(tasks, count, sizeof(TaskStatus_t), stack_cmp);
+        SUMMARY_APPEND("**stack** free min:");
+        for (UBaseType_t i = 0; i < count && i < SUMMARY_STACKS; i++) {
+            SUMMARY_APPEND(" %s=%lu", tasks[i].pcTaskName, (unsigned long)tasks[i].usStackHighWaterMark);
+        }
+        SUMMARY_APPEND("\n");
+    }
+    free(tasks);
+#endif
+
+    for (metrics_hist_t *hist = s_hists; hist; hist = hist->next) {
+        uint32_t n = atomic_load_explicit(&hist->count, memory_order_relaxed);
+        if (n == 0) {
+            continue;
+        }
+        char p50[12], p99[12];
+        SUMMARY_APPEND("`%s%s%s` n=%lu p50<=%s p99<=%s\n", hist->name,
+                       hist->label_value ? " " : "", hist->label_value ? hist->label_value : "", (unsigned long)n,
+                       format_us(metrics_hist_quantile_us(hist, 0.5f), p50),
+                       format_us(metrics_hist_quantile_us(hist, 0.99f), p99));
+    }
+#undef SUMMARY_APPEND
+
+    return used < len ? used : len - 1;
+}
@@ -0,0 +1,27 @@
+#ifndef PRESENCE
+#define PRESENCE
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "presence_engine.h"
+
+typedef struct {
+    uint32_t counts[PRESENCE_VERDICT_MAX];  /* events per verdict, OPEN counts every open */
+    uint32_t prewarm_opens;     /* opens triggered by probe requests */
+    uint32_t open_failures;     /* opens the gate actuator refused */
+    uint32_t dropped;           /* events lost because the queue was full */
+} presence_stats_t;
+
+/* Start the presence task: whitelisted stations joining the SoftAP open
+ * the gate. Call after whitelist_init() and gate_actuator_start(). */
+esp_err_t presence_start(void);
+
+/* Hand a radio event to the presence task. Never blocks, so it can be
+ * called from the Wi-Fi event handler; probe requests below the pre-warm
+ * RSSI are discarded right here. Returns ESP_ERR_TIMEOUT when the queue is
+ * full and ESP_ERR_INVALID_STATE before presence_start(). */
+esp_err_t presence_post(const presence_event_t *event);
+
+void presence_get_stats(presence_stats_t *out);
+
+#endif /* PRESENCE */
@@ -0,0 +1,98 @@
+#ifndef PRESENCE_ENGINE
+#define PRESENCE_ENGINE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Whitelisted devices tracked at once; the least recently seen one is
+ * forgotten when a new one arrives */
+#define PRESENCE_MAX_DEVICES 32
+
+typedef enum {
+    PRESENCE_EVENT_JOIN = 0,    /* station associated with the SoftAP */
+    PRESENCE_EVENT_LEAVE,       /* station disassociated */
+    PRESENCE_EVENT_PROBE,       /* probe request at or above the pre-warm RSSI */
+} presence_event_type_t;
+
+typedef struct {
+    presence_event_type_t type;
+    uint8_t mac[6];
+    int8_t rssi;                /* probe requests only */
+    int64_t time_us;            /* when the radio event arrived */
+} presence_event_t;
+
+/* What became of an event, in the order of the checks */
+typedef enum {
+    PRESENCE_VERDICT_OPEN = 0,  /* open the gate now */
+    PRESENCE_VERDICT_SETTLING,  /* open once the join has lasted settle_ms */
+    PRESENCE_VERDICT_LEFT,      /* leave recorded */
+    PRESENCE_VERDICT_UNKNOWN,   /* not whitelisted */
+    PRESENCE_VERDICT_STARTUP,   /* first join within away_min_s of start, likely at home all along */
+    PRESENCE_VERDICT_FLAP,      /* back after less than away_min_s, or gone before settling */
+    PRESENCE_VERDICT_COOLDOWN,  /* opened for this device less than cooldown_s ago */
+    PRESENCE_VERDICT_PROBE,     /* probe counted towards a pre-warm, or from a device at home */
+    PRESENCE_VERDICT_MAX,
+} presence_verdict_t;
+
+/* Tells whether mac is whitelisted; access is passed through to the open
+ * command untouched */
+typedef bool (*presence_lookup_fn_t)(const uint8_t mac[6], uint8_t *access, void *ctx);
+
+typedef struct {
+    uint32_t settle_ms;         /* how long a join must last before opening, 0 = at once */
+    uint32_t away_min_s;        /* absence before a join counts as an arrival */
+    uint32_t cooldown_s;        /* between two opens for the same device */
+    bool prewarm;               /* open on probe requests ahead of the join */
+    uint8_t prewarm_probes;     /* strong probes needed ... */
+    uint32_t prewarm_window_ms; /* ... with at most this gap between them */
+    presence_lookup_fn_t lookup;
+    void *lookup_ctx;
+} presence_config_t;
+
+/* An open command the engine decided on */
+typedef struct {
+    uint8_t mac[6];
+    uint8_t access;
+    bool prewarm;               /* triggered by probe requests, not a join */
+    int64_t event_time_us;      /* the join or probe that triggered it */
+} presence_open_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t access;
+    bool used;
+    bool present;
+    uint8_t probes;
+    int64_t seen_us;
+    int64_t left_us;            /* 0 = not seen leaving */
+    int64_t opened_us;          /* 0 = never opened */
+    int64_t joined_us;          /* join waiting to settle */
+    int64_t settle_due_us;      /* 0 = none waiting */
+    int64_t probe_us;
+} presence_device_t;
+
+/* The whole pipeline state. Not thread-safe and never blocks: feed it from
+ * one task, with the time taken from the events, so the same code runs on
+ * the device and under a simulated clock. */
+typedef struct {
+    presence_config_t config;
+    int64_t start_us;
+    presence_device_t devices[PRESENCE_MAX_DEVICES];
+    uint32_t counts[PRESENCE_VERDICT_MAX];
+} presence_engine_t;
+
+void presence_engine_init(presence_engine_t *engine, const presence_config_t *config, int64_t now_us);
+
+/* Account for one event. On PRESENCE_VERDICT_OPEN, *out holds the command. */
+presence_verdict_t presence_engine_feed(presence_engine_t *engine, const presence_event_t *event,
+                                        presence_open_t *out);
+
+/* Collect one join that has settled by now_us. Call until it returns false. */
+bool presence_engine_poll(presence_engine_t *engine, int64_t now_us, presence_open_t *out);
+
+/* Earliest settle deadline, or 0 when no join is waiting */
+int64_t presence_engine_next_deadline(const presence_engine_t *engine);
+
+const char *presence_verdict_to_str(presence_verdict_t verdict);
+
+#endif /* PRESENCE_ENGINE */
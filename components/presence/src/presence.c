@@ -0,0 +1,154 @@
+#include "presence.h"
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "access_log.h"
+#include "gate_actuator.h"
+#include "whitelist.h"
+
+static const char *TAG = "presence";
+
+#define PRESENCE_QUEUE_LEN 16
+
+static QueueHandle_t s_queue = NULL;
+/* Owned by the presence task */
+static presence_engine_t s_engine;
+static uint32_t s_prewarm_opens;
+static uint32_t s_open_failures;
+static uint32_t s_dropped;
+
+static bool presence_lookup(const uint8_t mac[6], uint8_t *access, void *ctx)
+{
+    whitelist_access_t level;
+    if (!whitelist_lookup(mac, &level)) {
+        return false;
+    }
+    *access = level;
+    return true;
+}
+
+static void presence_open(const presence_open_t *open)
+{
+    /* Limited access is for pedestrians */
+    gate_action_t action = open->access == WHITELIST_ACCESS_LIMITED ? GATE_ACTION_OPEN_HALF : GATE_ACTION_OPEN;
+    char mac[18];
+
+#if CONFIG_PRESENCE_AUTO_OPEN
+    gate_request_t request = {
+        .action = action,
+        .source = GATE_SOURCE_PRESENCE,
+        .event_time_us = open->event_time_us,
+    };
+    esp_err_t err = gate_actuator_submit(&request);
+    access_log_append(ACCESS_SOURCE_WIFI, ACCESS_ACTION_GATE_OPEN + action,
+                      err == ESP_OK ? ACCESS_RESULT_OK : ACCESS_RESULT_FAILED, 0, open->mac);
+    if (err != ESP_OK) {
+        s_open_failures++;
+    }
+#endif
+    if (open->prewarm) {
+        s_prewarm_opens++;
+    }
+
+    /* After the submit, so the log line does not delay the relay */
+    whitelist_mac_to_str(open->mac, mac);
+#if CONFIG_PRESENCE_AUTO_OPEN
+    ESP_LOGI(TAG, "%s arriving (%s), gate %s", mac, open->prewarm ? "probe" : "join", gate_action_to_str(action));
+#else
+    ESP_LOGI(TAG, "%s arriving (%s), would %s the gate", mac, open->prewarm ? "probe" : "join",
+             gate_action_to_str(action));
+#endif
+}
+
+static void presence_task(void *arg)
+{
+    presence_event_t event;
+    presence_open_t open;
+
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        int64_t due = presence_engine_next_deadline(&s_engine);
+        if (due) {
+            int64_t wait_ms = (due - esp_timer_get_time() + 999) / 1000;
+            wait = wait_ms > 0 ? pdMS_TO_TICKS(wait_ms) + 1 : 0;
+        }
+
+        if (xQueueReceive(s_queue, &event, wait) == pdTRUE) {
+            presence_verdict_t verdict = presence_engine_feed(&s_engine, &event, &open);
+            if (event.type == PRESENCE_EVENT_JOIN) {
+                access_log_append(ACCESS_SOURCE_WIFI, ACCESS_ACTION_STATION_JOIN,
+                                  verdict == PRESENCE_VERDICT_UNKNOWN ? ACCESS_RESULT_DENIED : ACCESS_RESULT_OK,
+                                  0, event.mac);
+            }
+            if (verdict == PRESENCE_VERDICT_OPEN) {
+                presence_open(&open);
+            }
+        }
+        while (presence_engine_poll(&s_engine, esp_timer_get_time(), &open)) {
+            presence_open(&open);
+        }
+    }
+}
+
+esp_err_t presence_start(void)
+{
+    if (s_queue) {
+        return ESP_OK;
+    }
+
+    presence_config_t config = {
+        .settle_ms = CONFIG_PRESENCE_SETTLE_MS,
+        .away_min_s = CONFIG_PRESENCE_AWAY_MIN_S,
+        .cooldown_s = CONFIG_PRESENCE_COOLDOWN_S,
+#if CONFIG_PRESENCE_PREWARM
+        .prewarm = true,
+        .prewarm_probes = CONFIG_PRESENCE_PREWARM_PROBES,
+        .prewarm_window_ms = CONFIG_PRESENCE_PREWARM_WINDOW_MS,
+#endif
+        .lookup = presence_lookup,
+    };
+    presence_engine_init(&s_engine, &config, esp_timer_get_time());
+
+    s_queue = xQueueCreate(PRESENCE_QUEUE_LEN, sizeof(presence_event_t));
+    if (!s_queue) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(presence_task, "presence", 3072, NULL, CONFIG_PRESENCE_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create presence task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t presence_post(const presence_event_t *event)
+{
+    if (event->type == PRESENCE_EVENT_PROBE) {
+#if CONFIG_PRESENCE_PREWARM
+        if (event->rssi < CONFIG_PRESENCE_PREWARM_RSSI) {
+            return ESP_OK;
+        }
+#else
+        return ESP_OK;
+#endif
+    }
+    if (!s_queue) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xQueueSend(s_queue, event, 0) != pdTRUE) {
+        s_dropped++;
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+void presence_get_stats(presence_stats_t *out)
+{
+    memcpy(out->counts, s_engine.counts, sizeof(out->counts));
+    out->prewarm_opens = s_prewarm_opens;
+    out->open_failures = s_open_failures;
+    out->dropped = s_dropped;
+}
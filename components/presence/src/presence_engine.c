@@ -0,0 +1,224 @@
+#include "presence_engine.h"
+
+#include <string.h>
+
+#define US_PER_MS 1000LL
+#define US_PER_S  1000000LL
+
+static const char *const s_verdict_names[PRESENCE_VERDICT_MAX] = {
+    [PRESENCE_VERDICT_OPEN] = "open",
+    [PRESENCE_VERDICT_SETTLING] = "settling",
+    [PRESENCE_VERDICT_LEFT] = "left",
+    [PRESENCE_VERDICT_UNKNOWN] = "unknown",
+    [PRESENCE_VERDICT_STARTUP] = "startup",
+    [PRESENCE_VERDICT_FLAP] = "flap",
+    [PRESENCE_VERDICT_COOLDOWN] = "cooldown",
+    [PRESENCE_VERDICT_PROBE] = "probe",
+};
+
+void presence_engine_init(presence_engine_t *engine, const presence_config_t *config, int64_t now_us)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->config = *config;
+    engine->start_us = now_us;
+}
+
+static presence_device_t *device_find(presence_engine_t *engine, const uint8_t mac[6])
+{
+    for (int i = 0; i < PRESENCE_MAX_DEVICES; i++) {
+        if (engine->devices[i].used && memcmp(engine->devices[i].mac, mac, 6) == 0) {
+            return &engine->devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* Find the device or take a slot for it: a free one, else the one seen
+ * longest ago, preferring devices that are away. A forgotten device that
+ * is at home counts as new on its next join. */
+static presence_device_t *device_track(presence_engine_t *engine, const uint8_t mac[6])
+{
+    presence_device_t *dev = device_find(engine, mac);
+    if (dev) {
+        return dev;
+    }
+
+    presence_device_t *victim = NULL;
+    for (int i = 0; i < PRESENCE_MAX_DEVICES; i++) {
+        presence_device_t *cand = &engine->devices[i];
+        if (!cand->used) {
+            victim = cand;
+            break;
+        }
+        if (cand->settle_due_us) {
+            continue;
+        }
+        if (!victim || (victim->present && !cand->present) ||
+                (victim->present == cand->present && cand->seen_us < victim->seen_us)) {
+            victim = cand;
+        }
+    }
+    if (!victim) {
+        /* Every slot has a join waiting: drop the oldest wait */
+        victim = &engine->devices[0];
+    }
+    memset(victim, 0, sizeof(*victim));
+    memcpy(victim->mac, mac, 6);
+    victim->used = true;
+    return victim;
+}
+
+/* May this device open the gate at now? Shared by joins and probes. */
+static presence_verdict_t arrival_check(const presence_engine_t *engine, const presence_device_t *dev, int64_t now)
+{
+    const presence_config_t *cfg = &engine->config;
+    int64_t away_min = cfg->away_min_s * US_PER_S;
+
+    if (dev->left_us) {
+        if (now - dev->left_us < away_min) {
+            return PRESENCE_VERDICT_FLAP;
+        }
+    } else if (now - engine->start_us < away_min) {
+        return PRESENCE_VERDICT_STARTUP;
+    }
+    if (dev->opened_us && now - dev->opened_us < cfg->cooldown_s * US_PER_S) {
+        return PRESENCE_VERDICT_COOLDOWN;
+    }
+    return PRESENCE_VERDICT_OPEN;
+}
+
+static void device_open(presence_device_t *dev, int64_t event_time_us, bool prewarm, presence_open_t *out)
+{
+    dev->opened_us = event_time_us;
+    dev->settle_due_us = 0;
+    dev->probes = 0;
+    memcpy(out->mac, dev->mac, 6);
+    out->access = dev->access;
+    out->prewarm = prewarm;
+    out->event_time_us = event_time_us;
+}
+
+static presence_verdict_t feed_join(presence_engine_t *engine, const presence_event_t *event, presence_open_t *out)
+{
+    const presence_config_t *cfg = &engine->config;
+    uint8_t access = 0;
+    if (!cfg->lookup(event->mac, &access, cfg->lookup_ctx)) {
+        return PRESENCE_VERDICT_UNKNOWN;
+    }
+
+    presence_device_t *dev = device_track(engine, event->mac);
+    /* A second join without a leave in between is a reassociation */
+    presence_verdict_t verdict = dev->present ? PRESENCE_VERDICT_FLAP : arrival_check(engine, dev, event->time_us);
+    dev->present = true;
+    dev->seen_us = event->time_us;
+    dev->access = access;
+    dev->probes = 0;
+
+    if (verdict == PRESENCE_VERDICT_OPEN && cfg->settle_ms) {
+        dev->joined_us = event->time_us;
+        dev->settle_due_us = event->time_us + cfg->settle_ms * US_PER_MS;
+        return PRESENCE_VERDICT_SETTLING;
+    }
+    if (verdict == PRESENCE_VERDICT_OPEN) {
+        device_open(dev, event->time_us, false, out);
+    }
+    return verdict;
+}
+
+static presence_verdict_t feed_leave(presence_engine_t *engine, const presence_event_t *event)
+{
+    /* Only whitelisted devices are tracked, so no lookup is needed */
+    presence_device_t *dev = device_find(engine, event->mac);
+    if (!dev) {
+        return PRESENCE_VERDICT_UNKNOWN;
+    }
+
+    presence_verdict_t verdict = dev->settle_due_us ? PRESENCE_VERDICT_FLAP : PRESENCE_VERDICT_LEFT;
+    dev->settle_due_us = 0;
+    dev->present = false;
+    dev->seen_us = event->time_us;
+    dev->left_us = event->time_us;
+    return verdict;
+}
+
+static presence_verdict_t feed_probe(presence_engine_t *engine, const presence_event_t *event, presence_open_t *out)
+{
+    const presence_config_t *cfg = &engine->config;
+    uint8_t access = 0;
+    if (!cfg->prewarm) {
+        return PRESENCE_VERDICT_PROBE;
+    }
+    if (!cfg->lookup(event->mac, &access, cfg->lookup_ctx)) {
+        return PRESENCE_VERDICT_UNKNOWN;
+    }
+
+    presence_device_t *dev = device_track(engine, event->mac);
+    dev->access = access;
+    /* Phones at home keep probing; only a device on its way in counts */
+    if (dev->present || arrival_check(engine, dev, event->time_us) != PRESENCE_VERDICT_OPEN) {
+        return PRESENCE_VERDICT_PROBE;
+    }
+
+    if (dev->probes && event->time_us - dev->probe_us > cfg->prewarm_window_ms * US_PER_MS) {
+        dev->probes = 0;
+    }
+    dev->probe_us = event->time_us;
+    dev->seen_us = event->time_us;
+    if (++dev->probes < cfg->prewarm_probes) {
+        return PRESENCE_VERDICT_PROBE;
+    }
+    device_open(dev, event->time_us, true, out);
+    return PRESENCE_VERDICT_OPEN;
+}
+
+presence_verdict_t presence_engine_feed(presence_engine_t *engine, const presence_event_t *event,
+                                        presence_open_t *out)
+{
+    presence_verdict_t verdict;
+    switch (event->type) {
+    case PRESENCE_EVENT_JOIN:
+        verdict = feed_join(engine, event, out);
+        break;
+    case PRESENCE_EVENT_LEAVE:
+        verdict = feed_leave(engine, event);
+        break;
+    case PRESENCE_EVENT_PROBE:
+        verdict = feed_probe(engine, event, out);
+        break;
+    default:
+        verdict = PRESENCE_VERDICT_UNKNOWN;
+        break;
+    }
+    engine->counts[verdict]++;
+    return verdict;
+}
+
+bool presence_engine_poll(presence_engine_t *engine, int64_t now_us, presence_open_t *out)
+{
+    for (int i = 0; i < PRESENCE_MAX_DEVICES; i++) {
+        presence_device_t *dev = &engine->devices[i];
+        if (dev->settle_due_us && dev->settle_due_us <= now_us) {
+            device_open(dev, dev->joined_us, false, out);
+            engine->counts[PRESENCE_VERDICT_OPEN]++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t presence_engine_next_deadline(const presence_engine_t *engine)
+{
+    int64_t next = 0;
+    for (int i = 0; i < PRESENCE_MAX_DEVICES; i++) {
+        int64_t due = engine->devices[i].settle_due_us;
+        if (due && (!next || due < next)) {
+            next = due;
+        }
+    }
+    return next;
+}
+
+const char *presence_verdict_to_str(presence_verdict_t verdict)
+{
+    return verdict < PRESENCE_VERDICT_MAX ? s_verdict_names[verdict] : "?";
+}
@@ -0,0 +1,104 @@
+#ifndef SETTINGS
+#define SETTINGS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Run-time configuration: Wi-Fi, web UI credentials, the Discord
+ * allow-lists and the gate timing, typed by schema.def, cached in RAM as
+ * one contiguous snapshot and stored in NVS.
+ *
+ * Readers pin the current snapshot with settings_acquire() and let go of it
+ * with settings_release(): two atomic operations, no lock, nothing copied.
+ * An update is collected in a draft, then settings_commit() fills the spare
+ * snapshot, publishes it with one atomic store and saves it. A snapshot is
+ * never written while a reader holds it, so hold it briefly and never block
+ * with it. Consumers notice a change by the generation of the snapshot and
+ * apply it from their own task. */
+
+/* Must match IDS_MAX in tools/gen_settings_schema.py */
+#define SETTINGS_IDS_MAX 8
+/* Longest value as text: a full ids list */
+#define SETTINGS_VALUE_MAX (SETTINGS_IDS_MAX * 21)
+
+typedef struct {
+    uint8_t count;
+    uint64_t id[SETTINGS_IDS_MAX];
+} settings_ids_t;
+
+typedef enum {
+    SETTINGS_TYPE_STR,
+    SETTINGS_TYPE_U32,
+    SETTINGS_TYPE_BOOL,
+    SETTINGS_TYPE_IDS,
+} settings_type_t;
+
+#define SETTINGS_FLAG_SECRET    (1 << 0)    /* never shown back */
+#define SETTINGS_FLAG_RESTART   (1 << 1)    /* only read at start-up */
+#define SETTINGS_FLAG_OPTIONAL  (1 << 2)    /* str that may also be empty */
+
+#include "settings_schema.h"
+
+typedef struct {
+    const char *name;
+    settings_type_t type;
+    uint32_t min;               /* length, value or count, per type */
+    uint32_t max;
+    uint16_t offset;            /* in settings_t */
+    uint8_t flags;
+    const char *help;
+} settings_field_t;
+
+/* An update in progress, private to its writer until committed. Only the
+ * fields set on it are applied, over whatever is current at commit time. */
+typedef struct {
+    settings_t values;
+    uint32_t changed;           /* bit per field */
+} settings_draft_t;
+
+typedef struct {
+    uint32_t generation;
+    uint32_t commits;
+    uint32_t persist_failures;
+    uint32_t reader_waits;      /* commits that found the spare snapshot pinned */
+    uint32_t last_swap_us;      /* commit to publication */
+    uint32_t max_swap_us;
+    uint32_t last_persist_us;   /* NVS write of the new snapshot */
+    uint32_t max_persist_us;
+    uint16_t loaded_version;    /* schema version found in NVS, 0 if none */
+} settings_stats_t;
+
+/* Initialise NVS flash and load the stored snapshot, migrating it from an
+ * older schema version. Anything unusable leaves the defaults in place.
+ * Before this call settings_acquire() returns the compile-time defaults. */
+esp_err_t settings_init(void);
+
+const settings_t *settings_acquire(void);
+void settings_release(const settings_t *settings);
+
+/* The draft starts as a copy of the current snapshot */
+void settings_draft_init(settings_draft_t *draft);
+/* Parse value as the type of field key and check it against the schema.
+ * ESP_ERR_NOT_FOUND for an unknown key, ESP_ERR_INVALID_ARG for a value
+ * that does not parse, ESP_ERR_INVALID_SIZE for one out of range. */
+esp_err_t settings_draft_set(settings_draft_t *draft, const char *key, const char *value);
+/* Publish the draft and save it. restart, if given, tells whether a field
+ * that is only read at start-up changed. The new snapshot is in use even
+ * when saving fails (ESP_FAIL). */
+esp_err_t settings_commit(const settings_draft_t *draft, bool *restart);
+/* One field: settings_draft_init(), settings_draft_set() and settings_commit() */
+esp_err_t settings_set(const char *key, const char *value, bool *restart);
+
+size_t settings_field_count(void);
+const settings_field_t *settings_field(size_t index);
+const settings_field_t *settings_find(const char *key);
+/* The value as settings_draft_set() takes it; secrets are not hidden here */
+void settings_format(const settings_t *settings, const settings_field_t *field, char *out, size_t out_len);
+/* Comma separated IDs, as in the Kconfig defaults */
+esp_err_t settings_ids_from_str(const char *str, uint32_t max_count, settings_ids_t *out);
+
+void settings_get_stats(settings_stats_t *out);
+
+#endif /* SETTINGS */
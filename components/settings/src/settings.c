@@ -0,0 +1,544 @@
+#include "settings.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+static const char *TAG = "settings";
+
+#define SETTINGS_NVS_NAMESPACE  "settings"
+#define SETTINGS_NVS_KEY        "snapshot"
+/* A reader pinning the spare snapshot longer than this is a bug */
+#define SETTINGS_READER_WAIT_MS 1000
+
+/* Stored in front of the snapshot */
+typedef struct {
+    uint16_t version;
+    uint16_t size;
+    uint32_t layout_id;
+} settings_blob_header_t;
+
+typedef struct {
+    settings_blob_header_t header;
+    settings_t values;
+} settings_blob_t;
+
+/* Compile-time defaults; ids lists are parsed from their strings at init */
+#define DEFAULT_STR(name, def)  .name = def,
+#define DEFAULT_U32(name, def)  .name = def,
+#define DEFAULT_BOOL(name, def) .name = def,
+#define DEFAULT_IDS(name, def)
+#define DEFAULT_INIT(name, type, min, max, def, flags, help) DEFAULT_##type(name, def)
+#define SETTINGS_DEFAULTS { SETTINGS_FOR_EACH_FIELD(DEFAULT_INIT) }
+
+#define FIELD_ENTRY(name, type, min, max, def, flags, help) \
+    { #name, SETTINGS_TYPE_##type, min, max, offsetof(settings_t, name), flags, help },
+static const settings_field_t s_fields[SETTINGS_FIELD_COUNT] = {
+    SETTINGS_FOR_EACH_FIELD(FIELD_ENTRY)
+};
+
+/* Readers use s_snapshots[s_current] and count themselves in s_readers;
+ * writers fill the other one once nobody counts there any more. */
+static settings_t s_snapshots[2] = { SETTINGS_DEFAULTS, SETTINGS_DEFAULTS };
+static atomic_uint s_current;
+static atomic_uint s_readers[2];
+static SemaphoreHandle_t s_write_lock = NULL;
+/* Staging for NVS, under s_write_lock */
+static settings_blob_t s_blob;
+static settings_stats_t s_stats;
+
+static size_t field_size(const settings_field_t *field)
+{
+    switch (field->type) {
+    case SETTINGS_TYPE_STR:
+        return field->max + 1;
+    case SETTINGS_TYPE_U32:
+        return sizeof(uint32_t);
+    case SETTINGS_TYPE_BOOL:
+        return sizeof(bool);
+    default:
+        return sizeof(settings_ids_t);
+    }
+}
+
+static void *field_ptr(const settings_t *settings, const settings_field_t *field)
+{
+    return (uint8_t *)settings + field->offset;
+}
+
+esp_err_t settings_ids_from_str(const char *str, uint32_t max_count, settings_ids_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    const char *p = str ? str : "";
+    for (;;) {
+        while (*p == ',' || *p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '\0') {
+            return ESP_OK;
+        }
+        uint64_t id = 0;
+        const char *start = p;
+        while (*p >= '0' && *p <= '9') {
+            uint64_t digit = *p - '0';
+            if (id > (UINT64_MAX - digit) / 10) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            id = id * 10 + digit;
+            p++;
+        }
+        if (p == start || id == 0 || (*p != '\0' && *p != ',' && *p != ' ' && *p != '\t')) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (out->count >= max_count || out->count >= SETTINGS_IDS_MAX) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        out->id[out->count++] = id;
+    }
+}
+
+static void default_ids(const char *name, const char *def, uint32_t max_count, settings_ids_t *out)
+{
+    if (settings_ids_from_str(def, max_count, out) != ESP_OK) {
+        /* A broken allow-list must not turn into an empty one, which allows everything */
+        ESP_LOGE(TAG, "Bad default for %s, allowing nobody", name);
+        memset(out, 0, sizeof(*out));
+        out->count = 1;
+    }
+}
+
+#define DEFAULT_IDS_STR(name, max, def)
+#define DEFAULT_IDS_U32(name, max, def)
+#define DEFAULT_IDS_BOOL(name, max, def)
+#define DEFAULT_IDS_IDS(name, max, def) default_ids(#name, def, max, &settings->name);
+#define DEFAULT_IDS_PARSE(name, type, min, max, def, flags, help) DEFAULT_IDS_##type(name, max, def)
+
+static void load_defaults(settings_t *settings)
+{
+    static const settings_t defaults = SETTINGS_DEFAULTS;
+    *settings = defaults;
+    SETTINGS_FOR_EACH_FIELD(DEFAULT_IDS_PARSE)
+}
+
+/* Whatever was stored, strings end within their field and lists within theirs */
+static void sanitize(settings_t *settings)
+{
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        const settings_field_t *field = &s_fields[i];
+        if (field->type == SETTINGS_TYPE_STR) {
+            ((char *)field_ptr(settings, field))[field->max] = '\0';
+        } else if (field->type == SETTINGS_TYPE_IDS) {
+            settings_ids_t *ids = field_ptr(settings, field);
+            if (ids->count > field->max) {
+                ids->count = field->max;
+            }
+        }
+    }
+}
+
+/* Version 0: nothing stored yet, but the web UI credentials may have been
+ * provisioned in the "http_auth" namespace. Those keys are left in place
+ * for older firmware. */
+static void migrate_from_v0(const void *blob, size_t len, settings_t *draft)
+{
+    nvs_handle_t nvs;
+    if (nvs_open("http_auth", NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    char value[sizeof(draft->http_password)];
+    size_t value_len = sizeof(draft->http_username);
+    if (nvs_get_str(nvs, "username", value, &value_len) == ESP_OK && value[0]) {
+        strlcpy(draft->http_username, value, sizeof(draft->http_username));
+        ESP_LOGI(TAG, "Imported the web UI username");
+    }
+    value_len = sizeof(draft->http_password);
+    if (nvs_get_str(nvs, "password", value, &value_len) == ESP_OK && value[0]) {
+        strlcpy(draft->http_password, value, sizeof(draft->http_password));
+        ESP_LOGI(TAG, "Imported the web UI password");
+    }
+    memset(value, 0, sizeof(value));
+    nvs_close(nvs);
+}
+
+/* Brings a snapshot stored by an older schema version into draft, which
+ * holds the defaults. blob is NULL for version 0. */
+typedef void (*settings_migrate_fn_t)(const void *blob, size_t len, settings_t *draft);
+
+static const struct {
+    uint16_t from;
+    settings_migrate_fn_t migrate;
+} s_migrations[] = {
+    { 0, migrate_from_v0 },
+};
+
+/* Wait until no reader holds the spare snapshot. Called with s_write_lock. */
+static settings_t *spare_acquire(void)
+{
+    unsigned spare = atomic_load(&s_current) ^ 1;
+    if (atomic_load(&s_readers[spare]) == 0) {
+        return &s_snapshots[spare];
+    }
+    s_stats.reader_waits++;
+    for (int waited = 0; atomic_load(&s_readers[spare]) != 0; waited++) {
+        if (waited * portTICK_PERIOD_MS >= SETTINGS_READER_WAIT_MS) {
+            ESP_LOGE(TAG, "Snapshot still pinned, update dropped");
+            return NULL;
+        }
+        vTaskDelay(1);
+    }
+    return &s_snapshots[spare];
+}
+
+static void spare_publish(settings_t *spare)
+{
+    unsigned current = atomic_load(&s_current);
+    spare->generation = s_snapshots[current].generation + 1;
+    atomic_store(&s_current, current ^ 1);
+}
+
+/* Called with s_write_lock */
+static esp_err_t persist(const settings_t *settings)
+{
+    int64_t start = esp_timer_get_time();
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        s_blob.header.version = SETTINGS_SCHEMA_VERSION;
+        s_blob.header.size = sizeof(settings_t);
+        s_blob.header.layout_id = SETTINGS_LAYOUT_ID;
+        s_blob.values = *settings;
+        err = nvs_set_blob(nvs, SETTINGS_NVS_KEY, &s_blob, sizeof(s_blob));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        memset(&s_blob, 0, sizeof(s_blob));
+        nvs_close(nvs);
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    s_stats.last_persist_us = elapsed;
+    if (elapsed > s_stats.max_persist_us) {
+        s_stats.max_persist_us = elapsed;
+    }
+    if (err != ESP_OK) {
+        s_stats.persist_failures++;
+        ESP_LOGE(TAG, "Failed to save settings (%s)", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* Fill next from NVS. Returns whether it has to be saved back. */
+static bool load(settings_t *next)
+{
+    load_defaults(next);
+
+    nvs_handle_t nvs;
+    size_t len = sizeof(s_blob);
+    esp_err_t err = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(nvs, SETTINGS_NVS_KEY, &s_blob, &len);
+        nvs_close(nvs);
+    }
+
+    uint16_t version = 0;
+    if (err == ESP_OK && len >= sizeof(settings_blob_header_t)) {
+        version = s_blob.header.version;
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Stored settings unreadable (%s), using defaults", esp_err_to_name(err));
+        return false;
+    }
+    s_stats.loaded_version = version;
+
+    if (version == SETTINGS_SCHEMA_VERSION) {
+        if (s_blob.header.layout_id != SETTINGS_LAYOUT_ID || s_blob.header.size != sizeof(settings_t) ||
+                len != sizeof(s_blob)) {
+            /* schema.def changed without a version bump */
+            ESP_LOGE(TAG, "Stored settings have another layout, using defaults");
+            return false;
+        }
+        *next = s_blob.values;
+        sanitize(next);
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(s_migrations) / sizeof(s_migrations[0]); i++) {
+        if (s_migrations[i].from == version) {
+            ESP_LOGI(TAG, "Migrating settings from version %u to %d", version, SETTINGS_SCHEMA_VERSION);
+            s_migrations[i].migrate(version ? &s_blob : NULL, len, next);
+            sanitize(next);
+            return true;
+        }
+    }
+    /* Written by newer firmware, or too old to migrate: leave it alone */
+    ESP_LOGW(TAG, "No migration from settings version %u, using defaults", version);
+    return false;
+}
+
+esp_err_t settings_init(void)
+{
+    if (s_write_lock) {
+        return ESP_OK;
+    }
+
+    /* The first NVS user at start-up */
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    s_write_lock = xSemaphoreCreateMutex();
+    if (!s_write_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    settings_t *next = spare_acquire();
+    if (!next) {
+        xSemaphoreGive(s_write_lock);
+        return ESP_ERR_TIMEOUT;
+    }
+    bool migrated = load(next);
+    memset(&s_blob, 0, sizeof(s_blob));
+    spare_publish(next);
+    s_stats.generation = next->generation;
+    err = migrated ? persist(next) : ESP_OK;
+    xSemaphoreGive(s_write_lock);
+    return err;
+}
+
+const settings_t *settings_acquire(void)
+{
+    for (;;) {
+        unsigned index = atomic_load(&s_current);
+        atomic_fetch_add(&s_readers[index], 1);
+        /* Still current once pinned: no writer touches it until released */
+        if (atomic_load(&s_current) == index) {
+            return &s_snapshots[index];
+        }
+        atomic_fetch_sub(&s_readers[index], 1);
+    }
+}
+
+void settings_release(const settings_t *settings)
+{
+    atomic_fetch_sub(&s_readers[settings - s_snapshots], 1);
+}
+
+void settings_draft_init(settings_draft_t *draft)
+{
+    const settings_t *current = settings_acquire();
+    draft->values = *current;
+    settings_release(current);
+    draft->changed = 0;
+}
+
+static esp_err_t parse_u32(const char *value, uint32_t *out)
+{
+    if (*value < '0' || *value > '9') {
+        return ESP_ERR_INVALID_ARG;
+    }
+    char *end;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (*end != '\0' || parsed > UINT32_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = parsed;
+    return ESP_OK;
+}
+
+static esp_err_t parse_bool(const char *value, bool *out)
+{
+    if (strcmp(value, "true") == 0 || strcmp(value, "on") == 0 || strcmp(value, "1") == 0) {
+        *out = true;
+    } else if (strcmp(value, "false") == 0 || strcmp(value, "off") == 0 || strcmp(value, "0") == 0) {
+        *out = false;
+    } else {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t settings_draft_set(settings_draft_t *draft, const char *key, const char *value)
+{
+    const settings_field_t *field = settings_find(key);
+    if (!field) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    void *ptr = field_ptr(&draft->values, field);
+
+    switch (field->type) {
+    case SETTINGS_TYPE_STR: {
+        size_t len = strlen(value);
+        bool empty_ok = len == 0 && (field->flags & SETTINGS_FLAG_OPTIONAL);
+        if (!empty_ok && (len < field->min || len > field->max)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(ptr, value, len + 1);
+        break;
+    }
+    case SETTINGS_TYPE_U32: {
+        uint32_t parsed;
+        if (parse_u32(value, &parsed) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (parsed < field->min || parsed > field->max) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *(uint32_t *)ptr = parsed;
+        break;
+    }
+    case SETTINGS_TYPE_BOOL:
+        if (parse_bool(value, ptr) != ESP_OK) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        break;
+    case SETTINGS_TYPE_IDS: {
+        settings_ids_t ids;
+        esp_err_t err = settings_ids_from_str(value, field->max, &ids);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (ids.count < field->min) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(ptr, &ids, sizeof(ids));
+        break;
+    }
+    }
+    draft->changed |= 1u << (field - s_fields);
+    return ESP_OK;
+}
+
+esp_err_t settings_commit(const settings_draft_t *draft, bool *restart)
+{
+    if (restart) {
+        *restart = false;
+    }
+    if (!s_write_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!draft->changed) {
+        return ESP_OK;
+    }
+
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    settings_t *next = spare_acquire();
+    if (!next) {
+        xSemaphoreGive(s_write_lock);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    /* Apply the draft over the current snapshot, not over the one it was
+     * copied from, so concurrent updates of other fields are kept */
+    const settings_t *current = &s_snapshots[atomic_load(&s_current)];
+    *next = *current;
+    bool needs_restart = false;
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        if (!(draft->changed & (1u << i))) {
+            continue;
+        }
+        const settings_field_t *field = &s_fields[i];
+        size_t size = field_size(field);
+        if (memcmp(field_ptr(current, field), field_ptr(&draft->values, field), size) != 0) {
+            needs_restart |= (field->flags & SETTINGS_FLAG_RESTART) != 0;
+            memcpy(field_ptr(next, field), field_ptr(&draft->values, field), size);
+        }
+    }
+    spare_publish(next);
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    s_stats.generation = next->generation;
+    s_stats.commits++;
+    s_stats.last_swap_us = elapsed;
+    if (elapsed > s_stats.max_swap_us) {
+        s_stats.max_swap_us = elapsed;
+    }
+    esp_err_t err = persist(next);
+    xSemaphoreGive(s_write_lock);
+
+    if (restart) {
+        *restart = needs_restart;
+    }
+    return err;
+}
+
+esp_err_t settings_set(const char *key, const char *value, bool *restart)
+{
+    settings_draft_t draft;
+    settings_draft_init(&draft);
+    esp_err_t err = settings_draft_set(&draft, key, value);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return settings_commit(&draft, restart);
+}
+
+size_t settings_field_count(void)
+{
+    return SETTINGS_FIELD_COUNT;
+}
+
+const settings_field_t *settings_field(size_t index)
+{
+    return index < SETTINGS_FIELD_COUNT ? &s_fields[index] : NULL;
+}
+
+const settings_field_t *settings_find(const char *key)
+{
+    for (size_t i = 0; i < SETTINGS_FIELD_COUNT; i++) {
+        if (strcmp(s_fields[i].name, key) == 0) {
+            return &s_fields[i];
+        }
+    }
+    return NULL;
+}
+
+void settings_format(const settings_t *settings, const settings_field_t *field, char *out, size_t out_len)
+{
+    const void *ptr = field_ptr(settings, field);
+    switch (field->type) {
+    case SETTINGS_TYPE_STR:
+        strlcpy(out, ptr, out_len);
+        break;
+    case SETTINGS_TYPE_U32:
+        snprintf(out, out_len, "%lu", (unsigned long)*(const uint32_t *)ptr);
+        break;
+    case SETTINGS_TYPE_BOOL:
+        strlcpy(out, *(const bool *)ptr ? "true" : "false", out_len);
+        break;
+    case SETTINGS_TYPE_IDS: {
+        const settings_ids_t *ids = ptr;
+        size_t used = 0;
+        out[0] = '\0';
+        for (int i = 0; i < ids->count && used < out_len; i++) {
+            used += snprintf(out + used, out_len - used, "%s%llu", i ? "," : "", (unsigned long long)ids->id[i]);
+        }
+        break;
+    }
+    }
+}
+
+void settings_get_stats(settings_stats_t *out)
+{
+    if (!s_write_lock) {
+        memset(out, 0, sizeof(*out));
+        return;
+    }
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    *out = s_stats;
+    xSemaphoreGive(s_write_lock);
+}
@@ -1,6 +1,9 @@
 #ifndef SOFTAP_STA
 #define SOFTAP_STA
 
+/* Bring up the SoftAP and start connecting the station without waiting for
+ * it. Services that need the uplink subscribe to LINK_EVENT (see
+ * link_supervisor.h). */
 void start_softap_sta(void);
 
 #endif /* SOFTAP_STA */
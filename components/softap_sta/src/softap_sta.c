@@ -14,14 +14,19 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
 #include "esp_mac.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif_net_stack.h"
 #include "esp_netif.h"
-#include "nvs_flash.h"
+#include "esp_timer.h"
+#include "boot_trace.h"
+#include "dns_responder.h"
+#include "link_supervisor.h"
+#include "presence.h"
+#include "settings.h"
+#include "softap_sta.h"
 #include "lwip/inet.h"
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
@@ -31,53 +36,68 @@
 #include "lwip/err.h"
 #include "lwip/sys.h"
 
-/* The examples use WiFi configuration that you can set via project configuration menu.
-
-   If you'd rather not, just change the below entries to strings with
-   the config you want - ie #define CONFIG_ESP_WIFI_REMOTE_AP_SSID "mywifissid"
-*/
+/* Network names and passphrases come from the run-time settings, read once
+   here: changing them takes a restart (see settings.h). */
 
 #define ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD   WIFI_AUTH_WPA2_PSK
 
-/* The event group allows multiple bits for each event, but we only care about two events:
- * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
-#define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
-
 /*DHCP server option*/
 #define DHCPS_OFFER_DNS             0x02
 
 static const char *TAG_AP = "WiFi SoftAP";
 static const char *TAG_STA = "WiFi Sta";
 
-static int s_retry_num = 0;
+static esp_netif_t *s_netif_ap = NULL;
+static esp_netif_t *s_netif_sta = NULL;
 
-/* FreeRTOS event group to signal when we are connected/disconnected */
-static EventGroupHandle_t s_wifi_event_group;
+static void softap_set_upstream_dns(esp_netif_t *esp_netif_sta);
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data)
 {
+    /* Presence latency is measured from here */
+    int64_t now = esp_timer_get_time();
+
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED) {
         wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *) event_data;
-        ESP_LOGI(TAG_AP, "Station "MACSTR" joined, AID=%d",
-                 MAC2STR(event->mac), event->aid);
+        presence_event_t presence = { .type = PRESENCE_EVENT_JOIN, .time_us = now };
+        memcpy(presence.mac, event->mac, sizeof(presence.mac));
+        presence_post(&presence);
+        ESP_LOGI(TAG_AP, "Station "MACSTR" joined, AID=%d", MAC2STR(event->mac), event->aid);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED) {
         wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *) event_data;
+        presence_event_t presence = { .type = PRESENCE_EVENT_LEAVE, .time_us = now };
+        memcpy(presence.mac, event->mac, sizeof(presence.mac));
+        presence_post(&presence);
         ESP_LOGI(TAG_AP, "Station "MACSTR" left, AID=%d, reason:%d",
                  MAC2STR(event->mac), event->aid, event->reason);
-    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        esp_wifi_connect();
-        ESP_LOGI(TAG_STA, "Station started");
+#if CONFIG_PRESENCE_PREWARM
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_PROBEREQRECVED) {
+        /* Frequent: no logging, presence_post() drops the weak ones */
+        wifi_event_ap_probe_req_rx_t *event = (wifi_event_ap_probe_req_rx_t *) event_data;
+        presence_event_t presence = { .type = PRESENCE_EVENT_PROBE, .rssi = event->rssi, .time_us = now };
+        memcpy(presence.mac, event->mac, sizeof(presence.mac));
+        presence_post(&presence);
+#endif
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *) event_data;
         ESP_LOGI(TAG_STA, "Got IP:" IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
-        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+    } else if (event_base == LINK_EVENT && event_id == LINK_EVENT_UP) {
+        /* The upstream DNS server may differ after every reconnect */
+        softap_set_upstream_dns(s_netif_sta);
+    } else if (event_base == LINK_EVENT && event_id == LINK_EVENT_DOWN) {
+        /* Fail forwarded queries at once instead of after the timeout */
+        dns_responder_set_upstream(0);
     }
 }
 
+/* Wi-Fi config strings may fill their field without a NUL; the rest of
+ * the field is left zeroed */
+static void wifi_config_copy(uint8_t *field, size_t field_len, const char *value)
+{
+    memcpy(field, value, strnlen(value, field_len));
+}
+
 /* Initialize soft AP */
 esp_netif_t *wifi_init_softap(void)
 {
@@ -85,26 +105,28 @@ esp_netif_t *wifi_init_softap(void)
 
     wifi_config_t wifi_ap_config = {
         .ap = {
-            .ssid = CONFIG_ESP_WIFI_AP_SSID,
-            .ssid_len = strlen(CONFIG_ESP_WIFI_AP_SSID),
-            .channel = CONFIG_ESP_WIFI_AP_CHANNEL,
-            .password = CONFIG_ESP_WIFI_AP_PASSWORD,
-            .max_connection = CONFIG_ESP_MAX_STA_CONN_AP,
             .authmode = WIFI_AUTH_WPA2_PSK,
             .pmf_cfg = {
                 .required = false,
             },
         },
     };
-
-    if (strlen(CONFIG_ESP_WIFI_AP_PASSWORD) == 0) {
+    const settings_t *settings = settings_acquire();
+    wifi_config_copy(wifi_ap_config.ap.ssid, sizeof(wifi_ap_config.ap.ssid), settings->ap_ssid);
+    wifi_ap_config.ap.ssid_len = strlen(settings->ap_ssid);
+    wifi_config_copy(wifi_ap_config.ap.password, sizeof(wifi_ap_config.ap.password), settings->ap_password);
+    wifi_ap_config.ap.channel = settings->ap_channel;
+    wifi_ap_config.ap.max_connection = settings->ap_max_conn;
+    settings_release(settings);
+
+    if (wifi_ap_config.ap.password[0] == '\0') {
         wifi_ap_config.ap.authmode = WIFI_AUTH_OPEN;
     }
 
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_ap_config));
 
-    ESP_LOGI(TAG_AP, "wifi_init_softap finished. SSID:%s password:%s channel:%d",
-             CONFIG_ESP_WIFI_AP_SSID, CONFIG_ESP_WIFI_AP_PASSWORD, CONFIG_ESP_WIFI_AP_CHANNEL);
+    ESP_LOGI(TAG_AP, "wifi_init_softap finished. SSID:%.*s channel:%d",
+             wifi_ap_config.ap.ssid_len, (const char *)wifi_ap_config.ap.ssid, wifi_ap_config.ap.channel);
 
     return esp_netif_ap;
 }
@@ -116,8 +138,6 @@ esp_netif_t *wifi_init_sta(void)
 
     wifi_config_t wifi_sta_config = {
         .sta = {
-            .ssid = CONFIG_ESP_WIFI_REMOTE_AP_SSID,
-            .password = CONFIG_ESP_WIFI_REMOTE_AP_PASSWORD,
             .scan_method = WIFI_ALL_CHANNEL_SCAN,
             .failure_retry_cnt = CONFIG_ESP_MAXIMUM_STA_RETRY,
             /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
@@ -130,6 +150,11 @@ esp_netif_t *wifi_init_sta(void)
         },
     };
 
+    const settings_t *settings = settings_acquire();
+    wifi_config_copy(wifi_sta_config.sta.ssid, sizeof(wifi_sta_config.sta.ssid), settings->sta_ssid);
+    wifi_config_copy(wifi_sta_config.sta.password, sizeof(wifi_sta_config.sta.password), settings->sta_password);
+    settings_release(settings);
+
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config) );
 
     ESP_LOGI(TAG_STA, "wifi_init_sta finished.");
@@ -137,10 +162,36 @@ esp_netif_t *wifi_init_sta(void)
     return esp_netif_sta;
 }
 
-void softap_set_dns_addr(esp_netif_t *esp_netif_ap,esp_netif_t *esp_netif_sta)
+static void softap_set_upstream_dns(esp_netif_t *esp_netif_sta)
 {
     esp_netif_dns_info_t dns;
-    esp_netif_get_dns_info(esp_netif_sta,ESP_NETIF_DNS_MAIN,&dns);
+    if (esp_netif_get_dns_info(esp_netif_sta, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK &&
+            dns.ip.type == ESP_IPADDR_TYPE_V4) {
+        dns_responder_set_upstream(dns.ip.u_addr.ip4.addr);
+    }
+}
+
+/* SoftAP clients resolve through the local responder: the hostname and
+ * captive-portal probes never leave the device, and the DHCP lease stays
+ * valid across uplink reconnects whatever the upstream server. */
+static void softap_start_dns(esp_netif_t *esp_netif_ap)
+{
+    esp_netif_ip_info_t ip_info;
+    ESP_ERROR_CHECK(esp_netif_get_ip_info(esp_netif_ap, &ip_info));
+
+    dns_responder_config_t config = {
+        .ip = ip_info.ip.addr,
+        .hostname = CONFIG_MDNS_HOST_NAME,
+    };
+    if (ESP_ERROR_CHECK_WITHOUT_ABORT(dns_responder_start(&config)) != ESP_OK) {
+        /* Leave the DHCP server without a DNS offer, as before */
+        return;
+    }
+
+    esp_netif_dns_info_t dns = {
+        .ip.type = ESP_IPADDR_TYPE_V4,
+        .ip.u_addr.ip4.addr = ip_info.ip.addr,
+    };
     uint8_t dhcps_offer_option = DHCPS_OFFER_DNS;
     ESP_ERROR_CHECK_WITHOUT_ABORT(esp_netif_dhcps_stop(esp_netif_ap));
     ESP_ERROR_CHECK(esp_netif_dhcps_option(esp_netif_ap, ESP_NETIF_OP_SET, ESP_NETIF_DOMAIN_NAME_SERVER, &dhcps_offer_option, sizeof(dhcps_offer_option)));
@@ -153,17 +204,6 @@ void start_softap_sta(void)
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    //Initialize NVS
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
-
-    /* Initialize event group */
-    s_wifi_event_group = xEventGroupCreate();
-
     /* Register Event handler */
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                     ESP_EVENT_ANY_ID,
@@ -175,6 +215,16 @@ void start_softap_sta(void)
                     &wifi_event_handler,
                     NULL,
                     NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(LINK_EVENT,
+                    LINK_EVENT_UP,
+                    &wifi_event_handler,
+                    NULL,
+                    NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(LINK_EVENT,
+                    LINK_EVENT_DOWN,
+                    &wifi_event_handler,
+                    NULL,
+                    NULL));
 
     /*Initialize WiFi */
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -182,16 +232,32 @@ void start_softap_sta(void)
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
 
+#if CONFIG_PRESENCE_PREWARM
+    /* Probe request events are masked by default */
+    ESP_ERROR_CHECK(esp_wifi_set_event_mask(WIFI_EVENT_MASK_NONE));
+#endif
+
     /* Initialize AP */
     ESP_LOGI(TAG_AP, "ESP_WIFI_MODE_AP");
-    esp_netif_t *esp_netif_ap = wifi_init_softap();
+    s_netif_ap = wifi_init_softap();
 
     /* Initialize STA */
     ESP_LOGI(TAG_STA, "ESP_WIFI_MODE_STA");
-    esp_netif_t *esp_netif_sta = wifi_init_sta();
+    s_netif_sta = wifi_init_sta();
+
+    /* Set sta as the default interface */
+    esp_netif_set_default_netif(s_netif_sta);
+
+    /* Connecting, reconnecting and the backoff between attempts are all
+     * handled by the link supervisor */
+    ESP_ERROR_CHECK(link_supervisor_start());
 
     /* Start WiFi */
     ESP_ERROR_CHECK(esp_wifi_start() );
+    boot_trace_mark("wifi_started");
+
+    softap_start_dns(s_netif_ap);
+    boot_trace_mark("dns");
 
     /* reduce AP transmit power to limit range (value in dBm; experiment: try 8, 6, 4, 0) */
     esp_err_t _err = esp_wifi_set_max_tx_power(8);
@@ -200,37 +266,12 @@ void start_softap_sta(void)
     } else {
         ESP_LOGI(TAG_AP, "Set max TX power to small value to limit AP range");
     }
-    
-    /*
-     * Wait until either the connection is established (WIFI_CONNECTED_BIT) or
-     * connection failed for the maximum number of re-tries (WIFI_FAIL_BIT).
-     * The bits are set by event_handler() (see above)
-     */
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           portMAX_DELAY);
-
-    /* xEventGroupWaitBits() returns the bits before the call returned,
-     * hence we can test which event actually happened. */
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG_STA, "connected to ap SSID:%s password:%s",
-                 CONFIG_ESP_WIFI_REMOTE_AP_SSID, CONFIG_ESP_WIFI_REMOTE_AP_PASSWORD);
-        softap_set_dns_addr(esp_netif_ap,esp_netif_sta);
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG_STA, "Failed to connect to SSID:%s, password:%s",
-                 CONFIG_ESP_WIFI_REMOTE_AP_SSID, CONFIG_ESP_WIFI_REMOTE_AP_PASSWORD);
-    } else {
-        ESP_LOGE(TAG_STA, "UNEXPECTED EVENT");
-        return;
-    }
 
-    /* Set sta as the default interface */
-    esp_netif_set_default_netif(esp_netif_sta);
+    /* The upstream connection is finished by the link supervisor; the SoftAP
+     * and everything local work without it. */
 
     // /* Enable napt on the AP netif */
     // if (esp_netif_napt_enable(esp_netif_ap) != ESP_OK) {
     //     ESP_LOGE(TAG_STA, "NAPT not enabled on the netif: %p", esp_netif_ap);
     // }
-}
\ No newline at end of file
+}
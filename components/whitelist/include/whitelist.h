@@ -0,0 +1,72 @@
+#ifndef WHITELIST
+#define WHITELIST
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define WHITELIST_NAME_MAX 24
+
+typedef enum {
+    WHITELIST_ACCESS_FULL = 0,
+    WHITELIST_ACCESS_LIMITED,
+    WHITELIST_ACCESS_TEMPORARY,
+    WHITELIST_ACCESS_MAX,
+} whitelist_access_t;
+
+/* Packed record, stored as-is in the NVS blobs */
+typedef struct __attribute__((packed)) {
+    uint8_t mac[6];
+    uint8_t access;         /* whitelist_access_t */
+    uint8_t reserved;
+    uint32_t expires;       /* UNIX time, 0 = never expires */
+    char name[WHITELIST_NAME_MAX];
+} whitelist_entry_t;
+
+/* Flash write accounting, used to measure NVS write amplification */
+typedef struct {
+    uint32_t changes;           /* add/update/remove operations */
+    uint32_t blobs_written;
+    uint32_t bytes_requested;   /* entry bytes actually changed */
+    uint32_t bytes_written;     /* blob bytes handed to NVS */
+} whitelist_nvs_stats_t;
+
+typedef void (*whitelist_iter_cb_t)(const whitelist_entry_t *entry, void *ctx);
+
+/* Load the whitelist from NVS. NVS flash must already be initialised. */
+esp_err_t whitelist_init(void);
+
+/* Constant-time check used from the Wi-Fi event path. Expiring entries are
+ * only honoured once the system clock has been set. */
+bool whitelist_is_allowed(const uint8_t mac[6]);
+/* Same check, also reporting the access level of an allowed device */
+bool whitelist_lookup(const uint8_t mac[6], whitelist_access_t *access);
+
+esp_err_t whitelist_get(const uint8_t mac[6], whitelist_entry_t *out);
+/* Insert a new entry or update the existing one with the same MAC */
+esp_err_t whitelist_add(const whitelist_entry_t *entry);
+esp_err_t whitelist_remove(const uint8_t mac[6]);
+/* Group many changes into one NVS write: add/remove only update RAM until
+ * the matching whitelist_batch_end(), which flushes the touched chunks. */
+void whitelist_batch_begin(void);
+esp_err_t whitelist_batch_end(void);
+size_t whitelist_count(void);
+/* Calls cb for every entry while holding the whitelist lock, which the
+ * Wi-Fi join path also takes: cb must be short and must not block or do
+ * I/O. To send the list somewhere, copy it out with whitelist_copy(). */
+void whitelist_foreach(whitelist_iter_cb_t cb, void *ctx);
+/* Copies up to max entries, starting at position first, and returns how
+ * many were copied; 0 past the end. The lock is only held for the copy.
+ * A removal between calls moves the last entry into the hole, so a list
+ * read in several batches can miss or repeat an entry changed meanwhile. */
+size_t whitelist_copy(size_t first, whitelist_entry_t *out, size_t max);
+void whitelist_get_nvs_stats(whitelist_nvs_stats_t *out);
+
+/* "AA:BB:CC:DD:EE:FF" (or '-' separated) <-> 6 bytes */
+esp_err_t whitelist_mac_from_str(const char *str, uint8_t mac[6]);
+void whitelist_mac_to_str(const uint8_t mac[6], char out[18]);
+const char *whitelist_access_to_str(whitelist_access_t access);
+esp_err_t whitelist_access_from_str(const char *str, whitelist_access_t *out);
+
+#endif /* WHITELIST */
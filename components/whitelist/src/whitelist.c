@@ -0,0 +1,427 @@
+#include "whitelist.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+static const char *TAG = "whitelist";
+
+#define WL_NVS_NAMESPACE    "whitelist"
+#define WL_NVS_COUNT_KEY    "count"
+#define WL_MAX_ENTRIES      CONFIG_WHITELIST_MAX_ENTRIES
+#define WL_CHUNK            CONFIG_WHITELIST_NVS_CHUNK
+#define WL_CHUNK_COUNT      ((WL_MAX_ENTRIES + WL_CHUNK - 1) / WL_CHUNK)
+
+/* Open-addressed index, kept at most half full so probe chains stay short */
+#define WL_INDEX_SIZE_FOR(n) ((n) <= 16 ? 32 : (n) <= 32 ? 64 : (n) <= 64 ? 128 : (n) <= 128 ? 256 : \
+                              (n) <= 256 ? 512 : (n) <= 512 ? 1024 : 2048)
+#define WL_INDEX_SIZE       WL_INDEX_SIZE_FOR(WL_MAX_ENTRIES)
+#define WL_INDEX_MASK       (WL_INDEX_SIZE - 1)
+
+/* Wall-clock values before this mean SNTP has not set the time yet */
+#define WL_CLOCK_VALID_AFTER 1700000000
+
+/* Entries are stored densely so they map straight onto the NVS chunks;
+ * the index holds entry position + 1 (0 marks an empty slot). */
+static whitelist_entry_t s_entries[WL_MAX_ENTRIES];
+static uint16_t s_index[WL_INDEX_SIZE];
+static size_t s_count = 0;
+static size_t s_stored_count = 0;
+static uint8_t s_dirty[(WL_CHUNK_COUNT + 7) / 8];
+static whitelist_nvs_stats_t s_stats;
+static SemaphoreHandle_t s_lock = NULL;
+/* Held by flush_dirty(), which owns s_flush_buf and s_stored_count */
+static SemaphoreHandle_t s_flush_lock = NULL;
+static whitelist_entry_t s_flush_buf[WL_CHUNK];
+/* Open batches; flushing is deferred while non-zero */
+static int s_batch = 0;
+
+static inline uint32_t mac_hash(const uint8_t mac[6])
+{
+    /* FNV-1a over the six bytes */
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 6; i++) {
+        h = (h ^ mac[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Returns the index slot holding mac, or the empty slot where it would go */
+static size_t index_probe(const uint8_t mac[6])
+{
+    size_t slot = mac_hash(mac) & WL_INDEX_MASK;
+    while (s_index[slot] != 0 && memcmp(s_entries[s_index[slot] - 1].mac, mac, 6) != 0) {
+        slot = (slot + 1) & WL_INDEX_MASK;
+    }
+    return slot;
+}
+
+/* Linear-probing delete with backward shift, so no tombstones accumulate */
+static void index_delete(size_t hole)
+{
+    size_t next = hole;
+    s_index[hole] = 0;
+    for (;;) {
+        next = (next + 1) & WL_INDEX_MASK;
+        if (s_index[next] == 0) {
+            return;
+        }
+        size_t home = mac_hash(s_entries[s_index[next] - 1].mac) & WL_INDEX_MASK;
+        /* Leave the entry if its home lies cyclically in (hole, next] */
+        bool stays = (hole <= next) ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!stays) {
+            s_index[hole] = s_index[next];
+            s_index[next] = 0;
+            hole = next;
+        }
+    }
+}
+
+static void mark_dirty(size_t pos)
+{
+    size_t chunk = pos / WL_CHUNK;
+    s_dirty[chunk / 8] |= 1 << (chunk % 8);
+}
+
+/* Rewrite only the chunks touched since the last flush. Each chunk is
+ * copied out under s_lock and written after releasing it, so lookups from
+ * the Wi-Fi event path never wait for the flash. s_flush_lock keeps one
+ * flush at a time; a change made meanwhile dirties its chunk again and the
+ * next flush picks it up. */
+static esp_err_t flush_dirty(void)
+{
+    xSemaphoreTake(s_flush_lock, portMAX_DELAY);
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(WL_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        xSemaphoreGive(s_flush_lock);
+        ESP_LOGE(TAG, "Failed to open NVS (%s)", esp_err_to_name(err));
+        return err;
+    }
+
+    char key[8];
+    uint8_t taken[sizeof(s_dirty)] = { 0 };
+    size_t count = 0;
+    for (size_t chunk = 0; chunk < WL_CHUNK_COUNT && err == ESP_OK; chunk++) {
+        uint8_t bit = 1 << (chunk % 8);
+        size_t first = chunk * WL_CHUNK;
+        size_t n = 0;
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        bool dirty = s_dirty[chunk / 8] & bit;
+        if (dirty) {
+            s_dirty[chunk / 8] &= ~bit;
+            n = first >= s_count ? 0 : s_count - first < WL_CHUNK ? s_count - first : WL_CHUNK;
+            memcpy(s_flush_buf, &s_entries[first], n * sizeof(whitelist_entry_t));
+        }
+        count = s_count;
+        xSemaphoreGive(s_lock);
+        if (!dirty) {
+            continue;
+        }
+        taken[chunk / 8] |= bit;
+
+        snprintf(key, sizeof(key), "c%u", (unsigned)chunk);
+        if (n == 0) {
+            err = nvs_erase_key(nvs, key);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+            continue;
+        }
+        err = nvs_set_blob(nvs, key, s_flush_buf, n * sizeof(whitelist_entry_t));
+        s_stats.blobs_written++;
+        s_stats.bytes_written += n * sizeof(whitelist_entry_t);
+    }
+    if (err == ESP_OK && count != s_stored_count) {
+        err = nvs_set_u16(nvs, WL_NVS_COUNT_KEY, count);
+        s_stats.bytes_written += sizeof(uint16_t);
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+
+    if (err == ESP_OK) {
+        s_stored_count = count;
+    } else {
+        /* Retry the chunks taken by this flush with the next one */
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        for (size_t i = 0; i < sizeof(s_dirty); i++) {
+            s_dirty[i] |= taken[i];
+        }
+        xSemaphoreGive(s_lock);
+        ESP_LOGE(TAG, "Failed to persist whitelist (%s)", esp_err_to_name(err));
+    }
+    xSemaphoreGive(s_flush_lock);
+    return err;
+}
+
+esp_err_t whitelist_init(void)
+{
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        s_flush_lock = xSemaphoreCreateMutex();
+        if (!s_lock || !s_flush_lock) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_count = 0;
+    memset(s_index, 0, sizeof(s_index));
+
+    nvs_handle_t nvs;
+    uint16_t stored = 0;
+    if (nvs_open(WL_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        nvs_get_u16(nvs, WL_NVS_COUNT_KEY, &stored);
+        if (stored > WL_MAX_ENTRIES) {
+            ESP_LOGW(TAG, "Stored whitelist has %u entries, keeping %d", stored, WL_MAX_ENTRIES);
+            stored = WL_MAX_ENTRIES;
+        }
+
+        char key[8];
+        for (size_t first = 0; first < stored; first += WL_CHUNK) {
+            size_t len = (stored - first < WL_CHUNK ? stored - first : WL_CHUNK) * sizeof(whitelist_entry_t);
+            snprintf(key, sizeof(key), "c%u", (unsigned)(first / WL_CHUNK));
+            if (nvs_get_blob(nvs, key, &s_entries[first], &len) != ESP_OK) {
+                ESP_LOGE(TAG, "Whitelist chunk %s unreadable, truncating", key);
+                break;
+            }
+            s_count = first + len / sizeof(whitelist_entry_t);
+        }
+        nvs_close(nvs);
+    }
+
+    for (size_t i = 0; i < s_count; i++) {
+        s_index[index_probe(s_entries[i].mac)] = i + 1;
+    }
+    s_stored_count = stored;
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGI(TAG, "Loaded %u whitelisted devices", (unsigned)s_count);
+    return ESP_OK;
+}
+
+bool whitelist_lookup(const uint8_t mac[6], whitelist_access_t *access)
+{
+    if (!s_lock) {
+        return false;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t slot = index_probe(mac);
+    bool allowed = false;
+    if (s_index[slot] != 0) {
+        const whitelist_entry_t *entry = &s_entries[s_index[slot] - 1];
+        time_t now = time(NULL);
+        allowed = entry->expires == 0 || (now > WL_CLOCK_VALID_AFTER && now < (time_t)entry->expires);
+        if (allowed && access) {
+            *access = entry->access;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return allowed;
+}
+
+bool whitelist_is_allowed(const uint8_t mac[6])
+{
+    return whitelist_lookup(mac, NULL);
+}
+
+esp_err_t whitelist_get(const uint8_t mac[6], whitelist_entry_t *out)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint16_t pos = s_index[index_probe(mac)];
+    if (pos != 0) {
+        *out = s_entries[pos - 1];
+    }
+    xSemaphoreGive(s_lock);
+    return pos != 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t whitelist_add(const whitelist_entry_t *entry)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (entry->access >= WHITELIST_ACCESS_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t slot = index_probe(entry->mac);
+    size_t pos;
+    if (s_index[slot] != 0) {
+        pos = s_index[slot] - 1;
+        if (memcmp(&s_entries[pos], entry, sizeof(*entry)) == 0) {
+            /* Nothing changed, spare the flash */
+            xSemaphoreGive(s_lock);
+            return ESP_OK;
+        }
+    } else if (s_count < WL_MAX_ENTRIES) {
+        pos = s_count++;
+        s_index[slot] = pos + 1;
+    } else {
+        xSemaphoreGive(s_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_entries[pos] = *entry;
+    s_entries[pos].name[WHITELIST_NAME_MAX - 1] = '\0';
+    mark_dirty(pos);
+    s_stats.changes++;
+    s_stats.bytes_requested += sizeof(whitelist_entry_t);
+
+    bool flush = s_batch == 0;
+    xSemaphoreGive(s_lock);
+    return flush ? flush_dirty() : ESP_OK;
+}
+
+esp_err_t whitelist_remove(const uint8_t mac[6])
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t slot = index_probe(mac);
+    if (s_index[slot] == 0) {
+        xSemaphoreGive(s_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t pos = s_index[slot] - 1;
+    size_t last = s_count - 1;
+    index_delete(slot);
+    /* Keep the array dense by moving the last entry into the hole */
+    if (pos != last) {
+        s_entries[pos] = s_entries[last];
+        s_index[index_probe(s_entries[pos].mac)] = pos + 1;
+        mark_dirty(pos);
+    }
+    mark_dirty(last);
+    s_count--;
+    s_stats.changes++;
+    s_stats.bytes_requested += sizeof(whitelist_entry_t);
+
+    bool flush = s_batch == 0;
+    xSemaphoreGive(s_lock);
+    return flush ? flush_dirty() : ESP_OK;
+}
+
+void whitelist_batch_begin(void)
+{
+    if (!s_lock) {
+        return;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_batch++;
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t whitelist_batch_end(void)
+{
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool flush = s_batch > 0 && --s_batch == 0;
+    xSemaphoreGive(s_lock);
+    return flush ? flush_dirty() : ESP_OK;
+}
+
+size_t whitelist_count(void)
+{
+    return s_count;
+}
+
+void whitelist_foreach(whitelist_iter_cb_t cb, void *ctx)
+{
+    if (!s_lock) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (size_t i = 0; i < s_count; i++) {
+        cb(&s_entries[i], ctx);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+size_t whitelist_copy(size_t first, whitelist_entry_t *out, size_t max)
+{
+    if (!s_lock) {
+        return 0;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    size_t count = first < s_count ? s_count - first : 0;
+    count = count < max ? count : max;
+    if (count) {
+        memcpy(out, &s_entries[first], count * sizeof(whitelist_entry_t));
+    }
+    xSemaphoreGive(s_lock);
+    return count;
+}
+
+void whitelist_get_nvs_stats(whitelist_nvs_stats_t *out)
+{
+    *out = s_stats;
+}
+
+esp_err_t whitelist_mac_from_str(const char *str, uint8_t mac[6])
+{
+    unsigned int b[6];
+    char sep[5];
+    int n = sscanf(str, "%2x%c%2x%c%2x%c%2x%c%2x%c%2x", &b[0], &sep[0], &b[1], &sep[1], &b[2], &sep[2],
+                   &b[3], &sep[3], &b[4], &sep[4], &b[5]);
+    if (n != 11 || strlen(str) != 17) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < 5; i++) {
+        if (sep[i] != ':' && sep[i] != '-') {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    for (int i = 0; i < 6; i++) {
+        mac[i] = b[i];
+    }
+    return ESP_OK;
+}
+
+void whitelist_mac_to_str(const uint8_t mac[6], char out[18])
+{
+    snprintf(out, 18, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static const char *const s_access_names[WHITELIST_ACCESS_MAX] = {
+    [WHITELIST_ACCESS_FULL] = "full",
+    [WHITELIST_ACCESS_LIMITED] = "limited",
+    [WHITELIST_ACCESS_TEMPORARY] = "temporary",
+};
+
+const char *whitelist_access_to_str(whitelist_access_t access)
+{
+    return access < WHITELIST_ACCESS_MAX ? s_access_names[access] : "unknown";
+}
+
+esp_err_t whitelist_access_from_str(const char *str, whitelist_access_t *out)
+{
+    for (int i = 0; i < WHITELIST_ACCESS_MAX; i++) {
+        if (strcasecmp(str, s_access_names[i]) == 0) {
+            *out = i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
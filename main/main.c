@@ -1,26 +1,63 @@
 #include "esp_log.h"
-// #include "mdns_service.h"
 
+#include "access_log.h"
 #include "basic_http_server.h"
+#include "boot_trace.h"
 #include "dc_bot.h"
+#include "dlog.h"
+#include "gate_actuator.h"
+#include "mdns_service.h"
+#include "presence.h"
+#include "settings.h"
 #include "softap_sta.h"
+#include "whitelist.h"
 
 
 static const char *TAG = "LCU-30H Gate Automation";
 
 void app_main(void)
 {
+    boot_trace_mark("app_main");
     ESP_LOGI(TAG, "Starting services...");
 
-    // // Initilaize MDNS
-    // initialise_mdns();
+    // Hot-path messages are rendered in the background from here on
+    ESP_ERROR_CHECK_WITHOUT_ABORT(dlog_start());
 
-    // Initialize and start WiFi-Station+SoftAP
+    // Initialize NVS and load the settings every service below reads
+    ESP_ERROR_CHECK(settings_init());
+    boot_trace_mark("settings");
+
+    // Start the gate actuator first so commands can be queued from any source
+    ESP_ERROR_CHECK(gate_actuator_start());
+    boot_trace_mark("gate_actuator");
+
+    // Initialize WiFi-Station+SoftAP, the station connects in the background
     start_softap_sta();
 
-    // Initialize SPIFFS filesystem
-    ESP_ERROR_CHECK(init_fs());
+    // Announce <hostname>.local; SoftAP clients get it from the local DNS responder too
+    ESP_ERROR_CHECK_WITHOUT_ABORT(initialise_mdns());
+    boot_trace_mark("mdns");
+
+    // Load the device whitelist from NVS
+    ESP_ERROR_CHECK(whitelist_init());
+    boot_trace_mark("whitelist");
+
+    // Joins before this point fall in the startup window and would not open anyway
+    ESP_ERROR_CHECK_WITHOUT_ABORT(presence_start());
+    boot_trace_mark("presence");
+
+    // Events are buffered in RAM until then; a broken log must not stop the gate
+    ESP_ERROR_CHECK_WITHOUT_ABORT(access_log_start());
+    boot_trace_mark("access_log");
+
+    // Map the web UI bundle from flash
+    ESP_ERROR_CHECK(init_assets());
+    boot_trace_mark("assets");
+
+    // Local control must not depend on the uplink: serve the web UI right away
+    ESP_ERROR_CHECK_WITHOUT_ABORT(start_rest_server());
+    boot_trace_mark("http");
 
-    // Initialize and start the Discord Bot
+    // The Discord bot logs in whenever the uplink is up, without blocking here
     dc_bot_start();
-}
\ No newline at end of file
+}
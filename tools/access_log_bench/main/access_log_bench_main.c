@@ -0,0 +1,114 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "access_log.h"
+
+#define BENCH_EVENTS 1000
+/* Yield to the flush task this often in the paced run, below the ring size */
+#define BENCH_PACE (CONFIG_ACCESS_LOG_RING_SIZE / 2)
+
+static void wait_for_flush(uint32_t stored_target)
+{
+    access_log_stats_t stats;
+    for (int i = 0; i < 500; i++) {
+        access_log_get_stats(&stats);
+        if (stats.stored >= stored_target) {
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+/* Append BENCH_EVENTS records and print one JSON result line. Both runs
+ * write a multiple of 8 records, so every page is full and written once. */
+static void bench_run(const char *name, int pace)
+{
+    static const uint8_t mac[6] = { 0x02, 0x10, 0x00, 0x00, 0x00, 0x01 };
+    access_log_stats_t before, after;
+    int64_t busy_us = 0;
+
+    access_log_get_stats(&before);
+    for (int i = 0; i < BENCH_EVENTS; i += pace) {
+        int64_t start = esp_timer_get_time();
+        for (int j = i; j < i + pace && j < BENCH_EVENTS; j++) {
+            access_log_append(ACCESS_SOURCE_WIFI, ACCESS_ACTION_STATION_JOIN, ACCESS_RESULT_OK, j, mac);
+        }
+        busy_us += esp_timer_get_time() - start;
+        if (pace < BENCH_EVENTS) {
+            vTaskDelay(1);
+        }
+    }
+    access_log_get_stats(&after);
+    /* appended only counts the records the ring took */
+    wait_for_flush(before.stored + (after.appended - before.appended));
+    access_log_get_stats(&after);
+
+    uint32_t stored = after.stored - before.stored;
+    printf("{\"run\": \"%s\", \"events\": %d, \"append_ns\": %.1f, \"dropped\": %lu, \"stored\": %lu, "
+           "\"page_writes_per_1000\": %.1f, \"sector_erases_per_1000\": %.1f}\n",
+           name, BENCH_EVENTS, busy_us * 1000.0 / BENCH_EVENTS,
+           (unsigned long)(after.dropped - before.dropped), (unsigned long)stored,
+           stored ? (after.page_writes - before.page_writes) * 1000.0 / stored : 0.0,
+           stored ? (after.sector_erases - before.sector_erases) * 1000.0 / stored : 0.0);
+}
+
+/* Where access_log_start() resumed: right after the newest record found in
+ * flash. Run the bench twice without erasing the flash to check it. */
+static void recovery_run(void)
+{
+    access_log_stats_t stats;
+    access_log_record_t newest;
+
+    access_log_get_stats(&stats);
+    size_t found = access_log_read(0, &newest, 1);
+    bool consistent = found ? newest.seq + 1 == stats.next_seq : stats.next_seq == 1;
+    printf("{\"run\": \"recovery\", \"next_seq\": %lu, \"newest_seq\": %lu, \"consistent\": %s}\n",
+           (unsigned long)stats.next_seq, found ? (unsigned long)newest.seq : 0UL, consistent ? "true" : "false");
+}
+
+/* Page through the whole log, newest first, as GET /api/v1/logs does: the
+ * sequence numbers must count down one by one from the newest */
+static void readback_run(void)
+{
+    static access_log_record_t page[32];
+    access_log_stats_t stats;
+    uint32_t records = 0;
+    uint32_t gaps = 0;
+    uint32_t expect = 0;
+    uint32_t before = 0;
+    size_t n;
+
+    access_log_get_stats(&stats);
+    while ((n = access_log_read(before, page, sizeof(page) / sizeof(page[0]))) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            gaps += expect && page[i].seq != expect;
+            expect = page[i].seq - 1;
+        }
+        records += n;
+        before = page[n - 1].seq;
+    }
+    printf("{\"run\": \"readback\", \"records\": %lu, \"oldest_seq\": %lu, \"newest_seq\": %lu, "
+           "\"capacity\": %lu, \"gaps\": %lu}\n",
+           (unsigned long)records, (unsigned long)(records ? expect + 1 : 0), (unsigned long)(stats.next_seq - 1),
+           (unsigned long)stats.capacity, (unsigned long)gaps);
+}
+
+void app_main(void)
+{
+    ESP_ERROR_CHECK(access_log_start());
+    recovery_run();
+
+    /* The flush task keeps up: cost of the append alone */
+    bench_run("paced", BENCH_PACE);
+    /* Back to back: shows what the ring absorbs before dropping */
+    bench_run("burst", BENCH_EVENTS);
+    readback_run();
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
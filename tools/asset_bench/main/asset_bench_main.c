@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_timer.h"
+
+#include "asset_bundle.h"
+
+#define REQUESTS        200000
+#define SCRATCH_BUFSIZE 10240
+#define SEGMENT         1460
+#define ASSETS_MAX      16
+#define PATH_MAX_LEN    (sizeof(BENCH_WWW_DIR) + 32)
+
+/* The old in-RAM table, resolved once at mount time */
+typedef struct {
+    char uri[32];
+    char path[PATH_MAX_LEN];
+    uint32_t stored_len;
+} file_asset_t;
+
+static file_asset_t s_files[ASSETS_MAX];
+static size_t s_file_count;
+static char s_scratch[SCRATCH_BUFSIZE];
+static char s_segment[SEGMENT];
+static uint32_t s_checksum;
+static uint64_t s_copied;
+
+/* Socket stand-in: lwIP copies the body into segments either way */
+static void sink(const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0) {
+        size_t n = len < SEGMENT ? len : SEGMENT;
+        memcpy(s_segment, p, n);
+        s_checksum += (uint8_t)s_segment[n - 1];
+        s_copied += n;
+        p += n;
+        len -= n;
+    }
+}
+
+static const file_asset_t *file_find(const char *uri, size_t uri_len)
+{
+    size_t lo = 0, hi = s_file_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const char *name = s_files[mid].uri;
+        int cmp = strncmp(name, uri, uri_len);
+        if (cmp == 0 && name[uri_len] != '\0') {
+            cmp = 1;
+        }
+        if (cmp == 0) {
+            return &s_files[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/* open(), read() through the scratch buffer, close(), as rest_send_asset() did */
+static bool file_serve(const file_asset_t *asset)
+{
+    int fd = open(asset->path, O_RDONLY, 0);
+    if (fd == -1) {
+        return false;
+    }
+    ssize_t read_bytes;
+    while ((read_bytes = read(fd, s_scratch, SCRATCH_BUFSIZE)) > 0) {
+        s_copied += read_bytes;
+        sink(s_scratch, read_bytes);
+    }
+    close(fd);
+    return read_bytes == 0;
+}
+
+static void report(const char *name, int64_t lookup_us, int64_t serve_us, uint32_t failures, uint32_t fds)
+{
+    printf("{\"run\": \"%s\", \"requests\": %d, \"lookup_ns\": %.1f, \"serve_ns\": %.1f, \"total_ns\": %.1f, "
+           "\"bytes_copied_per_request\": %.0f, \"fds_per_request\": %lu, \"failures\": %lu, \"checksum\": %lu}\n",
+           name, REQUESTS, lookup_us * 1000.0 / REQUESTS, serve_us * 1000.0 / REQUESTS,
+           (lookup_us + serve_us) * 1000.0 / REQUESTS, (double)s_copied / REQUESTS, (unsigned long)fds,
+           (unsigned long)failures, (unsigned long)s_checksum);
+}
+
+void app_main(void)
+{
+    asset_bundle_t bundle;
+    ESP_ERROR_CHECK(asset_bundle_map(BENCH_BUNDLE, &bundle));
+
+    /* Request the assets round-robin, the way a page load fetches them */
+    const char *uris[ASSETS_MAX];
+    size_t uri_count = bundle.count < ASSETS_MAX ? bundle.count : ASSETS_MAX;
+    for (size_t i = 0; i < uri_count; i++) {
+        const asset_bundle_index_t *entry = &bundle.index[i];
+        file_asset_t *file = &s_files[s_file_count++];
+        uris[i] = asset_bundle_str(&bundle, entry->uri);
+        strlcpy(file->uri, uris[i], sizeof(file->uri));
+        snprintf(file->path, sizeof(file->path), "%s%s%s", BENCH_WWW_DIR, uris[i],
+                 entry->flags & ASSET_FLAG_GZIP ? ".gz" : "");
+        file->stored_len = entry->stored_len;
+    }
+
+    int64_t lookup_us = 0, serve_us = 0;
+    uint32_t failures = 0;
+    s_checksum = 0;
+    s_copied = 0;
+    for (int i = 0; i < REQUESTS; i++) {
+        const char *uri = uris[i % uri_count];
+        int64_t start = esp_timer_get_time();
+        const file_asset_t *asset = file_find(uri, strlen(uri));
+        int64_t found = esp_timer_get_time();
+        if (!asset || !file_serve(asset)) {
+            failures++;
+        }
+        lookup_us += found - start;
+        serve_us += esp_timer_get_time() - found;
+    }
+    report("file", lookup_us, serve_us, failures, 1);
+
+    lookup_us = serve_us = 0;
+    failures = 0;
+    s_checksum = 0;
+    s_copied = 0;
+    for (int i = 0; i < REQUESTS; i++) {
+        const char *uri = uris[i % uri_count];
+        int64_t start = esp_timer_get_time();
+        const asset_bundle_index_t *asset = asset_bundle_find(&bundle, uri, strlen(uri));
+        int64_t found = esp_timer_get_time();
+        if (asset) {
+            sink(asset_bundle_data(&bundle, asset), asset->stored_len);
+        } else {
+            failures++;
+        }
+        lookup_us += found - start;
+        serve_us += esp_timer_get_time() - found;
+    }
+    report("bundle", lookup_us, serve_us, failures, 0);
+
+    printf("{\"run\": \"layout\", \"assets\": %u, \"bundle_bytes\": %lu, \"raw_bytes\": %lu}\n",
+           bundle.count, (unsigned long)bundle.size, (unsigned long)bundle.raw_total);
+    fflush(stdout);
+    exit(0);
+}
@@ -0,0 +1,268 @@
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_tls_crypto.h"
+
+#include "access_log.h"
+#include "basic_http_server.h"
+#include "dlog.h"
+#include "gate_actuator.h"
+#include "settings.h"
+#include "whitelist.h"
+
+#define REQUESTS        2000
+/* Requests before the counters are read: first-use allocations settle */
+#define WARMUP          50
+#define RESPONSE_MAX    2048
+#define SESSION_MAX     64
+
+/* Heap allocations of the whole program, see main/CMakeLists.txt */
+static _Atomic uint32_t s_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+typedef struct {
+    int status;
+    char session[SESSION_MAX];  /* value of the sid cookie set, if any */
+} response_t;
+
+static uint32_t s_latency_us[REQUESTS];
+static char s_authorization[192];
+static char s_cookie[SESSION_MAX + 16];
+
+static int connect_server(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_HTTP_SERVER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct timeval timeout = { .tv_sec = 2 };
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* One request on the keep-alive connection; false if it broke */
+static bool exchange(int sock, const char *request, response_t *resp)
+{
+    char buf[RESPONSE_MAX + 1];
+    size_t len = 0;
+    char *body = NULL;
+
+    if (send(sock, request, strlen(request), 0) < 0) {
+        return false;
+    }
+    while (!body) {
+        int got = recv(sock, buf + len, RESPONSE_MAX - len, 0);
+        if (got <= 0) {
+            return false;
+        }
+        len += got;
+        buf[len] = '\0';
+        body = strstr(buf, "\r\n\r\n");
+        if (!body && len == RESPONSE_MAX) {
+            return false;
+        }
+    }
+    body += 4;
+
+    resp->status = atoi(buf + strlen("HTTP/1.1 "));
+    resp->session[0] = '\0';
+    const char *cookie = strstr(buf, "Set-Cookie: sid=");
+    if (cookie && cookie < body) {
+        cookie += strlen("Set-Cookie: sid=");
+        size_t cookie_len = strcspn(cookie, ";\r");
+        snprintf(resp->session, sizeof(resp->session), "%.*s", (int)cookie_len, cookie);
+    }
+    const char *length = strstr(buf, "Content-Length:");
+    size_t body_len = length && length < body ? strtoul(length + strlen("Content-Length:"), NULL, 10) : 0;
+
+    /* Drain the rest of the body */
+    size_t have = len - (body - buf);
+    while (have < body_len) {
+        int got = recv(sock, buf, sizeof(buf) - 1, 0);
+        if (got <= 0) {
+            return false;
+        }
+        have += got;
+    }
+    return true;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Send the same request REQUESTS times and report allocations, heap growth
+ * and latency. Returns the allocations per request. */
+static double bench_run(const char *name, const char *request, response_t *last)
+{
+    int sock = connect_server();
+    uint32_t failures = 0;
+    uint32_t sessions_issued = 0;
+    char session[SESSION_MAX] = "";
+    if (sock < 0) {
+        printf("{\"run\": \"%s\", \"error\": \"connect\"}\n", name);
+        return 0;
+    }
+
+    for (int i = 0; i < WARMUP; i++) {
+        exchange(sock, request, last);
+    }
+    vTaskDelay(pdMS_TO_TICKS(50));
+    size_t heap_before = mallinfo2().uordblks;
+    uint32_t allocs_before = atomic_load(&s_allocs);
+
+    for (int i = 0; i < REQUESTS; i++) {
+        int64_t start = esp_timer_get_time();
+        if (!exchange(sock, request, last)) {
+            failures++;
+        }
+        s_latency_us[i] = esp_timer_get_time() - start;
+        if (last->session[0] && strcmp(last->session, session) != 0) {
+            strcpy(session, last->session);
+            sessions_issued++;
+        }
+    }
+
+    uint32_t allocs = atomic_load(&s_allocs) - allocs_before;
+    vTaskDelay(pdMS_TO_TICKS(50));
+    long heap_growth = (long)mallinfo2().uordblks - (long)heap_before;
+    close(sock);
+
+    qsort(s_latency_us, REQUESTS, sizeof(s_latency_us[0]), compare_u32);
+    printf("{\"run\": \"%s\", \"requests\": %d, \"status\": %d, \"allocs_per_request\": %.2f, "
+           "\"heap_growth\": %ld, \"sessions_issued\": %lu, \"p50_us\": %lu, \"p99_us\": %lu, \"failures\": %lu}\n",
+           name, REQUESTS, last->status, (double)allocs / REQUESTS, heap_growth, (unsigned long)sessions_issued,
+           (unsigned long)s_latency_us[REQUESTS / 2], (unsigned long)s_latency_us[REQUESTS * 99 / 100],
+           (unsigned long)failures);
+    return (double)allocs / REQUESTS;
+}
+
+/* Status of one request carrying only the session cookie */
+static int cookie_status(void)
+{
+    char request[256];
+    response_t resp = { 0 };
+    snprintf(request, sizeof(request), "GET /bench-missing HTTP/1.1\r\nHost: bench\r\n%s\r\n", s_cookie);
+    int sock = connect_server();
+    bool ok = sock >= 0 && exchange(sock, request, &resp);
+    if (sock >= 0) {
+        close(sock);
+    }
+    return ok ? resp.status : -1;
+}
+
+static void credentials_init(void)
+{
+    char user_info[128];
+    const settings_t *settings = settings_acquire();
+    int info_len = snprintf(user_info, sizeof(user_info), "%s:%s", settings->http_username, settings->http_password);
+    settings_release(settings);
+
+    size_t out = 0;
+    char encoded[136];
+    esp_crypto_base64_encode((unsigned char *)encoded, sizeof(encoded), &out, (unsigned char *)user_info, info_len);
+    encoded[out] = '\0';
+    snprintf(s_authorization, sizeof(s_authorization), "Authorization: Basic %s\r\n", encoded);
+}
+
+static void auth_runs(void)
+{
+    char request[512];
+    response_t resp = { 0 };
+
+    /* Turned away by httpd itself: what any request costs without auth */
+    double base = bench_run("baseline", "PUT /bench-missing HTTP/1.1\r\nHost: bench\r\nContent-Length: 0\r\n\r\n",
+                            &resp);
+    double denied = bench_run("no_credentials", "GET /bench-missing HTTP/1.1\r\nHost: bench\r\n\r\n", &resp);
+
+    snprintf(request, sizeof(request), "GET /bench-missing HTTP/1.1\r\nHost: bench\r\n%s\r\n", s_authorization);
+    double basic = bench_run("basic", request, &resp);
+    snprintf(s_cookie, sizeof(s_cookie), "Cookie: sid=%s\r\n", resp.session);
+
+    snprintf(request, sizeof(request), "GET /bench-missing HTTP/1.1\r\nHost: bench\r\n%s\r\n", s_cookie);
+    double session = bench_run("session", request, &resp);
+
+    printf("{\"run\": \"auth_allocs\", \"no_credentials\": %.2f, \"basic\": %.2f, \"session\": %.2f}\n",
+           denied - base, basic - base, session - base);
+}
+
+/* A settings change keeps the sessions unless it is the credentials */
+static void session_runs(void)
+{
+    bool restart;
+    int before = cookie_status();
+    settings_set("gate_gap_ms", "150", &restart);
+    int after_other = cookie_status();
+    settings_set("http_password", "auth-bench-password", &restart);
+    int after_password = cookie_status();
+
+    /* 404: the session let the request through to the asset lookup */
+    printf("{\"run\": \"sessions\", \"before\": %d, \"after_settings_change\": %d, \"after_password_change\": %d, "
+           "\"kept\": %s, \"dropped\": %s}\n",
+           before, after_other, after_password, after_other == 404 ? "true" : "false",
+           after_password == 401 ? "true" : "false");
+}
+
+/* Same start-up as tools/http_host */
+void app_main(void)
+{
+    ESP_ERROR_CHECK(settings_init());
+    ESP_ERROR_CHECK(dlog_start());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(gate_actuator_start());
+    ESP_ERROR_CHECK(whitelist_init());
+    ESP_ERROR_CHECK(access_log_start());
+    ESP_ERROR_CHECK(init_assets());
+    ESP_ERROR_CHECK(start_rest_server());
+
+    credentials_init();
+    auth_runs();
+    session_runs();
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
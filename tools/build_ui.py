@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+"""Build the web UI into a single page that works without an uplink.
+
+Phones on the SoftAP often have no internet access, so the page may not
+load anything from a CDN. Starting from the sources in assets/pages:
+
+  utilities   The Tailwind utility classes found in the HTML and scripts are
+              generated as static CSS, nothing else: a small subset of
+              Tailwind 3 with its default theme, preflight included. A class
+              in a class attribute that is neither generated nor defined in
+              a local stylesheet fails the build.
+  icons       <i data-feather="name" class="..."> becomes an <svg> referring
+              to an inline sprite holding only the icons named in the sources
+              (assets/icons, from Feather).
+  bundle      Local stylesheets and scripts are folded into the page, which
+              is then minified. Remote URLs fail the build.
+
+The page and any other files (the favicon) are written to the output
+directory, ready for tools/compress_assets.py. With --budget the build also
+fails when the gzipped files outgrow it, so the bytes a cold load costs stay
+tracked with every build.
+"""
+import argparse
+import gzip
+import os
+import re
+import shutil
+import sys
+
+# Tailwind 3 default theme, the colours and shades the UI uses
+COLORS = {
+    'black': '0 0 0', 'white': '255 255 255',
+    'gray-50': '249 250 251', 'gray-100': '243 244 246', 'gray-200': '229 231 235', 'gray-300': '209 213 219',
+    'gray-400': '156 163 175', 'gray-500': '107 114 128', 'gray-600': '75 85 99', 'gray-700': '55 65 81',
+    'gray-800': '31 41 55',
+    'indigo-100': '224 231 255', 'indigo-500': '99 102 241', 'indigo-600': '79 70 229', 'indigo-700': '67 56 202',
+    'indigo-800': '55 48 163',
+    'green-100': '220 252 231', 'green-500': '34 197 94', 'green-600': '22 163 74', 'green-800': '22 101 52',
+    'blue-100': '219 234 254', 'blue-500': '59 130 246', 'blue-600': '37 99 235', 'blue-800': '30 64 175',
+    'purple-100': '243 232 255', 'purple-500': '168 85 247', 'purple-600': '147 51 234',
+    'red-100': '254 226 226', 'red-500': '239 68 68', 'red-600': '220 38 38', 'red-800': '153 27 27',
+    'yellow-100': '254 249 195', 'yellow-800': '133 77 14',
+}
+FONT_SIZES = {
+    'xs': ('0.75rem', '1rem'), 'sm': ('0.875rem', '1.25rem'), 'base': ('1rem', '1.5rem'),
+    'lg': ('1.125rem', '1.75rem'), 'xl': ('1.25rem', '1.75rem'), '2xl': ('1.5rem', '2rem'),
+}
+FONT_WEIGHTS = {'normal': '400', 'medium': '500', 'semibold': '600', 'bold': '700'}
+RADII = {'': '0.25rem', 'sm': '0.125rem', 'md': '0.375rem', 'lg': '0.5rem', 'xl': '0.75rem', 'full': '9999px'}
+SHADOWS = {
+    'sm': '0 1px 2px 0 rgb(0 0 0/0.05)',
+    '': '0 1px 3px 0 rgb(0 0 0/0.1),0 1px 2px -1px rgb(0 0 0/0.1)',
+    'md': '0 4px 6px -1px rgb(0 0 0/0.1),0 2px 4px -2px rgb(0 0 0/0.1)',
+    'lg': '0 10px 15px -3px rgb(0 0 0/0.1),0 4px 6px -4px rgb(0 0 0/0.1)',
+    'xl': '0 20px 25px -5px rgb(0 0 0/0.1),0 8px 10px -6px rgb(0 0 0/0.1)',
+}
+MAX_WIDTHS = {'sm': '24rem', 'md': '28rem', 'lg': '32rem', 'xl': '36rem', '2xl': '42rem', '7xl': '80rem'}
+BREAKPOINTS = [('sm', '640px'), ('md', '768px'), ('lg', '1024px')]
+STATES = {'hover': ':hover', 'focus': ':focus'}
+STATIC = {
+    'block': 'display:block', 'inline-flex': 'display:inline-flex', 'flex': 'display:flex', 'grid': 'display:grid',
+    'hidden': 'display:none', 'fixed': 'position:fixed', 'relative': 'position:relative',
+    'absolute': 'position:absolute', 'inset-0': 'inset:0px', 'flex-1': 'flex:1 1 0%',
+    'items-center': 'align-items:center', 'items-start': 'align-items:flex-start',
+    'justify-between': 'justify-content:space-between', 'justify-center': 'justify-content:center',
+    'justify-end': 'justify-content:flex-end', 'mx-auto': 'margin-left:auto;margin-right:auto',
+    'w-full': 'width:100%', 'min-h-screen': 'min-height:100vh', 'overflow-hidden': 'overflow:hidden',
+    'text-right': 'text-align:right', 'invisible': 'visibility:hidden', 'visible': 'visibility:visible',
+    'outline-none': 'outline:2px solid transparent;outline-offset:2px',
+    'border': 'border-width:1px', 'border-b': 'border-bottom-width:1px', 'border-t': 'border-top-width:1px',
+    'border-l-4': 'border-left-width:4px', 'border-transparent': 'border-color:transparent',
+    'transition-all': 'transition-property:all;transition-timing-function:cubic-bezier(0.4,0,0.2,1);'
+                      'transition-duration:150ms',
+    # Tailwind 3 applies transforms without it; kept so old markup still matches
+    'transform': '',
+    'ring-2': '--tw-ring-offset-shadow:0 0 0 var(--tw-ring-offset-width) var(--tw-ring-offset-color);'
+              '--tw-ring-shadow:0 0 0 calc(2px + var(--tw-ring-offset-width)) var(--tw-ring-color);'
+              'box-shadow:var(--tw-ring-offset-shadow),var(--tw-ring-shadow),var(--tw-shadow,0 0 #0000)',
+    'ring-offset-2': '--tw-ring-offset-width:2px',
+}
+SPACING_PROPS = {
+    'p': ['padding'], 'px': ['padding-left', 'padding-right'], 'py': ['padding-top', 'padding-bottom'],
+    'm': ['margin'], 'mt': ['margin-top'], 'mb': ['margin-bottom'], 'ml': ['margin-left'], 'mr': ['margin-right'],
+    'w': ['width'], 'h': ['height'], 'gap': ['gap'],
+}
+PREFLIGHT = (
+    '*,::before,::after{box-sizing:border-box;border:0 solid rgb(229 231 235);'
+    '--tw-ring-offset-width:0px;--tw-ring-offset-color:#fff;--tw-ring-color:rgb(59 130 246/0.5)}'
+    'html{line-height:1.5;-webkit-text-size-adjust:100%;tab-size:4;font-family:ui-sans-serif,system-ui,'
+    '-apple-system,"Segoe UI",Roboto,"Helvetica Neue",Arial,sans-serif}'
+    'body{margin:0;line-height:inherit}'
+    'h1,h2,h3,h4,p{margin:0}h1,h2,h3,h4{font-size:inherit;font-weight:inherit}'
+    'a{color:inherit;text-decoration:inherit}'
+    'button,input{font-family:inherit;font-size:100%;font-weight:inherit;line-height:inherit;color:inherit;'
+    'margin:0;padding:0}'
+    'button{text-transform:none;background-color:transparent;background-image:none;cursor:pointer}'
+    'input::placeholder{opacity:1;color:rgb(156 163 175)}'
+    'svg{display:block;vertical-align:middle}[hidden]{display:none}'
+    # Feather's stroke style, for the sprite icons
+    '.i{fill:none;stroke:currentColor;stroke-width:2;stroke-linecap:round;stroke-linejoin:round}'
+)
+
+ICON_RE = re.compile(r'<i data-feather="([^"]+)"(?: class="([^"]*)")?></i>')
+CLASS_ATTR_RE = re.compile(r'class(?:Name)?\s*=\s*["\'`]([^"\'`]*)["\'`]')
+TOKEN_RE = re.compile(r'[A-Za-z0-9:_./-]+')
+
+
+def spacing(value):
+    """Tailwind spacing scale: 1 = 0.25rem, fractions allowed (2.5)."""
+    if not re.fullmatch(r'\d+(\.5)?', value):
+        return None
+    rem = float(value) / 4
+    return '0px' if rem == 0 else '{:g}rem'.format(rem)
+
+
+def color(name):
+    rgb = COLORS.get(name)
+    return rgb and 'rgb({} / var(--tw-alpha, 1))'.format(rgb)
+
+
+def utility(name):
+    """CSS declarations for a utility class, or None if it is not one.
+    Classes whose rule needs a child selector return (suffix, declarations)."""
+    if name in STATIC:
+        return STATIC[name]
+    m = re.fullmatch(r'(-?)z-(\d+)', name)
+    if m:
+        return 'z-index:{}{}'.format(m.group(1), m.group(2))
+    m = re.fullmatch(r'grid-cols-(\d+)', name)
+    if m:
+        return 'grid-template-columns:repeat({},minmax(0,1fr))'.format(m.group(1))
+    m = re.fullmatch(r'(p|px|py|m|mt|mb|ml|mr|w|h|gap)-([\d.]+)', name)
+    if m and spacing(m.group(2)):
+        return ';'.join('{}:{}'.format(prop, spacing(m.group(2))) for prop in SPACING_PROPS[m.group(1)])
+    m = re.fullmatch(r'space-(x|y)-([\d.]+)', name)
+    if m and spacing(m.group(2)):
+        side = 'left' if m.group(1) == 'x' else 'top'
+        return (' > :not([hidden]) ~ :not([hidden])', 'margin-{}:{}'.format(side, spacing(m.group(2))))
+    if name == 'divide-y':
+        return (' > :not([hidden]) ~ :not([hidden])', 'border-top-width:1px;border-bottom-width:0px')
+    m = re.fullmatch(r'divide-(.+)', name)
+    if m and color(m.group(1)):
+        return (' > :not([hidden]) ~ :not([hidden])', 'border-color:rgb({})'.format(COLORS[m.group(1)]))
+    m = re.fullmatch(r'(bg|text|border|ring)-(.+)', name)
+    if m and m.group(2) in COLORS:
+        rgb = COLORS[m.group(2)]
+        if m.group(1) == 'bg':
+            return '--tw-bg-opacity:1;background-color:rgb({} / var(--tw-bg-opacity))'.format(rgb)
+        if m.group(1) == 'text':
+            return 'color:rgb({})'.format(rgb)
+        if m.group(1) == 'border':
+            return 'border-color:rgb({})'.format(rgb)
+        return '--tw-ring-color:rgb({})'.format(rgb)
+    m = re.fullmatch(r'bg-opacity-(\d+)', name)
+    if m:
+        return '--tw-bg-opacity:{:g}'.format(int(m.group(1)) / 100)
+    m = re.fullmatch(r'opacity-(\d+)', name)
+    if m:
+        return 'opacity:{:g}'.format(int(m.group(1)) / 100)
+    m = re.fullmatch(r'scale-(\d+)', name)
+    if m:
+        return 'transform:scale({:g})'.format(int(m.group(1)) / 100)
+    m = re.fullmatch(r'duration-(\d+)', name)
+    if m:
+        return 'transition-duration:{}ms'.format(m.group(1))
+    m = re.fullmatch(r'text-(.+)', name)
+    if m and m.group(1) in FONT_SIZES:
+        return 'font-size:{};line-height:{}'.format(*FONT_SIZES[m.group(1)])
+    m = re.fullmatch(r'font-(.+)', name)
+    if m and m.group(1) in FONT_WEIGHTS:
+        return 'font-weight:' + FONT_WEIGHTS[m.group(1)]
+    m = re.fullmatch(r'rounded-?(.*)', name)
+    if m and m.group(1) in RADII:
+        return 'border-radius:' + RADII[m.group(1)]
+    m = re.fullmatch(r'shadow-?(.*)', name)
+    if m and m.group(1) in SHADOWS:
+        return ('--tw-shadow:{};box-shadow:var(--tw-ring-offset-shadow,0 0 #0000),'
+                'var(--tw-ring-shadow,0 0 #0000),var(--tw-shadow)').format(SHADOWS[m.group(1)])
+    m = re.fullmatch(r'max-w-(.+)', name)
+    if m and m.group(1) in MAX_WIDTHS:
+        return 'max-width:' + MAX_WIDTHS[m.group(1)]
+    return None
+
+
+def escape(cls):
+    return re.sub(r'([:.\/])', r'\\\1', cls)
+
+
+def rule_for(cls):
+    """(media, selector, declarations) for a class with its variants."""
+    *variants, base = cls.split(':')
+    decl = utility(base)
+    if decl is None or len(variants) > 1:
+        return None
+    suffix = ''
+    if isinstance(decl, tuple):
+        suffix, decl = decl
+    media = None
+    pseudo = ''
+    for variant in variants:
+        if variant in STATES:
+            pseudo = STATES[variant]
+        elif variant in dict(BREAKPOINTS):
+            media = variant
+        else:
+            return None
+    return media, '.' + escape(cls) + pseudo + suffix, decl
+
+
+def generate_css(candidates):
+    """Utilities in source order of the theme: base, states, then breakpoints,
+    so later rules win the way they do in Tailwind."""
+    rules = {}
+    for cls in sorted(candidates):
+        rule = rule_for(cls)
+        if rule and rule[2]:
+            rules[cls] = rule
+
+    def order(item):
+        cls, (media, selector, _) = item
+        media_rank = [None] + [b for b, _ in BREAKPOINTS]
+        base = cls.split(':')[-1]
+        # Opacity modifiers must follow the colours they modify
+        return (media_rank.index(media), ':' in cls.replace(media + ':' if media else '', '', 1),
+                base.startswith('bg-opacity'), cls)
+
+    css = []
+    current = None
+    for cls, (media, selector, decl) in sorted(rules.items(), key=order):
+        if media != current:
+            if current:
+                css.append('}')
+            if media:
+                css.append('@media (min-width:{}){{'.format(dict(BREAKPOINTS)[media]))
+            current = media
+        css.append('{}{{{}}}'.format(selector, decl))
+    if current:
+        css.append('}')
+    return ''.join(css), set(rules)
+
+
+def minify_css(css):
+    css = re.sub(r'/\*.*?\*/', '', css, flags=re.S)
+    css = re.sub(r'\s+', ' ', css)
+    css = re.sub(r'\s*([{}:;,>])\s*', r'\1', css)
+    return css.replace(';}', '}').strip()
+
+
+def minify_js(js):
+    """Conservative: whole-line comments, indentation and blank lines only.
+    Anything smarter needs a real parser; gzip takes care of the rest."""
+    lines = []
+    for line in js.splitlines():
+        stripped = line.strip()
+        if stripped and not stripped.startswith('//'):
+            lines.append(stripped)
+    return '\n'.join(lines)
+
+
+def minify_html(html):
+    html = re.sub(r'<!--.*?-->', '', html, flags=re.S)
+    return re.sub(r'\s+', ' ', html).replace('> <', '><').strip()
+
+
+def render_icons(text, known):
+    def repl(m):
+        name, classes = m.group(1), m.group(2) or ''
+        if '${' not in name and name not in known:
+            sys.exit('build_ui: no icon "{}" in assets/icons'.format(name))
+        return '<svg class="{}"><use href="#i-{}"></use></svg>'.format(' '.join(['i'] + classes.split()), name)
+    return ICON_RE.sub(repl, text)
+
+
+def icon_sprite(icons_dir, sources):
+    """Symbols for every icon named in the sources, by literal or as a string"""
+    known = {f[:-4]: os.path.join(icons_dir, f) for f in os.listdir(icons_dir) if f.endswith('.svg')}
+    used = sorted(n for n in known if re.search(r'["\']{}["\']'.format(re.escape(n)), sources))
+    symbols = []
+    for name in used:
+        with open(known[name]) as f:
+            body = re.search(r'<svg[^>]*>(.*)</svg>', f.read(), re.S).group(1)
+        symbols.append('<symbol id="i-{}" viewBox="0 0 24 24">{}</symbol>'.format(name, body.strip()))
+    return '<svg style="display:none">{}</svg>'.format(''.join(symbols)), set(known), used
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('pages_dir')
+    parser.add_argument('icons_dir')
+    parser.add_argument('out_dir')
+    parser.add_argument('--budget', type=int, help='largest gzipped size of all files together')
+    args = parser.parse_args()
+
+    def read(name):
+        with open(os.path.join(args.pages_dir, name), encoding='utf-8') as f:
+            return f.read()
+
+    html = read('index.html')
+    remote = re.findall(r'(?:src|href)="((?:https?:)?//[^"]+)"', html)
+    if remote:
+        sys.exit('build_ui: remote resources are not available offline: ' + ', '.join(remote))
+
+    stylesheets = re.findall(r'<link rel="stylesheet" href="([^"]+)">', html)
+    scripts = re.findall(r'<script src="([^"]+)"></script>', html)
+    custom_css = ''.join(read(n) for n in stylesheets)
+    js = ''.join(read(n) for n in scripts)
+    inlined = set(stylesheets) | set(scripts) | {'index.html'}
+
+    sprite, known_icons, used_icons = icon_sprite(args.icons_dir, html + js)
+    html = render_icons(html, known_icons)
+    js = render_icons(js, known_icons)
+
+    # Every token of the page and the scripts is a candidate, like Tailwind's
+    # content scan; only what names a utility turns into CSS
+    candidates = set(TOKEN_RE.findall(html + js))
+    utilities_css, generated = generate_css(candidates)
+    # Classes styled by the local stylesheets or used as hooks by the scripts
+    custom_classes = set(re.findall(r'\.([A-Za-z][\w-]*)', custom_css + ' '.join(re.findall(r'[\'"]\.[\w-]+', js))))
+    unknown = set()
+    for attr in CLASS_ATTR_RE.findall(html + js):
+        for cls in attr.split():
+            if '${' not in cls and cls not in generated and cls not in custom_classes and cls != 'i' \
+                    and utility(cls.split(':')[-1]) != '':
+                unknown.add(cls)
+    if unknown:
+        sys.exit('build_ui: unknown classes: ' + ' '.join(sorted(unknown)))
+
+    css = minify_css(PREFLIGHT + utilities_css + custom_css)
+    for name in stylesheets:
+        html = html.replace('<link rel="stylesheet" href="{}">'.format(name), '')
+    html = html.replace('</head>', '<style>{}</style></head>'.format(css), 1)
+    for name in scripts:
+        html = html.replace('<script src="{}"></script>'.format(name), '')
+    html = minify_html(html)
+    html = re.sub(r'(<body[^>]*>)', lambda m: m.group(1) + sprite, html, count=1)
+    html = html.replace('</body>', '<script>{}</script></body>'.format(minify_js(js)), 1)
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    for stale in os.listdir(args.out_dir):
+        os.remove(os.path.join(args.out_dir, stale))
+    with open(os.path.join(args.out_dir, 'index.html'), 'w', encoding='utf-8') as f:
+        f.write(html)
+    for name in sorted(os.listdir(args.pages_dir)):
+        if name not in inlined and os.path.isfile(os.path.join(args.pages_dir, name)):
+            shutil.copy(os.path.join(args.pages_dir, name), args.out_dir)
+
+    total_raw = total_gz = 0
+    for name in sorted(os.listdir(args.out_dir)):
+        with open(os.path.join(args.out_dir, name), 'rb') as f:
+            data = f.read()
+        total_raw += len(data)
+        total_gz += min(len(data), len(gzip.compress(data, compresslevel=9, mtime=0)))
+    print('build_ui: {} utilities, {} icons, {} bytes, {} gzipped'.format(
+        len(generated), len(used_icons), total_raw, total_gz))
+    if args.budget is not None and total_gz > args.budget:
+        sys.exit('build_ui: {} bytes gzipped, over the budget of {}'.format(total_gz, args.budget))
+
+
+if __name__ == '__main__':
+    main()
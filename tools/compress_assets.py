@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Pack the web UI pages into the asset bundle served by the HTTP server.
+
+Every file in the source directory is gzipped (kept raw when gzip does not
+make it smaller) and written to one read-only bundle, mapped from flash at
+run time (see components/asset_bundle/include/asset_bundle.h):
+
+  header    magic, version, asset count, bundle size, raw size
+  index     per asset: URI, MIME type, ETag, body offset, raw and stored
+            sizes, flags (gzip, revalidate), sorted by URI
+  strings   the URIs, MIME types and ETags, NUL-terminated
+  bodies    aligned for word reads from the flash cache
+
+HTML references to the other assets get a `?v=<etag>` suffix so the browser
+can cache them for a long time and still pick up a new firmware's pages.
+With --out-dir the stored files are also written one by one.
+"""
+import argparse
+import gzip
+import hashlib
+import os
+import re
+import struct
+
+MIME_TYPES = {
+    '.html': 'text/html',
+    '.js': 'application/javascript',
+    '.css': 'text/css',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+    '.svg': 'image/svg+xml',
+    '.json': 'application/json',
+}
+
+
+MAGIC = 0x31424741          # "AGB1"
+VERSION = 1
+ALIGN = 16
+HEADER = struct.Struct('<IHHII')
+INDEX = struct.Struct('<IIIIIIHHI')
+FLAG_GZIP = 1 << 0
+FLAG_REVALIDATE = 1 << 1
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:16]
+
+
+def add_version_refs(html, versions):
+    """Append ?v=<hash> to src/href attributes that point to bundled assets."""
+    def repl(m):
+        name = m.group(2)
+        if name in versions:
+            return '{}="{}?v={}"'.format(m.group(1), name, versions[name])
+        return m.group(0)
+    return re.sub(r'(src|href)="([^"?#:]+)"', repl, html)
+
+
+def align(offset):
+    return (offset + ALIGN - 1) // ALIGN * ALIGN
+
+
+def pack(entries):
+    """Lay out the bundle; entries are (uri, mime, etag, raw_len, body, flags)."""
+    # Bytewise order, as the firmware compares
+    entries = sorted(entries, key=lambda e: e[0].encode('utf-8'))
+    strings = bytearray()
+    offsets = {}
+    strings_start = HEADER.size + INDEX.size * len(entries)
+
+    def intern(text):
+        if text not in offsets:
+            offsets[text] = strings_start + len(strings)
+            strings.extend(text.encode('utf-8') + b'\0')
+        return offsets[text]
+
+    refs = [(intern(uri), intern(mime), intern(etag)) for uri, mime, etag, _, _, _ in entries]
+    offset = align(strings_start + len(strings))
+    bodies = bytearray()
+    index = bytearray()
+    for (uri_ref, mime_ref, etag_ref), (uri, _, _, raw_len, body, flags) in zip(refs, entries):
+        bodies.extend(b'\0' * (align(offset + len(bodies)) - offset - len(bodies)))
+        index.extend(INDEX.pack(uri_ref, mime_ref, etag_ref, offset + len(bodies), raw_len, len(body),
+                                len(uri.encode('utf-8')), flags, 0))
+        bodies.extend(body)
+
+    size = offset + len(bodies)
+    raw_total = sum(e[3] for e in entries)
+    header = HEADER.pack(MAGIC, VERSION, len(entries), size, raw_total)
+    padding = b'\0' * (offset - strings_start - len(strings))
+    return header + bytes(index) + bytes(strings) + padding + bytes(bodies)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('src_dir')
+    parser.add_argument('bundle')
+    parser.add_argument('--out-dir', help='also write the stored files here')
+    parser.add_argument('--max-size', type=lambda v: int(v, 0), help='size of the partition')
+    args = parser.parse_args()
+
+    if args.out_dir:
+        os.makedirs(args.out_dir, exist_ok=True)
+        for stale in os.listdir(args.out_dir):
+            os.remove(os.path.join(args.out_dir, stale))
+
+    names = sorted(n for n in os.listdir(args.src_dir)
+                   if os.path.isfile(os.path.join(args.src_dir, n)))
+    sources = {}
+    for name in names:
+        with open(os.path.join(args.src_dir, name), 'rb') as f:
+            sources[name] = f.read()
+
+    # HTML files reference the others, so hash those first
+    versions = {n: content_hash(d) for n, d in sources.items() if not n.endswith('.html')}
+    for name in names:
+        if name.endswith('.html'):
+            sources[name] = add_version_refs(sources[name].decode('utf-8'), versions).encode('utf-8')
+
+    entries = []
+    for name in names:
+        raw = sources[name]
+        packed = gzip.compress(raw, compresslevel=9, mtime=0)
+        gzipped = len(packed) < len(raw)
+        body = packed if gzipped else raw
+        if args.out_dir:
+            with open(os.path.join(args.out_dir, name + '.gz' if gzipped else name), 'wb') as f:
+                f.write(body)
+
+        mime = MIME_TYPES.get(os.path.splitext(name)[1].lower(), 'text/plain')
+        # Pages carry the versioned links: the browser must always ask for them
+        flags = (FLAG_GZIP if gzipped else 0) | (FLAG_REVALIDATE if mime == 'text/html' else 0)
+        entries.append(('/' + name, mime, '"{}"'.format(content_hash(raw)), len(raw), body, flags))
+
+    bundle = pack(entries)
+    if args.max_size is not None and len(bundle) > args.max_size:
+        parser.error('bundle is {} bytes, the partition only {}'.format(len(bundle), args.max_size))
+    with open(args.bundle, 'wb') as f:
+        f.write(bundle)
+
+    total_raw = sum(e[3] for e in entries)
+    total_stored = sum(len(e[4]) for e in entries)
+    print('compress_assets: {} files, {} -> {} bytes, bundle {} bytes'.format(
+        len(entries), total_raw, total_stored, len(bundle)))
+
+
+if __name__ == '__main__':
+    main()
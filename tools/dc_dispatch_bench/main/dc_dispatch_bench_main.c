@@ -0,0 +1,193 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#define DISPATCHES          1000000
+
+/* The declarations dc_commands.inc expects, as in dc_bot.c */
+#define DC_MAX_ARGS         4
+#define DC_CMD_UNKNOWN      (-1)
+#define DC_CMD_UNKNOWN_SUB  (-2)
+
+typedef struct {
+    const char *content;
+} discord_message_t;
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} dc_arg_t;
+
+typedef struct {
+    dc_arg_t argv[DC_MAX_ARGS];
+    int argc;
+} dc_args_t;
+
+typedef esp_err_t (*cmd_handler_t)(discord_message_t *msg, const dc_args_t *args);
+
+typedef struct {
+    cmd_handler_t handler;
+    uint8_t min_args;
+    uint8_t max_args;
+    bool rest;
+    const char *usage;
+    const char *help;
+} dc_command_t;
+
+#include "dc_commands.inc"
+
+static const char *const s_messages[] = {
+    "!help",
+    "!gate open",
+    "!gate stats",
+    "!whitelist remove AA:BB:CC:DD:EE:FF",
+    "!config set gate_gap_ms 500",
+    "!status",
+    "!gate bogus",
+    "!unknown command",
+};
+
+/* Last usage reply looked up, as the bot does for unknown subcommands */
+static const char *volatile s_usage;
+
+static inline bool dc_is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Copied from dc_bot.c */
+static const char *dc_next_token(const char *p, const char **tok, size_t *len)
+{
+    while (dc_is_space(*p)) {
+        p++;
+    }
+    *tok = p;
+    while (*p && !dc_is_space(*p)) {
+        p++;
+    }
+    *len = p - *tok;
+    return p;
+}
+
+/* dc_bot_parse_command() up to the handler call: find the entry and slice
+ * the arguments in place */
+static int generated_dispatch(const char *content, dc_args_t *args)
+{
+    const char *cmd, *sub;
+    size_t cmd_len, sub_len;
+    bool consumed_sub;
+
+    const char *p = dc_next_token(content + 1, &cmd, &cmd_len);
+    const char *after_sub = dc_next_token(p, &sub, &sub_len);
+    int index = dc_command_find(cmd, cmd_len, sub, sub_len, &consumed_sub);
+    if (index == DC_CMD_UNKNOWN_SUB) {
+        s_usage = dc_command_usage(cmd, cmd_len);
+    }
+    if (index < 0) {
+        return index;
+    }
+    args->argc = 0;
+    p = consumed_sub ? after_sub : p;
+    for (;;) {
+        const char *tok;
+        size_t len;
+        p = dc_next_token(p, &tok, &len);
+        if (len == 0 || args->argc == s_dc_commands[index].max_args) {
+            break;
+        }
+        args->argv[args->argc++] = (dc_arg_t) { tok, len };
+    }
+    return index;
+}
+
+/* The old way, over the same commands: copy the message so strtok_r can cut
+ * it up, then compare against every entry in turn */
+typedef struct {
+    char cmd[16];
+    char sub[16];
+} linear_entry_t;
+
+static linear_entry_t s_linear[DC_COMMAND_COUNT];
+
+static int linear_dispatch(const char *content, dc_args_t *args)
+{
+    char buf[128];
+    char *saveptr = NULL;
+    strlcpy(buf, content + 1, sizeof(buf));
+    char *cmd = strtok_r(buf, " \t", &saveptr);
+    char *rest = strtok_r(NULL, "", &saveptr);
+    if (!cmd) {
+        return DC_CMD_UNKNOWN;
+    }
+
+    bool known_cmd = false;
+    for (int i = 0; i < DC_COMMAND_COUNT; i++) {
+        if (strcmp(cmd, s_linear[i].cmd) != 0) {
+            continue;
+        }
+        known_cmd = true;
+        char *sub_save = NULL;
+        char sub_buf[128];
+        strlcpy(sub_buf, rest ? rest : "", sizeof(sub_buf));
+        char *sub = strtok_r(sub_buf, " \t", &sub_save);
+        if (s_linear[i].sub[0] == '\0' || (sub && strcmp(sub, s_linear[i].sub) == 0)) {
+            args->argc = 0;
+            for (char *tok = s_linear[i].sub[0] ? strtok_r(NULL, " \t", &sub_save) : sub;
+                    tok && args->argc < DC_MAX_ARGS; tok = strtok_r(NULL, " \t", &sub_save)) {
+                args->argv[args->argc++] = (dc_arg_t) { tok, strlen(tok) };
+            }
+            return i;
+        }
+    }
+    return known_cmd ? DC_CMD_UNKNOWN_SUB : DC_CMD_UNKNOWN;
+}
+
+static void linear_init(void)
+{
+    for (int i = 0; i < DC_COMMAND_COUNT; i++) {
+        const char *space = strchr(s_dc_command_names[i], ' ');
+        size_t cmd_len = space ? (size_t)(space - s_dc_command_names[i]) : strlen(s_dc_command_names[i]);
+        snprintf(s_linear[i].cmd, sizeof(s_linear[i].cmd), "%.*s", (int)cmd_len, s_dc_command_names[i]);
+        snprintf(s_linear[i].sub, sizeof(s_linear[i].sub), "%s", space ? space + 1 : "");
+    }
+}
+
+void app_main(void)
+{
+    dc_args_t args;
+    volatile int sink = 0;
+
+    linear_init();
+    for (size_t m = 0; m < sizeof(s_messages) / sizeof(s_messages[0]); m++) {
+        const char *msg = s_messages[m];
+        int expected = generated_dispatch(msg, &args);
+        int generated_argc = args.argc;
+        bool agree = linear_dispatch(msg, &args) == expected && (expected < 0 || args.argc == generated_argc);
+
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < DISPATCHES; i++) {
+            sink += generated_dispatch(msg, &args);
+        }
+        int64_t generated_us = esp_timer_get_time() - start;
+
+        start = esp_timer_get_time();
+        for (int i = 0; i < DISPATCHES; i++) {
+            sink += linear_dispatch(msg, &args);
+        }
+        int64_t linear_us = esp_timer_get_time() - start;
+
+        printf("{\"run\": \"dispatch\", \"message\": \"%s\", \"entry\": %d, \"generated_ns\": %.1f, "
+               "\"linear_ns\": %.1f, \"agree\": %s}\n",
+               msg, expected, generated_us * 1000.0 / DISPATCHES, linear_us * 1000.0 / DISPATCHES,
+               agree ? "true" : "false");
+    }
+    printf("{\"run\": \"table\", \"commands\": %d}\n", DC_COMMAND_COUNT);
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
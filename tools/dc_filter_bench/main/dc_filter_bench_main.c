@@ -0,0 +1,241 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "dc_filter.h"
+
+static const char *TAG = "discord-bot";
+
+#define BENCH_EVENTS    5000
+/* Events are generated in chunks outside the timed part, so the stream
+ * fits the board's RAM */
+#define BENCH_CHUNK     100
+#define UART_BYTES_PER_S (CONFIG_ESP_CONSOLE_UART_BAUDRATE / 10)
+
+/* Shape of a gateway event as the bot sees it after the library parsed it */
+typedef enum {
+    EV_CREATE,
+    EV_UPDATE,
+    EV_DELETE,
+} ev_type_t;
+
+typedef struct {
+    ev_type_t type;
+    bool bot;
+    char id[24];
+    char channel_id[24];
+    char guild_id[24];
+    char author_id[24];
+    char username[16];
+    char content[208];
+} bench_event_t;
+
+static const char *const ALLOWED_GUILD = "1100000000000000001";
+static const char *const ALLOWED_CHANNEL = "1200000000000000001";
+static const char *const ALLOWED_USER = "1300000000000000001";
+
+static bench_event_t *s_events;
+static size_t s_log_bytes;
+static char s_log_line[512];
+
+/* Stand-in for the UART: format like the console would, then drop it */
+static int bench_vprintf(const char *fmt, va_list ap)
+{
+    int len = vsnprintf(s_log_line, sizeof(s_log_line), fmt, ap);
+    s_log_bytes += len > 0 ? len : 0;
+    return len;
+}
+
+static uint32_t s_rng = 0x2545F491;
+
+static uint32_t next_random(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static void random_text(char *out, size_t len)
+{
+    static const char *const words[] = { "lol", "anyone", "up", "for", "tonight", "the", "gate", "game",
+                                         "coffee", "is", "broken", "again", "nice", "see", "you", "there" };
+    size_t used = 0;
+    while (used + 10 < len - 1) {
+        used += snprintf(out + used, len - used, "%s ", words[next_random() % 16]);
+    }
+}
+
+/* A busy server: mostly chatter, some bots, edits and deletions, and a few
+ * commands of which only some come from an allowed user and channel */
+static void build_chunk(int first)
+{
+    for (int i = first; i < first + BENCH_CHUNK; i++) {
+        bench_event_t *ev = &s_events[i - first];
+        uint32_t roll = next_random() % 100;
+
+        memset(ev, 0, sizeof(*ev));
+        snprintf(ev->id, sizeof(ev->id), "14%017d", i);
+        strcpy(ev->guild_id, ALLOWED_GUILD);
+        strcpy(ev->channel_id, roll < 60 ? "1200000000000000002" : ALLOWED_CHANNEL);
+        snprintf(ev->author_id, sizeof(ev->author_id), "13000000000000%05lu", (unsigned long)(next_random() % 500 + 2));
+        snprintf(ev->username, sizeof(ev->username), "user%lu", (unsigned long)(next_random() % 500));
+        random_text(ev->content, 20 + next_random() % (sizeof(ev->content) - 20));
+
+        if (roll < 70) {
+            ev->type = EV_CREATE;
+        } else if (roll < 78) {
+            ev->type = EV_UPDATE;
+        } else if (roll < 82) {
+            ev->type = EV_DELETE;
+        } else if (roll < 88) {
+            /* Other bots, some of them answering to "!" as well */
+            ev->type = EV_CREATE;
+            ev->bot = true;
+            ev->content[0] = roll & 1 ? '!' : ev->content[0];
+        } else if (roll < 96) {
+            /* Commands from users who are not allowed */
+            ev->type = EV_CREATE;
+            strcpy(ev->content, "!gate open");
+        } else {
+            ev->type = EV_CREATE;
+            strcpy(ev->channel_id, ALLOWED_CHANNEL);
+            strcpy(ev->author_id, ALLOWED_USER);
+            strcpy(ev->content, "!gate stats");
+        }
+    }
+}
+
+/* What bot_event_handler did before: log every event in full */
+static int legacy_handle(const bench_event_t *ev)
+{
+    switch (ev->type) {
+    case EV_CREATE:
+        ESP_LOGI(TAG,
+            "New message (dm=%s, autor=%s#%s, bot=%s, channel=%s, guild=%s, content=%s)",
+            "false", ev->username, "0", ev->bot ? "true" : "false", ev->channel_id, ev->guild_id, ev->content);
+        if (ev->content[0] == '!') {
+            ESP_LOGI(TAG, "Processing command");
+            return 1;
+        }
+        ESP_LOGI(TAG, "Not a command, ignoring");
+        return 0;
+    case EV_UPDATE:
+        ESP_LOGI(TAG, "%s has updated his message (#%s). New content: %s", ev->username, ev->id, ev->content);
+        return 0;
+    case EV_DELETE:
+        ESP_LOGI(TAG, "Message #%s deleted", ev->id);
+        return 0;
+    }
+    return 0;
+}
+
+/* The handler now: edits and deletions are not registered, every message
+ * goes through the filter before anything else */
+static int filtered_handle(const dc_filter_t *filter, const bench_event_t *ev)
+{
+    if (ev->type != EV_CREATE) {
+        return 0;
+    }
+    if (dc_filter_check(filter, ev->content, ev->bot, ev->guild_id, ev->channel_id, ev->author_id) != DC_FILTER_PASS) {
+        return 0;
+    }
+    ESP_LOGI(TAG, "Command from %s in channel %s: %s", ev->username, ev->channel_id, ev->content);
+    return 1;
+}
+
+/* Verdicts on hand-made messages, with and without a user allow-list */
+static void checks_run(const dc_filter_t *filter)
+{
+    static const struct {
+        const char *content;
+        bool bot;
+        const char *author_id;
+        dc_filter_result_t open;    /* no allow-lists */
+        dc_filter_result_t listed;  /* the bench allow-lists */
+    } checks[] = {
+        { "!gate stats", false, ALLOWED_USER, DC_FILTER_PASS, DC_FILTER_PASS },
+        { "gate stats", false, ALLOWED_USER, DC_FILTER_DROP_PREFIX, DC_FILTER_DROP_PREFIX },
+        { "!gate open", true, ALLOWED_USER, DC_FILTER_DROP_BOT, DC_FILTER_DROP_BOT },
+        { "!gate open", false, "1300000000000000002", DC_FILTER_PASS, DC_FILTER_DROP_AUTHOR },
+        /* Webhook or system message */
+        { "!gate open", false, NULL, DC_FILTER_DROP_AUTHOR, DC_FILTER_DROP_AUTHOR },
+    };
+    dc_filter_t open;
+    int failures = 0;
+
+    ESP_ERROR_CHECK(dc_filter_init(&open, '!', "", "", ""));
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        dc_filter_result_t got_open = dc_filter_check(&open, checks[i].content, checks[i].bot, ALLOWED_GUILD,
+                                                      ALLOWED_CHANNEL, checks[i].author_id);
+        dc_filter_result_t got_listed = dc_filter_check(filter, checks[i].content, checks[i].bot, ALLOWED_GUILD,
+                                                        ALLOWED_CHANNEL, checks[i].author_id);
+        if (got_open != checks[i].open || got_listed != checks[i].listed) {
+            printf("{\"run\": \"checks\", \"case\": %u, \"open\": \"%s\", \"listed\": \"%s\"}\n", (unsigned)i,
+                   dc_filter_result_to_str(got_open), dc_filter_result_to_str(got_listed));
+            failures++;
+        }
+    }
+    printf("{\"run\": \"checks\", \"cases\": %u, \"failures\": %d}\n",
+           (unsigned)(sizeof(checks) / sizeof(checks[0])), failures);
+}
+
+static void bench_run(const char *name, const dc_filter_t *filter)
+{
+    int commands = 0;
+    int64_t busy_us = 0;
+    s_log_bytes = 0;
+    /* Both runs replay the same stream */
+    s_rng = 0x2545F491;
+#if !CONFIG_IDF_TARGET_LINUX
+    uint32_t heap_before = esp_get_free_heap_size();
+#endif
+
+    for (int first = 0; first < BENCH_EVENTS; first += BENCH_CHUNK) {
+        build_chunk(first);
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < BENCH_CHUNK; i++) {
+            commands += filter ? filtered_handle(filter, &s_events[i]) : legacy_handle(&s_events[i]);
+        }
+        busy_us += esp_timer_get_time() - start;
+    }
+
+    printf("{\"run\": \"%s\", \"events\": %d, \"commands\": %d, \"handler_ns\": %.1f, \"log_bytes\": %u, "
+           "\"uart_ms\": %.1f",
+           name, BENCH_EVENTS, commands, busy_us * 1000.0 / BENCH_EVENTS, (unsigned)s_log_bytes,
+           s_log_bytes * 1000.0 / UART_BYTES_PER_S);
+#if !CONFIG_IDF_TARGET_LINUX
+    printf(", \"heap_delta\": %ld, \"heap_min_free\": %lu",
+           (long)heap_before - (long)esp_get_free_heap_size(), (unsigned long)esp_get_minimum_free_heap_size());
+#endif
+    printf("}\n");
+}
+
+void app_main(void)
+{
+    dc_filter_t filter;
+    ESP_ERROR_CHECK(dc_filter_init(&filter, '!', ALLOWED_GUILD, ALLOWED_CHANNEL, ALLOWED_USER));
+    checks_run(&filter);
+
+    s_events = calloc(BENCH_CHUNK, sizeof(bench_event_t));
+    if (!s_events) {
+        printf("{\"error\": \"no memory for %d events\"}\n", BENCH_CHUNK);
+        return;
+    }
+
+    vprintf_like_t console = esp_log_set_vprintf(bench_vprintf);
+    bench_run("log-all", NULL);
+    bench_run("filtered", &filter);
+    esp_log_set_vprintf(console);
+
+    free(s_events);
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef DISCORD
+#define DISCORD
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+/* Host stand-in for the part of esp-discord the bot uses, same names and
+ * types. The gateway is a plain ws:// connection and the REST API plain
+ * HTTP, both to CONFIG_DISCORD_HOST_ADDR:CONFIG_DISCORD_HOST_PORT, where
+ * tools/fake_discord.py plays Discord. Event handlers run on the gateway
+ * task and the data they get is freed when they return, like upstream. */
+
+ESP_EVENT_DECLARE_BASE(DISCORD_EVENTS);
+
+typedef struct discord_client *discord_handle_t;
+
+typedef enum {
+    DISCORD_EVENT_ANY = ESP_EVENT_ANY_ID,
+    DISCORD_EVENT_CONNECTED,            /* data: discord_session_t, also after a resume */
+    DISCORD_EVENT_MESSAGE_RECEIVED,     /* data: discord_message_t */
+    DISCORD_EVENT_DISCONNECTED,
+} discord_event_t;
+
+typedef struct {
+    discord_handle_t client;
+    void *ptr;
+} discord_event_data_t;
+
+#define DISCORD_INTENT_GUILDS            (1 << 0)
+#define DISCORD_INTENT_GUILD_MESSAGES    (1 << 9)
+#define DISCORD_INTENT_MESSAGE_CONTENT   (1 << 15)
+
+typedef struct {
+    int intents;
+    const char *token;      /* NULL: CONFIG_DISCORD_HOST_TOKEN */
+} discord_config_t;
+
+discord_handle_t discord_create(const discord_config_t *config);
+
+/* At most CONFIG_DISCORD_HOST_HANDLERS handlers per client */
+esp_err_t discord_register_events(discord_handle_t handle, discord_event_t event,
+                                  esp_event_handler_t handler, void *arg);
+
+/* Start the gateway task. It reconnects and resumes the session until
+ * discord_logout(). */
+esp_err_t discord_login(discord_handle_t handle);
+esp_err_t discord_logout(discord_handle_t handle);
+
+#endif /* DISCORD */
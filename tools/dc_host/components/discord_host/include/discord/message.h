@@ -0,0 +1,28 @@
+#ifndef DISCORD_MESSAGE
+#define DISCORD_MESSAGE
+
+#include "discord.h"
+#include "discord/user.h"
+
+typedef struct {
+    char *id;
+    char *content;
+    char *channel_id;
+    discord_user_t *author;
+    char *guild_id;
+} discord_message_t;
+
+/* Host only: the API answered 429. esp-discord has no such code and fails
+ * a rate limited message with ESP_ERR_INVALID_RESPONSE like any refusal. */
+#define DISCORD_ERR_RATE_LIMITED    0xE101
+
+/* POST the message to its channel and wait for the answer. A rate limited
+ * message fails with DISCORD_ERR_RATE_LIMITED, an otherwise refused one
+ * with ESP_ERR_INVALID_RESPONSE. With out_result the created message is returned, to be freed with
+ * discord_message_free(). */
+esp_err_t discord_message_send(discord_handle_t handle, discord_message_t *message,
+                               discord_message_t **out_result);
+
+void discord_message_free(discord_message_t *message);
+
+#endif /* DISCORD_MESSAGE */
@@ -0,0 +1,11 @@
+#ifndef DISCORD_SESSION
+#define DISCORD_SESSION
+
+#include "discord/user.h"
+
+typedef struct {
+    char *session_id;
+    discord_user_t *user;
+} discord_session_t;
+
+#endif /* DISCORD_SESSION */
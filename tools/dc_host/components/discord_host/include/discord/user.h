@@ -0,0 +1,15 @@
+#ifndef DISCORD_USER
+#define DISCORD_USER
+
+#include <stdbool.h>
+
+typedef struct {
+    char *id;
+    bool bot;
+    char *username;
+    char *discriminator;
+} discord_user_t;
+
+void discord_user_free(discord_user_t *user);
+
+#endif /* DISCORD_USER */
@@ -0,0 +1,321 @@
+#include "discord_priv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "json_writer.h"
+#include "discord/session.h"
+
+static const char *TAG = "discord";
+
+ESP_EVENT_DEFINE_BASE(DISCORD_EVENTS);
+
+#define GATEWAY_PATH        "/?v=10&encoding=json"
+#define GATEWAY_BUFSIZE     4096
+/* How often the gateway task looks at the logout flag */
+#define GATEWAY_POLL_MS     100
+
+enum {
+    OP_DISPATCH = 0,
+    OP_HEARTBEAT = 1,
+    OP_IDENTIFY = 2,
+    OP_RESUME = 6,
+    OP_RECONNECT = 7,
+    OP_INVALID_SESSION = 9,
+    OP_HELLO = 10,
+    OP_HEARTBEAT_ACK = 11,
+};
+
+static void discord_emit(discord_handle_t client, discord_event_t event, void *ptr)
+{
+    discord_event_data_t data = { .client = client, .ptr = ptr };
+    for (int i = 0; i < client->handler_count; i++) {
+        const discord_handler_t *h = &client->handlers[i];
+        if (h->event == event || h->event == DISCORD_EVENT_ANY) {
+            h->handler(h->arg, DISCORD_EVENTS, event, &data);
+        }
+    }
+}
+
+/* Payloads are small: build them on the stack */
+static esp_err_t gateway_send(int fd, int op, json_writer_t *w)
+{
+    esp_err_t err = json_writer_finish(w);
+    if (err == ESP_OK) {
+        err = discord_ws_send_text(fd, w->buf, w->len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to send op %d (%s)", op, esp_err_to_name(err));
+    }
+    return err;
+}
+
+static esp_err_t gateway_heartbeat(discord_handle_t client, int fd)
+{
+    char buf[64];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), NULL, NULL);
+    json_writer_object_begin(&w);
+    json_writer_field_int(&w, "op", OP_HEARTBEAT);
+    if (client->seq >= 0) {
+        json_writer_field_int(&w, "d", client->seq);
+    } else {
+        json_writer_field_null(&w, "d");
+    }
+    json_writer_object_end(&w);
+    return gateway_send(fd, OP_HEARTBEAT, &w);
+}
+
+/* RESUME when there is a session to pick up, so events missed while
+ * disconnected are replayed; IDENTIFY otherwise */
+static esp_err_t gateway_identify(discord_handle_t client, int fd)
+{
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), NULL, NULL);
+    json_writer_object_begin(&w);
+    json_writer_field_int(&w, "op", client->session_id ? OP_RESUME : OP_IDENTIFY);
+    json_writer_key(&w, "d");
+    json_writer_object_begin(&w);
+    json_writer_field_str(&w, "token", client->token);
+    if (client->session_id) {
+        json_writer_field_str(&w, "session_id", client->session_id);
+        json_writer_field_int(&w, "seq", client->seq);
+    } else {
+        json_writer_field_int(&w, "intents", client->intents);
+        json_writer_key(&w, "properties");
+        json_writer_object_begin(&w);
+        json_writer_field_str(&w, "os", "linux");
+        json_writer_field_str(&w, "browser", "esp-discord");
+        json_writer_field_str(&w, "device", "esp-discord");
+        json_writer_object_end(&w);
+    }
+    json_writer_object_end(&w);
+    json_writer_object_end(&w);
+    return gateway_send(fd, client->session_id ? OP_RESUME : OP_IDENTIFY, &w);
+}
+
+static bool gateway_ready(discord_handle_t client, const cJSON *d)
+{
+    const cJSON *session_id = cJSON_GetObjectItemCaseSensitive(d, "session_id");
+    discord_user_t *user = discord_user_from_json(cJSON_GetObjectItemCaseSensitive(d, "user"));
+    char *id = cJSON_IsString(session_id) ? strdup(session_id->valuestring) : NULL;
+    if (!id || !user) {
+        ESP_LOGW(TAG, "Incomplete READY");
+        discord_user_free(user);
+        free(id);
+        return false;
+    }
+    free(client->session_id);
+    discord_user_free(client->user);
+    client->session_id = id;
+    client->user = user;
+    return true;
+}
+
+static void gateway_dispatch(discord_handle_t client, const char *type, const cJSON *d, bool *connected)
+{
+    bool up = false;
+    if (strcmp(type, "READY") == 0) {
+        up = gateway_ready(client, d);
+    } else if (strcmp(type, "RESUMED") == 0) {
+        ESP_LOGI(TAG, "Session resumed at %lld", (long long)client->seq);
+        up = client->user != NULL;
+    } else if (strcmp(type, "MESSAGE_CREATE") == 0) {
+        discord_message_t *message = discord_message_from_json(d);
+        if (message) {
+            discord_emit(client, DISCORD_EVENT_MESSAGE_RECEIVED, message);
+            discord_message_free(message);
+        } else {
+            ESP_LOGW(TAG, "Unreadable MESSAGE_CREATE");
+        }
+    }
+    if (up) {
+        discord_session_t session = { .session_id = client->session_id, .user = client->user };
+        *connected = true;
+        discord_emit(client, DISCORD_EVENT_CONNECTED, &session);
+    }
+}
+
+/* One gateway connection, until it breaks, the gateway asks for a
+ * reconnect or the client logs out. Returns whether a session was up. */
+static bool gateway_run(discord_handle_t client, int fd)
+{
+    int64_t heartbeat_us = 0;
+    int64_t next_heartbeat = INT64_MAX;
+    bool connected = false;
+
+    while (atomic_load(&client->running)) {
+        int64_t now = esp_timer_get_time();
+        if (now >= next_heartbeat) {
+            if (gateway_heartbeat(client, fd) != ESP_OK) {
+                break;
+            }
+            next_heartbeat = now + heartbeat_us;
+        }
+        int64_t wait_ms = (next_heartbeat - now) / 1000;
+        esp_err_t err = discord_net_wait(fd, wait_ms < GATEWAY_POLL_MS ? (int)wait_ms + 1 : GATEWAY_POLL_MS);
+        if (err == ESP_ERR_TIMEOUT) {
+            continue;
+        }
+        size_t len;
+        err = err == ESP_OK ? discord_ws_recv(fd, client->buf, GATEWAY_BUFSIZE, &len) : err;
+        if (err == ESP_ERR_INVALID_SIZE) {
+            ESP_LOGW(TAG, "Gateway payload over %d bytes dropped", GATEWAY_BUFSIZE);
+            continue;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Gateway connection lost");
+            break;
+        }
+
+        cJSON *payload = cJSON_ParseWithLength(client->buf, len);
+        const cJSON *op = cJSON_GetObjectItemCaseSensitive(payload, "op");
+        const cJSON *seq = cJSON_GetObjectItemCaseSensitive(payload, "s");
+        const cJSON *d = cJSON_GetObjectItemCaseSensitive(payload, "d");
+        if (!cJSON_IsNumber(op)) {
+            ESP_LOGW(TAG, "Unreadable gateway payload");
+            cJSON_Delete(payload);
+            continue;
+        }
+        if (cJSON_IsNumber(seq)) {
+            client->seq = (int64_t)seq->valuedouble;
+        }
+
+        bool reconnect = false;
+        switch (op->valueint) {
+        case OP_HELLO: {
+            const cJSON *interval = cJSON_GetObjectItemCaseSensitive(d, "heartbeat_interval");
+            heartbeat_us = cJSON_IsNumber(interval) ? (int64_t)interval->valuedouble * 1000 : 41250000;
+            next_heartbeat = esp_timer_get_time() + heartbeat_us;
+            reconnect = gateway_identify(client, fd) != ESP_OK;
+        } break;
+        case OP_HEARTBEAT:
+            reconnect = gateway_heartbeat(client, fd) != ESP_OK;
+            break;
+        case OP_RECONNECT:
+            ESP_LOGI(TAG, "Gateway asked for a reconnect");
+            reconnect = true;
+            break;
+        case OP_INVALID_SESSION:
+            /* Not resumable: identify afresh next time */
+            ESP_LOGW(TAG, "Session invalidated");
+            free(client->session_id);
+            client->session_id = NULL;
+            client->seq = -1;
+            reconnect = true;
+            break;
+        case OP_DISPATCH: {
+            const cJSON *type = cJSON_GetObjectItemCaseSensitive(payload, "t");
+            if (cJSON_IsString(type)) {
+                gateway_dispatch(client, type->valuestring, d, &connected);
+            }
+        } break;
+        default:
+            break;
+        }
+        cJSON_Delete(payload);
+        if (reconnect) {
+            break;
+        }
+    }
+    return connected;
+}
+
+static void gateway_task(void *arg)
+{
+    discord_handle_t client = arg;
+
+    while (atomic_load(&client->running)) {
+        int fd = discord_net_connect();
+        if (fd >= 0 && discord_ws_open(fd, GATEWAY_PATH) == ESP_OK) {
+            atomic_store(&client->fd, fd);
+            bool connected = gateway_run(client, fd);
+            atomic_store(&client->fd, -1);
+            if (connected) {
+                discord_emit(client, DISCORD_EVENT_DISCONNECTED, NULL);
+            }
+        } else {
+            ESP_LOGW(TAG, "Gateway %s:%d not reachable", CONFIG_DISCORD_HOST_ADDR, CONFIG_DISCORD_HOST_PORT);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        for (int waited = 0; waited < CONFIG_DISCORD_HOST_RECONNECT_MS && atomic_load(&client->running);
+                waited += GATEWAY_POLL_MS) {
+            vTaskDelay(pdMS_TO_TICKS(GATEWAY_POLL_MS));
+        }
+    }
+    client->task = NULL;
+    vTaskDelete(NULL);
+}
+
+discord_handle_t discord_create(const discord_config_t *config)
+{
+    discord_handle_t client = calloc(1, sizeof(*client));
+    if (!client) {
+        return NULL;
+    }
+    client->buf = malloc(GATEWAY_BUFSIZE);
+    if (!client->buf) {
+        free(client);
+        return NULL;
+    }
+    client->intents = config->intents;
+    client->token = config->token ? config->token : CONFIG_DISCORD_HOST_TOKEN;
+    client->seq = -1;
+    atomic_init(&client->running, false);
+    atomic_init(&client->fd, -1);
+    return client;
+}
+
+esp_err_t discord_register_events(discord_handle_t handle, discord_event_t event,
+                                  esp_event_handler_t handler, void *arg)
+{
+    if (!handle || !handler) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->handler_count == CONFIG_DISCORD_HOST_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    handle->handlers[handle->handler_count++] = (discord_handler_t) {
+        .event = event,
+        .handler = handler,
+        .arg = arg,
+    };
+    return ESP_OK;
+}
+
+esp_err_t discord_login(discord_handle_t handle)
+{
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* A task still winding down from a logout just carries on */
+    if (atomic_exchange(&handle->running, true) || handle->task) {
+        return ESP_OK;
+    }
+    if (xTaskCreate(gateway_task, "discord", 6144, handle, 4, &handle->task) != pdPASS) {
+        atomic_store(&handle->running, false);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t discord_logout(discord_handle_t handle)
+{
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    atomic_store(&handle->running, false);
+    /* Wake the task out of a blocking read */
+    int fd = atomic_load(&handle->fd);
+    if (fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,183 @@
+#include "discord_priv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "json_writer.h"
+
+static const char *TAG = "discord-message";
+
+/* Response head and the created message, which echoes the content */
+#define RESPONSE_MAX    (4096 + 512)
+
+static char *json_strdup(const cJSON *json, const char *name)
+{
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(json, name);
+    return cJSON_IsString(item) ? strdup(item->valuestring) : NULL;
+}
+
+void discord_user_free(discord_user_t *user)
+{
+    if (!user) {
+        return;
+    }
+    free(user->id);
+    free(user->username);
+    free(user->discriminator);
+    free(user);
+}
+
+discord_user_t *discord_user_from_json(const cJSON *json)
+{
+    discord_user_t *user = calloc(1, sizeof(*user));
+    if (!user) {
+        return NULL;
+    }
+    user->id = json_strdup(json, "id");
+    user->username = json_strdup(json, "username");
+    user->discriminator = json_strdup(json, "discriminator");
+    user->bot = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(json, "bot"));
+    if (!user->id || !user->username) {
+        discord_user_free(user);
+        return NULL;
+    }
+    if (!user->discriminator) {
+        user->discriminator = strdup("0");
+    }
+    return user;
+}
+
+void discord_message_free(discord_message_t *message)
+{
+    if (!message) {
+        return;
+    }
+    free(message->id);
+    free(message->content);
+    free(message->channel_id);
+    free(message->guild_id);
+    discord_user_free(message->author);
+    free(message);
+}
+
+discord_message_t *discord_message_from_json(const cJSON *json)
+{
+    discord_message_t *message = calloc(1, sizeof(*message));
+    if (!message) {
+        return NULL;
+    }
+    message->id = json_strdup(json, "id");
+    message->content = json_strdup(json, "content");
+    message->channel_id = json_strdup(json, "channel_id");
+    message->guild_id = json_strdup(json, "guild_id");
+    const cJSON *author = cJSON_GetObjectItemCaseSensitive(json, "author");
+    message->author = cJSON_IsObject(author) ? discord_user_from_json(author) : NULL;
+    if (!message->id || !message->channel_id || !message->author) {
+        discord_message_free(message);
+        return NULL;
+    }
+    if (!message->content) {
+        message->content = strdup("");
+    }
+    return message;
+}
+
+/* The whole response of a Connection: close request, NUL terminated */
+static esp_err_t http_read_response(int fd, char *buf, size_t size, int *status, const char **body)
+{
+    size_t len = 0;
+    for (;;) {
+        esp_err_t err = discord_net_wait(fd, DISCORD_NET_TIMEOUT_MS);
+        if (err != ESP_OK) {
+            return err;
+        }
+        int n = discord_net_recv(fd, buf + len, size - 1 - len);
+        if (n < 0) {
+            return ESP_FAIL;
+        }
+        len += n;
+        if (n == 0 || len == size - 1) {
+            break;
+        }
+    }
+    buf[len] = '\0';
+
+    char *end = strstr(buf, "\r\n\r\n");
+    if (!end || sscanf(buf, "HTTP/1.%*d %d", status) != 1) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    *body = end + 4;
+    return ESP_OK;
+}
+
+esp_err_t discord_message_send(discord_handle_t handle, discord_message_t *message,
+                               discord_message_t **out_result)
+{
+    if (!handle || !message || !message->content || !message->channel_id) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (out_result) {
+        *out_result = NULL;
+    }
+
+    /* Worst case every character escaped as \u00XX */
+    size_t body_size = strlen(message->content) * 6 + 32;
+    char *body = malloc(body_size);
+    char *response = malloc(RESPONSE_MAX);
+    if (!body || !response) {
+        free(body);
+        free(response);
+        return ESP_ERR_NO_MEM;
+    }
+    json_writer_t w;
+    json_writer_init(&w, body, body_size, NULL, NULL);
+    json_writer_object_begin(&w);
+    json_writer_field_str(&w, "content", message->content);
+    json_writer_object_end(&w);
+    esp_err_t err = json_writer_finish(&w);
+
+    int fd = err == ESP_OK ? discord_net_connect() : -1;
+    if (err == ESP_OK && fd < 0) {
+        err = ESP_FAIL;
+    }
+    if (err == ESP_OK) {
+        char head[256];
+        int head_len = snprintf(head, sizeof(head),
+                                "POST /api/v10/channels/%s/messages HTTP/1.1\r\nHost: %s:%d\r\n"
+                                "Authorization: Bot %s\r\nContent-Type: application/json\r\n"
+                                "Content-Length: %u\r\nConnection: close\r\n\r\n",
+                                message->channel_id, CONFIG_DISCORD_HOST_ADDR, CONFIG_DISCORD_HOST_PORT,
+                                handle->token, (unsigned)w.len);
+        err = discord_net_send(fd, head, head_len);
+        if (err == ESP_OK) {
+            err = discord_net_send(fd, body, w.len);
+        }
+    }
+
+    int status = 0;
+    const char *answer = NULL;
+    if (err == ESP_OK) {
+        err = http_read_response(fd, response, RESPONSE_MAX, &status, &answer);
+    }
+    if (err == ESP_OK && status / 100 != 2) {
+        ESP_LOGW(TAG, "Channel %s answered %d", message->channel_id, status);
+        err = status == 429 ? DISCORD_ERR_RATE_LIMITED : ESP_ERR_INVALID_RESPONSE;
+    }
+    if (err == ESP_OK && out_result) {
+        cJSON *json = cJSON_Parse(answer);
+        *out_result = json ? discord_message_from_json(json) : NULL;
+        cJSON_Delete(json);
+        if (!*out_result) {
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(response);
+    free(body);
+    return err;
+}
@@ -0,0 +1,284 @@
+#include "discord_priv.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "esp_log.h"
+
+static const char *TAG = "discord-net";
+
+#define WS_OP_CONTINUATION  0x0
+#define WS_OP_TEXT          0x1
+#define WS_OP_CLOSE         0x8
+#define WS_OP_PING          0x9
+#define WS_OP_PONG          0xA
+#define WS_HEAD_MAX         1024
+
+/* Calls in FreeRTOS tasks of the host build are interrupted by the tick
+ * signal: retry until they get through or really fail */
+
+int discord_net_connect(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_DISCORD_HOST_PORT),
+    };
+    if (inet_pton(AF_INET, CONFIG_DISCORD_HOST_ADDR, &addr.sin_addr) != 1) {
+        ESP_LOGE(TAG, "Invalid address %s", CONFIG_DISCORD_HOST_ADDR);
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct timeval tv = {
+        .tv_sec = DISCORD_NET_TIMEOUT_MS / 1000,
+        .tv_usec = (DISCORD_NET_TIMEOUT_MS % 1000) * 1000,
+    };
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    /* Frames are written whole: do not hold the last segment back */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int ret;
+    do {
+        ret = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 && errno != EISCONN) {
+        ESP_LOGD(TAG, "connect: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+esp_err_t discord_net_send(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        }
+        p += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+int discord_net_recv(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+    do {
+        n = recv(fd, buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -1 : (int)n;
+}
+
+esp_err_t discord_net_recv_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        int n = discord_net_recv(fd, p, len);
+        if (n <= 0) {
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? ESP_ERR_TIMEOUT : ESP_FAIL;
+        }
+        p += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t discord_net_wait(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return ESP_FAIL;
+    }
+    return ret == 0 ? ESP_ERR_TIMEOUT : ESP_OK;
+}
+
+esp_err_t discord_ws_open(int fd, const char *path)
+{
+    /* The fake does not check the key: the sample nonce of RFC 6455 will do */
+    char head[WS_HEAD_MAX];
+    int len = snprintf(head, sizeof(head),
+                       "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+                       path, CONFIG_DISCORD_HOST_ADDR, CONFIG_DISCORD_HOST_PORT);
+    esp_err_t err = discord_net_send(fd, head, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* Byte by byte up to the blank line, so no frame is read with it */
+    size_t got = 0;
+    while (got < 4 || memcmp(head + got - 4, "\r\n\r\n", 4) != 0) {
+        if (got == sizeof(head) - 1) {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        err = discord_net_recv_all(fd, head + got, 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        got++;
+    }
+    head[got] = '\0';
+    if (strncmp(head, "HTTP/1.1 101", 12) != 0) {
+        ESP_LOGW(TAG, "Upgrade refused: %.*s", (int)strcspn(head, "\r"), head);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    return ESP_OK;
+}
+
+/* Client frames are always masked */
+static esp_err_t ws_send_frame(int fd, uint8_t opcode, const char *data, size_t len)
+{
+    uint8_t head[14];
+    size_t head_len = 2;
+    head[0] = 0x80 | opcode;
+    if (len < 126) {
+        head[1] = 0x80 | len;
+    } else if (len <= 0xFFFF) {
+        head[1] = 0x80 | 126;
+        head[2] = len >> 8;
+        head[3] = len & 0xFF;
+        head_len = 4;
+    } else {
+        head[1] = 0x80 | 127;
+        for (int i = 0; i < 8; i++) {
+            head[2 + i] = (uint64_t)len >> (56 - 8 * i);
+        }
+        head_len = 10;
+    }
+    uint32_t mask = (uint32_t)rand();
+    memcpy(head + head_len, &mask, 4);
+    const uint8_t *key = head + head_len;
+    head_len += 4;
+
+    esp_err_t err = discord_net_send(fd, head, head_len);
+    char chunk[256];
+    for (size_t off = 0; err == ESP_OK && off < len; off += sizeof(chunk)) {
+        size_t n = len - off < sizeof(chunk) ? len - off : sizeof(chunk);
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = data[off + i] ^ key[(off + i) & 3];
+        }
+        err = discord_net_send(fd, chunk, n);
+    }
+    return err;
+}
+
+esp_err_t discord_ws_send_text(int fd, const char *data, size_t len)
+{
+    return ws_send_frame(fd, WS_OP_TEXT, data, len);
+}
+
+/* Payload of one frame into buf, or dropped when it does not fit */
+static esp_err_t ws_read_payload(int fd, uint64_t len, const uint8_t *mask, char *buf, size_t size, bool *fits)
+{
+    *fits = len <= size;
+    char sink[256];
+    for (uint64_t off = 0; off < len;) {
+        size_t n = len - off < sizeof(sink) ? len - off : sizeof(sink);
+        char *dst = *fits ? buf + off : sink;
+        esp_err_t err = discord_net_recv_all(fd, dst, n);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (mask) {
+            for (size_t i = 0; i < n; i++) {
+                dst[i] ^= mask[(off + i) & 3];
+            }
+        }
+        off += n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t discord_ws_recv(int fd, char *buf, size_t size, size_t *len)
+{
+    bool fits = true;
+    *len = 0;
+
+    for (;;) {
+        uint8_t head[2];
+        esp_err_t err = discord_net_recv_all(fd, head, sizeof(head));
+        if (err != ESP_OK) {
+            return ESP_FAIL;
+        }
+        bool fin = head[0] & 0x80;
+        uint8_t opcode = head[0] & 0x0F;
+        uint64_t payload_len = head[1] & 0x7F;
+        if (payload_len >= 126) {
+            uint8_t ext[8];
+            size_t ext_len = payload_len == 126 ? 2 : 8;
+            if (discord_net_recv_all(fd, ext, ext_len) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            payload_len = 0;
+            for (size_t i = 0; i < ext_len; i++) {
+                payload_len = payload_len << 8 | ext[i];
+            }
+        }
+        uint8_t mask[4];
+        if ((head[1] & 0x80) && discord_net_recv_all(fd, mask, sizeof(mask)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        const uint8_t *key = head[1] & 0x80 ? mask : NULL;
+
+        if (opcode & 0x8) {
+            /* Control frames carry at most 125 bytes */
+            char payload[125];
+            bool small;
+            if (payload_len > sizeof(payload) ||
+                    ws_read_payload(fd, payload_len, key, payload, sizeof(payload), &small) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            if (opcode == WS_OP_CLOSE) {
+                ws_send_frame(fd, WS_OP_CLOSE, payload, payload_len >= 2 ? 2 : 0);
+                return ESP_FAIL;
+            }
+            if (opcode == WS_OP_PING && ws_send_frame(fd, WS_OP_PONG, payload, payload_len) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            continue;
+        }
+        if (opcode != WS_OP_TEXT && opcode != WS_OP_CONTINUATION) {
+            ESP_LOGW(TAG, "Unexpected opcode %d", opcode);
+            return ESP_FAIL;
+        }
+
+        bool frame_fits;
+        size_t room = fits && *len < size - 1 ? size - 1 - *len : 0;
+        if (ws_read_payload(fd, payload_len, key, buf + *len, room, &frame_fits) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        fits = fits && frame_fits;
+        if (fits) {
+            *len += payload_len;
+        }
+        if (fin) {
+            if (!fits) {
+                *len = 0;
+                return ESP_ERR_INVALID_SIZE;
+            }
+            buf[*len] = '\0';
+            return ESP_OK;
+        }
+    }
+}
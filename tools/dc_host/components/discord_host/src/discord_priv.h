@@ -0,0 +1,59 @@
+#ifndef DISCORD_PRIV
+#define DISCORD_PRIV
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+#include "discord.h"
+#include "discord/message.h"
+
+/* Blocking socket calls give up after this long */
+#define DISCORD_NET_TIMEOUT_MS  5000
+
+typedef struct {
+    discord_event_t event;
+    esp_event_handler_t handler;
+    void *arg;
+} discord_handler_t;
+
+struct discord_client {
+    int intents;
+    const char *token;
+    discord_handler_t handlers[CONFIG_DISCORD_HOST_HANDLERS];
+    int handler_count;
+    TaskHandle_t task;
+    atomic_bool running;        /* between login and logout */
+    atomic_int fd;              /* gateway socket, -1 when closed */
+    char *buf;                  /* gateway frames */
+    /* Kept across reconnects to resume */
+    char *session_id;
+    discord_user_t *user;
+    int64_t seq;
+};
+
+/* TCP connection to the fake Discord with send and receive timeouts,
+ * -1 on failure */
+int discord_net_connect(void);
+esp_err_t discord_net_send(int fd, const void *data, size_t len);
+/* Up to len bytes: the count, 0 once the peer closed, -1 on error */
+int discord_net_recv(int fd, void *buf, size_t len);
+/* Exactly len bytes */
+esp_err_t discord_net_recv_all(int fd, void *buf, size_t len);
+/* ESP_OK once fd is readable, ESP_ERR_TIMEOUT after timeout_ms */
+esp_err_t discord_net_wait(int fd, int timeout_ms);
+
+/* Client side of the WebSocket upgrade on a connected socket */
+esp_err_t discord_ws_open(int fd, const char *path);
+esp_err_t discord_ws_send_text(int fd, const char *data, size_t len);
+/* Next text message into buf, NUL terminated, answering pings on the way.
+ * ESP_ERR_INVALID_SIZE when it did not fit (it is skipped), ESP_FAIL once
+ * the connection is closed or broken. */
+esp_err_t discord_ws_recv(int fd, char *buf, size_t size, size_t *len);
+
+/* NULL when a required field is missing or on allocation failure */
+discord_user_t *discord_user_from_json(const cJSON *json);
+discord_message_t *discord_message_from_json(const cJSON *json);
+
+#endif /* DISCORD_PRIV */
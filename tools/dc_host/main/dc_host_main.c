@@ -0,0 +1,60 @@
+#include <malloc.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+
+#include "access_log.h"
+#include "basic_http_server.h"
+#include "dc_bot.h"
+#include "dlog.h"
+#include "gate_actuator.h"
+#include "link_supervisor.h"
+#include "presence.h"
+#include "settings.h"
+#include "whitelist.h"
+
+#define HEAP_SAMPLE_MS  100
+
+/* Relay pulses as JSON lines, for the replay harness to time commands to
+ * the gate. Read off stdout on arrival, so no clock has to be shared. */
+static void gate_event_handler(void *arg, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    const gate_event_t *event = event_data;
+    if (event_id == GATE_EVENT_ACTIVE) {
+        printf("{\"ev\": \"gate\", \"action\": \"%s\", \"source\": \"%s\", \"t_us\": %lld}\n",
+               gate_action_to_str(event->action), gate_source_to_str(event->source),
+               (long long)esp_timer_get_time());
+    }
+}
+
+/* Same start-up as the firmware with the host link and Discord stand-ins in
+ * place of WiFi and esp-discord. Run by tools/fake_discord.py. */
+void app_main(void)
+{
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    /* Initialises NVS too */
+    ESP_ERROR_CHECK(settings_init());
+    ESP_ERROR_CHECK(dlog_start());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    ESP_ERROR_CHECK(gate_actuator_start());
+    ESP_ERROR_CHECK(whitelist_init());
+    ESP_ERROR_CHECK(presence_start());
+    ESP_ERROR_CHECK(access_log_start());
+    ESP_ERROR_CHECK(init_assets());
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(GATE_EVENT, ESP_EVENT_ANY_ID, gate_event_handler,
+                                                        NULL, NULL));
+    ESP_ERROR_CHECK(link_supervisor_start());
+    dc_bot_start();
+
+    /* Bytes allocated from the host heap: the stand-in for the free heap
+     * curve of the device */
+    for (;;) {
+        struct mallinfo2 info = mallinfo2();
+        printf("{\"ev\": \"heap\", \"used\": %zu, \"t_us\": %lld}\n", info.uordblks, (long long)esp_timer_get_time());
+        vTaskDelay(pdMS_TO_TICKS(HEAP_SAMPLE_MS));
+    }
+}
@@ -0,0 +1,118 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "dlog.h"
+
+#define BENCH_CALLS     400
+/* Requests come in bursts with idle time in between, as on the device */
+#define BENCH_BURST     8
+#define BENCH_IDLE_MS   50
+/* Same priority as the httpd task */
+#define BENCH_PRIORITY  5
+
+/* What DLOG() expands to without CONFIG_DLOG_DEFERRED */
+#define CLASSIC_LOG(name, ...) \
+    ESP_LOG_LEVEL_LOCAL(DLOG_LEVEL_##name, DLOG_TAG_##name, DLOG_FMT_##name, ##__VA_ARGS__)
+
+static vprintf_like_t s_console;
+static size_t s_log_bytes;
+static int64_t s_latency_us[BENCH_CALLS];
+static TaskHandle_t s_main_task;
+
+/* Pass everything on to the console, counting the bytes */
+static int bench_vprintf(const char *fmt, va_list ap)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    /* Unbuffered like a UART, and keeps stdout for the results */
+    int len = vfprintf(stderr, fmt, ap);
+#else
+    int len = s_console(fmt, ap);
+#endif
+    s_log_bytes += len > 0 ? len : 0;
+    return len;
+}
+
+/* The logging of a Discord command that moves the gate; the handler's own
+ * work is left out so the difference is the logging alone */
+static void handle_classic(int i)
+{
+    CLASSIC_LOG(DC_COMMAND, "gatekeeper", "1200000000000000001", i & 1 ? "!gate open" : "!gate close");
+    CLASSIC_LOG(GATE_DONE, i & 1 ? "open" : "close", "discord");
+}
+
+static void handle_deferred(int i)
+{
+    DLOG(DC_COMMAND, "gatekeeper", "1200000000000000001", i & 1 ? "!gate open" : "!gate close");
+    DLOG(GATE_DONE, i & 1 ? "open" : "close", "discord");
+}
+
+static int compare_us(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_run(const char *name, void (*handler)(int))
+{
+    dlog_stats_t before;
+    dlog_stats_t after;
+    int64_t total_us = 0;
+
+    dlog_flush();
+    dlog_get_stats(&before);
+    s_log_bytes = 0;
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        int64_t start = esp_timer_get_time();
+        handler(i);
+        s_latency_us[i] = esp_timer_get_time() - start;
+        total_us += s_latency_us[i];
+        if (i % BENCH_BURST == BENCH_BURST - 1) {
+            vTaskDelay(pdMS_TO_TICKS(BENCH_IDLE_MS));
+        }
+    }
+    /* Whatever the render task has not printed yet is still owed */
+    int64_t drain_start = esp_timer_get_time();
+    dlog_flush();
+    int64_t drain_us = esp_timer_get_time() - drain_start;
+    dlog_get_stats(&after);
+
+    qsort(s_latency_us, BENCH_CALLS, sizeof(s_latency_us[0]), compare_us);
+    printf("{\"run\": \"%s\", \"calls\": %d, \"mean_ns\": %.0f, \"p50_us\": %lld, \"p99_us\": %lld, "
+           "\"max_us\": %lld, \"log_bytes\": %u, \"final_drain_us\": %lld, \"dropped\": %lu}\n",
+           name, BENCH_CALLS, total_us * 1000.0 / BENCH_CALLS, (long long)s_latency_us[BENCH_CALLS / 2],
+           (long long)s_latency_us[BENCH_CALLS * 99 / 100], (long long)s_latency_us[BENCH_CALLS - 1],
+           (unsigned)s_log_bytes, (long long)drain_us, (unsigned long)(after.dropped - before.dropped));
+}
+
+static void bench_task(void *arg)
+{
+    s_console = esp_log_set_vprintf(bench_vprintf);
+    bench_run("classic", handle_classic);
+    bench_run("deferred", handle_deferred);
+    esp_log_set_vprintf(s_console);
+
+#if CONFIG_DLOG_STRIP_FORMATS
+    printf("{\"strip_formats\": true}\n");
+#endif
+    fflush(stdout);
+    xTaskNotifyGive(s_main_task);
+    vTaskDelete(NULL);
+}
+
+void app_main(void)
+{
+    ESP_ERROR_CHECK(dlog_start());
+
+    s_main_task = xTaskGetCurrentTaskHandle();
+    xTaskCreate(bench_task, "bench", 4096, NULL, BENCH_PRIORITY, NULL);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Render the deferred log records of a firmware built with
+CONFIG_DLOG_STRIP_FORMATS.
+
+Such a firmware prints hot-path messages as "#DL <base64>" lines instead of
+text. This filter reads a console capture (a file, or stdin, e.g.
+"idf.py monitor | tools/dlog_decode.py") and replaces every record with the
+line ESP_LOGx would have printed, using the same messages.def the firmware
+was built from; everything else passes through unchanged. The firmware
+announces the catalogue it was built with at start-up ("#DL catalogue
+<id>"); a mismatch is reported, as IDs then point at the wrong messages.
+"""
+import argparse
+import base64
+import binascii
+import os
+import re
+import struct
+import sys
+
+from gen_dlog_messages import SPEC, catalogue_id, parse
+
+DEFAULT_CATALOGUE = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'components', 'dlog',
+                                 'messages.def')
+RECORD = re.compile(r'#DL (\S+)')
+CATALOGUE = re.compile(r'#DL catalogue ([0-9a-f]{8})')
+HEADER = struct.Struct('<IHBB')
+
+
+def format_record(fmt, args, text):
+    """The C renderer's printf: every argument is a 32-bit value or a
+    (offset << 8 | length) reference into the text bytes."""
+    values = iter(args)
+
+    def convert(m):
+        flags, width, precision, _, conv = m.groups()
+        if conv == '%':
+            return '%'
+        value = next(values, 0)
+        spec = '%' + flags + width + ('.' + precision if precision is not None else '')
+        if conv == 's':
+            offset, length = value >> 8, value & 0xFF
+            chunk = text[offset:offset + length] if offset + length <= len(text) else b''
+            return (spec + 's') % chunk.decode('utf-8', errors='replace')
+        if conv in 'di':
+            return (spec + 'd') % (value - (1 << 32) if value & 0x80000000 else value)
+        if conv == 'u':
+            return (spec + 'd') % value
+        if conv == 'c':
+            return (spec + 'c') % chr(value & 0xFF)
+        return (spec + conv) % value
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode(payload, entries):
+    try:
+        frame = base64.b64decode(payload, validate=True)
+        timestamp, msg_id, nargs, text_len = HEADER.unpack_from(frame)
+        args = struct.unpack_from('<{}I'.format(nargs), frame, HEADER.size)
+    except (binascii.Error, struct.error, ValueError):
+        return None
+    text = frame[HEADER.size + 4 * nargs:HEADER.size + 4 * nargs + text_len]
+    if msg_id >= len(entries):
+        return '? ({}) dlog: unknown message {}'.format(timestamp, msg_id)
+    _, level, tag, fmt = entries[msg_id]
+    return '{} ({}) {}: {}'.format(level, timestamp, tag, format_record(fmt, args, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('input', nargs='?', help='console capture, stdin if omitted')
+    parser.add_argument('--catalogue', default=DEFAULT_CATALOGUE, help='messages.def the firmware was built from')
+    args = parser.parse_args()
+
+    entries = parse(args.catalogue)
+    expected = '{:08x}'.format(catalogue_id(entries))
+    source = open(args.input, errors='replace') if args.input else sys.stdin
+    with source:
+        for line in source:
+            announced = CATALOGUE.search(line)
+            if announced:
+                if announced.group(1) != expected:
+                    print('dlog_decode: firmware catalogue {} does not match {} ({})'.format(
+                        announced.group(1), expected, args.catalogue), file=sys.stderr)
+                sys.stdout.write(line)
+                continue
+            record = RECORD.search(line)
+            decoded = decode(record.group(1), entries) if record else None
+            if decoded is None:
+                sys.stdout.write(line)
+            else:
+                # Keep whatever the console printed before the record
+                sys.stdout.write(line[:record.start()] + decoded + '\n')
+            sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
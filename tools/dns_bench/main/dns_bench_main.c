@@ -0,0 +1,272 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "dns_engine.h"
+#include "dns_responder.h"
+
+#define UPSTREAM_PORT       15354
+/* Round trip from the SoftAP to the ISP resolver */
+#define UPSTREAM_DELAY_MS   30
+/* glibc and Android wait this long before retrying */
+#define CLIENT_TIMEOUT_MS   2000
+#define MAX_RUNS            1000
+#define ENGINE_LOOKUPS      1000000
+#define HOSTNAME            "lcu30h-home"
+
+static uint32_t s_latency_us[MAX_RUNS];
+static _Atomic bool s_upstream_silent;
+static int s_client = -1;
+
+static size_t build_query(uint8_t *msg, uint16_t id, const char *name, uint16_t type)
+{
+    memset(msg, 0, 12);
+    msg[0] = id >> 8;
+    msg[1] = id & 0xFF;
+    msg[2] = 0x01;          /* RD */
+    msg[5] = 1;             /* one question */
+    size_t pos = 12;
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t label = dot ? (size_t)(dot - name) : strlen(name);
+        msg[pos++] = label;
+        memcpy(msg + pos, name, label);
+        pos += label;
+        name += label + (dot ? 1 : 0);
+    }
+    msg[pos++] = 0;
+    msg[pos++] = type >> 8;
+    msg[pos++] = type & 0xFF;
+    msg[pos++] = 0;
+    msg[pos++] = 1;         /* IN */
+    return pos;
+}
+
+/* What a resolver sends back: the query plus one A record, TTL 300 */
+static size_t build_answer(uint8_t *msg, size_t query_len)
+{
+    static const uint8_t record[] = {
+        0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2C, 0x00, 0x04, 93, 184, 216, 34,
+    };
+    msg[2] = 0x81;          /* QR, RD */
+    msg[3] = 0x80;          /* RA */
+    msg[7] = 1;
+    memcpy(msg + query_len, record, sizeof(record));
+    return query_len + sizeof(record);
+}
+
+static void upstream_task(void *arg)
+{
+    int sock = *(int *)arg;
+    uint8_t msg[DNS_MSG_MAX];
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(sock, msg, sizeof(msg) - 16, 0, (struct sockaddr *)&from, &from_len);
+        if (len < 12 || atomic_load(&s_upstream_silent)) {
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS(UPSTREAM_DELAY_MS));
+        size_t answer_len = build_answer(msg, len);
+        sendto(sock, msg, answer_len, 0, (struct sockaddr *)&from, from_len);
+    }
+}
+
+static int udp_socket(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (sock >= 0 && bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* One lookup as a stub resolver makes it, without retries. Returns the
+ * microseconds to the answer, or -1 on timeout; *rcode is the answer's. */
+static int64_t lookup(uint16_t port, const char *name, int *rcode)
+{
+    uint8_t msg[DNS_MSG_MAX];
+    uint16_t id = rand() & 0xFFFF;
+    size_t len = build_query(msg, id, name, DNS_TYPE_A);
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+
+    int64_t start = esp_timer_get_time();
+    sendto(s_client, msg, len, 0, (struct sockaddr *)&to, sizeof(to));
+    while (esp_timer_get_time() - start < CLIENT_TIMEOUT_MS * 1000LL) {
+        int got = recv(s_client, msg, sizeof(msg), 0);
+        /* Late answers to earlier lookups are skipped */
+        if (got >= 12 && msg[0] == id >> 8 && msg[1] == (id & 0xFF)) {
+            *rcode = msg[3] & 0x0F;
+            return esp_timer_get_time() - start;
+        }
+    }
+    *rcode = -1;
+    return -1;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Look name up runs times; unique prefixes a fresh label every time so
+ * nothing comes from the cache */
+static void bench_run(const char *run, uint16_t port, const char *name, bool unique, int runs)
+{
+    uint32_t answered = 0;
+    uint32_t servfail = 0;
+    uint32_t timeouts = 0;
+    char fresh[DNS_NAME_MAX];
+    static uint32_t serial;
+
+    for (int i = 0; i < runs; i++) {
+        snprintf(fresh, sizeof(fresh), "n%lu.%s", (unsigned long)serial++, name);
+        int rcode;
+        int64_t us = lookup(port, unique ? fresh : name, &rcode);
+        if (us < 0) {
+            timeouts++;
+            us = CLIENT_TIMEOUT_MS * 1000LL;
+        } else if (rcode == 0) {
+            answered++;
+        } else if (rcode == DNS_RCODE_SERVFAIL) {
+            servfail++;
+        }
+        s_latency_us[i] = us;
+    }
+
+    qsort(s_latency_us, runs, sizeof(s_latency_us[0]), compare_u32);
+    printf("{\"run\": \"%s\", \"lookups\": %d, \"p50_us\": %lu, \"p99_us\": %lu, \"max_us\": %lu, "
+           "\"answered\": %lu, \"servfail\": %lu, \"timeouts\": %lu}\n",
+           run, runs, (unsigned long)s_latency_us[runs / 2], (unsigned long)s_latency_us[runs * 99 / 100],
+           (unsigned long)s_latency_us[runs - 1], (unsigned long)answered, (unsigned long)servfail,
+           (unsigned long)timeouts);
+}
+
+/* The table and the cache alone, without sockets */
+static void engine_run(void)
+{
+    static dns_engine_t engine;
+    dns_engine_config_t config = {
+        .ip = htonl(INADDR_LOOPBACK),
+        .hostname = HOSTNAME,
+        .captive = true,
+        .local_ttl_s = 300,
+        .cache_ttl_max_s = 60,
+        .stale_s = 600,
+    };
+    dns_engine_init(&engine, &config);
+
+    const char *const names[] = { HOSTNAME ".local", "captive.apple.com", "www.example.com" };
+    const char *const runs[] = { "engine_local", "engine_captive", "engine_cached" };
+    uint8_t query[DNS_MSG_MAX];
+    uint8_t out[DNS_MSG_MAX];
+    dns_question_t q;
+    size_t out_len;
+
+    /* Fill the cache, the entry looked up last */
+    for (int i = DNS_CACHE_ENTRIES - 1; i >= 0; i--) {
+        char name[32] = "www.example.com";
+        if (i) {
+            snprintf(name, sizeof(name), "filler%d.example.com", i);
+        }
+        size_t len = build_query(query, 1, name, DNS_TYPE_A);
+        dns_parse_question(query, len, &q);
+        dns_engine_store(&engine, &q, query, build_answer(query, len), 0);
+    }
+
+    for (int n = 0; n < 3; n++) {
+        size_t len = build_query(query, 1, names[n], DNS_TYPE_A);
+        uint32_t failures = 0;
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < ENGINE_LOOKUPS; i++) {
+            dns_verdict_t verdict = dns_engine_query(&engine, query, len, 1000, &q, out, &out_len);
+            failures += verdict != (n < 2 ? DNS_VERDICT_LOCAL : DNS_VERDICT_CACHED);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        printf("{\"run\": \"%s\", \"lookups\": %d, \"ns_per_lookup\": %.1f, \"cache_entries\": %d, "
+               "\"failures\": %lu}\n",
+               runs[n], ENGINE_LOOKUPS, elapsed * 1000.0 / ENGINE_LOOKUPS, DNS_CACHE_ENTRIES,
+               (unsigned long)failures);
+    }
+}
+
+void app_main(void)
+{
+    static int upstream;
+    upstream = udp_socket(UPSTREAM_PORT);
+    s_client = udp_socket(0);
+    struct timeval timeout = { .tv_usec = 100000 };
+    if (upstream < 0 || s_client < 0 ||
+            setsockopt(s_client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        printf("{\"run\": \"setup\", \"error\": \"sockets\"}\n");
+        return;
+    }
+    xTaskCreate(upstream_task, "upstream", 4096, &upstream, 5, NULL);
+
+    dns_responder_config_t config = {
+        .ip = htonl(INADDR_LOOPBACK),
+        .hostname = HOSTNAME,
+        .upstream_port = UPSTREAM_PORT,
+    };
+    ESP_ERROR_CHECK(dns_responder_start(&config));
+    dns_responder_set_upstream(htonl(INADDR_LOOPBACK));
+
+    engine_run();
+
+    /* Upstream up: the old path first, then every kind of answer */
+    bench_run("direct_up", UPSTREAM_PORT, "example.com", true, 50);
+    bench_run("local_hostname", CONFIG_DNS_RESPONDER_PORT, HOSTNAME ".local", false, MAX_RUNS);
+    bench_run("captive_probe", CONFIG_DNS_RESPONDER_PORT, "connectivitycheck.gstatic.com", false, MAX_RUNS);
+    bench_run("forward_miss", CONFIG_DNS_RESPONDER_PORT, "example.com", true, 50);
+    bench_run("forward_hit", CONFIG_DNS_RESPONDER_PORT, "www.example.com", false, MAX_RUNS);
+
+    /* Upstream silent with the uplink still up: the responder gives up
+     * before the client does; local names do not notice */
+    atomic_store(&s_upstream_silent, true);
+    bench_run("direct_down", UPSTREAM_PORT, "example.com", true, 3);
+    bench_run("silent_uncached", CONFIG_DNS_RESPONDER_PORT, "example.com", true, 3);
+    bench_run("silent_local", CONFIG_DNS_RESPONDER_PORT, HOSTNAME ".local", false, MAX_RUNS);
+
+    /* Uplink down: no waiting at all, stale answers where there are any */
+    dns_responder_set_upstream(0);
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_DNS_CACHE_TTL_MAX_S * 1000 + 100));
+    bench_run("down_stale", CONFIG_DNS_RESPONDER_PORT, "www.example.com", false, MAX_RUNS);
+    bench_run("down_uncached", CONFIG_DNS_RESPONDER_PORT, "example.com", true, 200);
+    bench_run("down_local", CONFIG_DNS_RESPONDER_PORT, HOSTNAME ".local", false, MAX_RUNS);
+
+    dns_responder_stats_t stats;
+    dns_responder_get_stats(&stats);
+    printf("{\"run\": \"stats\"");
+    for (int i = 0; i < DNS_VERDICT_MAX; i++) {
+        printf(", \"%s\": %lu", dns_verdict_to_str(i), (unsigned long)stats.counts[i]);
+    }
+    printf(", \"answered_upstream\": %lu, \"stale\": %lu, \"servfail\": %lu, \"upstream_timeouts\": %lu, "
+           "\"pending_max\": %lu}\n",
+           (unsigned long)stats.answered_upstream, (unsigned long)stats.stale, (unsigned long)stats.servfail,
+           (unsigned long)stats.upstream_timeouts, (unsigned long)stats.pending_max);
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,550 @@
+#!/usr/bin/env python3
+"""Fake Discord gateway and REST API for end-to-end runs of the bot.
+
+Serves both on one port, plain ws:// and HTTP, for the host build of the bot
+in tools/dc_host (CONFIG_DISCORD_HOST_PORT, 8765 by default):
+
+  gateway  GET /?v=10 upgraded to a WebSocket: HELLO, IDENTIFY or RESUME,
+           heartbeats, READY, then MESSAGE_CREATE dispatches. Dispatches
+           sent while the bot is disconnected are replayed on RESUME.
+  REST     POST /api/v10/channels/<id>/messages, the discord_message_send()
+           calls: recorded and answered with the created message, or with
+           a 429 while a rate_limit op of the trace is in force.
+
+Every trace starts the bot executable afresh (unless --bot is left out and a
+bot connects on its own), waits for it to identify and replays the trace
+against it. A trace is a JSON lines file, one op per line, times in ms from
+the start of the replay; blank lines and lines starting with # are skipped:
+
+  {"at": 0, "op": "message", "channel": "3001", "content": "!gate open",
+   "expect": "Gate opens", "repeat": 20, "every": 50}
+                message from a user; expect is a substring of the reply it
+                must get, repeat/every turn it into a series. Optional
+                "author", "guild" and "bot": true.
+  {"at": 500, "op": "reconnect"}       gateway asks for a reconnect (op 7)
+  {"at": 900, "op": "drop"}            connection cut without a close frame
+  {"at": 0, "op": "rate_limit", "count": 3, "retry_after": 0.5}
+                                       the next count sends get a 429
+
+The report, JSON on stdout or --output, has per trace:
+
+  reply_ms       message sent -> REST call carrying its reply, percentiles
+  gate_ms        message sent -> relay pulse of its gate command; commands
+                 the actuator coalesced with an earlier one get no pulse
+                 and are counted in gate_coalesced
+  dropped        messages with an expect whose reply never came within
+                 --settle seconds of the last op
+  out_of_order   replies posted ahead of the reply to an earlier message to
+                 the same channel
+  retry_gap_ms   429 -> next send to that channel, percentiles; sends
+                 sooner than the retry_after asked for are early_retries
+  heap           bytes allocated by the bot process, sampled every 100 ms
+                 (start, peak, end and the curve)
+
+With --baseline the same figures of an earlier report are printed next to
+the new ones, so a firmware change can be compared with the last run.
+"""
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import os
+import struct
+import sys
+import time
+
+from http_loadgen import percentile
+
+GATEWAY_PREFIX = '/?'
+MESSAGES_PREFIX = '/api/v10/channels/'
+WS_GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC11B85'
+BOT_USER = {'id': '900000000000000001', 'username': 'gate-bot', 'discriminator': '0', 'bot': True}
+DEFAULT_AUTHOR = '100000000000000001'
+DEFAULT_GUILD = '200000000000000001'
+GATE_ACTIONS = ('open', 'open-half', 'close')
+HEAP_CURVE_POINTS = 200
+
+
+def load_trace(path):
+    """The ops of a trace, series expanded, ordered by time."""
+    ops = []
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            try:
+                op = json.loads(line)
+            except ValueError as e:
+                sys.exit('{}:{}: {}'.format(path, number, e))
+            if op.get('op') not in ('message', 'reconnect', 'drop', 'rate_limit'):
+                sys.exit('{}:{}: unknown op {!r}'.format(path, number, op.get('op')))
+            repeat = op.pop('repeat', 1)
+            every = op.pop('every', 0)
+            for i in range(repeat):
+                ops.append(dict(op, at=op.get('at', 0) + i * every))
+    ops.sort(key=lambda op: op['at'])
+    return ops
+
+
+def gate_action(op):
+    """Gate action a message asks for, or None. Other bots are ignored."""
+    if op.get('bot'):
+        return None
+    words = op['content'].split()
+    if len(words) == 2 and words[0] == '!gate' and words[1] in GATE_ACTIONS:
+        return words[1]
+    return None
+
+
+class Gateway:
+    """Client WebSocket connection: frames from the bot are masked, ours are not."""
+
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+
+    async def recv(self):
+        """Next text message, None once the connection is closed."""
+        while True:
+            try:
+                head = await self.reader.readexactly(2)
+                length = head[1] & 0x7F
+                if length == 126:
+                    length = struct.unpack('!H', await self.reader.readexactly(2))[0]
+                elif length == 127:
+                    length = struct.unpack('!Q', await self.reader.readexactly(8))[0]
+                mask = await self.reader.readexactly(4) if head[1] & 0x80 else b'\0\0\0\0'
+                data = bytearray(await self.reader.readexactly(length))
+            except (asyncio.IncompleteReadError, ConnectionError):
+                return None
+            for i in range(len(data)):
+                data[i] ^= mask[i & 3]
+            opcode = head[0] & 0x0F
+            if opcode == 0x8:
+                return None
+            if opcode == 0x9:
+                self.send_frame(0xA, bytes(data))
+            elif opcode == 0x1:
+                return data.decode()
+
+    def send_frame(self, opcode, data):
+        if len(data) < 126:
+            head = struct.pack('!BB', 0x80 | opcode, len(data))
+        elif len(data) <= 0xFFFF:
+            head = struct.pack('!BBH', 0x80 | opcode, 126, len(data))
+        else:
+            head = struct.pack('!BBQ', 0x80 | opcode, 127, len(data))
+        self.writer.write(head + data)
+
+    def send(self, payload):
+        self.send_frame(0x1, json.dumps(payload).encode())
+
+    def abort(self):
+        self.writer.transport.abort()
+
+
+class FakeDiscord:
+    def __init__(self, heartbeat_ms):
+        self.heartbeat_ms = heartbeat_ms
+        self.reset()
+
+    def reset(self):
+        self.gateway = None
+        self.ready = asyncio.Event()
+        self.session_id = None
+        self.seq = 0
+        self.events = []            # (seq, payload) of the session, for resumes
+        self.next_id = 1100000000000000000
+        self.posts = []             # (time, channel, content) of accepted sends
+        self.attempts = []          # (time, channel, retry_after or None) of every send
+        self.rejected = 0
+        self.rate_limited = 0
+        self.retry_after = 1.0
+        self.counts = {'identify': 0, 'resume': 0, 'heartbeat': 0, 'replayed': 0}
+
+    def snowflake(self):
+        self.next_id += 1
+        return str(self.next_id)
+
+    async def handle(self, reader, writer):
+        try:
+            head = await reader.readuntil(b'\r\n\r\n')
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError):
+            writer.close()
+            return
+        lines = head.decode(errors='replace').split('\r\n')
+        method, path = lines[0].split(' ')[:2]
+        headers = {}
+        for line in lines[1:]:
+            if ':' in line:
+                name, value = line.split(':', 1)
+                headers[name.strip().lower()] = value.strip()
+
+        if method == 'GET' and path.startswith(GATEWAY_PREFIX) and headers.get('upgrade', '').lower() == 'websocket':
+            await self.serve_gateway(reader, writer, headers)
+        elif method == 'POST' and path.startswith(MESSAGES_PREFIX) and path.endswith('/messages'):
+            body = await reader.readexactly(int(headers.get('content-length', '0')))
+            self.serve_message(writer, path[len(MESSAGES_PREFIX):-len('/messages')], body)
+            await writer.drain()
+            writer.close()
+        else:
+            writer.write(b'HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n')
+            writer.close()
+
+    def serve_message(self, writer, channel, body):
+        now = time.monotonic()
+        if self.rate_limited > 0:
+            self.rate_limited -= 1
+            self.rejected += 1
+            status, answer = '429 Too Many Requests', {'message': 'You are being rate limited.',
+                                                       'retry_after': self.retry_after, 'global': False}
+            self.attempts.append((now, channel, self.retry_after))
+        else:
+            content = json.loads(body).get('content', '')
+            self.posts.append((now, channel, content))
+            self.attempts.append((now, channel, None))
+            status, answer = '200 OK', {'id': self.snowflake(), 'channel_id': channel, 'content': content,
+                                        'author': BOT_USER}
+        data = json.dumps(answer).encode()
+        writer.write('HTTP/1.1 {}\r\nContent-Type: application/json\r\nContent-Length: {}\r\n'
+                     'Connection: close\r\n\r\n'.format(status, len(data)).encode() + data)
+
+    async def serve_gateway(self, reader, writer, headers):
+        accept = base64.b64encode(hashlib.sha1((headers.get('sec-websocket-key', '') + WS_GUID)
+                                               .encode()).digest()).decode()
+        writer.write('HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n'
+                     'Sec-WebSocket-Accept: {}\r\n\r\n'.format(accept).encode())
+        gateway = Gateway(reader, writer)
+        gateway.send({'op': 10, 'd': {'heartbeat_interval': self.heartbeat_ms}, 's': None, 't': None})
+        live = False
+        while True:
+            text = await gateway.recv()
+            if text is None:
+                break
+            payload = json.loads(text)
+            op, d = payload.get('op'), payload.get('d')
+            if op == 1:
+                self.counts['heartbeat'] += 1
+                gateway.send({'op': 11})
+            elif op == 2:
+                self.counts['identify'] += 1
+                self.session_id = 'fake-{}'.format(self.snowflake())
+                self.seq = 0
+                self.events = []
+                self.gateway, live = gateway, True
+                self.dispatch('READY', {'v': 10, 'session_id': self.session_id, 'user': BOT_USER})
+                self.ready.set()
+            elif op == 6:
+                if d.get('session_id') != self.session_id:
+                    gateway.send({'op': 9, 'd': False})
+                    continue
+                self.counts['resume'] += 1
+                missed = [p for s, p in self.events if s > d.get('seq', 0)]
+                self.counts['replayed'] += len(missed)
+                for event in missed:
+                    gateway.send(event)
+                self.gateway, live = gateway, True
+                self.dispatch('RESUMED', {})
+            await writer.drain()
+        if live and self.gateway is gateway:
+            self.gateway = None
+        writer.close()
+
+    def dispatch(self, event, data):
+        self.seq += 1
+        payload = {'op': 0, 's': self.seq, 't': event, 'd': data}
+        if event != 'READY' and event != 'RESUMED':
+            self.events.append((self.seq, payload))
+        if self.gateway:
+            self.gateway.send(payload)
+
+    def message(self, op):
+        self.dispatch('MESSAGE_CREATE', {
+            'id': self.snowflake(),
+            'channel_id': str(op['channel']),
+            'guild_id': str(op.get('guild', DEFAULT_GUILD)),
+            'content': op['content'],
+            'author': {'id': str(op.get('author', DEFAULT_AUTHOR)), 'username': 'trace',
+                       'discriminator': '0', 'bot': bool(op.get('bot', False))},
+        })
+
+    def reconnect(self, drop):
+        gateway, self.gateway = self.gateway, None
+        if gateway and drop:
+            gateway.abort()
+        elif gateway:
+            gateway.send({'op': 7, 'd': None})
+
+
+class Bot:
+    """The bot process and what it prints: heap samples and relay pulses."""
+
+    def __init__(self):
+        self.proc = None
+        self.heap = []              # (time, bytes)
+        self.gates = []             # (time, action)
+        self.reader = None
+
+    async def start(self, path, log):
+        self.proc = await asyncio.create_subprocess_exec(path, stdin=asyncio.subprocess.DEVNULL,
+                                                         stdout=asyncio.subprocess.PIPE,
+                                                         stderr=asyncio.subprocess.STDOUT)
+        self.reader = asyncio.ensure_future(self.read(log))
+
+    async def read(self, log):
+        while True:
+            line = await self.proc.stdout.readline()
+            if not line:
+                return
+            now = time.monotonic()
+            if log:
+                log.write(line.decode(errors='replace'))
+            if not line.startswith(b'{'):
+                continue
+            try:
+                event = json.loads(line)
+            except ValueError:
+                continue
+            if event.get('ev') == 'heap':
+                self.heap.append((now, event['used']))
+            elif event.get('ev') == 'gate' and event.get('source') == 'discord':
+                self.gates.append((now, event['action']))
+
+    async def stop(self):
+        if self.proc and self.proc.returncode is None:
+            self.proc.terminate()
+            try:
+                await asyncio.wait_for(self.proc.wait(), 5)
+            except asyncio.TimeoutError:
+                self.proc.kill()
+                await self.proc.wait()
+        if self.reader:
+            await self.reader
+
+
+def summary(values):
+    values = sorted(values)
+    if not values:
+        return None
+    return {'p50': round(percentile(values, 50), 2), 'p90': round(percentile(values, 90), 2),
+            'p99': round(percentile(values, 99), 2), 'max': round(values[-1], 2), 'n': len(values)}
+
+
+def match_lines(sent, posts):
+    """Where the reply of every message with an expect went: (post, line)
+    per message index. Replies to one channel may be merged into one post,
+    one line each: every line answers one message."""
+    found = {}
+    for number, (post_time, channel, content) in enumerate(posts):
+        for line_number, line in enumerate(content.split('\n')):
+            for index, (sent_time, op) in enumerate(sent):
+                if (index not in found and 'expect' in op and str(op['channel']) == channel
+                        and sent_time <= post_time and op['expect'] in line):
+                    found[index] = (number, line_number)
+                    break
+    return found
+
+
+def match_replies(sent, posts):
+    """Reply latency per message with an expect."""
+    return {index: (posts[number][0] - sent[index][0]) * 1000
+            for index, (number, _) in match_lines(sent, posts).items()}
+
+
+def reply_order(sent, posts):
+    """Replies that reached their channel ahead of the reply to an earlier
+    message there. A refused send must not let later replies overtake it."""
+    found = match_lines(sent, posts)
+    overtaken = 0
+    for index, where in found.items():
+        channel = sent[index][1]['channel']
+        overtaken += any(later > index and sent[later][1]['channel'] == channel and found[later] < where
+                         for later in found)
+    return overtaken
+
+
+def retry_gaps(attempts):
+    """Time from every 429 to the next send to that channel, and how many of
+    those came before the retry_after Discord asked for."""
+    gaps = []
+    early = 0
+    for number, (refused_time, channel, retry_after) in enumerate(attempts):
+        if retry_after is None:
+            continue
+        following = [t for t, c, _ in attempts[number + 1:] if c == channel]
+        if following:
+            gaps.append((following[0] - refused_time) * 1000)
+            early += following[0] - refused_time < retry_after
+    return gaps, early
+
+
+def match_gates(sent, gates):
+    """Relay pulse latency per gate command: each pulse goes to the oldest
+    command for that action not yet matched that was sent before it."""
+    latency = {}
+    for gate_time, action in gates:
+        for index, (sent_time, op) in enumerate(sent):
+            if index not in latency and sent_time <= gate_time and gate_action(op) == action:
+                latency[index] = (gate_time - sent_time) * 1000
+                break
+    return latency
+
+
+def heap_summary(samples, t0):
+    if not samples:
+        return None
+    step = max(1, len(samples) // HEAP_CURVE_POINTS)
+    curve = [[round((t - t0) * 1000), used] for t, used in samples[::step]]
+    return {'start': samples[0][1], 'peak': max(used for _, used in samples), 'end': samples[-1][1],
+            'curve': curve}
+
+
+async def run_trace(fake, path, args, log):
+    ops = load_trace(path)
+    fake.reset()
+    bot = Bot()
+    if args.bot:
+        await bot.start(args.bot, log)
+    try:
+        try:
+            await asyncio.wait_for(fake.ready.wait(), args.connect_timeout)
+        except asyncio.TimeoutError:
+            sys.exit('{}: the bot did not identify within {} s'.format(path, args.connect_timeout))
+
+        t0 = time.monotonic()
+        sent = []
+        for op in ops:
+            delay = t0 + op['at'] / 1000.0 - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            if op['op'] == 'message':
+                sent.append((time.monotonic(), op))
+                fake.message(op)
+            elif op['op'] == 'rate_limit':
+                fake.rate_limited = op.get('count', 1)
+                fake.retry_after = op.get('retry_after', 1.0)
+            else:
+                fake.reconnect(op['op'] == 'drop')
+
+        # Until every expected reply came or the settle time is over
+        expected = sum(1 for _, op in sent if 'expect' in op)
+        deadline = time.monotonic() + args.settle
+        while time.monotonic() < deadline and len(match_replies(sent, fake.posts)) < expected:
+            await asyncio.sleep(0.1)
+        # Last heap samples after the work is done
+        await asyncio.sleep(0.3)
+    finally:
+        await bot.stop()
+
+    replies = match_replies(sent, fake.posts)
+    gaps, early = retry_gaps(fake.attempts)
+    gates = match_gates(sent, bot.gates)
+    gate_commands = [i for i, (_, op) in enumerate(sent) if gate_action(op)]
+    dropped = [op['content'] for i, (_, op) in enumerate(sent) if 'expect' in op and i not in replies]
+    return {
+        'trace': os.path.basename(path),
+        'messages': len(sent),
+        'commands': expected,
+        'replies': len(replies),
+        'dropped': len(dropped),
+        'dropped_commands': dropped[:20],
+        'reply_ms': summary(replies.values()),
+        'gate_commands': len(gate_commands),
+        'gate_pulses': len(bot.gates),
+        'gate_coalesced': len(gate_commands) - len(gates),
+        'gate_ms': summary(gates.values()),
+        'posts': len(fake.posts),
+        'posts_rejected': fake.rejected,
+        'retry_gap_ms': summary(gaps),
+        'early_retries': early,
+        'out_of_order': reply_order(sent, fake.posts),
+        'gateway': dict(fake.counts),
+        'heap': heap_summary(bot.heap, t0),
+    }
+
+
+FIGURES = (
+    ('reply p50 ms', lambda r: (r['reply_ms'] or {}).get('p50')),
+    ('reply p99 ms', lambda r: (r['reply_ms'] or {}).get('p99')),
+    ('gate p50 ms', lambda r: (r['gate_ms'] or {}).get('p50')),
+    ('gate p99 ms', lambda r: (r['gate_ms'] or {}).get('p99')),
+    ('dropped', lambda r: r['dropped']),
+    ('out of order', lambda r: r['out_of_order']),
+    ('early retries', lambda r: r['early_retries']),
+    ('posts', lambda r: r['posts']),
+    ('heap peak', lambda r: (r['heap'] or {}).get('peak')),
+    ('heap end-start', lambda r: r['heap'] and r['heap']['end'] - r['heap']['start']),
+)
+
+
+def compare(report, baseline):
+    """Print the figures of every trace next to those of the baseline run."""
+    previous = {run['trace']: run for run in baseline.get('runs', [])}
+    for run in report['runs']:
+        old = previous.get(run['trace'])
+        print('{}:'.format(run['trace']), file=sys.stderr)
+        for name, get in FIGURES:
+            new_value = get(run)
+            old_value = get(old) if old else None
+            delta = ''
+            if isinstance(new_value, (int, float)) and isinstance(old_value, (int, float)):
+                delta = '{:+.2f}'.format(new_value - old_value).rstrip('0').rstrip('.')
+                if old_value:
+                    delta += ' ({:+.1f}%)'.format((new_value - old_value) * 100.0 / old_value)
+            print('  {:<16} {:>12} {:>12}  {}'.format(name, str(old_value), str(new_value), delta), file=sys.stderr)
+
+
+async def amain(args):
+    fake = FakeDiscord(args.heartbeat)
+    server = await asyncio.start_server(fake.handle, args.host, args.port)
+    log = open(args.log, 'w') if args.log else None
+    report = {'tool': 'fake_discord', 'bot': args.bot, 'timestamp': int(time.time()), 'runs': []}
+    try:
+        for path in args.traces:
+            result = await run_trace(fake, path, args, log)
+            print('{trace:<20} commands {commands:<4} dropped {dropped:<3} out of order {out_of_order:<3} '
+                  'early retries {early_retries:<3} reply p50 {p50} ms  p99 {p99} ms'
+                  .format(p50=(result['reply_ms'] or {}).get('p50'), p99=(result['reply_ms'] or {}).get('p99'),
+                          **result), file=sys.stderr)
+            report['runs'].append(result)
+    finally:
+        server.close()
+        await server.wait_closed()
+        if log:
+            log.close()
+    return report
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('traces', nargs='+', help='trace files (e.g. tools/dc_traces/*.jsonl)')
+    parser.add_argument('--bot', help='bot executable to start for every trace '
+                                      '(e.g. tools/dc_host/build/dc_host.elf)')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=8765, help='CONFIG_DISCORD_HOST_PORT of the bot')
+    parser.add_argument('--heartbeat', type=int, default=41250, help='gateway heartbeat interval in ms')
+    parser.add_argument('--settle', type=float, default=15.0,
+                        help='seconds to wait for outstanding replies after the last op')
+    parser.add_argument('--connect-timeout', type=float, default=30.0)
+    parser.add_argument('--log', help='write the output of the bot here')
+    parser.add_argument('--baseline', help='earlier report to compare with')
+    parser.add_argument('--output', help='write the JSON report here instead of stdout')
+    args = parser.parse_args()
+
+    report = asyncio.run(amain(args))
+    if args.baseline:
+        with open(args.baseline) as f:
+            compare(report, json.load(f))
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,313 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "gate_actuator.h"
+#include "gate_arbiter.h"
+#include "gate_sim.h"
+
+#define US_PER_MS       1000LL
+
+/* Replayed storm of conflicting commands */
+#define STORM_COMMANDS  20000
+#define STORM_GAP_MAX_MS 400
+#define STORM_BURST     6
+/* A relay press fails this often */
+#define STORM_FAULT_EVERY 2500
+
+/* Live run through the actuator task */
+#define LIVE_TASKS      3
+#define LIVE_COMMANDS   2000
+
+static const gate_timing_t s_timing = {
+    .full_travel_ms = 20000,
+    .half_travel_ms = 6000,
+    .pulse_ms = 500,
+    .gap_ms = 300,
+};
+
+static int64_t s_now;
+static uint32_t s_rng = 0x9e3779b9;
+static uint8_t s_completions[STORM_COMMANDS];
+static uint32_t s_results[3];   /* ok, replaced, failed */
+
+static uint32_t rng_next(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static int64_t virtual_clock(void *ctx)
+{
+    return s_now;
+}
+
+static void storm_done(gate_action_t action, esp_err_t result, void *ctx)
+{
+    s_completions[(uintptr_t)ctx]++;
+    s_results[result == ESP_OK ? 0 : result == ESP_ERR_INVALID_STATE ? 1 : 2]++;
+}
+
+/* Every command sent to the simulated controller on a virtual clock, with
+ * the arbiter's idea of the gate checked against the simulated leaf at
+ * every step */
+static void storm_run(void)
+{
+    static gate_arbiter_t arb;
+    static gate_sim_t sim;
+    gate_sim_config_t sim_config = {
+        .full_travel_ms = s_timing.full_travel_ms,
+        .half_travel_ms = s_timing.half_travel_ms,
+        .min_pulse_ms = s_timing.pulse_ms,
+        .min_gap_ms = s_timing.gap_ms,
+        .clock = virtual_clock,
+    };
+    gate_arbiter_config_t config = { .timing = s_timing };
+    uint32_t mismatches = 0;
+    uint32_t max_outstanding = 0;
+    uint32_t completed = 0;
+    int64_t busy_us = 0;
+    /* The same stream through a first-in first-out queue of pulses */
+    int64_t fifo_free_us = 0;
+    int64_t fifo_max_wait_us = 0;
+
+    s_now = 1000 * US_PER_MS;
+    gate_sim_init(&sim, &sim_config);
+    gate_sim_hal(&sim, &config.hal);
+    gate_arbiter_init(&arb, &config, s_now);
+
+    for (int i = 0; i < STORM_COMMANDS; i++) {
+        int64_t next = s_now + (i % STORM_BURST ? (int64_t)(rng_next() % 20) * US_PER_MS :
+                                (int64_t)(rng_next() % STORM_GAP_MAX_MS) * US_PER_MS);
+        /* Wake up at every deadline, as the actuator task does */
+        int64_t due;
+        while ((due = gate_arbiter_poll(&arb, s_now)) && due <= next) {
+            s_now = due;
+        }
+        s_now = next;
+        if (i % STORM_FAULT_EVERY == STORM_FAULT_EVERY - 1) {
+            gate_sim_fail_next(&sim, 1);
+        }
+
+        gate_request_t request = {
+            .action = rng_next() % GATE_ACTION_MAX,
+            .source = rng_next() % GATE_SOURCE_MAX,
+            .event_time_us = s_now,
+            .done_cb = storm_done,
+            .ctx = (void *)(uintptr_t)i,
+        };
+        int64_t start = esp_timer_get_time();
+        gate_arbiter_submit(&arb, &request, s_now);
+        busy_us += esp_timer_get_time() - start;
+
+        /* After a fault the arbiter claims nothing about the state */
+        if (gate_arbiter_position(&arb, s_now) != gate_sim_position(&sim) ||
+                (gate_arbiter_state(&arb) != GATE_STATE_FAULT && gate_arbiter_state(&arb) != gate_sim_state(&sim))) {
+            mismatches++;
+        }
+        completed = s_results[0] + s_results[1] + s_results[2];
+        if (i + 1 - completed > max_outstanding) {
+            max_outstanding = i + 1 - completed;
+        }
+
+        int64_t fifo_start = fifo_free_us > s_now ? fifo_free_us : s_now;
+        fifo_max_wait_us = fifo_start - s_now > fifo_max_wait_us ? fifo_start - s_now : fifo_max_wait_us;
+        fifo_free_us = fifo_start + (s_timing.pulse_ms + s_timing.gap_ms) * US_PER_MS;
+    }
+
+    /* Let everything finish */
+    int64_t due;
+    while ((due = gate_arbiter_poll(&arb, s_now))) {
+        s_now = due;
+    }
+    uint32_t lost = 0;
+    uint32_t twice = 0;
+    for (int i = 0; i < STORM_COMMANDS; i++) {
+        lost += s_completions[i] == 0;
+        twice += s_completions[i] > 1;
+    }
+    bool final_match = gate_arbiter_position(&arb, s_now) == gate_sim_position(&sim) &&
+                       (gate_arbiter_state(&arb) == GATE_STATE_FAULT || gate_arbiter_state(&arb) == gate_sim_state(&sim));
+
+    printf("{\"run\": \"storm\", \"commands\": %d, \"pulses\": %lu, \"redundant\": %lu, \"replaced\": %lu, "
+           "\"faults\": %lu, \"done_ok\": %lu, \"done_replaced\": %lu, \"done_failed\": %lu, \"lost\": %lu, "
+           "\"completed_twice\": %lu, \"max_outstanding\": %lu, \"mismatches\": %lu, \"final_match\": %s, "
+           "\"controller_accepted\": %lu, \"controller_ignored\": %lu, \"overlaps\": %lu, \"submit_ns\": %.0f, "
+           "\"fifo_pulses\": %d, \"fifo_max_wait_s\": %lld}\n",
+           STORM_COMMANDS, (unsigned long)arb.stats.pulses, (unsigned long)arb.stats.redundant,
+           (unsigned long)arb.stats.superseded, (unsigned long)arb.stats.faults, (unsigned long)s_results[0],
+           (unsigned long)s_results[1], (unsigned long)s_results[2], (unsigned long)lost, (unsigned long)twice,
+           (unsigned long)max_outstanding, (unsigned long)mismatches, final_match ? "true" : "false",
+           (unsigned long)sim.stats.accepted, (unsigned long)(sim.stats.short_pulses + sim.stats.early_pulses),
+           (unsigned long)sim.stats.overlaps, busy_us * 1000.0 / STORM_COMMANDS, STORM_COMMANDS,
+           (long long)(fifo_max_wait_us / (1000 * US_PER_MS)));
+}
+
+/* Let the arbiter carry out everything due, on the virtual clock */
+static void settle(gate_arbiter_t *arb)
+{
+    int64_t due;
+    while ((due = gate_arbiter_poll(arb, s_now))) {
+        s_now = due;
+    }
+}
+
+/* One pulse straight into the simulated controller, as the handheld remote
+ * or the auto-close would: the arbiter does not see it */
+static void remote_press(gate_sim_t *sim, const gate_hal_t *hal, gate_action_t action)
+{
+    s_now += s_timing.gap_ms * US_PER_MS;
+    hal->set_input(hal->ctx, action, true);
+    s_now += s_timing.pulse_ms * US_PER_MS;
+    hal->set_input(hal->ctx, action, false);
+    s_now += s_timing.full_travel_ms * US_PER_MS;
+}
+
+/* Repeats are only dropped while the gate is still moving: once it has
+ * settled, "open" pulses again, and brings the gate back after the remote
+ * closed it behind the arbiter's back */
+static void settled_run(void)
+{
+    static gate_arbiter_t arb;
+    static gate_sim_t sim;
+    gate_sim_config_t sim_config = {
+        .full_travel_ms = s_timing.full_travel_ms,
+        .half_travel_ms = s_timing.half_travel_ms,
+        .min_pulse_ms = s_timing.pulse_ms,
+        .min_gap_ms = s_timing.gap_ms,
+        .clock = virtual_clock,
+    };
+    gate_arbiter_config_t config = { .timing = s_timing };
+    gate_request_t open = { .action = GATE_ACTION_OPEN, .source = GATE_SOURCE_HTTP };
+
+    s_now = 1000 * US_PER_MS;
+    gate_sim_init(&sim, &sim_config);
+    gate_sim_hal(&sim, &config.hal);
+    gate_arbiter_init(&arb, &config, s_now);
+
+    gate_verdict_t first = gate_arbiter_submit(&arb, &open, s_now);
+    s_now += (s_timing.pulse_ms + s_timing.full_travel_ms / 2) * US_PER_MS;
+    gate_arbiter_poll(&arb, s_now);
+    gate_verdict_t moving = gate_arbiter_submit(&arb, &open, s_now);
+    settle(&arb);
+
+    /* Past the travel time, the model and the gate agree on open */
+    s_now += s_timing.full_travel_ms * US_PER_MS;
+    gate_verdict_t settled = gate_arbiter_submit(&arb, &open, s_now);
+    settle(&arb);
+    bool settled_open = gate_sim_state(&sim) == GATE_STATE_OPEN;
+
+    /* The remote closes it; the model still says open */
+    remote_press(&sim, &config.hal, GATE_ACTION_CLOSE);
+    bool remote_closed = gate_sim_state(&sim) == GATE_STATE_CLOSED;
+    gate_verdict_t after_remote = gate_arbiter_submit(&arb, &open, s_now);
+    settle(&arb);
+    /* The arbiter thinks the leaf never moved; give it the time to reopen */
+    s_now += s_timing.full_travel_ms * US_PER_MS;
+    bool reopened = gate_sim_state(&sim) == GATE_STATE_OPEN;
+
+    bool pass = first == GATE_VERDICT_STARTED && moving == GATE_VERDICT_REDUNDANT &&
+                settled == GATE_VERDICT_STARTED && settled_open && remote_closed &&
+                after_remote == GATE_VERDICT_STARTED && reopened;
+    printf("{\"run\": \"settled\", \"while_moving\": \"%s\", \"after_travel\": \"%s\", \"after_remote_close\": \"%s\", "
+           "\"reopened\": %s, \"pulses\": %lu, \"redundant\": %lu, \"controller_accepted\": %lu, \"pass\": %s}\n",
+           moving == GATE_VERDICT_REDUNDANT ? "redundant" : "pulsed",
+           settled == GATE_VERDICT_STARTED ? "pulsed" : "dropped",
+           after_remote == GATE_VERDICT_STARTED ? "pulsed" : "dropped", reopened ? "true" : "false",
+           (unsigned long)arb.stats.pulses, (unsigned long)arb.stats.redundant, (unsigned long)sim.stats.accepted,
+           pass ? "true" : "false");
+}
+
+static gate_sim_t s_live_sim;
+static atomic_uint s_live_done;
+static atomic_uint s_live_rejected;
+static TaskHandle_t s_main_task;
+
+static void live_done(gate_action_t action, esp_err_t result, void *ctx)
+{
+    atomic_fetch_add(&s_live_done, 1);
+}
+
+static void live_task(void *arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+    for (int i = 0; i < LIVE_COMMANDS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        gate_request_t request = {
+            .action = seed % GATE_ACTION_MAX,
+            .source = (uintptr_t)arg % GATE_SOURCE_MAX,
+            .done_cb = live_done,
+        };
+        if (gate_actuator_submit(&request) != ESP_OK) {
+            atomic_fetch_add(&s_live_rejected, 1);
+        }
+        if (seed % 4 == 0) {
+            vTaskDelay(1);
+        }
+    }
+    xTaskNotifyGive(s_main_task);
+    vTaskDelete(NULL);
+}
+
+/* Several tasks hammering the real actuator task, which drives the
+ * simulated controller with the Kconfig timing */
+static void live_run(void)
+{
+    gate_sim_config_t sim_config = {
+        .full_travel_ms = CONFIG_GATE_TRAVEL_FULL_MS,
+        .half_travel_ms = CONFIG_GATE_TRAVEL_HALF_MS,
+        .min_pulse_ms = CONFIG_GATE_RELAY_PULSE_MS,
+        .min_gap_ms = CONFIG_GATE_RELAY_GAP_MS,
+    };
+    gate_hal_t hal;
+    gate_status_t status;
+
+    gate_sim_init(&s_live_sim, &sim_config);
+    gate_sim_hal(&s_live_sim, &hal);
+    ESP_ERROR_CHECK(gate_actuator_start_hal(&hal));
+
+    s_main_task = xTaskGetCurrentTaskHandle();
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < LIVE_TASKS; i++) {
+        xTaskCreate(live_task, "live", 3072, (void *)(uintptr_t)i, 5, NULL);
+    }
+    for (int i = 0; i < LIVE_TASKS; i++) {
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    /* Long enough for the last pulse and the travel after it */
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_GATE_RELAY_PULSE_MS + CONFIG_GATE_RELAY_GAP_MS * 2 +
+                             CONFIG_GATE_TRAVEL_FULL_MS + 100));
+
+    gate_actuator_get_status(&status);
+    gate_state_t sim_state = gate_sim_state(&s_live_sim);
+    unsigned submitted = LIVE_TASKS * LIVE_COMMANDS;
+    printf("{\"run\": \"live\", \"commands\": %u, \"rejected\": %u, \"done\": %u, \"pulses\": %lu, "
+           "\"redundant\": %lu, \"replaced\": %lu, \"queue_max\": %lu, \"queue_len\": %d, \"state\": \"%s\", "
+           "\"controller_state\": \"%s\", \"controller_ignored\": %lu, \"overlaps\": %lu, \"commands_per_s\": %.0f}\n",
+           submitted, atomic_load(&s_live_rejected), atomic_load(&s_live_done), (unsigned long)status.pulses,
+           (unsigned long)status.redundant, (unsigned long)status.superseded, (unsigned long)status.queue_max,
+           CONFIG_GATE_ACTUATOR_QUEUE_LEN, gate_state_to_str(status.state), gate_state_to_str(sim_state),
+           (unsigned long)(s_live_sim.stats.short_pulses + s_live_sim.stats.early_pulses),
+           (unsigned long)s_live_sim.stats.overlaps, submitted * 1e6 / elapsed_us);
+}
+
+void app_main(void)
+{
+    storm_run();
+    settled_run();
+    live_run();
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Generate the Discord bot command dispatcher from commands.def.
+
+The output is a C fragment included by dc_bot.c. It declares the handlers,
+holds the command table with argument counts and usage strings, the command
+names, the help text, and a switch-based lookup that matches the command and subcommand
+by length first and then by memcmp, so unknown input is rejected without
+copying or tokenizing the message.
+"""
+import argparse
+import re
+import sys
+from collections import OrderedDict
+
+MAX_ARGS = 4
+
+
+def c_str(text):
+    return '"' + text.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n') + '"'
+
+
+def parse(path):
+    entries = []
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            cols = [c.strip() for c in line.split('|')]
+            if len(cols) != 5:
+                sys.exit('{}:{}: expected 5 columns'.format(path, lineno))
+            cmd, sub, args, handler, help_text = cols
+            if not re.fullmatch(r'[a-z][a-z0-9-]*', cmd) or not re.fullmatch(r'-|[a-z][a-z0-9-]*', sub):
+                sys.exit('{}:{}: bad command name'.format(path, lineno))
+
+            arg_specs = args.split()
+            min_args = sum(1 for a in arg_specs if a.startswith('<'))
+            rest = bool(arg_specs) and arg_specs[-1].rstrip('>]').endswith('...')
+            if len(arg_specs) > MAX_ARGS:
+                sys.exit('{}:{}: at most {} arguments'.format(path, lineno, MAX_ARGS))
+            usage = ' '.join(['!' + cmd] + ([] if sub == '-' else [sub]) + arg_specs)
+            entries.append(dict(cmd=cmd, sub=None if sub == '-' else sub, handler=handler, help=help_text,
+                                min_args=min_args, max_args=len(arg_specs), rest=rest, usage=usage))
+    return entries
+
+
+def emit_match(out, indent, var, candidates):
+    """Emit a switch on <var>_len dispatching to the per-name bodies."""
+    by_len = OrderedDict()
+    for name, body in candidates:
+        by_len.setdefault(len(name), []).append((name, body))
+    pad = ' ' * indent
+    out.append('{}switch ({}_len) {{'.format(pad, var))
+    for length in sorted(by_len):
+        out.append('{}case {}:'.format(pad, length))
+        for name, body in by_len[length]:
+            out.append('{}    if (memcmp({}, {}, {}) == 0) {{'.format(pad, var, c_str(name), length))
+            body(out, indent + 8)
+            out.append('{}    }}'.format(pad))
+        out.append('{}    break;'.format(pad))
+    out.append('{}}}'.format(pad))
+
+
+def generate(entries, stubs=False):
+    out = ['/* Generated by tools/gen_dc_commands.py from commands.def - do not edit */', '']
+    for e in entries:
+        if stubs:
+            out.append('static esp_err_t {}(discord_message_t *msg, const dc_args_t *args) {{ return ESP_OK; }}'.format(
+                e['handler']))
+        else:
+            out.append('static esp_err_t {}(discord_message_t *msg, const dc_args_t *args);'.format(e['handler']))
+    out.append('')
+
+    out.append('static const dc_command_t s_dc_commands[] = {')
+    for e in entries:
+        out.append('    {{ {}, {}, {}, {}, {}, {} }},'.format(
+            e['handler'], e['min_args'], e['max_args'], 'true' if e['rest'] else 'false',
+            c_str('`{}`'.format(e['usage'])), c_str(e['help'])))
+    out.append('};')
+    out.append('#define DC_COMMAND_COUNT {}'.format(len(entries)))
+    out.append('')
+
+    out.append('/* "command subcommand" of every entry, e.g. for per-command metrics */')
+    out.append('static const char *const s_dc_command_names[DC_COMMAND_COUNT] = {')
+    for e in entries:
+        out.append('    {},'.format(c_str(e['cmd'] if e['sub'] is None else '{} {}'.format(e['cmd'], e['sub']))))
+    out.append('};')
+    out.append('')
+
+    help_lines = ['`{}` - {}'.format(e['usage'], e['help']) for e in entries]
+    out.append('static const char s_dc_help_text[] =')
+    for line in help_lines[:-1]:
+        out.append('    {}'.format(c_str(line + '\n')))
+    out.append('    {};'.format(c_str(help_lines[-1])))
+    out.append('')
+
+    commands = OrderedDict()
+    for index, e in enumerate(entries):
+        commands.setdefault(e['cmd'], []).append((index, e))
+
+    out.append('/* Returns the command index, DC_CMD_UNKNOWN or DC_CMD_UNKNOWN_SUB.')
+    out.append(' * *consumed_sub is set when the subcommand token was part of the match. */')
+    out.append('static int dc_command_find(const char *cmd, size_t cmd_len, const char *sub, size_t sub_len, bool *consumed_sub)')
+    out.append('{')
+
+    def command_body(subs):
+        def body(lines, indent):
+            pad = ' ' * indent
+            plain = [index for index, e in subs if e['sub'] is None]
+            named = [(e['sub'], index) for index, e in subs if e['sub'] is not None]
+            if named:
+                def sub_body(index):
+                    def inner(lines, indent):
+                        lines.append('{}*consumed_sub = true;'.format(' ' * indent))
+                        lines.append('{}return {};'.format(' ' * indent, index))
+                    return inner
+                emit_match(lines, indent, 'sub', [(name, sub_body(index)) for name, index in named])
+            if plain:
+                lines.append('{}return {};'.format(pad, plain[0]))
+            else:
+                lines.append('{}return DC_CMD_UNKNOWN_SUB;'.format(pad))
+        return body
+
+    out.append('    *consumed_sub = false;')
+    emit_match(out, 4, 'cmd', [(name, command_body(subs)) for name, subs in commands.items()])
+    out.append('    return DC_CMD_UNKNOWN;')
+    out.append('}')
+    out.append('')
+
+    out.append('/* Usage of every subcommand of a command, for unknown-subcommand replies */')
+    out.append('static const char *dc_command_usage(const char *cmd, size_t cmd_len)')
+    out.append('{')
+
+    def usage_body(subs):
+        def body(lines, indent):
+            usage = ', '.join('`{}`'.format(e['usage']) for _, e in subs)
+            lines.append('{}return {};'.format(' ' * indent, c_str(usage)))
+        return body
+
+    emit_match(out, 4, 'cmd', [(name, usage_body(subs)) for name, subs in commands.items()])
+    out.append('    return NULL;')
+    out.append('}')
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('definition')
+    parser.add_argument('output')
+    parser.add_argument('--stubs', action='store_true',
+                        help='define every handler as a no-op, for tools/dc_dispatch_bench')
+    args = parser.parse_args()
+
+    code = generate(parse(args.definition), args.stubs)
+    with open(args.output, 'w') as f:
+        f.write(code)
+
+
+if __name__ == '__main__':
+    main()
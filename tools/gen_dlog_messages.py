@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""Generate dlog_messages.h from the deferred log catalogue (messages.def).
+
+The header gives every message an ID (its position in the catalogue) and
+its level, tag and format as macros, so DLOG(name, ...) resolves all of them
+at compile time, plus an X-macro list for the on-device format table and a
+catalogue ID the host decoder checks against. Formats are validated here:
+the record only carries 32-bit integers and strings.
+"""
+import argparse
+import re
+import sys
+import zlib
+
+MAX_ARGS = 4
+LEVELS = {'E': 'ESP_LOG_ERROR', 'W': 'ESP_LOG_WARN', 'I': 'ESP_LOG_INFO', 'D': 'ESP_LOG_DEBUG',
+          'V': 'ESP_LOG_VERBOSE'}
+# flags, width, precision, length, conversion; * and 64-bit lengths are not supported
+SPEC = re.compile(r'%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|l)?([diouxXcs%])')
+ANY_SPEC = re.compile(r'%[^a-zA-Z%]*[a-zA-Z%]')
+
+
+def c_str(text):
+    return '"' + text.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def conversions(fmt):
+    """Conversion characters of fmt in order, without %%."""
+    return [m.group(5) for m in SPEC.finditer(fmt) if m.group(5) != '%']
+
+
+def parse(path):
+    """List of (name, level, tag, format) in catalogue order."""
+    entries = []
+    names = set()
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            cols = [c.strip() for c in line.split('|', 3)]
+            if len(cols) != 4:
+                sys.exit('{}:{}: expected 4 columns'.format(path, lineno))
+            name, level, tag, fmt = cols
+            if not re.fullmatch(r'[A-Z][A-Z0-9_]*', name) or name in names:
+                sys.exit('{}:{}: bad or duplicate message name'.format(path, lineno))
+            if level not in LEVELS:
+                sys.exit('{}:{}: level must be one of {}'.format(path, lineno, ' '.join(LEVELS)))
+            if len(ANY_SPEC.findall(fmt)) != len(SPEC.findall(fmt)):
+                sys.exit('{}:{}: unsupported conversion in "{}"'.format(path, lineno, fmt))
+            if len(conversions(fmt)) > MAX_ARGS:
+                sys.exit('{}:{}: at most {} arguments'.format(path, lineno, MAX_ARGS))
+            names.add(name)
+            entries.append((name, level, tag, fmt))
+    return entries
+
+
+def catalogue_id(entries):
+    text = ''.join('{}|{}|{}|{}\n'.format(*e) for e in entries)
+    return zlib.crc32(text.encode()) & 0xFFFFFFFF
+
+
+def generate(entries):
+    out = ['/* Generated by tools/gen_dlog_messages.py from messages.def, do not edit */',
+           '#pragma once',
+           '',
+           '#define DLOG_CATALOGUE_ID 0x{:08x}u'.format(catalogue_id(entries)),
+           '',
+           'typedef enum {']
+    out += ['    DLOG_ID_{},'.format(name) for name, _, _, _ in entries]
+    out += ['    DLOG_MESSAGE_COUNT,', '} dlog_id_t;', '']
+    for name, level, tag, fmt in entries:
+        out.append('#define DLOG_LEVEL_{} {}'.format(name, LEVELS[level]))
+        out.append('#define DLOG_TAG_{} {}'.format(name, c_str(tag)))
+        out.append('#define DLOG_FMT_{} {}'.format(name, c_str(fmt)))
+    out += ['', '#define DLOG_FOR_EACH_MESSAGE(X) \\']
+    out += ['    X({}) \\'.format(name) for name, _, _, _ in entries]
+    out += ['', '']
+    return '\n'.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('catalogue', help='messages.def')
+    parser.add_argument('output', help='generated header')
+    args = parser.parse_args()
+
+    text = generate(parse(args.catalogue))
+    with open(args.output, 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
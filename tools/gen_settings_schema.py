@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Generate settings_schema.h from the run-time settings schema (schema.def).
+
+The header holds the settings_t snapshot with one member per field, the
+schema version, a layout ID that changes with any field added, removed,
+retyped or resized (so a stored snapshot is never read with the wrong
+layout), and an X-macro list settings.c builds the defaults, the field table
+and the parsers from. Ranges and flags are validated here.
+"""
+import argparse
+import re
+import sys
+import zlib
+
+TYPES = ('str', 'u32', 'bool', 'ids')
+FLAGS = {'secret': 'SETTINGS_FLAG_SECRET', 'restart': 'SETTINGS_FLAG_RESTART',
+         'optional': 'SETTINGS_FLAG_OPTIONAL'}
+# Must match settings.h
+IDS_MAX = 8
+# One bit per field in the draft change mask
+FIELDS_MAX = 32
+
+
+def c_str(text):
+    return '"' + text.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def parse(path):
+    """Schema version and list of field dicts in schema order."""
+    version = None
+    fields = []
+    names = set()
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            m = re.fullmatch(r'version\s+(\d+)', line)
+            if m:
+                version = int(m.group(1))
+                continue
+            cols = [c.strip() for c in line.split('|', 5)]
+            if len(cols) != 6:
+                sys.exit('{}:{}: expected 6 columns'.format(path, lineno))
+            name, ftype, rng, default, flags, help_text = cols
+            if not re.fullmatch(r'[a-z][a-z0-9_]*', name) or name in names:
+                sys.exit('{}:{}: bad or duplicate field name'.format(path, lineno))
+            if ftype not in TYPES:
+                sys.exit('{}:{}: type must be one of {}'.format(path, lineno, ' '.join(TYPES)))
+            if ftype == 'bool':
+                if rng != '-':
+                    sys.exit('{}:{}: bool fields take no range'.format(path, lineno))
+                lo, hi = 0, 1
+            else:
+                m = re.fullmatch(r'(\d+)\.\.(\d+)', rng)
+                if not m or int(m.group(1)) > int(m.group(2)):
+                    sys.exit('{}:{}: range must be min..max'.format(path, lineno))
+                lo, hi = int(m.group(1)), int(m.group(2))
+            if ftype == 'ids' and hi > IDS_MAX:
+                sys.exit('{}:{}: at most {} IDs'.format(path, lineno, IDS_MAX))
+            if ftype == 'str' and hi > 255:
+                sys.exit('{}:{}: strings are at most 255 bytes'.format(path, lineno))
+            flag_list = [] if flags == '-' else [f.strip() for f in flags.split(',')]
+            if any(f not in FLAGS for f in flag_list):
+                sys.exit('{}:{}: flags must be among {}'.format(path, lineno, ' '.join(FLAGS)))
+            if 'optional' in flag_list and ftype != 'str':
+                sys.exit('{}:{}: only str fields can be optional'.format(path, lineno))
+            names.add(name)
+            fields.append(dict(name=name, type=ftype, lo=lo, hi=hi, default=default, flags=flag_list,
+                               help=help_text))
+    if version is None:
+        sys.exit('{}: missing version line'.format(path))
+    if len(fields) > FIELDS_MAX:
+        sys.exit('{}: at most {} fields'.format(path, FIELDS_MAX))
+    return version, fields
+
+
+def layout_id(fields):
+    """Changes whenever the stored snapshot would be laid out differently"""
+    text = ''.join('{}|{}|{}\n'.format(f['name'], f['type'], f['hi'] if f['type'] in ('str', 'ids') else '')
+                   for f in fields)
+    return zlib.crc32(text.encode()) & 0xFFFFFFFF
+
+
+def member(field):
+    if field['type'] == 'str':
+        return 'char {}[{} + 1];'.format(field['name'], field['hi'])
+    if field['type'] == 'u32':
+        return 'uint32_t {};'.format(field['name'])
+    if field['type'] == 'bool':
+        return 'bool {};'.format(field['name'])
+    return 'settings_ids_t {};'.format(field['name'])
+
+
+def generate(version, fields):
+    out = ['/* Generated by tools/gen_settings_schema.py from schema.def, do not edit */',
+           '#pragma once',
+           '',
+           '#define SETTINGS_SCHEMA_VERSION {}'.format(version),
+           '#define SETTINGS_LAYOUT_ID 0x{:08x}u'.format(layout_id(fields)),
+           '#define SETTINGS_FIELD_COUNT {}'.format(len(fields)),
+           '',
+           'typedef struct {',
+           '    uint32_t generation;        /* bumped by every commit */']
+    out += ['    ' + member(f) for f in fields]
+    out += ['} settings_t;', '',
+            '/* X(name, TYPE, min, max, default, flags, help) */',
+            '#define SETTINGS_FOR_EACH_FIELD(X) \\']
+    for f in fields:
+        flags = ' | '.join(FLAGS[x] for x in f['flags']) or '0'
+        out.append('    X({}, {}, {}u, {}u, {}, {}, {}) \\'.format(
+            f['name'], f['type'].upper(), f['lo'], f['hi'], f['default'], flags, c_str(f['help'])))
+    out += ['', '']
+    return '\n'.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('schema', help='schema.def')
+    parser.add_argument('output', help='generated header')
+    args = parser.parse_args()
+
+    text = generate(*parse(args.schema))
+    with open(args.output, 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,35 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_log.h"
+
+#include "access_log.h"
+#include "basic_http_server.h"
+#include "dlog.h"
+#include "gate_actuator.h"
+#include "settings.h"
+#include "whitelist.h"
+
+static const char *TAG = "http-host";
+
+/* Same start-up as the firmware minus WiFi and Discord, so the load
+ * generator exercises the real handlers on the host. */
+void app_main(void)
+{
+    /* Initialises NVS too */
+    ESP_ERROR_CHECK(settings_init());
+    ESP_ERROR_CHECK(dlog_start());
+    /* Carries the gate and access log events to the push channel */
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    ESP_ERROR_CHECK(gate_actuator_start());
+    ESP_ERROR_CHECK(whitelist_init());
+    ESP_ERROR_CHECK(access_log_start());
+    ESP_ERROR_CHECK(init_assets());
+    ESP_ERROR_CHECK(start_rest_server());
+    ESP_LOGW(TAG, "HTTP server listening on port %d", CONFIG_HTTP_SERVER_PORT);
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#if CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#else
+#include "esp_netif.h"
+#endif
+
+#include "access_log.h"
+#include "basic_http_server.h"
+#include "dlog.h"
+#include "gate_actuator.h"
+#include "settings.h"
+#include "whitelist.h"
+
+#define CYCLES          3000
+/* Cycles before the heap baseline is taken: first-use allocations settle */
+#define WARMUP_CYCLES   20
+#define REFUSED_EVERY   100
+
+/* Unauthenticated: answered with 401 straight from the server task */
+static const char PROBE_REQUEST[] = "GET /api/v1/stats/boot HTTP/1.1\r\nHost: bench\r\n\r\n";
+
+static uint32_t s_ttfb_us[CYCLES];
+
+/* Bytes in use on the host, free bytes on the board: either way a leak
+ * moves it, in opposite directions */
+static long heap_sample(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return -(long)mallinfo2().uordblks;
+#else
+    return esp_get_free_heap_size();
+#endif
+}
+
+/* Send the probe and wait for the first byte of the answer. Returns the
+ * microseconds since start_us, or -1 if the connection got nothing. */
+static int64_t probe(int64_t start_us)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_HTTP_SERVER_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct timeval timeout = { .tv_sec = 1 };
+    int64_t elapsed_us = -1;
+    char buf[16];
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+        send(sock, PROBE_REQUEST, sizeof(PROBE_REQUEST) - 1, 0) > 0 &&
+        recv(sock, buf, sizeof(buf), 0) > 0) {
+        elapsed_us = esp_timer_get_time() - start_us;
+    }
+    close(sock);
+    return elapsed_us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void cycle_run(void)
+{
+    rest_lifecycle_stats_t stats;
+    uint64_t start_total = 0;
+    uint64_t stop_total = 0;
+    uint32_t start_max = 0;
+    uint32_t failures = 0;
+    uint32_t answered_while_stopped = 0;
+    long heap_warm = 0;
+    long heap_low = 0;
+
+    for (int i = 0; i < CYCLES; i++) {
+        int64_t start = esp_timer_get_time();
+        if (start_rest_server() != ESP_OK) {
+            failures++;
+            continue;
+        }
+        int64_t ttfb_us = probe(start);
+        if (ttfb_us < 0) {
+            failures++;
+        }
+        s_ttfb_us[i] = ttfb_us < 0 ? UINT32_MAX : ttfb_us;
+        if (stop_rest_server() != ESP_OK) {
+            failures++;
+        }
+
+        rest_get_lifecycle_stats(&stats);
+        start_total += stats.last_start_us;
+        stop_total += stats.last_stop_us;
+        if (stats.last_start_us > start_max) {
+            start_max = stats.last_start_us;
+        }
+        if (i % REFUSED_EVERY == 0 && probe(esp_timer_get_time()) >= 0) {
+            answered_while_stopped++;
+        }
+
+        long heap = heap_sample();
+        if (i == WARMUP_CYCLES) {
+            heap_warm = heap_low = heap;
+        } else if (i > WARMUP_CYCLES && heap < heap_low) {
+            heap_low = heap;
+        }
+    }
+    /* Let the server task finish closing the last sessions */
+    vTaskDelay(pdMS_TO_TICKS(100));
+    long heap_end = heap_sample();
+
+    qsort(s_ttfb_us, CYCLES, sizeof(s_ttfb_us[0]), cmp_u32);
+    rest_get_lifecycle_stats(&stats);
+    printf("{\"run\": \"cycles\", \"mode\": \"%s\", \"cycles\": %d, \"failures\": %lu, \"start_us_avg\": %.1f, "
+           "\"start_us_max\": %lu, \"stop_us_avg\": %.1f, \"ttfb_us_p50\": %lu, \"ttfb_us_p99\": %lu, "
+           "\"ttfb_us_max\": %lu, \"answered_while_stopped\": %lu, \"refused\": %lu, \"stop_timeouts\": %lu, "
+           "\"heap_drift\": %ld, \"heap_worst\": %ld}\n",
+#if CONFIG_HTTP_RESIDENT_SERVER
+           "resident",
+#else
+           "restart",
+#endif
+           CYCLES, (unsigned long)failures, (double)start_total / CYCLES, (unsigned long)start_max,
+           (double)stop_total / CYCLES, (unsigned long)s_ttfb_us[CYCLES / 2],
+           (unsigned long)s_ttfb_us[CYCLES * 99 / 100], (unsigned long)s_ttfb_us[CYCLES - 1],
+           (unsigned long)answered_while_stopped, (unsigned long)stats.refused, (unsigned long)stats.stop_timeouts,
+           heap_warm - heap_end, heap_warm - heap_low);
+}
+
+/* Same start-up as tools/http_host */
+void app_main(void)
+{
+    ESP_ERROR_CHECK(settings_init());
+    ESP_ERROR_CHECK(dlog_start());
+#if !CONFIG_IDF_TARGET_LINUX
+    ESP_ERROR_CHECK(esp_netif_init());
+#endif
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(gate_actuator_start());
+    ESP_ERROR_CHECK(whitelist_init());
+    ESP_ERROR_CHECK(access_log_start());
+    ESP_ERROR_CHECK(init_assets());
+
+    cycle_run();
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,292 @@
+#!/usr/bin/env python3
+"""Load generator for the HTTP server component.
+
+Runs each scenario against a running server (usually the host build in
+tools/http_host) with 1..N concurrent keep-alive clients and prints the
+results as JSON:
+
+  assets        authenticated GETs of every static asset
+  unauthorized  GETs without credentials, all answered with 401
+  post          JSON POSTs to the whitelist endpoint
+
+With --slow-client an extra connection trickles a POST body one byte at a
+time during every run. With a single server task that client blocks
+everybody else (head-of-line blocking); with the worker pool it only ties up
+one worker. Compare the p99 of runs with and without it.
+
+With --import-sizes each size is uploaded once as a bulk whitelist import
+(POST /api/v1/devices/whitelist/import) and the server's reported peak heap
+use per upload is recorded, then the imported devices are removed again.
+
+Latency percentiles are per request. When the server runs on this machine,
+pass its PID (or let --server start it) to also record the peak resident
+memory of the process, the host stand-in for the heap high-water mark.
+"""
+import argparse
+import base64
+import http.client
+import json
+import os
+import socket
+import subprocess
+import sys
+import threading
+import time
+from urllib.parse import urlsplit
+
+SCENARIOS = ('assets', 'unauthorized', 'post')
+PAGES_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'assets', 'pages')
+
+
+def asset_uris():
+    uris = ['/']
+    for name in sorted(os.listdir(PAGES_DIR)):
+        if name != 'index.html':
+            uris.append('/' + name)
+    return uris
+
+
+def proc_memory_kb(pid):
+    """Peak and current resident set size of a local process, or None."""
+    if not pid:
+        return None
+    try:
+        with open('/proc/{}/status'.format(pid)) as f:
+            fields = dict(line.split(':', 1) for line in f if ':' in line)
+        return {'hwm_kb': int(fields['VmHWM'].split()[0]), 'rss_kb': int(fields['VmRSS'].split()[0])}
+    except (OSError, KeyError, ValueError):
+        return None
+
+
+def make_requests(scenario, client_id, auth):
+    """Endless generator of (method, uri, body, headers, expected status)."""
+    if scenario == 'assets':
+        headers = {'Authorization': auth, 'Accept-Encoding': 'gzip'}
+        uris = asset_uris()
+        while True:
+            for uri in uris:
+                yield 'GET', uri, None, headers, 200
+    elif scenario == 'unauthorized':
+        while True:
+            yield 'GET', '/', None, {}, 401
+    else:
+        headers = {'Authorization': auth, 'Content-Type': 'application/json'}
+        seq = 0
+        while True:
+            # A few MACs per client so repeated runs update instead of filling the whitelist
+            mac = '02:10:00:00:{:02X}:{:02X}'.format(client_id, seq % 4)
+            body = json.dumps({'mac': mac, 'name': 'loadgen {}'.format(client_id), 'access': 'limited'})
+            seq += 1
+            yield 'POST', '/api/v1/devices/whitelist', body, headers, 200
+
+
+def client_worker(host, port, scenario, client_id, auth, deadline, latencies, errors, lock):
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    local_latencies = []
+    local_errors = 0
+    for method, uri, body, headers, expected in make_requests(scenario, client_id, auth):
+        if time.monotonic() >= deadline:
+            break
+        start = time.perf_counter()
+        try:
+            conn.request(method, uri, body=body, headers=headers)
+            resp = conn.getresponse()
+            resp.read()
+            elapsed = time.perf_counter() - start
+            if resp.status != expected:
+                local_errors += 1
+            else:
+                local_latencies.append(elapsed)
+            if resp.will_close:
+                conn.close()
+        except (OSError, http.client.HTTPException):
+            # The server closes the socket after some errors (e.g. 401): reconnect
+            local_errors += 1
+            conn.close()
+    conn.close()
+    with lock:
+        latencies.extend(local_latencies)
+        errors[0] += local_errors
+
+
+def slow_client_worker(host, port, auth, deadline):
+    """Keep one request permanently half-received by sending its body slowly."""
+    body = json.dumps({'mac': '02:10:00:00:FF:00', 'name': 'slow client'}).encode()
+    head = ('POST /api/v1/devices/whitelist HTTP/1.1\r\nHost: {}\r\nAuthorization: {}\r\n'
+            'Content-Type: application/json\r\nContent-Length: {}\r\n\r\n').format(host, auth, len(body)).encode()
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection((host, port), timeout=10) as sock:
+                sock.sendall(head)
+                for i in range(len(body)):
+                    if time.monotonic() >= deadline:
+                        break
+                    sock.sendall(body[i:i + 1])
+                    # Well below the server's 5 s receive timeout
+                    time.sleep(0.5)
+                else:
+                    sock.recv(4096)
+        except OSError:
+            time.sleep(0.1)
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return None
+    index = min(len(sorted_values) - 1, max(0, int(round(pct / 100.0 * len(sorted_values))) - 1))
+    return sorted_values[index]
+
+
+def run(host, port, scenario, clients, duration, auth, pid, slow_client):
+    latencies = []
+    errors = [0]
+    lock = threading.Lock()
+    deadline = time.monotonic() + duration
+    threads = [threading.Thread(target=client_worker,
+                                args=(host, port, scenario, i, auth, deadline, latencies, errors, lock))
+               for i in range(clients)]
+    if slow_client:
+        threads.append(threading.Thread(target=slow_client_worker, args=(host, port, auth, deadline)))
+    start = time.monotonic()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.monotonic() - start
+
+    latencies.sort()
+    ms = lambda v: None if v is None else round(v * 1000.0, 3)
+    result = {
+        'scenario': scenario,
+        'clients': clients,
+        'slow_client': slow_client,
+        'duration_s': round(elapsed, 3),
+        'requests': len(latencies),
+        'errors': errors[0],
+        'rps': round(len(latencies) / elapsed, 1) if elapsed > 0 else 0,
+        'p50_ms': ms(percentile(latencies, 50)),
+        'p99_ms': ms(percentile(latencies, 99)),
+        'max_ms': ms(latencies[-1] if latencies else None),
+    }
+    memory = proc_memory_kb(pid)
+    if memory:
+        result.update(memory)
+    return result
+
+
+IMPORT_MAC_PREFIX = '02:1F'
+
+
+def import_run(host, port, size, auth, pid):
+    """Upload one bulk import of size devices and remove them afterwards."""
+    devices = [{'mac': '{}:00:{:02X}:{:02X}'.format(IMPORT_MAC_PREFIX, i >> 8, i & 0xFF),
+                'name': 'import {}'.format(i), 'access': 'temporary', 'expires': 4102444800}
+               for i in range(size)]
+    body = json.dumps(devices)
+    headers = {'Authorization': auth, 'Content-Type': 'application/json'}
+
+    conn = http.client.HTTPConnection(host, port, timeout=60)
+    start = time.perf_counter()
+    conn.request('POST', '/api/v1/devices/whitelist/import', body=body, headers=headers)
+    resp = conn.getresponse()
+    payload = resp.read()
+    elapsed = time.perf_counter() - start
+
+    result = {'devices': size, 'bytes': len(body), 'status': resp.status, 'ms': round(elapsed * 1000.0, 3)}
+    if resp.status == 200:
+        reply = json.loads(payload)
+        result.update({k: reply[k] for k in ('imported', 'rejected', 'heap_peak') if k in reply})
+    memory = proc_memory_kb(pid)
+    if memory:
+        result.update(memory)
+
+    # Leave the whitelist as it was
+    for device in devices[:result.get('imported', 0) + result.get('rejected', 0)]:
+        conn.request('DELETE', '/api/v1/devices/whitelist?mac=' + device['mac'].replace(':', '-'), headers=headers)
+        conn.getresponse().read()
+    conn.close()
+    return result
+
+
+def wait_for_server(host, port, timeout):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            conn = http.client.HTTPConnection(host, port, timeout=1)
+            conn.request('GET', '/')
+            conn.getresponse().read()
+            conn.close()
+            return True
+        except (OSError, http.client.HTTPException):
+            time.sleep(0.2)
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--url', default='http://127.0.0.1:8080', help='server base URL')
+    parser.add_argument('--user', default='esp')
+    parser.add_argument('--password', default='12346')
+    parser.add_argument('--scenario', action='append', choices=SCENARIOS,
+                        help='scenario to run, may be repeated (default: all)')
+    parser.add_argument('--clients', default='1,2,4,8,16', help='comma separated client counts')
+    parser.add_argument('--duration', type=float, default=5.0, help='seconds per run')
+    parser.add_argument('--slow-client', action='store_true',
+                        help='add a client that trickles its request body during every run')
+    parser.add_argument('--import-sizes', help='comma separated device counts for bulk import uploads')
+    parser.add_argument('--pid', type=int, help='PID of a local server, for memory figures')
+    parser.add_argument('--server', help='server executable to start (e.g. tools/http_host/build/http_host.elf)')
+    parser.add_argument('--output', help='write the JSON report here instead of stdout')
+    args = parser.parse_args()
+
+    target = urlsplit(args.url)
+    host, port = target.hostname, target.port or 80
+    auth = 'Basic ' + base64.b64encode('{}:{}'.format(args.user, args.password).encode()).decode()
+    clients = [int(c) for c in args.clients.split(',')]
+
+    server = None
+    pid = args.pid
+    if args.server:
+        server = subprocess.Popen([args.server], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        pid = server.pid
+    try:
+        if not wait_for_server(host, port, 15):
+            sys.exit('server at {} is not answering'.format(args.url))
+
+        report = {
+            'tool': 'http_loadgen',
+            'url': args.url,
+            'timestamp': int(time.time()),
+            'runs': [],
+        }
+        for scenario in args.scenario or SCENARIOS:
+            for count in clients:
+                result = run(host, port, scenario, count, args.duration, auth, pid, args.slow_client)
+                print('{scenario:>12} x{clients:<2} {rps:>8} req/s  p50 {p50_ms} ms  p99 {p99_ms} ms  '
+                      'errors {errors}'.format(**result), file=sys.stderr)
+                report['runs'].append(result)
+        if args.import_sizes:
+            report['imports'] = []
+            for size in (int(n) for n in args.import_sizes.split(',')):
+                result = import_run(host, port, size, auth, pid)
+                print('{:>12} x{:<4} status {} in {} ms, heap peak {}'.format(
+                    'import', size, result['status'], result['ms'], result.get('heap_peak', '-')), file=sys.stderr)
+                report['imports'].append(result)
+        memory = proc_memory_kb(pid)
+        if memory:
+            report['server_memory'] = memory
+    finally:
+        if server:
+            server.terminate()
+            server.wait()
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,214 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "cJSON.h"
+
+#include "json_writer.h"
+
+#define CHUNK_BUFSIZE   512
+#define SEGMENT         1460
+/* Serialised bytes per size class, enough runs for a stable average */
+#define WORK_BYTES      (4 * 1024 * 1024)
+
+typedef struct {
+    char mac[18];
+    char name[32];
+    const char *access;
+    uint32_t expires;
+} device_t;
+
+static const size_t SIZES[] = { 10, 100, 1000 };
+static const char *const ACCESS[] = { "full", "half", "none" };
+
+static device_t *s_devices;
+static char s_segment[SEGMENT];
+static int64_t s_first_byte_us;
+static int64_t s_start_us;
+
+/* Length and FNV-1a hash of the output, to compare both sides without
+ * holding a 1000 device document in RAM */
+static size_t s_out_len;
+static uint32_t s_out_hash;
+
+/* Heap bookkeeping of cJSON through its hooks: bytes live and the peak */
+static size_t s_heap_live;
+static size_t s_heap_peak;
+static uint32_t s_allocs;
+
+static void *count_malloc(size_t size)
+{
+    max_align_t *block = malloc(sizeof(max_align_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    *(size_t *)block = size;
+    s_heap_live += size;
+    s_allocs++;
+    if (s_heap_live > s_heap_peak) {
+        s_heap_peak = s_heap_live;
+    }
+    return block + 1;
+}
+
+static void count_free(void *ptr)
+{
+    if (ptr) {
+        max_align_t *block = (max_align_t *)ptr - 1;
+        s_heap_live -= *(size_t *)block;
+        free(block);
+    }
+}
+
+/* Socket stand-in: lwIP copies the body into segments either way */
+static void sink(const char *data, size_t len)
+{
+    if (s_first_byte_us == 0 && len > 0) {
+        s_first_byte_us = esp_timer_get_time() - s_start_us;
+    }
+    s_out_len += len;
+    while (len > 0) {
+        size_t n = len < SEGMENT ? len : SEGMENT;
+        memcpy(s_segment, data, n);
+        for (size_t i = 0; i < n; i++) {
+            s_out_hash = (s_out_hash ^ (uint8_t)s_segment[i]) * 16777619u;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static esp_err_t sink_flush(void *ctx, const char *data, size_t len)
+{
+    sink(data, len);
+    return ESP_OK;
+}
+
+static bool devices_init(size_t count)
+{
+    s_devices = calloc(count, sizeof(device_t));
+    for (size_t i = 0; s_devices && i < count; i++) {
+        device_t *dev = &s_devices[i];
+        snprintf(dev->mac, sizeof(dev->mac), "24:0A:C4:%02X:%02X:%02X",
+                 (unsigned)(i >> 16) & 0xFF, (unsigned)(i >> 8) & 0xFF, (unsigned)i & 0xFF);
+        /* Every seventh name needs escaping */
+        snprintf(dev->name, sizeof(dev->name), i % 7 ? "Phone %u" : "Guest \"%u\"", (unsigned)i);
+        dev->access = ACCESS[i % 3];
+        dev->expires = i % 5 ? 0 : 1767225600 + i * 3600;
+    }
+    return s_devices != NULL;
+}
+
+/* The old whitelist_get_handler: a tree, then the whole text */
+static bool cjson_run(size_t count)
+{
+    cJSON *root = cJSON_CreateArray();
+    for (size_t i = 0; i < count && root; i++) {
+        cJSON *item = cJSON_CreateObject();
+        if (!item) {
+            cJSON_Delete(root);
+            return false;
+        }
+        cJSON_AddStringToObject(item, "mac", s_devices[i].mac);
+        cJSON_AddStringToObject(item, "name", s_devices[i].name);
+        cJSON_AddStringToObject(item, "access", s_devices[i].access);
+        cJSON_AddNumberToObject(item, "expires", s_devices[i].expires);
+        cJSON_AddItemToArray(root, item);
+    }
+    char *text = root ? cJSON_PrintUnformatted(root) : NULL;
+    if (text) {
+        sink(text, strlen(text));
+    }
+    cJSON_free(text);
+    cJSON_Delete(root);
+    return text != NULL;
+}
+
+/* The new one: straight into the chunk buffer */
+static bool writer_run(size_t count)
+{
+    char buf[CHUNK_BUFSIZE];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), sink_flush, NULL);
+    json_writer_array_begin(&w);
+    for (size_t i = 0; i < count; i++) {
+        json_writer_object_begin(&w);
+        json_writer_field_str(&w, "mac", s_devices[i].mac);
+        json_writer_field_str(&w, "name", s_devices[i].name);
+        json_writer_field_str(&w, "access", s_devices[i].access);
+        json_writer_field_uint(&w, "expires", s_devices[i].expires);
+        json_writer_object_end(&w);
+    }
+    json_writer_array_end(&w);
+    return json_writer_finish(&w) == ESP_OK && json_writer_flush(&w) == ESP_OK;
+}
+
+static void report(const char *name, size_t count, int runs, int64_t total_us, int64_t first_byte_us,
+                   uint32_t failures, size_t heap_peak, uint32_t allocs, size_t bytes)
+{
+    printf("{\"run\": \"%s\", \"devices\": %u, \"runs\": %d, \"bytes\": %u, \"us_per_response\": %.1f, "
+           "\"first_byte_us\": %.1f, \"heap_peak\": %u, \"allocs\": %lu, \"failures\": %lu}\n",
+           name, (unsigned)count, runs, (unsigned)bytes, (double)total_us / runs, (double)first_byte_us / runs,
+           (unsigned)heap_peak, (unsigned long)allocs, (unsigned long)failures);
+}
+
+static void size_run(size_t count)
+{
+    bool (*const fns[])(size_t) = { cjson_run, writer_run };
+    const char *const names[] = { "cjson", "writer" };
+    uint32_t hashes[2] = { 0, 0 };
+    size_t lengths[2] = { 0, 0 };
+
+    for (int f = 0; f < 2; f++) {
+        /* A first pass for the output, the heap and the allocations */
+        s_out_len = 0;
+        s_out_hash = 2166136261u;
+        s_heap_live = s_heap_peak = 0;
+        s_allocs = 0;
+        bool ok = fns[f](count);
+        size_t heap_peak = s_heap_peak;
+        uint32_t allocs = s_allocs;
+        hashes[f] = s_out_hash;
+        lengths[f] = ok ? s_out_len : 0;
+
+        int runs = ok ? WORK_BYTES / (s_out_len ? s_out_len : 1) : 1;
+        runs = runs < 10 ? 10 : runs;
+        int64_t total_us = 0;
+        int64_t first_byte_total = 0;
+        uint32_t failures = ok ? 0 : 1;
+        for (int i = 0; ok && i < runs; i++) {
+            s_first_byte_us = 0;
+            s_start_us = esp_timer_get_time();
+            if (!fns[f](count)) {
+                failures++;
+            }
+            total_us += esp_timer_get_time() - s_start_us;
+            first_byte_total += s_first_byte_us;
+        }
+        report(names[f], count, runs, total_us, first_byte_total, failures, heap_peak, allocs, lengths[f]);
+    }
+
+    bool identical = lengths[0] && lengths[0] == lengths[1] && hashes[0] == hashes[1];
+    printf("{\"run\": \"compare\", \"devices\": %u, \"identical\": %s, \"writer_buffer\": %d}\n",
+           (unsigned)count, identical ? "true" : "false", CHUNK_BUFSIZE);
+}
+
+void app_main(void)
+{
+    cJSON_Hooks hooks = { .malloc_fn = count_malloc, .free_fn = count_free };
+    cJSON_InitHooks(&hooks);
+
+    size_t max = SIZES[sizeof(SIZES) / sizeof(SIZES[0]) - 1];
+    if (!devices_init(max)) {
+        printf("{\"run\": \"setup\", \"error\": \"no memory\"}\n");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++) {
+        size_run(SIZES[i]);
+    }
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_timer.h"
+
+#include "link_fsm.h"
+
+#define DEVICES         1000
+/* Failed attempts per outage in the jitter run: well past the cap */
+#define ATTEMPTS        12
+/* How long a recovered link stays up before the next fault */
+#define STABLE_MS       (10 * 60 * 1000)
+/* Refusals and DHCP offers come back within this */
+#define REPLY_MAX_MS    3000
+
+typedef enum {
+    FAULT_REFUSED = 0,          /* association or authentication rejected */
+    FAULT_ASSOC_TIMEOUT,        /* no answer from the AP */
+    FAULT_DHCP_TIMEOUT,         /* associated, never got a lease */
+    FAULT_COUNT,
+} fault_t;
+
+static const link_fsm_config_t s_cfg = {
+    .backoff_base_ms = CONFIG_LINK_BACKOFF_BASE_MS,
+    .backoff_max_ms = CONFIG_LINK_BACKOFF_MAX_MS,
+    .attempt_timeout_ms = CONFIG_LINK_ATTEMPT_TIMEOUT_MS,
+};
+
+static uint32_t s_delays[ATTEMPTS][DEVICES];
+static uint32_t s_faults[FAULT_COUNT];
+
+static uint32_t random_seed(void)
+{
+    return ((uint32_t)rand() << 16) ^ rand();
+}
+
+/* Backoff before the retry after the given number of failed attempts,
+ * before jitter */
+static uint32_t cap_ms(uint32_t attempt)
+{
+    uint64_t delay = attempt < 32 ? (uint64_t)s_cfg.backoff_base_ms << attempt : UINT64_MAX;
+    return delay < s_cfg.backoff_max_ms ? delay : s_cfg.backoff_max_ms;
+}
+
+static bool in_bounds(uint32_t delay, uint32_t attempt)
+{
+    uint32_t cap = cap_ms(attempt);
+    return delay >= cap / 2 && delay <= cap;
+}
+
+/* Fail the attempt in progress (state connecting) and return the backoff
+ * it leaves armed, or 0 if the machine did not go to backoff */
+static uint32_t fail_attempt(link_fsm_t *fsm, fault_t fault, int64_t *now_ms)
+{
+    link_actions_t actions;
+
+    s_faults[fault]++;
+    switch (fault) {
+    case FAULT_REFUSED:
+        *now_ms += rand() % REPLY_MAX_MS;
+        break;
+    case FAULT_ASSOC_TIMEOUT:
+        *now_ms += s_cfg.attempt_timeout_ms;
+        if (!link_fsm_input(fsm, LINK_INPUT_TIMER, *now_ms).disconnect) {
+            return 0;
+        }
+        break;
+    case FAULT_DHCP_TIMEOUT:
+        *now_ms += rand() % REPLY_MAX_MS;
+        actions = link_fsm_input(fsm, LINK_INPUT_CONNECTED, *now_ms);
+        *now_ms += actions.timer_ms;
+        if (actions.timer_ms != s_cfg.attempt_timeout_ms ||
+                !link_fsm_input(fsm, LINK_INPUT_TIMER, *now_ms).disconnect) {
+            return 0;
+        }
+        break;
+    default:
+        return 0;
+    }
+    actions = link_fsm_input(fsm, LINK_INPUT_DISCONNECTED, *now_ms);
+    return fsm->state == LINK_STATE_BACKOFF && !actions.connect ? actions.timer_ms : 0;
+}
+
+/* Let the backoff run out; the retry must scan, not use the cache */
+static bool retry(link_fsm_t *fsm, uint32_t delay, int64_t *now_ms)
+{
+    *now_ms += delay;
+    link_actions_t actions = link_fsm_input(fsm, LINK_INPUT_TIMER, *now_ms);
+    return actions.connect && !actions.use_cached_ap && actions.timer_ms == s_cfg.attempt_timeout_ms;
+}
+
+static bool come_up(link_fsm_t *fsm, int64_t *now_ms)
+{
+    *now_ms += rand() % REPLY_MAX_MS;
+    link_fsm_input(fsm, LINK_INPUT_CONNECTED, *now_ms);
+    *now_ms += rand() % REPLY_MAX_MS;
+    return link_fsm_input(fsm, LINK_INPUT_GOT_IP, *now_ms).notify == LINK_NOTIFY_UP;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Devices that never get through, from boot: every backoff within
+ * [cap / 2, cap] of its attempt, and spread out across devices */
+static void jitter_run(void)
+{
+    uint32_t errors = 0;
+    int64_t start = esp_timer_get_time();
+
+    for (int d = 0; d < DEVICES; d++) {
+        link_fsm_t fsm;
+        int64_t now_ms = 0;
+        link_fsm_init(&fsm, &s_cfg, false, random_seed());
+        link_fsm_input(&fsm, LINK_INPUT_START, now_ms);
+        for (int a = 0; a < ATTEMPTS; a++) {
+            uint32_t delay = fail_attempt(&fsm, rand() % FAULT_COUNT, &now_ms);
+            s_delays[a][d] = delay;
+            if (!delay || !retry(&fsm, delay, &now_ms)) {
+                errors++;
+            }
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    for (int a = 0; a < ATTEMPTS; a++) {
+        uint32_t *delays = s_delays[a];
+        uint32_t out_of_bounds = 0;
+        uint32_t distinct = 0;
+        for (int d = 0; d < DEVICES; d++) {
+            out_of_bounds += !in_bounds(delays[d], a);
+        }
+        qsort(delays, DEVICES, sizeof(delays[0]), compare_u32);
+        for (int d = 0; d < DEVICES; d++) {
+            distinct += d == 0 || delays[d] != delays[d - 1];
+        }
+        printf("{\"run\": \"jitter\", \"attempt\": %d, \"cap_ms\": %lu, \"min_ms\": %lu, \"p50_ms\": %lu, "
+               "\"max_ms\": %lu, \"distinct\": %lu, \"out_of_bounds\": %lu}\n",
+               a + 1, (unsigned long)cap_ms(a), (unsigned long)delays[0], (unsigned long)delays[DEVICES / 2],
+               (unsigned long)delays[DEVICES - 1], (unsigned long)distinct, (unsigned long)out_of_bounds);
+    }
+    printf("{\"run\": \"jitter_total\", \"devices\": %d, \"attempts\": %d, \"refused\": %lu, "
+           "\"assoc_timeouts\": %lu, \"dhcp_timeouts\": %lu, \"errors\": %lu, \"ns_per_attempt\": %.1f}\n",
+           DEVICES, ATTEMPTS, (unsigned long)s_faults[FAULT_REFUSED], (unsigned long)s_faults[FAULT_ASSOC_TIMEOUT],
+           (unsigned long)s_faults[FAULT_DHCP_TIMEOUT], (unsigned long)errors,
+           elapsed * 1000.0 / (DEVICES * ATTEMPTS));
+}
+
+/* After a run of failures the link comes up and stays up, then drops. The
+ * new outage must start over: one immediate retry on the cached AP, then
+ * the shortest backoff. by_lease drops it by losing the DHCP lease instead
+ * of the association. */
+static void reset_run(const char *name, bool by_lease)
+{
+    uint32_t fast_retries = 0;
+    uint32_t reset = 0;
+    uint32_t recovery_matches = 0;
+    uint32_t errors = 0;
+    uint32_t max_backoff = 0;
+
+    for (int d = 0; d < DEVICES; d++) {
+        link_fsm_t fsm;
+        int64_t now_ms = 0;
+        link_fsm_init(&fsm, &s_cfg, true, random_seed());
+        link_fsm_input(&fsm, LINK_INPUT_START, now_ms);
+
+        /* Boot outage: up to ATTEMPTS failures before it gets through */
+        int failures = rand() % ATTEMPTS;
+        bool ok = true;
+        for (int a = 0; a < failures && ok; a++) {
+            uint32_t delay = fail_attempt(&fsm, rand() % FAULT_COUNT, &now_ms);
+            ok = in_bounds(delay, a) && retry(&fsm, delay, &now_ms);
+        }
+        if (!ok || !come_up(&fsm, &now_ms)) {
+            errors++;
+            continue;
+        }
+        now_ms += STABLE_MS;
+
+        /* The drop */
+        int64_t down_at_ms = now_ms;
+        link_actions_t actions;
+        if (by_lease) {
+            actions = link_fsm_input(&fsm, LINK_INPUT_LOST_IP, now_ms);
+            if (actions.notify != LINK_NOTIFY_DOWN || actions.timer_ms != s_cfg.attempt_timeout_ms) {
+                errors++;
+                continue;
+            }
+            /* DHCP does not come back: the attempt times out and the
+             * station is disconnected */
+            now_ms += actions.timer_ms;
+            actions = link_fsm_input(&fsm, LINK_INPUT_TIMER, now_ms);
+            actions = link_fsm_input(&fsm, LINK_INPUT_DISCONNECTED, now_ms);
+        } else {
+            actions = link_fsm_input(&fsm, LINK_INPUT_DISCONNECTED, now_ms);
+            if (actions.notify != LINK_NOTIFY_DOWN) {
+                errors++;
+                continue;
+            }
+            if (actions.connect && actions.use_cached_ap) {
+                fast_retries++;
+            }
+            /* The cached AP is gone: the fast retry is refused */
+            now_ms += rand() % REPLY_MAX_MS;
+            actions = link_fsm_input(&fsm, LINK_INPUT_DISCONNECTED, now_ms);
+        }
+
+        /* The first backoff of the new outage is the shortest one again */
+        uint32_t delay = fsm.state == LINK_STATE_BACKOFF ? actions.timer_ms : 0;
+        max_backoff = delay > max_backoff ? delay : max_backoff;
+        if (delay && in_bounds(delay, 0)) {
+            reset++;
+        }
+        if (!delay || !retry(&fsm, delay, &now_ms) || !come_up(&fsm, &now_ms)) {
+            errors++;
+            continue;
+        }
+        if (fsm.stats.outages == 1 && fsm.stats.last_recovery_ms == now_ms - down_at_ms) {
+            recovery_matches++;
+        }
+    }
+
+    printf("{\"run\": \"%s\", \"devices\": %d, \"stable_ms\": %d, \"fast_retries\": %lu, \"backoff_reset\": %lu, "
+           "\"max_first_backoff_ms\": %lu, \"cap_ms\": %lu, \"recovery_matches\": %lu, \"errors\": %lu}\n",
+           name, DEVICES, STABLE_MS, (unsigned long)fast_retries, (unsigned long)reset, (unsigned long)max_backoff,
+           (unsigned long)cap_ms(0), (unsigned long)recovery_matches, (unsigned long)errors);
+}
+
+void app_main(void)
+{
+    srand(1);
+    jitter_run();
+    reset_run("reset_disconnect", false);
+    reset_run("reset_lost_ip", true);
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
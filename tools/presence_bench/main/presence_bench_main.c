@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+
+#include "gate_actuator.h"
+#include "presence.h"
+#include "whitelist.h"
+
+#define US_PER_S        1000000LL
+#define US_PER_MIN      (60 * US_PER_S)
+#define US_PER_H        (60 * US_PER_MIN)
+
+/* Replayed history */
+#define SIM_DAYS        30
+#define SIM_RESIDENTS   4
+#define SIM_VISITORS    12
+#define SIM_EVENTS_MAX  60000
+#define SIM_ARRIVALS_MAX 1024
+/* The device restarts at these days with the residents at home */
+#define SIM_REBOOT_DAYS { 3, 17 }
+/* What presence_post() drops, see PRESENCE_PREWARM_RSSI */
+#define SIM_PROBE_RSSI  -60
+/* An open this close to an arrival's first join serves it */
+#define SIM_MATCH_BEFORE_US (30 * US_PER_S)
+#define SIM_MATCH_AFTER_US  (60 * US_PER_S)
+
+/* Pipeline run */
+#define PIPE_ARRIVALS   200
+#define PIPE_GAP_MS     120
+
+typedef struct {
+    presence_event_t event;
+    bool reboot;
+} sim_event_t;
+
+typedef struct {
+    int device;
+    int64_t join_us;            /* first join of the arrival */
+    bool served;
+} sim_arrival_t;
+
+typedef struct {
+    const char *name;
+    presence_config_t config;
+} sim_setup_t;
+
+static sim_event_t s_events[SIM_EVENTS_MAX];
+static size_t s_event_count;
+static sim_arrival_t s_arrivals[SIM_ARRIVALS_MAX];
+static size_t s_arrival_count;
+static uint8_t s_macs[SIM_RESIDENTS + SIM_VISITORS][6];
+static uint32_t s_rng = 0x2545f491;
+
+static uint32_t rng_next(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static int64_t rng_range(int64_t lo, int64_t hi)
+{
+    return lo + (int64_t)(rng_next() % (uint32_t)(hi - lo + 1));
+}
+
+static bool rng_chance(int percent)
+{
+    return (int)(rng_next() % 100) < percent;
+}
+
+static void sim_push(int device, presence_event_type_t type, int64_t time_us, int8_t rssi)
+{
+    if (s_event_count == SIM_EVENTS_MAX || time_us < 0) {
+        return;
+    }
+    sim_event_t *ev = &s_events[s_event_count++];
+    memset(ev, 0, sizeof(*ev));
+    ev->event.type = type;
+    ev->event.rssi = rssi;
+    ev->event.time_us = time_us;
+    memcpy(ev->event.mac, s_macs[device], 6);
+}
+
+/* A phone coming home: probes while approaching, if it probes with its own
+ * MAC, then joins; at the edge of the range the first association may not
+ * hold. Returns when the phone is settled at home. */
+static int64_t sim_arrive(int device, int64_t t, bool probes)
+{
+    if (probes) {
+        int64_t probe = t - rng_range(12, 20) * US_PER_S;
+        for (int rssi = -88; probe < t; rssi += 6, probe += rng_range(1500, 3000) * 1000LL) {
+            sim_push(device, PRESENCE_EVENT_PROBE, probe, (int8_t)(rssi > -45 ? -45 : rssi));
+        }
+    }
+    sim_push(device, PRESENCE_EVENT_JOIN, t, 0);
+    if (s_arrival_count < SIM_ARRIVALS_MAX) {
+        s_arrivals[s_arrival_count++] = (sim_arrival_t){ .device = device, .join_us = t };
+    }
+    if (rng_chance(30)) {
+        int64_t drop = t + rng_range(1000, 4000) * 1000LL;
+        sim_push(device, PRESENCE_EVENT_LEAVE, drop, 0);
+        t = drop + rng_range(2, 10) * US_PER_S;
+        sim_push(device, PRESENCE_EVENT_JOIN, t, 0);
+    }
+    return t;
+}
+
+static bool sim_is_reboot_day(int day)
+{
+    static const int reboot_days[] = SIM_REBOOT_DAYS;
+    for (size_t i = 0; i < sizeof(reboot_days) / sizeof(reboot_days[0]); i++) {
+        if (reboot_days[i] == day) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* One resident's month: trips out and back, edge-of-range drops while at
+ * home, background probes, driving past without stopping, and rejoining
+ * after each device restart. Resident 0 lives at the edge of the range,
+ * residents 0 and 1 probe with their real MAC. */
+static void sim_resident(int device)
+{
+    bool edge = device == 0;
+    bool probes = device < 2;
+    int64_t end = SIM_DAYS * 24 * US_PER_H;
+    int64_t t = rng_range(0, 30) * US_PER_S;
+
+    sim_push(device, PRESENCE_EVENT_JOIN, t, 0);
+    while (t < end) {
+        int64_t home_until = t + rng_range(20 * US_PER_MIN / US_PER_S, 10 * US_PER_H / US_PER_S) * US_PER_S;
+        int day_from = (int)(t / (24 * US_PER_H));
+        int day_to = (int)(home_until / (24 * US_PER_H));
+        for (int day = day_from + 1; day <= day_to; day++) {
+            if (sim_is_reboot_day(day)) {
+                sim_push(device, PRESENCE_EVENT_JOIN, day * 24 * US_PER_H + rng_range(5, 30) * US_PER_S, 0);
+            }
+        }
+        while (t < home_until) {
+            t += rng_range(3, 8) * US_PER_MIN;
+            if (probes) {
+                sim_push(device, PRESENCE_EVENT_PROBE, t, (int8_t)rng_range(-70, -40));
+            }
+            if (rng_chance(edge ? 8 : 1)) {
+                sim_push(device, PRESENCE_EVENT_LEAVE, t, 0);
+                t += rng_range(5, 150) * US_PER_S;
+                sim_push(device, PRESENCE_EVENT_JOIN, t, 0);
+            }
+        }
+
+        sim_push(device, PRESENCE_EVENT_LEAVE, t, 0);
+        int64_t back = t + rng_range(15 * US_PER_MIN / US_PER_S, 6 * US_PER_H / US_PER_S) * US_PER_S;
+        if (probes && rng_chance(15)) {
+            /* Passing the gate on the way somewhere else */
+            int64_t pass = rng_range(t + 5 * US_PER_MIN, back - US_PER_MIN);
+            sim_push(device, PRESENCE_EVENT_PROBE, pass, -58);
+            sim_push(device, PRESENCE_EVENT_PROBE, pass + 1500 * 1000LL, -52);
+        }
+        if (back >= end) {
+            break;
+        }
+        t = sim_arrive(device, back, probes);
+    }
+}
+
+/* Guests on the SoftAP and phones probing from the street */
+static void sim_visitor(int device)
+{
+    int64_t end = SIM_DAYS * 24 * US_PER_H;
+    for (int64_t t = rng_range(0, 12 * US_PER_H / US_PER_S) * US_PER_S; t < end;
+            t += rng_range(2 * US_PER_H / US_PER_S, 48 * US_PER_H / US_PER_S) * US_PER_S) {
+        for (int i = 0; i < 3; i++) {
+            sim_push(device, PRESENCE_EVENT_PROBE, t + i * 2 * US_PER_S, (int8_t)rng_range(-80, -45));
+        }
+        if (rng_chance(25)) {
+            sim_push(device, PRESENCE_EVENT_JOIN, t + 10 * US_PER_S, 0);
+            sim_push(device, PRESENCE_EVENT_LEAVE, t + rng_range(60, 7200) * US_PER_S, 0);
+        }
+    }
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    int64_t x = ((const sim_event_t *)a)->event.time_us;
+    int64_t y = ((const sim_event_t *)b)->event.time_us;
+    return (x > y) - (x < y);
+}
+
+static void sim_generate(void)
+{
+    for (int i = 0; i < SIM_RESIDENTS + SIM_VISITORS; i++) {
+        s_macs[i][0] = 0x02;
+        s_macs[i][4] = i < SIM_RESIDENTS ? 0xaa : 0xbb;
+        s_macs[i][5] = (uint8_t)i;
+    }
+    for (int i = 0; i < SIM_RESIDENTS; i++) {
+        sim_resident(i);
+    }
+    for (int i = SIM_RESIDENTS; i < SIM_RESIDENTS + SIM_VISITORS; i++) {
+        sim_visitor(i);
+    }
+    static const int reboot_days[] = SIM_REBOOT_DAYS;
+    for (size_t i = 0; i < sizeof(reboot_days) / sizeof(reboot_days[0]) && s_event_count < SIM_EVENTS_MAX; i++) {
+        sim_event_t *ev = &s_events[s_event_count++];
+        memset(ev, 0, sizeof(*ev));
+        ev->reboot = true;
+        ev->event.time_us = reboot_days[i] * 24 * US_PER_H;
+    }
+    qsort(s_events, s_event_count, sizeof(s_events[0]), compare_events);
+}
+
+static bool sim_lookup(const uint8_t mac[6], uint8_t *access, void *ctx)
+{
+    *access = WHITELIST_ACCESS_FULL;
+    return mac[4] == 0xaa;
+}
+
+typedef struct {
+    uint32_t opens;
+    uint32_t prewarm_opens;
+    uint32_t false_opens;
+    uint32_t served;
+    int64_t total_delay_us;     /* open decision minus first join, per served arrival */
+    int64_t max_delay_us;
+    int64_t min_delay_us;
+} sim_result_t;
+
+static void sim_account(sim_result_t *res, const presence_open_t *open, int64_t decided_us)
+{
+    res->opens++;
+    res->prewarm_opens += open->prewarm;
+    for (size_t i = 0; i < s_arrival_count; i++) {
+        sim_arrival_t *arr = &s_arrivals[i];
+        if (arr->served || memcmp(s_macs[arr->device], open->mac, 6) != 0 ||
+                decided_us < arr->join_us - SIM_MATCH_BEFORE_US || decided_us > arr->join_us + SIM_MATCH_AFTER_US) {
+            continue;
+        }
+        int64_t delay = decided_us - arr->join_us;
+        arr->served = true;
+        res->served++;
+        res->total_delay_us += delay;
+        if (res->served == 1 || delay > res->max_delay_us) {
+            res->max_delay_us = delay;
+        }
+        if (res->served == 1 || delay < res->min_delay_us) {
+            res->min_delay_us = delay;
+        }
+        return;
+    }
+    res->false_opens++;
+}
+
+static void sim_run(const sim_setup_t *setup)
+{
+    static presence_engine_t engine;
+    sim_result_t res = { 0 };
+    presence_open_t open;
+    int64_t busy_us = 0;
+    uint32_t fed = 0;
+
+    for (size_t i = 0; i < s_arrival_count; i++) {
+        s_arrivals[i].served = false;
+    }
+    presence_engine_init(&engine, &setup->config, 0);
+
+    for (size_t i = 0; i < s_event_count; i++) {
+        const sim_event_t *ev = &s_events[i];
+        int64_t due;
+        while ((due = presence_engine_next_deadline(&engine)) && due <= ev->event.time_us) {
+            while (presence_engine_poll(&engine, due, &open)) {
+                sim_account(&res, &open, due);
+            }
+        }
+        if (ev->reboot) {
+            presence_engine_init(&engine, &setup->config, ev->event.time_us);
+            continue;
+        }
+        if (ev->event.type == PRESENCE_EVENT_PROBE && ev->event.rssi < SIM_PROBE_RSSI) {
+            continue;
+        }
+        int64_t start = esp_timer_get_time();
+        presence_verdict_t verdict = presence_engine_feed(&engine, &ev->event, &open);
+        busy_us += esp_timer_get_time() - start;
+        fed++;
+        if (verdict == PRESENCE_VERDICT_OPEN) {
+            sim_account(&res, &open, ev->event.time_us);
+        }
+    }
+
+    printf("{\"run\": \"%s\", \"arrivals\": %u, \"opens\": %lu, \"served\": %lu, \"missed\": %lu, "
+           "\"false_opens\": %lu, \"prewarm_opens\": %lu, \"delay_mean_ms\": %lld, \"delay_min_ms\": %lld, "
+           "\"delay_max_ms\": %lld, \"flaps\": %lu, \"cooldown\": %lu, \"startup\": %lu, \"events\": %lu, "
+           "\"feed_ns\": %.0f}\n",
+           setup->name, (unsigned)s_arrival_count, (unsigned long)res.opens, (unsigned long)res.served,
+           (unsigned long)(s_arrival_count - res.served), (unsigned long)res.false_opens,
+           (unsigned long)res.prewarm_opens,
+           res.served ? (long long)(res.total_delay_us / res.served / 1000) : 0LL,
+           (long long)(res.min_delay_us / 1000), (long long)(res.max_delay_us / 1000),
+           (unsigned long)engine.counts[PRESENCE_VERDICT_FLAP], (unsigned long)engine.counts[PRESENCE_VERDICT_COOLDOWN],
+           (unsigned long)engine.counts[PRESENCE_VERDICT_STARTUP], (unsigned long)fed,
+           fed ? busy_us * 1000.0 / fed : 0.0);
+}
+
+/* Join-to-relay latency through presence_post(), the presence task and the
+ * gate actuator, as recorded in the actuator's per-source histogram. Needs
+ * the zero away/cooldown settings of sdkconfig.defaults. */
+static void pipeline_run(void)
+{
+    whitelist_entry_t entry = { .mac = { 0x02, 0, 0, 0, 0xaa, 0x01 }, .access = WHITELIST_ACCESS_FULL };
+    gate_latency_hist_t hist;
+    presence_stats_t stats;
+
+    ESP_ERROR_CHECK(whitelist_add(&entry));
+    for (int i = 0; i < PIPE_ARRIVALS; i++) {
+        presence_event_t event = { .type = PRESENCE_EVENT_JOIN, .time_us = esp_timer_get_time() };
+        memcpy(event.mac, entry.mac, 6);
+        presence_post(&event);
+        vTaskDelay(pdMS_TO_TICKS(10));
+        event.type = PRESENCE_EVENT_LEAVE;
+        event.time_us = esp_timer_get_time();
+        presence_post(&event);
+        vTaskDelay(pdMS_TO_TICKS(PIPE_GAP_MS));
+    }
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_GATE_RELAY_PULSE_MS * 2));
+
+    gate_actuator_get_latency(GATE_SOURCE_PRESENCE, &hist);
+    presence_get_stats(&stats);
+    printf("{\"run\": \"pipeline\", \"arrivals\": %d, \"opens\": %lu, \"dropped\": %lu, \"mean_us\": %llu, "
+           "\"max_us\": %lu, \"buckets\": [", PIPE_ARRIVALS, (unsigned long)hist.count,
+           (unsigned long)stats.dropped, hist.count ? (unsigned long long)(hist.total_us / hist.count) : 0ULL,
+           (unsigned long)hist.max_us);
+    for (int i = 0; i < GATE_LATENCY_BUCKETS; i++) {
+        printf("%s[%lu, %lu]", i ? ", " : "", (unsigned long)gate_latency_bucket_us[i], (unsigned long)hist.buckets[i]);
+    }
+    printf("]}\n");
+}
+
+void app_main(void)
+{
+    const sim_setup_t setups[] = {
+        { "naive", { .away_min_s = 0, .cooldown_s = 0 } },
+        { "default", { .away_min_s = 180, .cooldown_s = 300 } },
+        { "away_60s", { .away_min_s = 60, .cooldown_s = 300 } },
+        { "away_600s", { .away_min_s = 600, .cooldown_s = 300 } },
+        { "settle_3s", { .settle_ms = 3000, .away_min_s = 180, .cooldown_s = 300 } },
+        { "prewarm", { .away_min_s = 180, .cooldown_s = 300, .prewarm = true, .prewarm_probes = 2,
+                       .prewarm_window_ms = 5000 } },
+        { "prewarm_3_probes", { .away_min_s = 180, .cooldown_s = 300, .prewarm = true, .prewarm_probes = 3,
+                                .prewarm_window_ms = 5000 } },
+    };
+
+    sim_generate();
+    printf("{\"days\": %d, \"events\": %u, \"arrivals\": %u}\n", SIM_DAYS, (unsigned)s_event_count,
+           (unsigned)s_arrival_count);
+    for (size_t i = 0; i < sizeof(setups) / sizeof(setups[0]); i++) {
+        sim_setup_t setup = setups[i];
+        setup.config.lookup = sim_lookup;
+        sim_run(&setup);
+    }
+
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(gate_actuator_start());
+    ESP_ERROR_CHECK(whitelist_init());
+    ESP_ERROR_CHECK(presence_start());
+    pipeline_run();
+
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,194 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "settings.h"
+
+#define READS           1000000
+#define COMMITS         200
+#define READER_TASKS    2
+
+#define LEGACY_USERNAME "legacy-user"
+#define LEGACY_PASSWORD "legacy-password"
+
+/* What hot paths read instead, for comparison */
+static settings_t s_locked_copy;
+static SemaphoreHandle_t s_copy_lock;
+static volatile uint32_t s_plain_value = 500;
+
+static atomic_bool s_stop;
+static atomic_uint s_readers_done;
+static atomic_uint s_reads;
+static atomic_uint s_torn;
+static TaskHandle_t s_main_task;
+
+/* Start from nothing stored but credentials in the pre-settings namespace */
+static void seed_legacy(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    nvs_handle_t nvs;
+    ESP_ERROR_CHECK(nvs_open("settings", NVS_READWRITE, &nvs));
+    ESP_ERROR_CHECK(nvs_erase_all(nvs));
+    ESP_ERROR_CHECK(nvs_commit(nvs));
+    nvs_close(nvs);
+    ESP_ERROR_CHECK(nvs_open("http_auth", NVS_READWRITE, &nvs));
+    ESP_ERROR_CHECK(nvs_set_str(nvs, "username", LEGACY_USERNAME));
+    ESP_ERROR_CHECK(nvs_set_str(nvs, "password", LEGACY_PASSWORD));
+    ESP_ERROR_CHECK(nvs_commit(nvs));
+    nvs_close(nvs);
+}
+
+static void migration_run(void)
+{
+    seed_legacy();
+    int64_t start = esp_timer_get_time();
+    ESP_ERROR_CHECK(settings_init());
+    int64_t init_us = esp_timer_get_time() - start;
+
+    settings_stats_t stats;
+    settings_get_stats(&stats);
+    const settings_t *settings = settings_acquire();
+    bool imported = strcmp(settings->http_username, LEGACY_USERNAME) == 0 &&
+                    strcmp(settings->http_password, LEGACY_PASSWORD) == 0;
+    settings_release(settings);
+
+    printf("{\"run\": \"migration\", \"from_version\": %u, \"to_version\": %d, \"imported\": %s, "
+           "\"snapshot_bytes\": %u, \"init_us\": %lld}\n",
+           stats.loaded_version, SETTINGS_SCHEMA_VERSION, imported ? "true" : "false",
+           (unsigned)sizeof(settings_t), (long long)init_us);
+}
+
+static void read_cost_run(void)
+{
+    uint32_t sum = 0;
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < READS; i++) {
+        const settings_t *settings = settings_acquire();
+        sum += settings->gate_pulse_ms;
+        settings_release(settings);
+    }
+    int64_t rcu_us = esp_timer_get_time() - start;
+
+    s_copy_lock = xSemaphoreCreateMutex();
+    s_locked_copy.gate_pulse_ms = 500;
+    start = esp_timer_get_time();
+    for (int i = 0; i < READS; i++) {
+        xSemaphoreTake(s_copy_lock, portMAX_DELAY);
+        sum += s_locked_copy.gate_pulse_ms;
+        xSemaphoreGive(s_copy_lock);
+    }
+    int64_t mutex_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < READS; i++) {
+        sum += s_plain_value;
+    }
+    int64_t plain_us = esp_timer_get_time() - start;
+
+    printf("{\"run\": \"read\", \"reads\": %d, \"acquire_release_ns\": %.1f, \"mutex_ns\": %.1f, "
+           "\"plain_ns\": %.1f, \"checksum\": %lu}\n",
+           READS, rcu_us * 1000.0 / READS, mutex_us * 1000.0 / READS, plain_us * 1000.0 / READS,
+           (unsigned long)sum);
+}
+
+/* Every commit below sets the gap to one less than the pulse: a reader
+ * seeing anything else saw half of an update */
+static void reader_task(void *arg)
+{
+    uint32_t reads = 0;
+    uint32_t torn = 0;
+    while (!atomic_load(&s_stop)) {
+        const settings_t *settings = settings_acquire();
+        if (settings->generation > 1 && settings->gate_gap_ms + 1 != settings->gate_pulse_ms) {
+            torn++;
+        }
+        settings_release(settings);
+        if (++reads % 64 == 0) {
+            /* Same priority as the writer: share a single core with it */
+            taskYIELD();
+        }
+    }
+    atomic_fetch_add(&s_reads, reads);
+    atomic_fetch_add(&s_torn, torn);
+    atomic_fetch_add(&s_readers_done, 1);
+    xTaskNotifyGive(s_main_task);
+    vTaskDelete(NULL);
+}
+
+static void update_run(void)
+{
+    uint64_t swap_total = 0;
+    uint64_t persist_total = 0;
+    uint32_t failures = 0;
+    char value[12];
+
+    s_main_task = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < READER_TASKS; i++) {
+        xTaskCreate(reader_task, "reader", 3072, NULL, uxTaskPriorityGet(NULL), NULL);
+    }
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < COMMITS; i++) {
+        settings_draft_t draft;
+        settings_stats_t stats;
+        settings_draft_init(&draft);
+        snprintf(value, sizeof(value), "%d", 100 + i);
+        settings_draft_set(&draft, "gate_pulse_ms", value);
+        snprintf(value, sizeof(value), "%d", 99 + i);
+        settings_draft_set(&draft, "gate_gap_ms", value);
+        if (settings_commit(&draft, NULL) != ESP_OK) {
+            failures++;
+        }
+        settings_get_stats(&stats);
+        swap_total += stats.last_swap_us;
+        persist_total += stats.last_persist_us;
+        /* One update per tick, the readers running in between */
+        vTaskDelay(1);
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start;
+
+    atomic_store(&s_stop, true);
+    while (atomic_load(&s_readers_done) < READER_TASKS) {
+        ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    }
+
+    settings_stats_t stats;
+    settings_get_stats(&stats);
+    const settings_t *settings = settings_acquire();
+    bool last_applied = settings->gate_pulse_ms == 100 + COMMITS - 1;
+    settings_release(settings);
+
+    printf("{\"run\": \"update\", \"commits\": %d, \"failures\": %lu, \"swap_us_avg\": %.1f, \"swap_us_max\": %lu, "
+           "\"persist_us_avg\": %.0f, \"persist_us_max\": %lu, \"reader_waits\": %lu, \"reads_per_s\": %.0f, "
+           "\"reads\": %u, \"torn_reads\": %u, \"last_applied\": %s, \"generation\": %lu}\n",
+           COMMITS, (unsigned long)failures, (double)swap_total / COMMITS, (unsigned long)stats.max_swap_us,
+           (double)persist_total / COMMITS, (unsigned long)stats.max_persist_us, (unsigned long)stats.reader_waits,
+           atomic_load(&s_reads) * 1e6 / elapsed_us, atomic_load(&s_reads), atomic_load(&s_torn), last_applied ? "true" : "false",
+           (unsigned long)stats.generation);
+}
+
+void app_main(void)
+{
+    migration_run();
+    read_cost_run();
+    update_run();
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
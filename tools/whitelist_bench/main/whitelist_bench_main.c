@@ -0,0 +1,214 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "whitelist.h"
+
+#define MAX_DEVICES     1000
+#define LOOKUPS         1000000
+#define UPDATES         200
+
+static const int s_sizes[] = { 10, 100, MAX_DEVICES };
+
+static uint32_t s_latency_us[MAX_DEVICES];
+static atomic_bool s_stop;
+static atomic_bool s_reader_done;
+static uint32_t s_reader_max_us;
+static uint32_t s_reader_lookups;
+
+static void make_entry(whitelist_entry_t *entry, uint32_t n, uint32_t version)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->mac[0] = 0x02;   /* locally administered */
+    entry->mac[2] = n >> 24;
+    entry->mac[3] = n >> 16;
+    entry->mac[4] = n >> 8;
+    entry->mac[5] = n;
+    entry->access = WHITELIST_ACCESS_FULL;
+    snprintf(entry->name, sizeof(entry->name), "device-%lu-%lu", (unsigned long)n, (unsigned long)version);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Start from an empty list, in RAM and in NVS */
+static void reset(void)
+{
+    nvs_handle_t nvs;
+    ESP_ERROR_CHECK(nvs_open("whitelist", NVS_READWRITE, &nvs));
+    ESP_ERROR_CHECK(nvs_erase_all(nvs));
+    ESP_ERROR_CHECK(nvs_commit(nvs));
+    nvs_close(nvs);
+    ESP_ERROR_CHECK(whitelist_init());
+}
+
+static double amplification(const whitelist_nvs_stats_t *before, const whitelist_nvs_stats_t *after)
+{
+    uint32_t requested = after->bytes_requested - before->bytes_requested;
+    return requested ? (double)(after->bytes_written - before->bytes_written) / requested : 0;
+}
+
+static void insert_run(int devices)
+{
+    whitelist_entry_t entry;
+    whitelist_nvs_stats_t before, after;
+
+    reset();
+    whitelist_get_nvs_stats(&before);
+    for (int i = 0; i < devices; i++) {
+        make_entry(&entry, i, 0);
+        int64_t start = esp_timer_get_time();
+        ESP_ERROR_CHECK(whitelist_add(&entry));
+        s_latency_us[i] = esp_timer_get_time() - start;
+    }
+    whitelist_get_nvs_stats(&after);
+    qsort(s_latency_us, devices, sizeof(s_latency_us[0]), compare_u32);
+    printf("{\"run\": \"insert\", \"devices\": %d, \"p50_us\": %lu, \"p99_us\": %lu, \"blobs_written\": %lu, "
+           "\"write_amplification\": %.2f, \"whole_list_amplification\": %.2f}\n",
+           devices, (unsigned long)s_latency_us[devices / 2], (unsigned long)s_latency_us[devices * 99 / 100],
+           (unsigned long)(after.blobs_written - before.blobs_written), amplification(&before, &after),
+           (devices + 1) / 2.0);
+
+    /* The same list again in one batch */
+    reset();
+    whitelist_get_nvs_stats(&before);
+    int64_t start = esp_timer_get_time();
+    whitelist_batch_begin();
+    for (int i = 0; i < devices; i++) {
+        make_entry(&entry, i, 0);
+        ESP_ERROR_CHECK(whitelist_add(&entry));
+    }
+    ESP_ERROR_CHECK(whitelist_batch_end());
+    int64_t elapsed = esp_timer_get_time() - start;
+    whitelist_get_nvs_stats(&after);
+    printf("{\"run\": \"insert_batch\", \"devices\": %d, \"total_us\": %lld, \"blobs_written\": %lu, "
+           "\"write_amplification\": %.2f}\n",
+           devices, (long long)elapsed, (unsigned long)(after.blobs_written - before.blobs_written),
+           amplification(&before, &after));
+}
+
+static void lookup_run(int devices)
+{
+    static uint8_t macs[2 * MAX_DEVICES][6];
+    whitelist_entry_t entry;
+    uint32_t allowed = 0;
+
+    /* Known MACs first, then as many unknown ones past the end of the list */
+    for (int i = 0; i < 2 * devices; i++) {
+        make_entry(&entry, i, 0);
+        memcpy(macs[i], entry.mac, 6);
+    }
+    for (int known = 1; known >= 0; known--) {
+        const uint8_t (*set)[6] = known ? macs : macs + devices;
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < LOOKUPS; i++) {
+            allowed += whitelist_is_allowed(set[i % devices]);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        printf("{\"run\": \"%s\", \"devices\": %d, \"lookups\": %d, \"ns_per_lookup\": %.1f}\n",
+               known ? "lookup_known" : "lookup_unknown", devices, LOOKUPS, elapsed * 1000.0 / LOOKUPS);
+    }
+    if (allowed != LOOKUPS) {
+        printf("{\"run\": \"lookup\", \"devices\": %d, \"error\": \"allowed %lu of %d\"}\n",
+               devices, (unsigned long)allowed, LOOKUPS);
+    }
+}
+
+/* Rename one device at a time: one entry changed, one chunk rewritten */
+static void update_run(int devices)
+{
+    whitelist_entry_t entry;
+    whitelist_nvs_stats_t before, after;
+
+    whitelist_get_nvs_stats(&before);
+    for (int i = 0; i < UPDATES; i++) {
+        make_entry(&entry, rand() % devices, i + 1);
+        ESP_ERROR_CHECK(whitelist_add(&entry));
+    }
+    whitelist_get_nvs_stats(&after);
+    printf("{\"run\": \"update\", \"devices\": %d, \"updates\": %d, \"bytes_per_update\": %.1f, "
+           "\"write_amplification\": %.2f, \"whole_list_amplification\": %d}\n",
+           devices, UPDATES, (double)(after.bytes_written - before.bytes_written) / UPDATES,
+           amplification(&before, &after), devices);
+}
+
+static void reader_task(void *arg)
+{
+    int devices = *(int *)arg;
+    whitelist_entry_t entry;
+    make_entry(&entry, 0, 0);
+    while (!atomic_load(&s_stop)) {
+        entry.mac[4] = (s_reader_lookups % devices) >> 8;
+        entry.mac[5] = s_reader_lookups % devices;
+        int64_t start = esp_timer_get_time();
+        whitelist_is_allowed(entry.mac);
+        uint32_t us = esp_timer_get_time() - start;
+        s_reader_max_us = us > s_reader_max_us ? us : s_reader_max_us;
+        s_reader_lookups++;
+        if (s_reader_lookups % 64 == 0) {
+            vTaskDelay(1);
+        }
+    }
+    atomic_store(&s_reader_done, true);
+    vTaskDelete(NULL);
+}
+
+/* Lookups from another task while every update is written to NVS */
+static void contention_run(int devices)
+{
+    whitelist_entry_t entry;
+
+    s_reader_max_us = 0;
+    s_reader_lookups = 0;
+    atomic_store(&s_stop, false);
+    atomic_store(&s_reader_done, false);
+    xTaskCreate(reader_task, "reader", 4096, &devices, 5, NULL);
+
+    for (int i = 0; i < UPDATES; i++) {
+        make_entry(&entry, rand() % devices, UPDATES + i + 1);
+        int64_t start = esp_timer_get_time();
+        ESP_ERROR_CHECK(whitelist_add(&entry));
+        s_latency_us[i] = esp_timer_get_time() - start;
+    }
+    atomic_store(&s_stop, true);
+    while (!atomic_load(&s_reader_done)) {
+        vTaskDelay(1);
+    }
+    qsort(s_latency_us, UPDATES, sizeof(s_latency_us[0]), compare_u32);
+    printf("{\"run\": \"lookup_during_flush\", \"devices\": %d, \"updates\": %d, \"flush_p50_us\": %lu, "
+           "\"flush_max_us\": %lu, \"lookups\": %lu, \"lookup_max_us\": %lu}\n",
+           devices, UPDATES, (unsigned long)s_latency_us[UPDATES / 2], (unsigned long)s_latency_us[UPDATES - 1],
+           (unsigned long)s_reader_lookups, (unsigned long)s_reader_max_us);
+}
+
+void app_main(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+
+    for (size_t i = 0; i < sizeof(s_sizes) / sizeof(s_sizes[0]); i++) {
+        insert_run(s_sizes[i]);
+        lookup_run(s_sizes[i]);
+        update_run(s_sizes[i]);
+        contention_run(s_sizes[i]);
+    }
+    fflush(stdout);
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+"""Fan-out test for the WebSocket push channel (/api/v1/events).
+
+For every subscriber count (default 1..8) the tool opens that many
+WebSocket connections to a running server (usually the host build in
+tools/http_host), then triggers gate commands with POST /api/v1/gate and
+times how long each subscriber waits for the resulting "gate" frame. The
+results are printed as JSON:
+
+  latency     POST sent -> frame received, per subscriber and command
+  spread      first -> last subscriber to receive the same frame
+  push        the server's own counters from /api/v1/stats/push, among
+              them the time from serialising an event to handing it to the
+              last subscriber (fan-out) and, on the device, the free heap
+
+Every command also produces an access log frame, so the counters include
+those. When the server runs on this machine, pass its PID (or let --server
+start it) to also record the resident memory of the process after each run,
+the host stand-in for the heap use per subscriber.
+"""
+import argparse
+import base64
+import http.client
+import json
+import os
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+from urllib.parse import urlsplit
+
+from http_loadgen import percentile, proc_memory_kb, wait_for_server
+
+EVENTS_URI = '/api/v1/events'
+
+
+class Subscriber:
+    """Minimal WebSocket client: server frames are unmasked and, for this
+    endpoint, always single text frames."""
+
+    def __init__(self, host, port, auth):
+        self.sock = socket.create_connection((host, port), timeout=10)
+        key = base64.b64encode(os.urandom(16)).decode()
+        self.sock.sendall(('GET {} HTTP/1.1\r\nHost: {}:{}\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n'
+                           'Sec-WebSocket-Key: {}\r\nSec-WebSocket-Version: 13\r\nAuthorization: {}\r\n\r\n')
+                          .format(EVENTS_URI, host, port, key, auth).encode())
+        head = b''
+        while b'\r\n\r\n' not in head:
+            chunk = self.sock.recv(1024)
+            if not chunk:
+                raise OSError('connection closed during handshake')
+            head += chunk
+        head, self.buf = head.split(b'\r\n\r\n', 1)
+        status = head.split(b'\r\n', 1)[0]
+        if b' 101 ' not in status + b' ':
+            raise OSError('handshake refused: ' + status.decode(errors='replace'))
+        self.frames = []
+        self.cond = threading.Condition()
+        self.thread = threading.Thread(target=self._reader, daemon=True)
+        self.thread.start()
+
+    def _read(self, n):
+        while len(self.buf) < n:
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise OSError('connection closed')
+            self.buf += chunk
+        data, self.buf = self.buf[:n], self.buf[n:]
+        return data
+
+    def _reader(self):
+        try:
+            while True:
+                b0, b1 = self._read(2)
+                length = b1 & 0x7F
+                if length == 126:
+                    length = struct.unpack('>H', self._read(2))[0]
+                elif length == 127:
+                    length = struct.unpack('>Q', self._read(8))[0]
+                payload = self._read(length)
+                received = time.perf_counter()
+                if b0 & 0x0F == 0x1:
+                    with self.cond:
+                        self.frames.append((received, json.loads(payload)))
+                        self.cond.notify_all()
+                elif b0 & 0x0F == 0x8:
+                    break
+        except (OSError, ValueError):
+            pass
+
+    def wait_for(self, match, since, timeout):
+        """Arrival time of the first frame after index since that matches."""
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while True:
+                for received, frame in self.frames[since:]:
+                    if match(frame):
+                        return received
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return None
+                self.cond.wait(remaining)
+
+    def close(self):
+        try:
+            # Masked close frame with an empty payload, as clients must mask
+            self.sock.sendall(b'\x88\x80' + os.urandom(4))
+        except OSError:
+            pass
+        self.sock.close()
+
+
+def get_json(host, port, uri, auth):
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    conn.request('GET', uri, headers={'Authorization': auth})
+    resp = conn.getresponse()
+    body = resp.read()
+    conn.close()
+    return json.loads(body) if resp.status == 200 else None
+
+
+def run(host, port, subscribers, commands, action, auth, pid, timeout):
+    subs = [Subscriber(host, port, auth) for _ in range(subscribers)]
+    conn = http.client.HTTPConnection(host, port, timeout=10)
+    headers = {'Authorization': auth, 'Content-Type': 'application/json'}
+    body = json.dumps({'action': action})
+    latencies = []
+    spreads = []
+    missed = 0
+    before = get_json(host, port, '/api/v1/stats/push', auth) or {}
+    try:
+        for _ in range(commands):
+            marks = [len(s.frames) for s in subs]
+            start = time.perf_counter()
+            conn.request('POST', '/api/v1/gate', body=body, headers=headers)
+            conn.getresponse().read()
+            arrivals = [s.wait_for(lambda f: f.get('type') == 'gate' and f.get('state') == 'active', m, timeout)
+                        for s, m in zip(subs, marks)]
+            got = [a for a in arrivals if a is not None]
+            missed += len(arrivals) - len(got)
+            latencies.extend(a - start for a in got)
+            if got:
+                spreads.append(max(got) - min(got))
+            # The actuator runs one command at a time: wait for the pulse to end
+            for s, m in zip(subs, marks):
+                s.wait_for(lambda f: f.get('type') == 'gate' and f.get('state') == 'idle', m, timeout)
+        memory = proc_memory_kb(pid)
+        after = get_json(host, port, '/api/v1/stats/push', auth) or {}
+    finally:
+        conn.close()
+        for s in subs:
+            s.close()
+
+    latencies.sort()
+    spreads.sort()
+    ms = lambda v: None if v is None else round(v * 1000.0, 3)
+    result = {
+        'subscribers': subscribers,
+        'commands': commands,
+        'frames_missed': missed,
+        'latency_p50_ms': ms(percentile(latencies, 50)),
+        'latency_p99_ms': ms(percentile(latencies, 99)),
+        'latency_max_ms': ms(latencies[-1] if latencies else None),
+        'spread_p50_ms': ms(percentile(spreads, 50)),
+        'spread_max_ms': ms(spreads[-1] if spreads else None),
+    }
+    if after:
+        frames = after.get('frames', 0) - before.get('frames', 0)
+        result['push'] = {
+            'frames': frames,
+            'sends': after.get('sends', 0) - before.get('sends', 0),
+            'send_errors': after.get('send_errors', 0) - before.get('send_errors', 0),
+            'dropped': after.get('dropped', 0) - before.get('dropped', 0),
+            'max_fanout_us': after.get('max_fanout_us'),
+            'last_fanout_us': after.get('last_fanout_us'),
+        }
+        for key in ('heap_free', 'heap_min_free'):
+            if key in after:
+                result['push'][key] = after[key]
+    if memory:
+        result.update(memory)
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--url', default='http://127.0.0.1:8080', help='server base URL')
+    parser.add_argument('--user', default='esp')
+    parser.add_argument('--password', default='12346')
+    parser.add_argument('--subscribers', default='1,2,3,4,5,6,7,8', help='comma separated subscriber counts')
+    parser.add_argument('--commands', type=int, default=10, help='gate commands per run')
+    parser.add_argument('--action', default='close', help='gate action to trigger')
+    parser.add_argument('--timeout', type=float, default=5.0, help='seconds to wait for a frame')
+    parser.add_argument('--pid', type=int, help='PID of a local server, for memory figures')
+    parser.add_argument('--server', help='server executable to start (e.g. tools/http_host/build/http_host.elf)')
+    parser.add_argument('--output', help='write the JSON report here instead of stdout')
+    args = parser.parse_args()
+
+    target = urlsplit(args.url)
+    host, port = target.hostname, target.port or 80
+    auth = 'Basic ' + base64.b64encode('{}:{}'.format(args.user, args.password).encode()).decode()
+
+    server = None
+    pid = args.pid
+    if args.server:
+        server = subprocess.Popen([args.server], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        pid = server.pid
+    try:
+        if not wait_for_server(host, port, 15):
+            sys.exit('server at {} is not answering'.format(args.url))
+
+        report = {
+            'tool': 'ws_fanout',
+            'url': args.url,
+            'timestamp': int(time.time()),
+            'idle_memory': proc_memory_kb(pid),
+            'runs': [],
+        }
+        for count in (int(c) for c in args.subscribers.split(',')):
+            result = run(host, port, count, args.commands, args.action, auth, pid, args.timeout)
+            print('subscribers x{subscribers:<2} p50 {latency_p50_ms} ms  p99 {latency_p99_ms} ms  '
+                  'spread {spread_max_ms} ms  missed {frames_missed}'.format(**result), file=sys.stderr)
+            report['runs'].append(result)
+    finally:
+        if server:
+            server.terminate()
+            server.wait()
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+
+if __name__ == '__main__':
+    main()